@@ -4,7 +4,7 @@ set -e
 
 # --- Parse Arguments ---
 SHOULD_FLASH=false
-SHOULD_UPLOAD_FS=false
+SHOULD_UPLOAD_ASSETS=false
 SHOULD_ERASE=false
 
 for arg in "$@"
@@ -14,8 +14,8 @@ do
         SHOULD_FLASH=true
         shift
         ;;
-        --upload-fs)
-        SHOULD_UPLOAD_FS=true
+        --upload-assets)
+        SHOULD_UPLOAD_ASSETS=true
         shift
         ;;
         --erase-flash)
@@ -43,17 +43,21 @@ echo "Installing dependencies and compiling..."
 pio run --environment esp32dev
 cp .pio/build/esp32dev/firmware.bin .
 
+# Pack data/ into the asset bundle for the flash-mapped assets partition
+echo "Packing assets..."
+python3 tools/pack_assets.py data assets.bin --partitions partitions.csv
+
 # Erase flash if requested
 if [ "$SHOULD_ERASE" = true ]; then
     echo "Erasing the flash..."
     pio run --target erase --environment esp32dev
 fi
 
-# Build and upload filesystem if requested
-if [ "$SHOULD_UPLOAD_FS" = true ]; then
-    echo "Building and uploading the SPIFFS filesystem image..."
-    pio run --target buildfs --environment esp32dev
-    pio run --target uploadfs --environment esp32dev
+# Write the asset bundle straight to its partition if requested
+if [ "$SHOULD_UPLOAD_ASSETS" = true ]; then
+    ASSETS_OFFSET=$(awk -F, '$1 ~ /^assets/ { gsub(/ /, "", $4); print $4 }' partitions.csv)
+    echo "Flashing assets.bin at $ASSETS_OFFSET..."
+    pio pkg exec --package tool-esptoolpy -- esptool.py --chip esp32 write_flash "$ASSETS_OFFSET" assets.bin
 fi
 
 # If --flash is passed, upload the firmware
@@ -0,0 +1,121 @@
+#include "assets.h"
+#include <FSImpl.h>
+#include <esp_partition.h>
+#include <memory>
+
+struct AssetsHeader {
+    char magic[4];
+    uint16_t version;
+    uint16_t count;
+    uint32_t total_size;
+};
+
+static const uint8_t *assets_base = nullptr;
+static const AssetEntry *assets_entries = nullptr;
+static uint16_t assets_count = 0;
+static spi_flash_mmap_handle_t assets_handle;
+
+bool assets_begin() {
+    const esp_partition_t *partition = esp_partition_find_first(
+        ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t)ASSETS_PARTITION_SUBTYPE, ASSETS_PARTITION_LABEL);
+    if (!partition) {
+        Serial.println("[Assets] no assets partition");
+        return false;
+    }
+
+    const void *mapped;
+    esp_err_t err = esp_partition_mmap(partition, 0, partition->size, SPI_FLASH_MMAP_DATA, &mapped, &assets_handle);
+    if (err != ESP_OK) {
+        Serial.printf("[Assets] mmap failed: %s\n", esp_err_to_name(err));
+        return false;
+    }
+
+    const AssetsHeader *header = (const AssetsHeader *)mapped;
+    if (memcmp(header->magic, ASSETS_MAGIC, 4) != 0 || header->version != ASSETS_VERSION ||
+        header->total_size > partition->size ||
+        sizeof(AssetsHeader) + header->count * sizeof(AssetEntry) > header->total_size) {
+        Serial.println("[Assets] partition holds no valid bundle, run build.sh --upload-assets");
+        spi_flash_munmap(assets_handle);
+        return false;
+    }
+
+    const AssetEntry *entries = (const AssetEntry *)(header + 1);
+    for (int i = 0; i < header->count; i++) {
+        if (entries[i].offset > header->total_size || entries[i].size > header->total_size - entries[i].offset) {
+            Serial.printf("[Assets] entry %d runs past the bundle\n", i);
+            spi_flash_munmap(assets_handle);
+            return false;
+        }
+    }
+
+    assets_base = (const uint8_t *)mapped;
+    assets_entries = entries;
+    assets_count = header->count;
+    Serial.printf("[Assets] %d assets, %u bytes mapped from flash\n", assets_count, (unsigned)header->total_size);
+    return true;
+}
+
+bool assets_ready() {
+    return assets_base != nullptr;
+}
+
+const AssetEntry *assets_find(const char *name) {
+    if (*name == '/') name++;
+    for (int i = 0; i < assets_count; i++) {
+        if (strncmp(assets_entries[i].name, name, ASSETS_NAME_LEN) == 0) return &assets_entries[i];
+    }
+    return nullptr;
+}
+
+const uint8_t *assets_data(const AssetEntry *asset) {
+    return assets_base + asset->offset;
+}
+
+// ---------- Asset files ----------
+// Just enough of fs::FileImpl for the codecs: read, seek, position, size.
+
+class AssetFileImpl : public fs::FileImpl {
+public:
+    AssetFileImpl(const AssetEntry *asset) : asset(asset), data(assets_data(asset)) {}
+
+    size_t write(const uint8_t *buf, size_t size) override { return 0; }
+    size_t read(uint8_t *buf, size_t size) override {
+        if (size > asset->size - pos) size = asset->size - pos;
+        memcpy(buf, data + pos, size);
+        pos += size;
+        return size;
+    }
+    void flush() override {}
+    bool seek(uint32_t offset, fs::SeekMode mode) override {
+        uint32_t target = mode == fs::SeekSet ? offset
+                        : mode == fs::SeekCur ? pos + offset
+                        : asset->size + offset;
+        if (target > asset->size) return false;
+        pos = target;
+        return true;
+    }
+    size_t position() const override { return pos; }
+    size_t size() const override { return asset->size; }
+    bool setBufferSize(size_t size) { return false; }
+    void close() override {}
+    time_t getLastWrite() override { return 0; }
+    const char *path() const override { return asset->name; }
+    const char *name() const override { return asset->name; }
+    boolean isDirectory(void) override { return false; }
+    fs::FileImplPtr openNextFile(const char *mode) override { return fs::FileImplPtr(); }
+    boolean seekDir(long position) { return false; }
+    String getNextFileName(void) { return String(); }
+    void rewindDirectory(void) override {}
+    operator bool() override { return true; }
+
+private:
+    const AssetEntry *asset;
+    const uint8_t *data;
+    uint32_t pos = 0;
+};
+
+File assets_open(const char *name) {
+    const AssetEntry *asset = assets_find(name);
+    if (!asset) return File();
+    return File(std::make_shared<AssetFileImpl>(asset));
+}
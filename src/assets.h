@@ -0,0 +1,39 @@
+#pragma once
+
+#include <Arduino.h>
+#include <FS.h>
+
+// ---------- Assets ----------
+// Read-only files baked into their own flash partition by
+// tools/pack_assets.py. The partition is memory-mapped once at boot, so assets
+// are read straight from flash with no filesystem in between. Bitmaps are
+// packed already thresholded to 1 bpp in SSD1306 page order (one byte is eight
+// vertical pixels) and can be blitted into the display buffer as they are.
+
+#define ASSETS_PARTITION_LABEL "assets"
+#define ASSETS_PARTITION_SUBTYPE 0x40
+#define ASSETS_MAGIC "WAST"
+#define ASSETS_VERSION 1
+#define ASSETS_NAME_LEN 24
+
+enum AssetType : uint8_t { ASSET_RAW = 0, ASSET_BITMAP = 1 };
+
+// Directory entry, as laid out by the packer
+struct AssetEntry {
+    char name[ASSETS_NAME_LEN];
+    uint32_t offset; // from the start of the bundle
+    uint32_t size;
+    uint16_t width;  // bitmaps only
+    uint16_t height;
+    uint8_t type;
+    uint8_t reserved[3];
+};
+
+// Maps the partition and checks the bundle header
+bool assets_begin();
+bool assets_ready();
+
+const AssetEntry *assets_find(const char *name);
+const uint8_t *assets_data(const AssetEntry *asset);
+// A read-only File over a mapped asset, for code that streams files
+File assets_open(const char *name);
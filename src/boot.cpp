@@ -0,0 +1,75 @@
+#include "boot.h"
+#include "settings.h"
+
+struct BootStageTime {
+    uint32_t start_ms;
+    uint32_t end_ms;
+    int8_t core;
+};
+
+static const char *boot_stage_names[BOOT_STAGE_COUNT] = {
+    "display", "settings", "assets", "sd", "card scan", "bt", "library", "audio", "spectrum"
+};
+
+// Each stage only ever writes its own slot, so the SD task needs no lock
+static BootStageTime boot_times[BOOT_STAGE_COUNT];
+
+static BootSettings settings = {0, 0, "", ""};
+
+void boot_stage_begin(BootStage stage) {
+    boot_times[stage].start_ms = millis();
+    boot_times[stage].end_ms = 0;
+    boot_times[stage].core = xPortGetCoreID();
+}
+
+void boot_stage_end(BootStage stage) {
+    boot_times[stage].end_ms = millis();
+}
+
+void boot_print_profile() {
+    uint32_t first = UINT32_MAX, last = 0, serial = 0;
+    Serial.println("[Boot] stage        start    end   took  core");
+    for (int i = 0; i < BOOT_STAGE_COUNT; i++) {
+        const BootStageTime &t = boot_times[i];
+        if (t.end_ms == 0) continue; // skipped
+        uint32_t took = t.end_ms - t.start_ms;
+        Serial.printf("[Boot] %-10s %6u %6u %6u  %d\n", boot_stage_names[i], t.start_ms, t.end_ms, took, t.core);
+        first = min(first, t.start_ms);
+        last = max(last, t.end_ms);
+        serial += took;
+    }
+    if (last == 0) return;
+    // Stages that overlapped show up as the difference between the two
+    Serial.printf("[Boot] setup done at %u ms: stages took %u ms, %u ms run in parallel\n",
+                  last, serial, serial > last - first ? serial - (last - first) : 0);
+}
+
+void boot_milestone(const char *name) {
+    Serial.printf("[Boot] %s at %lu ms\n", name, millis());
+}
+
+void boot_settings_load() {
+    BootSettings saved;
+    if (settings_get(BOOT_SETTINGS_KEY, saved)) {
+        saved.artist[sizeof(saved.artist) - 1] = '\0';
+        saved.album[sizeof(saved.album) - 1] = '\0';
+        if (saved.mode >= BOOT_MODE_COUNT) saved.mode = BOOT_MODE_SPLASH;
+        settings = saved;
+    }
+}
+
+void boot_settings_save() {
+    settings_put(BOOT_SETTINGS_KEY, settings);
+}
+
+BootSettings &boot_settings() {
+    return settings;
+}
+
+const char *boot_mode_label() {
+    switch (settings.mode) {
+        case BOOT_MODE_FAST: return "Boot: fast";
+        case BOOT_MODE_RESUME: return "Boot: resume";
+        default: return "Boot: splash";
+    }
+}
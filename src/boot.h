@@ -0,0 +1,50 @@
+#pragma once
+
+#include <Arduino.h>
+
+// ---------- Boot ----------
+// setup() runs as a handful of stages. The display comes up first so there is
+// something on screen; the SD card is then brought up and scanned on a helper
+// task while the main task starts Bluetooth, and the two meet before the
+// spectrum task starts. Every stage records when it started and finished and
+// on which core, and the profile is printed at the end of setup().
+
+enum BootStage {
+  BOOT_DISPLAY,
+  BOOT_SETTINGS,
+  BOOT_ASSETS,
+  BOOT_SD,
+  BOOT_CARD_SCAN,
+  BOOT_BT,
+  BOOT_LIBRARY,
+  BOOT_AUDIO,
+  BOOT_SPECTRUM,
+  BOOT_STAGE_COUNT
+};
+
+void boot_stage_begin(BootStage stage);
+void boot_stage_end(BootStage stage);
+void boot_print_profile();
+// One line with the time since power-on, e.g. when the first screen is up
+void boot_milestone(const char *name);
+
+// ---------- Boot settings ----------
+// Splash plays the splash screen and jingle. Fast skips them and goes
+// straight back to the browse screen that was open last. Resume also picks
+// the last track up where it stopped (the session, session.h).
+
+#define BOOT_SETTINGS_KEY "boot" // in the settings
+
+enum BootMode : uint8_t { BOOT_MODE_SPLASH, BOOT_MODE_FAST, BOOT_MODE_RESUME, BOOT_MODE_COUNT };
+
+struct BootSettings {
+    uint8_t mode;        // BootMode
+    uint8_t last_screen; // AppState of the last browse screen, 0 if none
+    char artist[48];
+    char album[96];  // /Artist/Album when the player was open
+};
+
+void boot_settings_load();
+void boot_settings_save();
+BootSettings &boot_settings();
+const char *boot_mode_label(); // "Boot: ..." for the player menu
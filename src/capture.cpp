@@ -0,0 +1,248 @@
+#include "capture.h"
+#include <SD.h>
+#include "tasks.h"
+#include "memory.h"
+#include "pcmring.h"
+#include "jitter.h"
+
+#define CAPTURE_HEADER_BYTES 44
+
+static Frame *capture_ring = nullptr;
+static volatile uint32_t capture_write_pos = 0;
+static volatile uint32_t capture_read_pos = 0;
+// Where the newest file starts, and how many have been asked for; two
+// flushes the writer has not reached yet end up in one file
+static volatile uint32_t capture_segment_at = 0;
+static volatile uint32_t capture_segment_seq = 0;
+static uint32_t capture_last_flushes = 0; // audio path only
+static volatile uint32_t capture_dropped_frames = 0;
+static volatile uint32_t capture_drops = 0;
+
+// Dropped frames, by where they belong in the ring. The audio path grows
+// capture_gap_open while blocks keep dropping and hands it to the writer
+// once a block fits again; the writer then owns the entry.
+struct CaptureGap {
+    uint32_t at;     // ring position the lost frames come before
+    uint32_t frames;
+    uint32_t seq;    // capture_segment_seq when they were lost
+};
+static CaptureGap capture_gaps[CAPTURE_GAPS];
+static volatile uint32_t capture_gap_write = 0;
+static volatile uint32_t capture_gap_read = 0;
+static CaptureGap capture_gap_open = {0, 0, 0}; // audio path only
+static volatile uint32_t capture_unfilled_frames = 0; // no gap entry free: missing from the file
+static char capture_label[128] = "";
+
+// Writer task state
+static File capture_file;
+static String capture_path;
+static uint32_t capture_file_index = 0;
+static uint32_t capture_file_frames = 0;
+static uint32_t capture_file_dropped = 0; // capture_dropped_frames when the file opened
+static uint32_t capture_file_drops = 0;
+static uint32_t capture_file_unfilled = 0;
+static uint32_t capture_file_underruns = 0; // jitter_underruns() when the file opened
+static unsigned long capture_last_sync = 0;
+
+static void put_le(uint8_t *out, uint32_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) out[i] = (uint8_t)(value >> (8 * i));
+}
+
+// 16-bit stereo PCM; the sizes are patched in by capture_sync()
+static void capture_write_header(uint32_t frames) {
+    uint8_t header[CAPTURE_HEADER_BYTES];
+    uint32_t data_bytes = frames * sizeof(Frame);
+    memcpy(header, "RIFF", 4);
+    put_le(header + 4, 36 + data_bytes, 4);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    put_le(header + 16, 16, 4);
+    put_le(header + 20, 1, 2); // PCM
+    put_le(header + 22, 2, 2);
+    put_le(header + 24, CAPTURE_SAMPLE_RATE, 4);
+    put_le(header + 28, CAPTURE_SAMPLE_RATE * sizeof(Frame), 4);
+    put_le(header + 32, sizeof(Frame), 2);
+    put_le(header + 34, 16, 2);
+    memcpy(header + 36, "data", 4);
+    put_le(header + 40, data_bytes, 4);
+    capture_file.write(header, sizeof(header));
+}
+
+// The decode task needs the card more than we do while its ring is low
+static bool capture_decode_starved() {
+    return pcm_ring_streaming() && pcm_ring_depth() < jitter_target_frames() / 2;
+}
+
+// Logs an underrun that happened while the card was busy with our I/O
+static void capture_check_underruns(uint32_t before, unsigned long started, const char *what) {
+    uint32_t now = jitter_underruns();
+    if (now == before) return;
+    Serial.printf("[Capture] %u underrun(s) during a %s taking %lu ms\n",
+                  now - before, what, millis() - started);
+}
+
+static void capture_sync() {
+    uint32_t underruns = jitter_underruns();
+    unsigned long started = millis();
+    capture_file.seek(0);
+    capture_write_header(capture_file_frames);
+    capture_file.seek(CAPTURE_HEADER_BYTES + capture_file_frames * sizeof(Frame));
+    capture_file.flush();
+    capture_last_sync = millis();
+    capture_check_underruns(underruns, started, "sync");
+}
+
+static void capture_close() {
+    if (!capture_file) return;
+    capture_sync();
+    capture_file.close();
+    Serial.printf("[Capture] %s closed: %u frames, %u dropped in %u gaps (%u not filled with silence), %u underruns while open\n",
+                  capture_path.c_str(), capture_file_frames, capture_dropped_frames - capture_file_dropped,
+                  capture_drops - capture_file_drops, capture_unfilled_frames - capture_file_unfilled,
+                  jitter_underruns() - capture_file_underruns);
+}
+
+static bool capture_open() {
+    if (!SD.exists(CAPTURE_DIR)) SD.mkdir(CAPTURE_DIR);
+    char path[32];
+    do {
+        snprintf(path, sizeof(path), CAPTURE_DIR "/%03u.wav", capture_file_index++);
+    } while (SD.exists(path) && capture_file_index < 1000);
+    capture_file = SD.open(path, FILE_WRITE);
+    if (!capture_file) {
+        Serial.printf("[Capture] cannot create %s\n", path);
+        return false;
+    }
+    capture_path = path;
+    capture_file_frames = 0;
+    capture_file_dropped = capture_dropped_frames;
+    capture_file_drops = capture_drops;
+    capture_file_unfilled = capture_unfilled_frames;
+    capture_file_underruns = jitter_underruns();
+    capture_write_header(0);
+    capture_last_sync = millis();
+    Serial.printf("[Capture] %s: %s\n", path, capture_label);
+    return true;
+}
+
+// Writes up to one block of the silence standing in for a gap
+static void capture_fill_gap(CaptureGap &gap) {
+    static const Frame silence[CAPTURE_WRITE_FRAMES];
+    uint32_t count = min(gap.frames, (uint32_t)CAPTURE_WRITE_FRAMES);
+    task_busy_begin(TASK_CAPTURE);
+    if (capture_file || capture_open()) {
+        uint32_t underruns = jitter_underruns();
+        unsigned long started = millis();
+        capture_file.write((const uint8_t*)silence, count * sizeof(Frame));
+        capture_file_frames += count;
+        capture_check_underruns(underruns, started, "write");
+    }
+    task_busy_end(TASK_CAPTURE);
+    gap.frames -= count;
+    if (gap.frames == 0) capture_gap_read = capture_gap_read + 1;
+}
+
+static void capture_task(void *param) {
+    uint32_t segment_seq = 0;
+    for (;;) {
+        uint32_t r = capture_read_pos;
+        uint32_t available = capture_write_pos - r;
+        uint32_t seq = capture_segment_seq;
+        uint32_t at = capture_segment_at;
+        CaptureGap *gap = capture_gap_read != capture_gap_write ? &capture_gaps[capture_gap_read % CAPTURE_GAPS] : nullptr;
+        if (gap && gap->at == r && !capture_decode_starved() &&
+            (seq == segment_seq || r != at || gap->seq != seq)) {
+            // Lost before the flush at r, if there is one: still the old file
+            capture_fill_gap(*gap);
+            continue;
+        }
+        if (gap) available = min(available, gap->at - r);
+        if (seq != segment_seq) {
+            if (r == at) {
+                // Everything of the old track is out: the next frame starts a file
+                capture_close();
+                segment_seq = seq;
+                continue;
+            }
+            available = min(available, at - r);
+        }
+        if (capture_decode_starved()) {
+            // Our ring takes the wait; if it fills, blocks are dropped
+            delay(CAPTURE_IDLE_MS);
+            continue;
+        }
+        if (available == 0) {
+            if (capture_file && millis() - capture_last_sync >= CAPTURE_SYNC_MS) capture_sync();
+            delay(CAPTURE_IDLE_MS);
+            continue;
+        }
+
+        // Up to the end of the ring; the rest goes on the next pass
+        uint32_t start = r & (CAPTURE_RING_FRAMES - 1);
+        uint32_t count = min(available, min((uint32_t)CAPTURE_WRITE_FRAMES, CAPTURE_RING_FRAMES - start));
+        task_busy_begin(TASK_CAPTURE);
+        if (capture_file || capture_open()) {
+            uint32_t underruns = jitter_underruns();
+            unsigned long started = millis();
+            capture_file.write((const uint8_t*)&capture_ring[start], count * sizeof(Frame));
+            capture_file_frames += count;
+            capture_check_underruns(underruns, started, "write");
+        }
+        task_busy_end(TASK_CAPTURE);
+        capture_read_pos = r + count;
+    }
+}
+
+bool capture_begin() {
+    capture_ring = (Frame*)malloc(CAPTURE_RING_FRAMES * sizeof(Frame));
+    if (!capture_ring) {
+        Serial.printf("[Capture] no memory for %u frames, capture off\n", CAPTURE_RING_FRAMES);
+        return false;
+    }
+    memory_note_alloc(MEM_AUDIO, CAPTURE_RING_FRAMES * sizeof(Frame));
+    task_start(TASK_CAPTURE, capture_task);
+    Serial.printf("[Capture] recording output to %s, %u frame buffer\n", CAPTURE_DIR, CAPTURE_RING_FRAMES);
+    return true;
+}
+
+void capture_set_label(const char *label) {
+    snprintf(capture_label, sizeof(capture_label), "%s", label);
+}
+
+// Hands the frames lost since the last block that fit to the writer
+static void capture_close_gap() {
+    if (capture_gap_open.frames == 0) return;
+    uint32_t g = capture_gap_write;
+    if (g - capture_gap_read < CAPTURE_GAPS) {
+        capture_gaps[g % CAPTURE_GAPS] = capture_gap_open;
+        capture_gap_write = g + 1;
+    } else {
+        capture_unfilled_frames += capture_gap_open.frames;
+    }
+    capture_gap_open.frames = 0;
+}
+
+void capture_tap(const Frame *frames, uint32_t count, uint32_t flushes) {
+    if (!capture_ring) return;
+    uint32_t w = capture_write_pos;
+    if (flushes != capture_last_flushes) {
+        capture_close_gap(); // the old track's loss stays in its own file
+        capture_last_flushes = flushes;
+        capture_segment_at = w;
+        capture_segment_seq = capture_segment_seq + 1;
+    }
+    if (count == 0) return;
+    if (CAPTURE_RING_FRAMES - (w - capture_read_pos) < count) {
+        // The card is behind: this block is lost and written as silence
+        // once the writer gets to where it belonged
+        if (capture_gap_open.frames == 0) capture_gap_open = {w, 0, capture_segment_seq};
+        capture_gap_open.frames += count;
+        capture_dropped_frames += count;
+        capture_drops++;
+        return;
+    }
+    capture_close_gap();
+    for (uint32_t i = 0; i < count; i++) {
+        capture_ring[(w + i) & (CAPTURE_RING_FRAMES - 1)] = frames[i];
+    }
+    capture_write_pos = w + count;
+}
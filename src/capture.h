@@ -0,0 +1,46 @@
+#pragma once
+
+#include <Arduino.h>
+#include <BluetoothA2DPSource.h>
+
+// ---------- PCM capture ----------
+// Debug build only (env:esp32dev-capture). Records the exact frames
+// get_data_frames() hands to the A2DP stack into WAV files on SD, to diff
+// against a reference decode of the same track. The audio path copies into
+// a ring of its own; a low priority task (see tasks.h) writes it out. When
+// the card falls behind and the ring is full, the block is dropped and
+// counted, never waited for; the writer puts as many frames of silence in
+// its place, so the file stays aligned with the reference. Only with more
+// than CAPTURE_GAPS drops waiting at once is a file left short, and its
+// "closed" line says by how many frames.
+//
+// Every ring flush (a track picked, playback stopped) starts a new file,
+// /capture/NNN.wav, so each file starts on the first frame of its track;
+// tracks that follow on by themselves stay in one file.
+// For a bit exact comparison set the EQ to flat and crossfade off.
+//
+// The writer shares the card with the decode task, which has only the PCM
+// ring (~93 ms) to ride out a busy card. Writes are kept small, nothing is
+// written or synced while that ring is below half its target, and syncs
+// are rare. Underruns that happen while a file is open are counted in its
+// "closed" line; one that happens during a capture write or sync is logged
+// on the spot with how long the card took.
+
+#ifndef CAPTURE_RING_FRAMES
+#define CAPTURE_RING_FRAMES 8192 // power of two; ~186 ms at 44.1 kHz
+#endif
+#define CAPTURE_WRITE_FRAMES 256  // per SD write, 1 KB
+#define CAPTURE_GAPS 16           // drops waiting to be written as silence
+#define CAPTURE_IDLE_MS 20
+#define CAPTURE_SYNC_MS 30000     // header rewritten, so a reset leaves a valid file
+#define CAPTURE_SAMPLE_RATE 44100 // what the A2DP source streams
+#define CAPTURE_DIR "/capture"
+
+// Allocates the ring and starts the writer; false without the memory
+bool capture_begin();
+
+// Names the track whose audio comes after the next flush, for the log
+void capture_set_label(const char *label);
+
+// Audio path: never blocks, never allocates. flushes is pcm_ring_flushes()
+void capture_tap(const Frame *frames, uint32_t count, uint32_t flushes);
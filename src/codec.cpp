@@ -0,0 +1,308 @@
+#include "codec.h"
+
+// ---------- MP3 ----------
+
+// Helix reports PCM through a plain callback while write() runs; this points
+// at the codec whose write() is on the stack
+static Mp3Codec *mp3_writer = nullptr;
+
+static void mp3_data_callback(MP3FrameInfo &info, short *pcm, size_t len, void *ref) {
+    if (mp3_writer) {
+        mp3_writer->store_pcm(info, pcm, len);
+    }
+}
+
+void Mp3Codec::store_pcm(MP3FrameInfo &info, short *pcm, size_t len) {
+    format.sample_rate = info.samprate;
+    format.channels = info.nChans;
+    format.bits_per_sample = info.bitsPerSample;
+    format.bitrate = info.bitrate;
+
+    if (buffer_len + len < sizeof(buffer) / sizeof(int16_t)) {
+        memcpy(buffer + buffer_len, pcm, len * sizeof(int16_t));
+        buffer_len += len;
+    } else {
+        Serial.println("PCM buffer overflow!");
+    }
+}
+
+bool Mp3Codec::open(File &file, uint32_t data_start, uint32_t data_end) {
+    this->file = file;
+    this->data_start = data_start;
+    this->data_end = data_end;
+    this->file.seek(data_start);
+    format = {0, 0, 0, 0};
+    buffer_len = 0;
+    input_pos = input_len = 0;
+    locked = false;
+    silence_pending = 0;
+    lose_sync(true);
+
+    if (decoder_running) {
+        decoder.drop_input(); // leftovers of the previous track
+        return true;
+    }
+    return allocate();
+}
+
+// Moves what is left of the window to its start and tops it up from the file
+void Mp3Codec::fill_input() {
+    uint16_t left = input_len - input_pos;
+    if (left > 0 && input_pos > 0) memmove(input, input + input_pos, left);
+    input_pos = 0;
+    input_len = left;
+    uint32_t want = min((uint32_t)(MP3_INPUT_SIZE - input_len), bytes_left());
+    if (want == 0) return;
+    int bytes_read = file.read(input + input_len, want);
+    if (bytes_read > 0) input_len += bytes_read;
+}
+
+// Length of the frame at the window's start, 0 if there is none
+uint32_t Mp3Codec::frame_at_input() {
+    uint32_t available = input_len - input_pos;
+    Mp3FrameHeader header;
+    if (available < MP3_HEADER_BYTES || !mp3_parse_header(input + input_pos, header)) return 0;
+    if (locked && !mp3_same_stream(stream, header)) return 0;
+    if (header.frame_bytes > available) return 0; // cut short by the end of the data
+
+    // Two stray sync bytes are common; two matching headers a frame apart
+    // are not. The last frame of the data has no next header.
+    Mp3FrameHeader next;
+    if (available >= header.frame_bytes + MP3_HEADER_BYTES) {
+        if (!mp3_parse_header(input + input_pos + header.frame_bytes, next) ||
+            !mp3_same_stream(header, next)) return 0;
+    } else if (hunting || !locked) {
+        return 0;
+    }
+    if (!locked) {
+        stream = header;
+        locked = true;
+        format.sample_rate = header.sample_rate;
+        format.channels = header.channels;
+        format.bits_per_sample = 16;
+        format.bitrate = header.bitrate;
+    }
+    return header.frame_bytes;
+}
+
+void Mp3Codec::lose_sync(bool quiet) {
+    if (hunting) return;
+    hunting = true;
+    hunt_quiet = quiet;
+    memset(&hunt, 0, sizeof(hunt));
+    hunt.position = file.position() - (input_len - input_pos);
+}
+
+void Mp3Codec::regain_sync() {
+    hunting = false;
+    if (hunt_quiet) return;
+
+    // Fill the gap with as much silence as the skipped bytes would have
+    // played, less what was already played while hunting
+    uint32_t lost = (hunt.skipped_bytes + stream.frame_bytes / 2) / stream.frame_bytes;
+    hunt.lost_frames += lost;
+    uint32_t gap = min(lost * stream.samples, (uint32_t)stream.sample_rate * MP3_MAX_CONCEAL_MS / 1000);
+    if (gap > hunt.silence_frames) conceal(gap - hunt.silence_frames);
+
+    if (!event_pending) {
+        event = hunt;
+        event_pending = true;
+    } else {
+        events_dropped++;
+    }
+}
+
+void Mp3Codec::conceal(uint32_t frames) {
+    silence_pending += frames;
+    hunt.silence_frames += frames;
+}
+
+int32_t Mp3Codec::decode(int16_t *pcm, int32_t max_frames) {
+    uint32_t scanned = 0;
+    int empty_frames = 0;
+    while (buffer_len == 0 && silence_pending == 0) {
+        if (input_len - input_pos < MP3_MAX_FRAME_BYTES + MP3_HEADER_BYTES) fill_input();
+        uint32_t available = input_len - input_pos;
+        if (available < MP3_HEADER_BYTES) break; // end of the data
+
+        uint32_t frame_bytes = frame_at_input();
+        if (frame_bytes > 0) {
+            if (hunting) regain_sync();
+            mp3_writer = this;
+            decoder.write(input + input_pos, frame_bytes);
+            mp3_writer = nullptr;
+            input_pos += frame_bytes;
+            if (buffer_len == 0 && ++empty_frames >= MP3_MAX_EMPTY_FRAMES) {
+                // Headers fine but helix cannot decode them; helix holds one
+                // frame back, the rest are lost
+                lose_sync(false);
+                hunt.lost_frames += empty_frames - 1;
+                conceal((empty_frames - 1) * stream.samples);
+                regain_sync();
+                empty_frames = 0;
+            }
+            continue;
+        }
+
+        // Junk or a damaged frame: skip to the next possible sync byte
+        uint32_t start_cycles = ESP.getCycleCount();
+        lose_sync(false);
+        const uint8_t *next = (const uint8_t*)memchr(input + input_pos + 1, 0xFF, available - 1);
+        uint32_t skipped = next ? next - (input + input_pos) : available;
+        input_pos += skipped;
+        hunt.skipped_bytes += skipped;
+        hunt.cycles += ESP.getCycleCount() - start_cycles;
+        scanned += skipped;
+        if (scanned >= MP3_RESYNC_BUDGET) {
+            // Keep the sink fed while the hunt goes on in the next call
+            if (locked && !hunt_quiet) conceal(max_frames);
+            break;
+        }
+    }
+
+    int channels = format.channels == 1 ? 1 : 2;
+    if (silence_pending > 0) {
+        // The gap comes before whatever was decoded after it
+        int32_t frames = min((int32_t)silence_pending, max_frames);
+        memset(pcm, 0, frames * channels * sizeof(int16_t));
+        silence_pending -= frames;
+        return frames;
+    }
+
+    int32_t frames = min(buffer_len / channels, max_frames);
+    memcpy(pcm, buffer, frames * channels * sizeof(int16_t));
+
+    // Shift the remaining data to the beginning of the buffer
+    int32_t consumed = frames * channels;
+    buffer_len -= consumed;
+    if (buffer_len > 0) {
+        memmove(buffer, buffer + consumed, buffer_len * sizeof(int16_t));
+    }
+    return frames;
+}
+
+bool Mp3Codec::seek(uint32_t position) {
+    reset();
+    if (position < data_start) position = data_start;
+    input_pos = input_len = 0;
+    hunting = false;
+    if (!file.seek(position)) {
+        Serial.printf("Failed to seek to position %u\n", position);
+        return false;
+    }
+    // decode() finds the next frame; whatever it skips to get there is
+    // expected, not corruption
+    lose_sync(true);
+    return true;
+}
+
+void Mp3Codec::reset() {
+    buffer_len = 0;
+    silence_pending = 0;
+    decoder.drop_input(); // bytes from before a seek are not the next frame
+}
+
+void Mp3Codec::close() {
+    buffer_len = 0;
+    silence_pending = 0;
+}
+
+bool Mp3Codec::allocate() {
+    if (decoder_running) return true;
+    decoder.begin();
+    decoder.setDataCallback(mp3_data_callback);
+    decoder_running = true;
+    return true;
+}
+
+void Mp3Codec::release() {
+    if (decoder_running) {
+        decoder.end();
+        decoder_running = false;
+    }
+    buffer_len = 0;
+}
+
+bool Mp3Codec::finished() {
+    return buffer_len == 0 && silence_pending == 0 && input_len - input_pos < MP3_HEADER_BYTES && bytes_left() == 0;
+}
+
+void Mp3Codec::log_events() {
+    if (!event_pending) return;
+    Mp3ResyncEvent e = event;
+    event_pending = false;
+    uint32_t rate = format.sample_rate ? format.sample_rate : 44100;
+    Serial.printf("[MP3] corrupt data at %u: %u bytes skipped, %u frames lost, %u ms silence, %u us to resync\n",
+                  e.position, e.skipped_bytes, e.lost_frames, (uint32_t)((uint64_t)e.silence_frames * 1000 / rate),
+                  e.cycles / ESP.getCpuFreqMHz());
+    if (events_dropped > 0) {
+        Serial.printf("[MP3] %u more corrupt regions not shown\n", events_dropped);
+        events_dropped = 0;
+    }
+}
+
+// ---------- WAV ----------
+
+struct WavHeader {
+    // RIFF Chunk
+    char riff_header[4]; // "RIFF"
+    uint32_t wav_size; // Size of the WAV file in bytes
+    char wave_header[4]; // "WAVE"
+    // Format Chunk
+    char fmt_header[4]; // "fmt "
+    uint32_t fmt_chunk_size; // Should be 16 for PCM
+    uint16_t audio_format; // Should be 1 for PCM
+    uint16_t num_channels;
+    uint32_t sample_rate;
+    uint32_t byte_rate; // sample_rate * num_channels * bits_per_sample / 8
+    uint16_t sample_alignment; // num_channels * bits_per_sample / 8
+    uint16_t bit_depth;
+    // Data Chunk
+    char data_header[4]; // "data"
+    uint32_t data_size; // Number of bytes in data.
+};
+
+bool WavCodec::open(File &file, uint32_t data_start, uint32_t data_end) {
+    this->file = file;
+    WavHeader header;
+    this->file.seek(data_start);
+    if (this->file.read((uint8_t*)&header, sizeof(WavHeader)) != sizeof(WavHeader)) {
+        Serial.println("Failed to read WAV header");
+        return false;
+    }
+    if (strncmp(header.riff_header, "RIFF", 4) != 0 || strncmp(header.wave_header, "WAVE", 4) != 0) {
+        Serial.println("Invalid WAV file format");
+        return false;
+    }
+    if (header.audio_format != 1 || header.bit_depth != 16 || header.num_channels < 1 || header.num_channels > 2) {
+        Serial.printf("Unsupported WAV format: %u channels, %u bit, format %u\n",
+                      header.num_channels, header.bit_depth, header.audio_format);
+        return false;
+    }
+
+    this->data_start = data_start + sizeof(WavHeader);
+    this->data_end = this->data_start + header.data_size;
+    if (header.data_size == 0 || this->data_end > data_end) this->data_end = data_end;
+
+    format.sample_rate = header.sample_rate;
+    format.channels = header.num_channels;
+    format.bits_per_sample = header.bit_depth;
+    format.bitrate = header.sample_rate * header.num_channels * header.bit_depth;
+    return true;
+}
+
+int32_t WavCodec::decode(int16_t *pcm, int32_t max_frames) {
+    uint32_t bytes_per_frame = format.channels * sizeof(int16_t);
+    uint32_t bytes = min(max_frames * bytes_per_frame, bytes_left());
+    bytes -= bytes % bytes_per_frame;
+    if (bytes == 0) return 0;
+    int bytes_read = file.read((uint8_t*)pcm, bytes);
+    return bytes_read > 0 ? bytes_read / bytes_per_frame : 0;
+}
+
+bool WavCodec::seek(uint32_t position) {
+    if (position < data_start) position = data_start;
+    uint32_t bytes_per_frame = format.channels * sizeof(int16_t);
+    position -= (position - data_start) % bytes_per_frame;
+    return file.seek(position);
+}
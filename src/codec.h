@@ -0,0 +1,168 @@
+#pragma once
+
+#include <Arduino.h>
+#include <FS.h>
+#include <MP3DecoderHelix.h>
+#include "mp3frame.h"
+
+// ---------- Codecs ----------
+// Every playable format sits behind this interface so the decks do not care
+// what they are decoding. A codec reads the deck's file between data_start
+// and data_end and hands back interleaved 16-bit PCM, one or two channels.
+//
+// Memory: a codec allocates its decoder memory once, on first use (or at
+// boot through allocate()), and keeps it across tracks; close() only resets
+// it, so playing track after track never touches the heap. A deck keeps the
+// memory of one compressed codec at a time and release()s it only when the
+// next track is in another format. Worst case per deck, roughly:
+//   MP3   helix decoder ~24 KB + frame and PCM buffers ~12 KB, plus a 2 KB
+//         static input window per codec
+//   M4A   helix AAC decoder with SBR ~60 KB (LC only ~30 KB)
+//   FLAC  4 KB input + 2 x 4608 x 4-byte blocks = 40 KB
+//   WAV   nothing
+// The actual cost is measured when a decoder is first allocated and logged as
+// "[Audio] ... decoder allocated". Everything else on the audio path (read
+// buffers, PCM buffers, sample table windows) is static.
+// This is not one worst-case allocation made at boot: helix allocates its
+// decoders itself, so there is no arena to place them in, and keeping all
+// three resident on two decks would not fit next to Bluetooth. A format
+// switch therefore frees one decoder and allocates another; the soak build
+// (HEAP_SOAK_TRACKS) checks that mixed albums do not fragment the heap.
+
+struct CodecFormat {
+    int sample_rate;
+    int channels;
+    int bits_per_sample; // of the source; output is always 16-bit
+    int bitrate;         // bits per second, for the remaining-time estimate
+};
+
+class Codec {
+public:
+    virtual ~Codec() {}
+    virtual const char *name() const = 0;
+
+    // Checks the stream at data_start and allocates the decoder's memory.
+    // Returns false if the file is not something this codec can play.
+    virtual bool open(File &file, uint32_t data_start, uint32_t data_end) = 0;
+    // Decodes up to max_frames frames (format.channels samples each) into pcm.
+    // Returns the number of frames written; 0 at the end of the stream or when
+    // no audio turned up in a few attempts.
+    virtual int32_t decode(int16_t *pcm, int32_t max_frames) = 0;
+    // Moves to an absolute byte position and resyncs to the next frame
+    virtual bool seek(uint32_t position) = 0;
+    // Drops decoded but unplayed audio
+    virtual void reset() = 0;
+    // Stops decoding the current file; decoder memory stays allocated
+    virtual void close() = 0;
+    // Allocates decoder memory ahead of the first open(); open() does it too
+    virtual bool allocate() { return true; }
+    // Frees decoder memory, when the deck moves to a codec of another format
+    virtual void release() {}
+    // True once the file is exhausted and all decoded audio was returned
+    virtual bool finished() = 0;
+    // Prints what decode() noted on the audio task, where printing is not
+    // allowed; called from loop()
+    virtual void log_events() {}
+    // Playing time left; estimated from the bytes left unless the container
+    // knows better
+    virtual uint32_t remaining_ms() {
+        return format.bitrate ? (uint64_t)bytes_left() * 8000 / format.bitrate : UINT32_MAX;
+    }
+
+    // Where decoding stops. CUE tracks that share a file move it, within
+    // the audio open() found, to carry on into the next track.
+    uint32_t end() const { return data_end; }
+    void set_end(uint32_t end) { data_end = end; }
+
+    CodecFormat format = {0, 0, 0, 0};
+
+protected:
+    uint32_t bytes_left() {
+        uint32_t position = file.position();
+        return position < data_end ? data_end - position : 0;
+    }
+
+    File file;
+    uint32_t data_start = 0;
+    uint32_t data_end = 0;
+};
+
+// Helix decoder that can drop its buffered input for the next track.
+// end()/begin() would do the same but free and reallocate the decoder.
+template <class Decoder>
+class ReusableHelix : public Decoder {
+public:
+    void drop_input() { this->buffer_size = 0; }
+};
+
+#define MP3_INPUT_SIZE 2048         // holds a frame of any size plus the next header
+#define MP3_RESYNC_BUDGET 4096      // bytes scanned for sync per decode() call
+#define MP3_MAX_EMPTY_FRAMES 4      // frames fed without output before concealing
+#define MP3_MAX_CONCEAL_MS 1000     // longest silence inserted for one gap
+
+// One corrupt region, from losing sync to finding it again
+struct Mp3ResyncEvent {
+    uint32_t position;       // file offset where sync was lost
+    uint32_t skipped_bytes;
+    uint32_t lost_frames;    // MP3 frames skipped or not decodable
+    uint32_t silence_frames; // PCM frames of silence played in their place
+    uint32_t cycles;         // CPU spent hunting for sync
+};
+
+// libhelix MP3, fed one validated frame at a time. A frame is only accepted
+// if its header and the one right after it match the stream. Junk is skipped in bulk up to MP3_RESYNC_BUDGET bytes
+// per call, and missing frames come out as silence so the sink never runs
+// dry.
+class Mp3Codec : public Codec {
+public:
+    const char *name() const override { return "MP3"; }
+    bool open(File &file, uint32_t data_start, uint32_t data_end) override;
+    int32_t decode(int16_t *pcm, int32_t max_frames) override;
+    bool seek(uint32_t position) override;
+    void reset() override;
+    void close() override;
+    bool allocate() override;
+    void release() override;
+    bool finished() override;
+    void log_events() override;
+
+    // Called from the helix data callback while this codec is decoding
+    void store_pcm(MP3FrameInfo &info, short *pcm, size_t len);
+
+private:
+    void fill_input();
+    uint32_t frame_at_input();
+    void lose_sync(bool quiet);
+    void regain_sync();
+    void conceal(uint32_t frames);
+
+    ReusableHelix<libhelix::MP3DecoderHelix> decoder;
+    bool decoder_running = false;
+    int16_t buffer[4096];
+    int32_t buffer_len = 0;
+
+    uint8_t input[MP3_INPUT_SIZE];
+    uint16_t input_pos = 0;
+    uint16_t input_len = 0;
+    Mp3FrameHeader stream;       // first good frame
+    bool locked = false;         // stream is valid
+    bool hunting = false;        // looking for sync
+    bool hunt_quiet = false;     // after open() or seek(): not corruption
+    uint32_t silence_pending = 0; // PCM frames of silence to play next
+    Mp3ResyncEvent hunt;
+    Mp3ResyncEvent event;        // last finished one, for log_events()
+    volatile bool event_pending = false;
+    uint32_t events_dropped = 0;
+};
+
+// Uncompressed 16-bit PCM after a canonical 44-byte RIFF header
+class WavCodec : public Codec {
+public:
+    const char *name() const override { return "WAV"; }
+    bool open(File &file, uint32_t data_start, uint32_t data_end) override;
+    int32_t decode(int16_t *pcm, int32_t max_frames) override;
+    bool seek(uint32_t position) override;
+    void reset() override {}
+    void close() override {}
+    bool finished() override { return bytes_left() == 0; }
+};
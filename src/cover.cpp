@@ -0,0 +1,274 @@
+#include "cover.h"
+#include "jpeg.h"
+#include "tags.h"
+#include "tasks.h"
+#include "governor.h"
+#include <SD.h>
+
+#define COVER_MAGIC "WCOV"
+#define COVER_SOI_SEARCH 1024 // an APIC or PICTURE header in front of the image
+
+struct CoverCacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint16_t size;   // COVER_SIZE it was made for
+    uint16_t found;  // 0: the album has no usable art, no pixels follow
+    uint32_t files;  // cover_folder_stamp() when it was made
+};
+
+static const char *const cover_files[] = {"cover.jpg", "folder.jpg", "front.jpg"};
+
+static TaskHandle_t cover_task_handle = nullptr;
+
+// Request, UI -> task. The counter is odd while the path is being written.
+static char request_path[COVER_PATH_MAX];
+static volatile uint32_t request_seq = 0;
+static String requested_song; // UI only
+static String requested_folder;
+
+// Result, task -> UI, the same way
+static uint8_t result_pages[COVER_BYTES];
+static uint32_t result_request = 0;
+static volatile uint32_t result_seq = 0;
+static uint32_t taken_seq = 0; // UI only
+
+static uint32_t job_seq = 0; // task only
+static bool job_aborted = false;
+
+static String cover_folder(const String &path) {
+    return path.substring(0, path.lastIndexOf('/'));
+}
+
+// ---------- Rendering ----------
+
+// Contrast stretch, then Floyd-Steinberg to one bit per pixel, in page
+// layout: a byte per column of 8 rows, bit 0 at the top
+static void cover_dither(const uint8_t *gray, uint8_t *pages) {
+    int lo = 255, hi = 0;
+    for (int i = 0; i < COVER_SIZE * COVER_SIZE; i++) {
+        lo = min(lo, (int)gray[i]);
+        hi = max(hi, (int)gray[i]);
+    }
+    int range = max(hi - lo, 1);
+    int16_t err_rows[2][COVER_SIZE + 2];
+    memset(err_rows, 0, sizeof(err_rows));
+    memset(pages, 0, COVER_BYTES);
+    for (int y = 0; y < COVER_SIZE; y++) {
+        int16_t *err = err_rows[y & 1];
+        int16_t *below = err_rows[(y + 1) & 1];
+        memset(below, 0, sizeof(err_rows[0]));
+        for (int x = 0; x < COVER_SIZE; x++) {
+            int value = (gray[y * COVER_SIZE + x] - lo) * 255 / range + err[x + 1];
+            bool white = value >= 128;
+            int e = value - (white ? 255 : 0);
+            err[x + 2] += e * 7 / 16;
+            below[x] += e * 3 / 16;
+            below[x + 1] += e * 5 / 16;
+            below[x + 2] += e / 16;
+            if (white) pages[(y / 8) * COVER_SIZE + x] |= 1 << (y & 7);
+        }
+    }
+}
+
+// Between MCU rows: stop if another album was asked for, pause while the
+// governor sheds background work
+static bool cover_keep_going() {
+    while (!governor_background_allowed()) {
+        if (request_seq != job_seq) break;
+        task_busy_end(TASK_COVER);
+        vTaskDelay(pdMS_TO_TICKS(COVER_WAIT_MS));
+        task_busy_begin(TASK_COVER);
+    }
+    job_aborted = request_seq != job_seq;
+    return !job_aborted;
+}
+
+// The JPEG inside an embedded picture: past the MIME type, description and
+// the like to the SOI marker
+static bool cover_find_jpeg(File &file, uint32_t &start, uint32_t &length) {
+    uint8_t buf[64];
+    uint32_t end = start + length;
+    uint32_t limit = min(end, start + COVER_SOI_SEARCH);
+    for (uint32_t pos = start; pos + 3 <= limit; pos += sizeof(buf) - 2) {
+        file.seek(pos);
+        int n = file.read(buf, min((uint32_t)sizeof(buf), limit - pos));
+        for (int i = 0; i + 2 < n; i++) {
+            if (buf[i] == 0xFF && buf[i + 1] == 0xD8 && buf[i + 2] == 0xFF) {
+                start = pos + i;
+                length = end - start;
+                return true;
+            }
+            if (buf[i] == 0x89 && buf[i + 1] == 'P' && buf[i + 2] == 'N') {
+                Serial.println("[Cover] PNG art is not supported");
+                return false;
+            }
+        }
+    }
+    return false;
+}
+
+static bool cover_decode(const String &song_path, const String &folder, uint8_t *gray, String &source) {
+    for (const char *name : cover_files) {
+        String path = folder + "/" + name;
+        File file = SD.open(path, FILE_READ);
+        if (!file) continue;
+        bool ok = !file.isDirectory() && jpeg_thumbnail(file, 0, file.size(), gray, COVER_SIZE, COVER_SIZE, cover_keep_going);
+        file.close();
+        if (ok) {
+            source = name;
+            return true;
+        }
+        if (job_aborted) return false;
+    }
+
+    File file = SD.open(song_path, FILE_READ);
+    if (!file) return false;
+    TrackInfo info;
+    // Not through the tag cache: its appends come from the UI and decode tasks
+    tags_read(file, song_path, info, false);
+    uint32_t start = info.picture_start;
+    uint32_t length = info.picture_length;
+    bool ok = length && cover_find_jpeg(file, start, length) &&
+              jpeg_thumbnail(file, start, length, gray, COVER_SIZE, COVER_SIZE, cover_keep_going);
+    file.close();
+    if (ok) source = "embedded art";
+    return ok;
+}
+
+// Size and modification time of the cover files in the folder; 0 when
+// there are none. A cached thumbnail, or the note that there is no usable
+// art, holds until this changes: a cover.jpg added or replaced is picked up,
+// and an unreadable one is not decoded again on every visit.
+static uint32_t cover_folder_stamp(const String &folder) {
+    uint32_t h = 0;
+    for (uint32_t n = 0; n < sizeof(cover_files) / sizeof(cover_files[0]); n++) {
+        File file = SD.open(folder + "/" + cover_files[n], FILE_READ);
+        if (!file) continue;
+        uint32_t stamp[3] = {n, (uint32_t)file.size(), (uint32_t)file.getLastWrite()};
+        file.close();
+        if (h == 0) h = 2166136261u; // FNV-1a
+        for (size_t i = 0; i < sizeof(stamp); i++) {
+            h = (h ^ ((const uint8_t*)stamp)[i]) * 16777619u;
+        }
+    }
+    return h;
+}
+
+// From the album's cache, or decoded and then cached
+static bool cover_make(const String &song_path, uint8_t *pages) {
+    String folder = cover_folder(song_path);
+    String cache_path = folder + "/" + COVER_CACHE_NAME;
+    CoverCacheHeader header;
+    File cache = SD.open(cache_path, FILE_READ);
+    if (cache) {
+        bool valid = cache.read((uint8_t*)&header, sizeof(header)) == sizeof(header) &&
+                     memcmp(header.magic, COVER_MAGIC, 4) == 0 && header.version == COVER_CACHE_VERSION &&
+                     header.size == COVER_SIZE;
+        bool current = valid && header.files == cover_folder_stamp(folder);
+        bool found = current && header.found && cache.read(pages, COVER_BYTES) == COVER_BYTES;
+        cache.close();
+        if (found) return true;
+        if (current && !header.found) return false;
+    }
+
+    unsigned long start = millis();
+    job_aborted = false;
+    uint8_t *gray = new uint8_t[COVER_SIZE * COVER_SIZE];
+    String source;
+    bool found = cover_decode(song_path, folder, gray, source);
+    if (found) cover_dither(gray, pages);
+    delete[] gray;
+    if (job_aborted) return false; // another album was asked for; nothing learned
+
+    if (found) {
+        Serial.printf("[Cover] %s: thumbnail from %s in %lu ms\n", folder.c_str(), source.c_str(), millis() - start);
+    } else {
+        Serial.printf("[Cover] %s: no usable cover art\n", folder.c_str());
+    }
+    SD.remove(cache_path);
+    cache = SD.open(cache_path, FILE_WRITE);
+    if (cache) {
+        memcpy(header.magic, COVER_MAGIC, 4);
+        header.version = COVER_CACHE_VERSION;
+        header.size = COVER_SIZE;
+        header.found = found;
+        header.files = cover_folder_stamp(folder);
+        cache.write((const uint8_t*)&header, sizeof(header));
+        if (found) cache.write(pages, COVER_BYTES);
+        cache.close();
+    }
+    return found;
+}
+
+// ---------- Task ----------
+
+static void cover_publish(uint32_t seq, const uint8_t *pages) {
+    result_seq = result_seq + 1;
+    __sync_synchronize();
+    memcpy(result_pages, pages, COVER_BYTES);
+    result_request = seq;
+    __sync_synchronize();
+    result_seq = result_seq + 1;
+}
+
+static void cover_task(void *param) {
+    char path[COVER_PATH_MAX];
+    uint8_t pages[COVER_BYTES];
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        for (;;) {
+            uint32_t seq = request_seq;
+            if (seq & 1) {
+                vTaskDelay(1); // the UI is writing a request
+                continue;
+            }
+            __sync_synchronize();
+            memcpy(path, request_path, sizeof(path));
+            __sync_synchronize();
+            if (seq != request_seq) continue;
+            if (seq == job_seq) break; // handled
+
+            job_seq = seq;
+            if (!cover_keep_going()) continue;
+            task_busy_begin(TASK_COVER);
+            {
+                MemoryScope scope(MEM_UI);
+                if (cover_make(String(path), pages)) cover_publish(seq, pages);
+            }
+            task_busy_end(TASK_COVER);
+        }
+    }
+}
+
+void cover_begin() {
+    cover_task_handle = task_start(TASK_COVER, cover_task);
+}
+
+bool cover_request(const Song &song) {
+    if (song.path == requested_song) return false;
+    requested_song = song.path;
+    String folder = cover_folder(song.path);
+    if (folder == requested_folder) return false;
+    requested_folder = folder;
+    if (song.path.length() == 0 || song.path.length() >= COVER_PATH_MAX) return true;
+
+    request_seq = request_seq + 1;
+    __sync_synchronize();
+    strcpy(request_path, song.path.c_str());
+    __sync_synchronize();
+    request_seq = request_seq + 1;
+    if (cover_task_handle) xTaskNotifyGive(cover_task_handle);
+    return true;
+}
+
+bool cover_take(uint8_t *pages) {
+    uint32_t seq = result_seq;
+    if ((seq & 1) || seq == taken_seq) return false;
+    __sync_synchronize();
+    memcpy(pages, result_pages, COVER_BYTES);
+    uint32_t request = result_request;
+    __sync_synchronize();
+    if (seq != result_seq) return false; // being rewritten; next time
+    taken_seq = seq;
+    return request == request_seq;
+}
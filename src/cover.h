@@ -0,0 +1,34 @@
+#pragma once
+
+#include <Arduino.h>
+#include "song.h"
+
+// ---------- Cover art ----------
+// A small 1-bpp thumbnail of the playing album's cover for the player
+// screen. The picture is cover.jpg, folder.jpg or front.jpg in the album
+// folder, else the art embedded in the playing file (ID3 APIC, FLAC
+// PICTURE or MP4 covr). The cover task (tasks.h) decodes it once with the
+// JPEG thumbnailer (jpeg.h), stretches its contrast, dithers it and stores
+// it in SSD1306 page layout in COVER_CACHE_NAME in the album folder, so
+// the player screen only ever copies COVER_BYTES into the frame buffer.
+// The task runs at idle priority, never on the audio path, waits while the
+// governor holds back background work, and drops a decode as soon as
+// another album is asked for. The thumbnail, or the lack of usable art, is
+// kept until a cover file in the album folder is added or changes.
+
+#define COVER_CACHE_NAME "_cover.dat"
+#define COVER_CACHE_VERSION 3
+#define COVER_SIZE 24 // thumbnail width and height, a multiple of 8
+#define COVER_BYTES (COVER_SIZE * COVER_SIZE / 8)
+#define COVER_PATH_MAX 192
+#define COVER_WAIT_MS 500 // governor recheck while background work is held back
+
+void cover_begin();
+
+// UI: the thumbnail wanted now is for this song's album. True if that is a
+// different album from the last request, whose thumbnail no longer applies.
+bool cover_request(const Song &song);
+
+// UI: copies the thumbnail for the last request into pages once it is
+// ready. True once per thumbnail.
+bool cover_take(uint8_t *pages);
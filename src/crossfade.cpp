@@ -0,0 +1,100 @@
+#include "crossfade.h"
+
+// Overlap lengths the player cycles through, 0 = plain cut
+static const uint16_t crossfade_lengths_ms[] = {0, 2000, 4000, 6000, 8000};
+#define CROSSFADE_LENGTH_COUNT (sizeof(crossfade_lengths_ms) / sizeof(crossfade_lengths_ms[0]))
+
+// sin() over a quarter turn, Q15, 64 steps plus the end point. The fade-in
+// gain is sin(t), the fade-out gain is the same table read backwards
+// (cos(t)), so fade_in^2 + fade_out^2 stays at 1 the whole way through.
+static const int16_t crossfade_curve[65] = {
+        0,   804,  1608,  2410,  3212,  4011,  4808,  5602,
+     6393,  7179,  7962,  8739,  9512, 10278, 11039, 11793,
+    12539, 13279, 14010, 14732, 15446, 16151, 16846, 17530,
+    18204, 18868, 19519, 20159, 20787, 21403, 22005, 22594,
+    23170, 23731, 24279, 24811, 25329, 25832, 26319, 26790,
+    27245, 27683, 28105, 28510, 28898, 29268, 29621, 29956,
+    30273, 30571, 30852, 31113, 31356, 31580, 31785, 31971,
+    32137, 32285, 32412, 32521, 32609, 32678, 32728, 32757,
+    32767,
+};
+
+static uint32_t crossfade_ms = 0;
+static uint32_t crossfade_decoder_bytes = 0;
+
+static uint32_t crossfade_length = 0;
+static uint32_t crossfade_pos = 0;
+
+void crossfade_set_ms(uint32_t ms) {
+    crossfade_ms = ms;
+}
+
+uint32_t crossfade_get_ms() {
+    return crossfade_ms;
+}
+
+void crossfade_cycle_length() {
+    size_t i = 0;
+    while (i < CROSSFADE_LENGTH_COUNT && crossfade_lengths_ms[i] != crossfade_ms) i++;
+    crossfade_ms = crossfade_lengths_ms[(i + 1) % CROSSFADE_LENGTH_COUNT];
+    Serial.printf("[Crossfade] overlap set to %u ms\n", crossfade_ms);
+}
+
+String crossfade_label() {
+    if (crossfade_ms == 0) return "Fade: off";
+    return "Fade: " + String(crossfade_ms / 1000) + "s";
+}
+
+void crossfade_note_decoder_cost(uint32_t bytes) {
+    crossfade_decoder_bytes = bytes;
+}
+
+uint32_t crossfade_decoder_cost() {
+    return crossfade_decoder_bytes ? crossfade_decoder_bytes : CROSSFADE_DECODER_COST_ESTIMATE;
+}
+
+bool crossfade_has_headroom(int dual_decode_load_percent) {
+    uint32_t needed = crossfade_decoder_cost() + CROSSFADE_HEAP_MARGIN;
+    uint32_t largest_block = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    if (largest_block < needed) {
+        Serial.printf("[Crossfade] not enough heap for a second decoder (largest block %u, need %u), cutting instead\n",
+                      largest_block, needed);
+        return false;
+    }
+    if (dual_decode_load_percent > CROSSFADE_MAX_LOAD_PERCENT) {
+        Serial.printf("[Crossfade] dual decode would load the audio core to %d%%, cutting instead\n",
+                      dual_decode_load_percent);
+        return false;
+    }
+    return true;
+}
+
+void crossfade_begin(uint32_t length_frames) {
+    crossfade_length = length_frames > 0 ? length_frames : 1;
+    crossfade_pos = 0;
+}
+
+// Interpolated Q15 gain for position pos of len
+static inline int32_t crossfade_gain(uint32_t pos, uint32_t len) {
+    uint32_t t = (uint32_t)(((uint64_t)pos << 16) / len); // 0..65536 over the fade
+    uint32_t index = t >> 10;                               // 0..64
+    uint32_t frac = t & 1023;
+    if (index >= 64) return crossfade_curve[64];
+    return crossfade_curve[index] + (((crossfade_curve[index + 1] - crossfade_curve[index]) * (int32_t)frac) >> 10);
+}
+
+bool crossfade_mix(Frame *out, const Frame *in, int32_t frames) {
+    for (int32_t i = 0; i < frames; i++) {
+        uint32_t pos = crossfade_pos < crossfade_length ? crossfade_pos : crossfade_length;
+        int32_t gain_in = crossfade_gain(pos, crossfade_length);
+        int32_t gain_out = crossfade_gain(crossfade_length - pos, crossfade_length);
+
+        int32_t l = (out[i].channel1 * gain_out + in[i].channel1 * gain_in) >> 15;
+        int32_t r = (out[i].channel2 * gain_out + in[i].channel2 * gain_in) >> 15;
+        out[i].channel1 = (int16_t)constrain(l, (int32_t)-32768, (int32_t)32767);
+        out[i].channel2 = (int16_t)constrain(r, (int32_t)-32768, (int32_t)32767);
+
+        if (crossfade_pos < crossfade_length) crossfade_pos++;
+    }
+    return crossfade_pos >= crossfade_length;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <Arduino.h>
+#include <BluetoothA2DPSource.h>
+
+// ---------- Crossfade ----------
+// Equal-power mix of the outgoing and incoming deck over a configurable
+// overlap. The decks themselves live in main.cpp; this module owns the
+// setting, the headroom checks and the fixed-point gain curve.
+
+// Dual decode must leave this much of the audio core free
+#define CROSSFADE_MAX_LOAD_PERCENT 80
+// Heap kept free on top of the second decoder's cost
+#define CROSSFADE_HEAP_MARGIN 16384
+// Used until the first real measurement of a decoder's heap cost
+#define CROSSFADE_DECODER_COST_ESTIMATE 32768
+
+void crossfade_set_ms(uint32_t ms);
+uint32_t crossfade_get_ms();
+void crossfade_cycle_length();
+String crossfade_label();
+
+// Returns false (and logs why) when two decoders would not fit
+bool crossfade_has_headroom(int dual_decode_load_percent);
+void crossfade_note_decoder_cost(uint32_t bytes);
+uint32_t crossfade_decoder_cost();
+
+// Audio path
+void crossfade_begin(uint32_t length_frames);
+// out = out * fade_out + in * fade_in, in place; returns true once the
+// overlap is complete
+bool crossfade_mix(Frame *out, const Frame *in, int32_t frames);
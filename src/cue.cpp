@@ -0,0 +1,460 @@
+#include "cue.h"
+#include <SD.h>
+#include "lines.h"
+#include "flac.h"
+#include "governor.h"
+#include "mp3frame.h"
+#include "tags.h"
+
+#define CUE_CACHE_MAGIC "WCUE"
+#define CUE_FRAMES_PER_SECOND 75   // CD frames, the unit of INDEX times
+#define CUE_MP3_PROBE_FRAMES 32    // frames at one bitrate that make an untagged MP3 CBR
+#define CUE_FLAC_LINEAR_BYTES 1024 // bisection stops this close, then steps frame by frame
+#define CUE_SCAN_BUFFER 4096
+#define CUE_WAV_HEADER_BYTES 44    // canonical header, as WavCodec expects
+#define CUE_PROGRESS_BYTES 262144  // VBR walk reported, and paused for the governor, every 256 KB
+
+static CueProgress cue_progress = nullptr; // for the cue_load() in progress
+
+struct CueTrack {
+    String file;     // card path of the audio
+    String title;
+    uint8_t number;
+    uint32_t index;  // INDEX 01, in CD frames
+    bool has_index;
+};
+typedef MemVector<CueTrack, MEM_LIBRARY> CueTrackList;
+
+// Random access to the audio through one buffer, for reading headers
+struct ScanWindow {
+    File &file;
+    uint32_t end;
+    uint8_t *buf;
+    uint32_t start;
+    uint32_t len;
+
+    ScanWindow(File &file, uint32_t end, uint8_t *buf) : file(file), end(end), buf(buf), start(0), len(0) {}
+
+    // n bytes at offset, or nullptr past the end
+    const uint8_t *at(uint32_t offset, uint32_t n) {
+        if (offset + n > end) return nullptr;
+        if (offset < start || offset + n > start + len) {
+            start = offset;
+            file.seek(offset);
+            int got = file.read(buf, min((uint32_t)CUE_SCAN_BUFFER, end - offset));
+            len = got > 0 ? got : 0;
+            if (len < n) return nullptr;
+        }
+        return buf + (offset - start);
+    }
+};
+
+static uint32_t le32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint32_t fnv1a(uint32_t h, const uint8_t *data, size_t len) {
+    for (size_t i = 0; i < len; i++) h = (h ^ data[i]) * 16777619u;
+    return h;
+}
+
+// ---------- Sheet ----------
+
+// s with its keyword and the spaces after it skipped, or nullptr if it is
+// another command
+static const char *cue_keyword(const char *s, const char *word) {
+    size_t n = strlen(word);
+    if (strncasecmp(s, word, n) != 0 || (s[n] != ' ' && s[n] != '\t')) return nullptr;
+    s += n;
+    while (*s == ' ' || *s == '\t') s++;
+    return s;
+}
+
+// A quoted value, or the first word of an unquoted one
+static String cue_value(const char *s) {
+    if (*s == '"') {
+        const char *close = strchr(s + 1, '"');
+        String value = s + 1;
+        return close ? value.substring(0, close - s - 1) : value;
+    }
+    const char *space = strpbrk(s, " \t");
+    String value = s;
+    return space ? value.substring(0, space - s) : value;
+}
+
+// The sheet's FILE, next to the sheet. Rips are often re-encoded after the
+// sheet was written, so the same name with another supported extension will do.
+static String cue_audio_path(const String &dir, String name) {
+    name.replace('\\', '/');
+    name = name.substring(name.lastIndexOf('/') + 1);
+    String path = dir + "/" + name;
+    if (name.length() > 0 && SD.exists(path)) return path;
+
+    int dot = path.lastIndexOf('.');
+    String base = dot > (int)dir.length() ? path.substring(0, dot) : path;
+    static const char *extensions[] = {".flac", ".mp3", ".wav"};
+    for (const char *extension : extensions) {
+        if (SD.exists(base + extension)) return base + extension;
+    }
+    return String();
+}
+
+static void cue_parse(File &file, const String &dir, CueTrackList &tracks) {
+    LineReader in(file);
+    char line[CUE_LINE_MAX];
+    String audio;
+    bool in_track = false;
+    bool first = true;
+
+    while (in.next(line, sizeof(line))) {
+        char *s = line;
+        if (first && (uint8_t)s[0] == 0xEF && (uint8_t)s[1] == 0xBB && (uint8_t)s[2] == 0xBF) s += 3;
+        first = false;
+        s = line_trim(s);
+
+        const char *value;
+        if ((value = cue_keyword(s, "FILE"))) {
+            audio = cue_audio_path(dir, cue_value(value));
+            if (audio.length() == 0) Serial.printf("[CUE] %s not on the card\n", cue_value(value).c_str());
+            in_track = false;
+        } else if ((value = cue_keyword(s, "TRACK"))) {
+            in_track = audio.length() > 0 && strstr(value, "AUDIO") && tracks.size() < CUE_MAX_TRACKS;
+            if (in_track) tracks.push_back({audio, String(), (uint8_t)atoi(value), 0, false});
+        } else if (!in_track) {
+            continue; // album TITLE, PERFORMER, REM...
+        } else if ((value = cue_keyword(s, "TITLE"))) {
+            tracks.back().title = cue_value(value);
+        } else if ((value = cue_keyword(s, "INDEX"))) {
+            unsigned number, mm, ss, ff;
+            if (sscanf(value, "%u %u:%u:%u", &number, &mm, &ss, &ff) == 4 && number == 1) {
+                tracks.back().index = (mm * 60 + ss) * CUE_FRAMES_PER_SECOND + ff;
+                tracks.back().has_index = true;
+            }
+        }
+    }
+}
+
+// ---------- Seek table ----------
+// Each locate_*() turns INDEX times (sorted) into the byte offsets of the
+// frames that play them
+
+static bool locate_wav(ScanWindow &w, const uint32_t *times, int count, uint32_t *offsets, uint32_t &audio_end) {
+    const uint8_t *h = w.at(0, CUE_WAV_HEADER_BYTES);
+    if (!h || memcmp(h, "RIFF", 4) != 0 || memcmp(h + 8, "WAVE", 4) != 0) return false;
+    uint32_t channels = h[22] | (h[23] << 8);
+    uint32_t rate = le32(h + 24);
+    uint32_t frame_bytes = channels * (h[34] | (h[35] << 8)) / 8;
+    uint32_t data_size = le32(h + 40);
+    if (rate == 0 || frame_bytes == 0) return false;
+
+    if (data_size && CUE_WAV_HEADER_BYTES + data_size < audio_end) audio_end = CUE_WAV_HEADER_BYTES + data_size;
+    for (int i = 0; i < count; i++) {
+        uint64_t offset = CUE_WAV_HEADER_BYTES + (uint64_t)times[i] * rate / CUE_FRAMES_PER_SECOND * frame_bytes;
+        offsets[i] = offset < audio_end ? offset : audio_end;
+    }
+    return true;
+}
+
+// First position from from where a frame header is followed by another of
+// the same stream, the way the decoder locks on; w.end if there is none
+static uint32_t mp3_sync(ScanWindow &w, uint32_t from, Mp3FrameHeader &header) {
+    for (uint32_t pos = from; pos + MP3_HEADER_BYTES <= w.end; pos++) {
+        const uint8_t *p = w.at(pos, MP3_HEADER_BYTES);
+        if (!p) break;
+        if (p[0] != 0xFF || !mp3_parse_header(p, header)) continue;
+        Mp3FrameHeader next;
+        const uint8_t *q = w.at(pos + header.frame_bytes, MP3_HEADER_BYTES);
+        if (!q || (mp3_parse_header(q, next) && mp3_same_stream(header, next))) return pos; // or the last frame
+    }
+    return w.end;
+}
+
+static bool locate_mp3(ScanWindow &w, uint32_t audio_start, const uint32_t *times, int count, uint32_t *offsets) {
+    Mp3FrameHeader stream;
+    uint32_t first = mp3_sync(w, audio_start, stream);
+    if (first >= w.end) return false;
+    uint32_t rate = stream.sample_rate;
+
+    // A Xing/VBRI frame up front holds no audio and means VBR; "Info" is
+    // what LAME writes there for CBR
+    bool tagged = false;
+    bool vbr = false;
+    const uint8_t *frame = w.at(first, min((uint32_t)stream.frame_bytes, w.end - first));
+    for (int i = MP3_HEADER_BYTES; frame && i + 4 <= 40 && i + 4 <= stream.frame_bytes; i++) {
+        if (memcmp(frame + i, "Xing", 4) == 0 || memcmp(frame + i, "VBRI", 4) == 0) {
+            tagged = vbr = true;
+            break;
+        }
+        if (memcmp(frame + i, "Info", 4) == 0) {
+            tagged = true;
+            break;
+        }
+    }
+    uint32_t audio = tagged ? first + stream.frame_bytes : first;
+    Mp3FrameHeader h;
+    if (!tagged) {
+        // Nothing to say which: a run of frames at one bitrate is taken as CBR
+        uint32_t pos = audio;
+        for (int i = 0; i < CUE_MP3_PROBE_FRAMES && !vbr; i++) {
+            const uint8_t *p = w.at(pos, MP3_HEADER_BYTES);
+            if (!p || !mp3_parse_header(p, h)) break;
+            vbr = h.bitrate != stream.bitrate;
+            pos += h.frame_bytes;
+        }
+    }
+
+    if (!vbr) {
+        // Frame n starts about n * bitrate * samples / 8 / rate bytes in;
+        // padding spreads the remainder, so a header is within a few bytes
+        for (int i = 0; i < count; i++) {
+            uint64_t n = (uint64_t)times[i] * rate / CUE_FRAMES_PER_SECOND / stream.samples;
+            uint64_t estimate = audio + n * stream.bitrate * stream.samples / 8 / rate;
+            offsets[i] = estimate < w.end ? mp3_sync(w, estimate > audio + 2 ? estimate - 2 : audio, h) : w.end;
+        }
+        return true;
+    }
+
+    // VBR: count samples header by header, once, for the frame that holds
+    // each start
+    uint64_t samples = 0;
+    uint32_t pos = audio;
+    uint32_t reported = audio;
+    int next = 0;
+    while (next < count) {
+        const uint8_t *p = w.at(pos, MP3_HEADER_BYTES);
+        if (!p) break;
+        if (pos - reported >= CUE_PROGRESS_BYTES) {
+            reported = pos;
+            if (cue_progress) cue_progress((uint64_t)pos * 100 / w.end);
+            governor_yield();
+        }
+        if (!mp3_parse_header(p, h) || !mp3_same_stream(stream, h)) {
+            pos = mp3_sync(w, pos + 1, h); // junk between frames, skipped like the decoder does
+            continue;
+        }
+        while (next < count && (uint64_t)times[next] * rate / CUE_FRAMES_PER_SECOND < samples + h.samples) {
+            offsets[next++] = pos;
+        }
+        samples += h.samples;
+        pos += h.frame_bytes;
+    }
+    while (next < count) offsets[next++] = w.end;
+    return true;
+}
+
+static bool locate_flac(File &file, uint32_t audio_start, uint32_t audio_end,
+                        const uint32_t *times, int count, uint32_t *offsets) {
+    FlacStreamInfo info;
+    if (!flac_read_info(file, audio_start, audio_end, info) || info.sample_rate == 0) return false;
+
+    uint32_t lo = info.first_frame; // a frame that starts at or before the target
+    for (int i = 0; i < count; i++) {
+        governor_yield(); // each track start is a binary search over the file
+        uint64_t target = (uint64_t)times[i] * info.sample_rate / CUE_FRAMES_PER_SECOND;
+        uint32_t hi = audio_end;
+        uint32_t offset;
+        uint64_t sample;
+        while (hi - lo > CUE_FLAC_LINEAR_BYTES) {
+            uint32_t mid = lo + (hi - lo) / 2;
+            if (!flac_find_frame(file, mid, audio_end, info, offset, sample) || sample > target || offset >= hi) {
+                hi = mid;
+            } else {
+                lo = offset;
+            }
+        }
+        while (flac_find_frame(file, lo + 1, audio_end, info, offset, sample) && sample <= target) {
+            lo = offset;
+        }
+        offsets[i] = lo;
+    }
+    return true;
+}
+
+static bool cue_locate(File &file, const String &path, FileType type, const uint32_t *times, int count,
+                       uint32_t *offsets, uint32_t &audio_end) {
+    uint32_t audio_start = 0;
+    audio_end = file.size();
+    if (type != WAV) {
+        TrackInfo info;
+        tags_read(file, path, info);
+        audio_start = info.audio_start;
+        audio_end = info.audio_end;
+    }
+    if (type == FLAC) return locate_flac(file, audio_start, audio_end, times, count, offsets);
+
+    MemVector<uint8_t, MEM_LIBRARY> buffer(CUE_SCAN_BUFFER);
+    ScanWindow window(file, audio_end, buffer.data());
+    if (type == WAV) return locate_wav(window, times, count, offsets, audio_end);
+    if (type == MP3) return locate_mp3(window, audio_start, times, count, offsets);
+    return false;
+}
+
+// Tracks parsed[from, to), which share one audio file, as songs with their
+// byte ranges
+static void cue_add_file(const CueTrackList &parsed, size_t from, size_t to, SongList &tracks) {
+    const String &audio = parsed[from].file;
+    FileType type;
+    if (!song_type_from_path(audio, type) || type == M4A) {
+        Serial.printf("[CUE] %s: only MP3, WAV and FLAC can be split\n", audio.c_str());
+        return;
+    }
+
+    MemVector<uint32_t, MEM_LIBRARY> times;
+    MemVector<size_t, MEM_LIBRARY> picked;
+    for (size_t k = from; k < to; k++) {
+        // Out of order or without INDEX 01: not something we can seek to
+        if (!parsed[k].has_index || (!times.empty() && parsed[k].index <= times.back())) continue;
+        times.push_back(parsed[k].index);
+        picked.push_back(k);
+    }
+    if (times.empty()) return;
+
+    MemVector<uint32_t, MEM_LIBRARY> offsets(times.size());
+    File file = SD.open(audio);
+    if (!file) return;
+    if (cue_progress) cue_progress(0);
+    uint32_t audio_end = 0;
+    bool ok = cue_locate(file, audio, type, times.data(), times.size(), offsets.data(), audio_end);
+    file.close();
+    if (!ok) {
+        Serial.printf("[CUE] cannot index %s\n", audio.c_str());
+        return;
+    }
+
+    for (size_t j = 0; j < times.size(); j++) {
+        uint32_t end = j + 1 < times.size() ? offsets[j + 1] : audio_end;
+        if (offsets[j] >= end) continue;
+        const CueTrack &track = parsed[picked[j]];
+        String title = track.title;
+        if (title.length() == 0) {
+            char name[12];
+            snprintf(name, sizeof(name), "Track %02u", track.number);
+            title = name;
+        }
+        tracks.push_back({audio, type, title, offsets[j], end});
+    }
+}
+
+// ---------- Cache ----------
+// A stamp line, then one "<type>|<start>|<end>|<path>|<title>" line per
+// track. FAT names can't hold '|', so only the title may.
+
+static String cue_cache_path(const String &path) {
+    uint32_t h = fnv1a(2166136261u, (const uint8_t*)path.c_str(), path.length());
+    char name[32];
+    snprintf(name, sizeof(name), CUE_CACHE_DIR "/%08x.dat", h);
+    return String(name);
+}
+
+// Size and modification time of every audio file the tracks come from
+static uint32_t cue_audio_stamp(const SongList &tracks) {
+    uint32_t h = 2166136261u;
+    const String *last = nullptr;
+    for (const auto &track : tracks) {
+        if (last && *last == track.path) continue;
+        last = &track.path;
+        File file = SD.open(track.path);
+        uint32_t stamp[2] = {0, 0};
+        if (file) {
+            stamp[0] = file.size();
+            stamp[1] = (uint32_t)file.getLastWrite();
+            file.close();
+        }
+        h = fnv1a(h, (const uint8_t*)stamp, sizeof(stamp));
+    }
+    return h;
+}
+
+static bool cue_cache_read(const String &path, uint32_t size, uint32_t modified, SongList &tracks) {
+    File cache = SD.open(cue_cache_path(path), FILE_READ);
+    if (!cache) return false;
+    LineReader in(cache);
+    char line[CUE_LINE_MAX * 2];
+    char magic[5] = "";
+    unsigned version = 0, cached_size = 0, cached_modified = 0, audio_stamp = 0, count = 0;
+    bool ok = in.next(line, sizeof(line)) &&
+              sscanf(line, "%4s %u %u %u %u %u", magic, &version, &cached_size, &cached_modified,
+                     &audio_stamp, &count) == 6 &&
+              strcmp(magic, CUE_CACHE_MAGIC) == 0 && version == CUE_CACHE_VERSION &&
+              cached_size == size && cached_modified == modified;
+    if (ok) {
+        tracks.reserve(count);
+        while (in.next(line, sizeof(line))) {
+            unsigned type, start, end;
+            char *path_bar = strchr(line, '|');
+            path_bar = path_bar ? strchr(path_bar + 1, '|') : nullptr;
+            path_bar = path_bar ? strchr(path_bar + 1, '|') : nullptr;
+            char *title_bar = path_bar ? strchr(path_bar + 1, '|') : nullptr;
+            if (!title_bar || sscanf(line, "%u|%u|%u|", &type, &start, &end) != 3) continue;
+            *title_bar = '\0';
+            tracks.push_back({String(path_bar + 1), (FileType)type, String(title_bar + 1), start, end});
+        }
+        ok = tracks.size() == count && cue_audio_stamp(tracks) == audio_stamp;
+        if (!ok) tracks.clear();
+    }
+    cache.close();
+    return ok;
+}
+
+static void cue_cache_write(const String &path, uint32_t size, uint32_t modified, const SongList &tracks) {
+    if (!SD.exists(CUE_CACHE_DIR)) SD.mkdir(CUE_CACHE_DIR);
+    String name = cue_cache_path(path);
+    SD.remove(name);
+    File cache = SD.open(name, FILE_WRITE);
+    if (!cache) {
+        Serial.printf("[CUE] cannot write cache %s\n", name.c_str());
+        return;
+    }
+    cache.printf("%s %u %u %u %u %u\n", CUE_CACHE_MAGIC, CUE_CACHE_VERSION, size, modified,
+                 cue_audio_stamp(tracks), (unsigned)tracks.size());
+    for (const auto &track : tracks) {
+        cache.printf("%d|%u|%u|%s|%s\n", (int)track.type, track.start, track.end,
+                     track.path.c_str(), track.title.c_str());
+    }
+    cache.close();
+}
+
+bool cue_is_file(const String &name) {
+    String lower = name;
+    lower.toLowerCase();
+    return lower.endsWith(".cue");
+}
+
+bool cue_load(const String &path, SongList &tracks, CueProgress progress) {
+    unsigned long start = millis();
+    tracks.clear();
+    File sheet = SD.open(path, FILE_READ);
+    if (!sheet) return false;
+    uint32_t size = sheet.size();
+    uint32_t modified = (uint32_t)sheet.getLastWrite();
+
+    if (cue_cache_read(path, size, modified, tracks)) {
+        sheet.close();
+        Serial.printf("[CUE] %s: %u tracks from cache in %lu ms\n", path.c_str(),
+                      (unsigned)tracks.size(), millis() - start);
+        return true;
+    }
+
+    CueTrackList parsed;
+    cue_parse(sheet, path.substring(0, path.lastIndexOf('/')), parsed);
+    sheet.close();
+
+    // One pass over each audio file for all of its tracks
+    cue_progress = progress;
+    size_t from = 0;
+    while (from < parsed.size()) {
+        size_t to = from;
+        while (to < parsed.size() && parsed[to].file == parsed[from].file) to++;
+        cue_add_file(parsed, from, to, tracks);
+        from = to;
+    }
+    cue_progress = nullptr;
+    if (tracks.empty()) {
+        Serial.printf("[CUE] %s: no tracks to play\n", path.c_str());
+        return false;
+    }
+    cue_cache_write(path, size, modified, tracks);
+    Serial.printf("[CUE] %s: %u tracks, seek table built in %lu ms\n", path.c_str(),
+                  (unsigned)tracks.size(), millis() - start);
+    return true;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <Arduino.h>
+#include "song.h"
+
+// ---------- CUE sheets ----------
+// A .cue next to one long MP3, WAV or FLAC rip splits it into tracks that
+// list and play like separate songs. Each track is the byte range of the
+// file from its INDEX 01 to the next track's. The ranges come from a seek
+// table worked out once per sheet:
+//   WAV   arithmetic on the sample frame size
+//   MP3   arithmetic for CBR, then synced to the next frame header; VBR
+//         files are walked header by header once
+//   FLAC  bisection on the sample numbers in the frame headers
+// It is cached in CUE_CACHE_DIR, stamped with the size and modification
+// time of the sheet and of the audio, so opening the album again is a
+// single read and starting a track is a seek like resuming a normal file.
+
+#define CUE_CACHE_DIR "/data/_cue"
+#define CUE_CACHE_VERSION 1
+#define CUE_MAX_TRACKS 99
+#define CUE_LINE_MAX 256
+
+// True for a CUE sheet file name (by extension)
+bool cue_is_file(const String &name);
+
+// Told how far a seek table build has got, in percent of the audio file;
+// 0 when one starts. Building one for a long VBR MP3 reads the whole file.
+typedef void (*CueProgress)(uint32_t percent);
+
+// The tracks of the sheet at path, in order, each with its byte range. False
+// if none of the audio files it names is on the card and supported. progress
+// is only called when the cache can't be used.
+bool cue_load(const String &path, SongList &tracks, CueProgress progress = nullptr);
@@ -0,0 +1,215 @@
+#include "equalizer.h"
+#include <math.h>
+
+// Winamp band centres in Hz
+const uint16_t eq_band_centres[EQ_BANDS] = {60, 170, 310, 600, 1000, 3000, 6000, 12000, 14000, 16000};
+
+// The classic Winamp presets (tenths of a dB). The preamp takes off roughly
+// half of the largest boost so heavy presets do not clip straight away.
+const EqPreset eq_presets[] = {
+    {"Flat",              0, {   0,   0,   0,   0,   0,   0,   0,   0,   0,   0}},
+    {"Classical",         0, {   0,   0,   0,   0,   0,   0, -72, -72, -72, -96}},
+    {"Club",            -40, {   0,   0,  80,  56,  56,  56,  32,   0,   0,   0}},
+    {"Dance",           -48, {  96,  72,  24,   0,   0, -56, -72, -72,   0,   0}},
+    {"Full Bass",       -48, { -80,  96,  96,  56,  16, -40, -80,-104,-112,-112}},
+    {"Full Bass&Treble",-60, {  72,  56,   0, -72, -48,  16,  80, 112, 120, 120}},
+    {"Full Treble",     -84, { -96, -96, -96, -40,  24, 112, 160, 160, 160, 168}},
+    {"Laptop",          -72, {  48, 112,  56, -32, -24,  16,  48,  96, 128, 144}},
+    {"Large Hall",      -52, { 104, 104,  56,  56,   0, -48, -48, -48,   0,   0}},
+    {"Live",            -28, { -48,   0,  40,  56,  56,  56,  40,  24,  24,  24}},
+    {"Party",           -36, {  72,  72,   0,   0,   0,   0,   0,   0,  72,  72}},
+    {"Pop",             -40, { -16,  48,  72,  80,  56,   0, -24, -24, -16, -16}},
+    {"Reggae",          -32, {   0,   0,   0, -56,   0,  64,  64,   0,   0,   0}},
+    {"Rock",            -56, {  80,  48, -56, -80, -32,  40,  88, 112, 112, 112}},
+    {"Ska",             -56, { -24, -48, -40,   0,  40,  56,  88,  96, 112,  96}},
+    {"Soft",            -60, {  48,  16,   0, -24,   0,  40,  80,  96, 112, 120}},
+    {"Soft Rock",       -44, {  40,  40,  24,   0, -40, -56, -32,   0,  24,  88}},
+    {"Techno",          -48, {  80,  56,   0, -56, -48,   0,  80,  96,  96,  88}},
+};
+const int eq_preset_count = sizeof(eq_presets) / sizeof(eq_presets[0]);
+
+// ---------- Fixed point layout ----------
+// Coefficients are Q29 (range +/-4, enough for +20 dB peaks). Samples are
+// carried between stages as int32 with 8 extra fractional bits so the
+// low-frequency bands do not drown in rounding noise.
+#define EQ_COEF_SHIFT 29
+#define EQ_SAMPLE_SHIFT 8
+#define EQ_PREAMP_SHIFT 12
+#define EQ_BAND_Q 1.41f // about one octave per band
+
+struct EqBiquad {
+    int32_t b0, b1, b2, a1, a2;
+};
+
+struct EqChannelState {
+    int32_t x1, x2, y1, y2;
+    int32_t err; // first-order error feedback of the Q29 truncation
+};
+
+// Settings written by the UI
+static int16_t eq_gains_db10[EQ_BANDS] = {0};
+static int16_t eq_preamp_db10 = 0;
+static int eq_preset_index = 0;
+static bool eq_settings_dirty = true;
+
+// Filters for one set of settings at one sample rate. The UI fills the bank
+// the audio task is not using and publishes it by index; the audio task
+// switches at the start of a block and clears the filter history then.
+struct EqBank {
+    EqBiquad coefs[EQ_BANDS];
+    uint8_t active[EQ_BANDS];
+    uint8_t active_count;
+    int32_t preamp_q;
+    int sample_rate;
+    bool active_flag;
+};
+static EqBank eq_banks[2];
+static volatile uint8_t eq_published = 0;    // UI: the newest bank
+static volatile uint8_t eq_live = 0;         // audio task: the bank in use
+static volatile int eq_wanted_rate = 0;      // audio task: the stream's rate
+
+// Audio task state
+static EqChannelState eq_state[EQ_BANDS][2];
+
+// Benchmark counters
+static volatile uint32_t eq_bench_cycles = 0;
+static volatile uint32_t eq_bench_frames = 0;
+
+void eq_set_preset(int index) {
+    if (index < 0 || index >= eq_preset_count) index = 0;
+    eq_preset_index = index;
+    eq_preamp_db10 = eq_presets[index].preamp_db10;
+    for (int i = 0; i < EQ_BANDS; i++) {
+        eq_gains_db10[i] = eq_presets[index].gains_db10[i];
+    }
+    eq_settings_dirty = true;
+    Serial.printf("[EQ] preset: %s\n", eq_presets[index].name);
+}
+
+int eq_get_preset() {
+    return eq_preset_index;
+}
+
+const char *eq_get_preset_name() {
+    return eq_presets[eq_preset_index].name;
+}
+
+void eq_set_band(int band, int16_t gain_db10) {
+    if (band < 0 || band >= EQ_BANDS) return;
+    eq_gains_db10[band] = constrain(gain_db10, (int16_t)-EQ_MAX_GAIN_DB10, (int16_t)EQ_MAX_GAIN_DB10);
+    eq_settings_dirty = true;
+}
+
+void eq_set_preamp(int16_t preamp_db10) {
+    eq_preamp_db10 = constrain(preamp_db10, (int16_t)-EQ_MAX_GAIN_DB10, (int16_t)EQ_MAX_GAIN_DB10);
+    eq_settings_dirty = true;
+}
+
+bool eq_is_active() {
+    return eq_banks[eq_live].active_flag;
+}
+
+static int32_t eq_to_q29(float v) {
+    return (int32_t)lrintf(v * (float)(1 << EQ_COEF_SHIFT));
+}
+
+// RBJ cookbook peaking filter, into a bank the audio task is not reading
+static void eq_compute_bank(EqBank &bank, int sample_rate) {
+    bank.active_count = 0;
+    for (int i = 0; i < EQ_BANDS; i++) {
+        int16_t gain = eq_gains_db10[i];
+        // Skip flat bands and bands that sit above ~0.45 fs (e.g. 16 kHz at 32 kHz)
+        if (gain == 0 || eq_band_centres[i] * 20 >= sample_rate * 9) {
+            continue;
+        }
+        float w0 = 2.0f * (float)M_PI * eq_band_centres[i] / sample_rate;
+        float alpha = sinf(w0) / (2.0f * EQ_BAND_Q);
+        float a = powf(10.0f, gain / 400.0f);
+        float cosw0 = cosf(w0);
+        float a0 = 1.0f + alpha / a;
+
+        EqBiquad &c = bank.coefs[i];
+        c.b0 = eq_to_q29((1.0f + alpha * a) / a0);
+        c.b1 = eq_to_q29((-2.0f * cosw0) / a0);
+        c.b2 = eq_to_q29((1.0f - alpha * a) / a0);
+        c.a1 = eq_to_q29((-2.0f * cosw0) / a0);
+        c.a2 = eq_to_q29((1.0f - alpha / a) / a0);
+        bank.active[bank.active_count++] = i;
+    }
+
+    bank.preamp_q = (int32_t)lrintf(powf(10.0f, eq_preamp_db10 / 200.0f) * (1 << EQ_PREAMP_SHIFT));
+    bank.sample_rate = sample_rate;
+    bank.active_flag = bank.active_count > 0 || eq_preamp_db10 != 0;
+}
+
+void eq_update() {
+    int rate = eq_wanted_rate;
+    if (rate <= 0) return;
+    if (!eq_settings_dirty && eq_banks[eq_published].sample_rate == rate) return;
+    // The spare bank may still be in use until the audio task has taken the
+    // last one published
+    if (eq_live != eq_published) return;
+    uint8_t spare = eq_published ^ 1;
+    eq_compute_bank(eq_banks[spare], rate);
+    eq_settings_dirty = false;
+    __sync_synchronize();
+    eq_published = spare;
+    Serial.printf("[EQ] coefficients updated: %d active bands @ %d Hz\n", eq_banks[spare].active_count, rate);
+}
+
+void eq_process(int16_t *pcm, size_t samples, int channels, int sample_rate) {
+    if (sample_rate != eq_wanted_rate) eq_wanted_rate = sample_rate;
+    if (eq_published != eq_live) {
+        // New filters: the old history would ring through them
+        memset(eq_state, 0, sizeof(eq_state));
+        eq_live = eq_published;
+    }
+    // Until eq_update() catches up with a new rate the old bank carries on;
+    // the bands sit a little off for a moment but stay stable
+    const EqBank &bank = eq_banks[eq_live];
+    if (!bank.active_flag || channels < 1 || channels > 2) {
+        return;
+    }
+
+    uint32_t start_cycles = ESP.getCycleCount();
+    const int32_t preamp = bank.preamp_q;
+
+    for (size_t n = 0; n < samples; n++) {
+        int ch = n % channels;
+        int32_t x = (pcm[n] * preamp) >> (EQ_PREAMP_SHIFT - EQ_SAMPLE_SHIFT);
+
+        for (int k = 0; k < bank.active_count; k++) {
+            const EqBiquad &c = bank.coefs[bank.active[k]];
+            EqChannelState &s = eq_state[bank.active[k]][ch];
+
+            int64_t acc = (int64_t)c.b0 * x + (int64_t)c.b1 * s.x1 + (int64_t)c.b2 * s.x2
+                        - (int64_t)c.a1 * s.y1 - (int64_t)c.a2 * s.y2 + s.err;
+            int32_t y = (int32_t)(acc >> EQ_COEF_SHIFT);
+            s.err = (int32_t)(acc & ((1 << EQ_COEF_SHIFT) - 1));
+
+            s.x2 = s.x1;
+            s.x1 = x;
+            s.y2 = s.y1;
+            s.y1 = y;
+            x = y;
+        }
+
+        x = (x + (1 << (EQ_SAMPLE_SHIFT - 1))) >> EQ_SAMPLE_SHIFT;
+        pcm[n] = (int16_t)constrain(x, (int32_t)-32768, (int32_t)32767);
+    }
+
+    eq_bench_cycles += ESP.getCycleCount() - start_cycles;
+    eq_bench_frames += samples / channels;
+}
+
+void eq_get_stats(EqStats &stats) {
+    uint32_t frames = eq_bench_frames;
+    stats.frames = frames;
+    stats.cycles_per_frame = frames ? eq_bench_cycles / frames : 0;
+    stats.active_bands = eq_banks[eq_live].active_count;
+}
+
+void eq_reset_stats() {
+    eq_bench_cycles = 0;
+    eq_bench_frames = 0;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <Arduino.h>
+
+// ---------- 10-band graphic equalizer ----------
+// Winamp style: ten peaking filters at the classic Winamp band centres,
+// +/-20 dB per band plus a preamp. Gains are stored in tenths of a dB.
+
+#define EQ_BANDS 10
+#define EQ_MAX_GAIN_DB10 200
+
+struct EqPreset {
+    const char *name;
+    int16_t preamp_db10;
+    int16_t gains_db10[EQ_BANDS];
+};
+
+extern const uint16_t eq_band_centres[EQ_BANDS];
+extern const EqPreset eq_presets[];
+extern const int eq_preset_count;
+
+// Settings (UI task; eq_update() turns them into filters)
+void eq_set_preset(int index);
+int eq_get_preset();
+const char *eq_get_preset_name();
+void eq_set_band(int band, int16_t gain_db10);
+void eq_set_preamp(int16_t preamp_db10);
+
+// UI task, every loop: computes the filters for changed settings or a new
+// stream sample rate off the audio path and hands them to the audio task,
+// which picks them up on its next block
+void eq_update();
+
+// Audio path: processes interleaved 16-bit PCM in place. Returns straight
+// away when every band is flat.
+void eq_process(int16_t *pcm, size_t samples, int channels, int sample_rate);
+bool eq_is_active();
+
+// Benchmark: average CPU cycles spent per stereo frame since the last reset
+struct EqStats {
+    uint32_t cycles_per_frame;
+    uint32_t frames;
+    uint8_t active_bands;
+};
+void eq_get_stats(EqStats &stats);
+void eq_reset_stats();
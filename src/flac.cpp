@@ -0,0 +1,579 @@
+#include "flac.h"
+
+static FlacStats flac_stats = {0, 0, 0, 0, 0};
+
+FlacStats flac_get_stats() {
+    return flac_stats;
+}
+
+void flac_reset_stats() {
+    flac_stats = {0, 0, 0, 0, 0};
+}
+
+// CRC-8 over the frame header, polynomial x^8 + x^2 + x + 1
+static uint8_t flac_crc8(const uint8_t *data, int len) {
+    uint8_t crc = 0;
+    for (int i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (int b = 0; b < 8; b++) {
+            crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+// CRC-16 over the whole frame, polynomial x^16 + x^15 + x^2 + 1, a table
+// byte at a time since it runs over every byte of the stream
+static uint16_t flac_crc16_table[256];
+static bool flac_crc16_ready = false;
+
+static void flac_crc16_init() {
+    for (int i = 0; i < 256; i++) {
+        uint16_t crc = i << 8;
+        for (int b = 0; b < 8; b++) {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x8005 : crc << 1;
+        }
+        flac_crc16_table[i] = crc;
+    }
+    flac_crc16_ready = true;
+}
+
+static inline uint16_t flac_crc16_byte(uint16_t crc, uint8_t byte) {
+    return (crc << 8) ^ flac_crc16_table[(crc >> 8) ^ byte];
+}
+
+// ---------- Stream ----------
+
+bool flac_read_info(File &file, uint32_t data_start, uint32_t data_end, FlacStreamInfo &info) {
+    file.seek(data_start);
+    uint8_t marker[4];
+    if (file.read(marker, 4) != 4 || memcmp(marker, "fLaC", 4) != 0) {
+        Serial.println("Not a FLAC stream");
+        return false;
+    }
+
+    bool have_info = false;
+    bool last = false;
+    while (!last) {
+        uint8_t header[4];
+        if (file.read(header, 4) != 4) return false;
+        last = header[0] & 0x80;
+        uint32_t length = (header[1] << 16) | (header[2] << 8) | header[3];
+        uint32_t next = file.position() + length;
+        if (next >= data_end) return false;
+
+        if ((header[0] & 0x7F) == 0 && length >= 34) {
+            uint8_t block[34];
+            if (file.read(block, 34) != 34) return false;
+            info.min_block_size = (block[0] << 8) | block[1];
+            info.max_block_size = (block[2] << 8) | block[3];
+            info.sample_rate = (block[10] << 12) | (block[11] << 4) | (block[12] >> 4);
+            info.channels = ((block[12] >> 1) & 7) + 1;
+            info.bits_per_sample = (((block[12] & 1) << 4) | (block[13] >> 4)) + 1;
+            info.total_samples = ((uint64_t)(block[13] & 0x0F) << 32) |
+                                 ((uint32_t)block[14] << 24) | (block[15] << 16) | (block[16] << 8) | block[17];
+            have_info = true;
+        }
+        file.seek(next);
+    }
+    if (!have_info) {
+        Serial.println("FLAC stream has no STREAMINFO");
+        return false;
+    }
+    info.first_frame = file.position();
+    return true;
+}
+
+// Header length up to and including the CRC-8, and the coded frame or
+// sample number; 0 if data does not start a plausible header
+static int flac_parse_frame_header(const uint8_t *data, int len, uint64_t &number) {
+    if (len < 16 || data[0] != 0xFF || (data[1] & 0xFE) != 0xF8) return 0;
+    int block_code = data[2] >> 4;
+    int rate_code = data[2] & 0x0F;
+    int assignment = data[3] >> 4;
+    int size_code = (data[3] >> 1) & 7;
+    if (block_code == 0 || rate_code == 15 || assignment > 10 || size_code == 3 || (data[3] & 1)) return 0;
+
+    // UTF-8 style: the leading ones say how many bytes follow
+    int pos = 4;
+    uint8_t first = data[pos++];
+    int extra = 0;
+    while (extra < 7 && (first & (0x40 >> extra))) extra++;
+    if (!(first & 0x80)) {
+        extra = 0;
+        number = first;
+    } else {
+        if (extra == 0 || extra > 6) return 0;
+        number = first & (0x3F >> extra);
+    }
+    for (int i = 0; i < extra; i++) {
+        if ((data[pos] & 0xC0) != 0x80) return 0;
+        number = (number << 6) | (data[pos++] & 0x3F);
+    }
+
+    if (block_code == 6) pos += 1;
+    else if (block_code == 7) pos += 2;
+    if (rate_code == 12) pos += 1;
+    else if (rate_code >= 13) pos += 2;
+    if (data[pos] != flac_crc8(data, pos)) return 0;
+    return pos + 1;
+}
+
+bool flac_find_frame(File &file, uint32_t position, uint32_t data_end, const FlacStreamInfo &info,
+                     uint32_t &offset, uint64_t &sample) {
+    uint8_t window[512];
+    if (position < info.first_frame) position = info.first_frame;
+    while (position + 16 <= data_end) {
+        file.seek(position);
+        int len = file.read(window, min((uint32_t)sizeof(window), data_end - position));
+        if (len < 16) return false;
+        // Candidates too close to the window's end are looked at in the next one
+        int i = 0;
+        for (; i + 16 <= len; i++) {
+            uint64_t number;
+            if (window[i] != 0xFF || !flac_parse_frame_header(window + i, len - i, number)) continue;
+            // Fixed-blocksize streams count frames, variable ones samples
+            sample = (window[i + 1] & 1) ? number : number * info.min_block_size;
+            if (info.total_samples && sample >= info.total_samples) continue;
+            offset = position + i;
+            return true;
+        }
+        position += i;
+    }
+    return false;
+}
+
+bool FlacCodec::open(File &file, uint32_t data_start, uint32_t data_end) {
+    close();
+    this->file = file;
+    this->data_start = data_start;
+    this->data_end = data_end;
+
+    if (!flac_crc16_ready) flac_crc16_init();
+    FlacStreamInfo info;
+    if (!flac_read_info(this->file, data_start, data_end, info)) return false;
+    max_block_size = info.max_block_size;
+    format.sample_rate = info.sample_rate;
+    format.channels = info.channels;
+    stream_bps = info.bits_per_sample;
+    uint64_t total_samples = info.total_samples;
+    if (format.channels > 2 || stream_bps < 4 || stream_bps > 24 ||
+        max_block_size < 16 || max_block_size > FLAC_MAX_BLOCK_SIZE) {
+        Serial.printf("Unsupported FLAC stream: %d channels, %d bit, blocks up to %u\n",
+                      format.channels, stream_bps, max_block_size);
+        return false;
+    }
+    first_frame = info.first_frame;
+    this->file.seek(first_frame);
+    if (!allocate()) {
+        return false;
+    }
+
+    format.bits_per_sample = stream_bps;
+    format.bitrate = total_samples ? (uint64_t)(data_end - first_frame) * 8 * format.sample_rate / total_samples : 0;
+    reset();
+    return true;
+}
+
+int32_t FlacCodec::decode(int16_t *pcm, int32_t max_frames) {
+    int32_t produced = 0;
+    int channels = format.channels;
+    while (produced < max_frames) {
+        if (block_pos >= block_size) {
+            if (!decode_frame()) break;
+            continue;
+        }
+
+        int32_t n = min((int32_t)(block_size - block_pos), max_frames - produced);
+        for (int ch = 0; ch < channels; ch++) {
+            const int32_t *src = samples[ch] + block_pos;
+            int16_t *dst = pcm + produced * channels + ch;
+            if (frame_bps > 16) {
+                int shift = frame_bps - 16;
+                for (int32_t i = 0; i < n; i++) dst[i * channels] = (int16_t)(src[i] >> shift);
+            } else {
+                int shift = 16 - frame_bps;
+                for (int32_t i = 0; i < n; i++) dst[i * channels] = (int16_t)(src[i] * (1 << shift));
+            }
+        }
+        block_pos += n;
+        produced += n;
+    }
+    return produced;
+}
+
+bool FlacCodec::seek(uint32_t position) {
+    if (position < first_frame) position = first_frame;
+    reset();
+    // decode() finds the next frame header from here
+    return file.seek(position);
+}
+
+void FlacCodec::reset() {
+    input_len = 0;
+    input_pos = 0;
+    bit_cache = 0;
+    bit_count = 0;
+    input_exhausted = false;
+    block_size = 0;
+    block_pos = 0;
+}
+
+void FlacCodec::close() {
+    reset();
+}
+
+// Sized for the largest stream accepted rather than this stream's STREAMINFO,
+// so the buffers never have to be reallocated for the next track
+bool FlacCodec::allocate() {
+    if (input) return true;
+    input = (uint8_t*)malloc(FLAC_INPUT_SIZE);
+    bool allocated = input != nullptr;
+    for (int ch = 0; ch < 2; ch++) {
+        samples[ch] = (int32_t*)malloc(FLAC_MAX_BLOCK_SIZE * sizeof(int32_t));
+        allocated = allocated && samples[ch] != nullptr;
+    }
+    if (!allocated) {
+        Serial.printf("Not enough heap for FLAC buffers (%u bytes)\n",
+                      (unsigned)(FLAC_INPUT_SIZE + 2 * FLAC_MAX_BLOCK_SIZE * sizeof(int32_t)));
+        release();
+        return false;
+    }
+    return true;
+}
+
+void FlacCodec::release() {
+    free(input);
+    input = nullptr;
+    for (int ch = 0; ch < 2; ch++) {
+        free(samples[ch]);
+        samples[ch] = nullptr;
+    }
+    reset();
+}
+
+bool FlacCodec::finished() {
+    return block_pos >= block_size && (input_exhausted || (input_pos >= input_len && bytes_left() == 0));
+}
+
+// ---------- Bit reader ----------
+
+bool FlacCodec::refill() {
+    uint32_t left = bytes_left();
+    int bytes_read = left ? file.read(input, min((uint32_t)FLAC_INPUT_SIZE, left)) : 0;
+    if (bytes_read <= 0) {
+        input_exhausted = true;
+        return false;
+    }
+    input_len = bytes_read;
+    input_pos = 0;
+    return true;
+}
+
+// Bytes are only pulled when a read needs them, so hitting the end of the
+// input always means the stream was cut short
+inline uint8_t FlacCodec::next_byte() {
+    if (input_pos >= input_len && !refill()) return 0;
+    uint8_t byte = input[input_pos++];
+    frame_crc = flac_crc16_byte(frame_crc, byte);
+    return byte;
+}
+
+inline uint32_t FlacCodec::read_bits(int bits) {
+    if (bits == 0) return 0;
+    while (bit_count < bits) {
+        bit_cache = (bit_cache << 8) | next_byte();
+        bit_count += 8;
+    }
+    bit_count -= bits;
+    return (uint32_t)(bit_cache >> bit_count) & (0xFFFFFFFFu >> (32 - bits));
+}
+
+inline int32_t FlacCodec::read_signed(int bits) {
+    if (bits == 0) return 0;
+    return (int32_t)(read_bits(bits) << (32 - bits)) >> (32 - bits);
+}
+
+// Counts zero bits up to and including the next one bit
+inline uint32_t FlacCodec::read_unary() {
+    uint32_t zeros = 0;
+    for (;;) {
+        if (bit_count == 0) {
+            bit_cache = next_byte();
+            bit_count = 8;
+            if (input_exhausted) return zeros;
+        }
+        uint32_t bits = (uint32_t)bit_cache & ((1u << bit_count) - 1);
+        if (bits == 0) {
+            zeros += bit_count;
+            bit_count = 0;
+            continue;
+        }
+        int top = 31 - __builtin_clz(bits);
+        zeros += bit_count - 1 - top;
+        bit_count = top;
+        return zeros;
+    }
+}
+
+// ---------- Frames ----------
+
+// Finds the next frame and parses its header. Candidates whose CRC-8 does
+// not match are skipped, which is also how decoding resyncs after a seek.
+bool FlacCodec::read_frame_header() {
+    static const uint32_t rates[12] = {0, 88200, 176400, 192000, 8000, 16000,
+                                       22050, 24000, 32000, 44100, 48000, 96000};
+    static const int sizes[8] = {0, 8, 12, 0, 16, 20, 24, 32};
+
+    align_to_byte();
+    uint32_t previous = 0;
+    for (;;) {
+        uint32_t byte = read_bits(8);
+        if (input_exhausted) return false;
+        if (previous != 0xFF || (byte & 0xFE) != 0xF8) {
+            previous = byte;
+            continue;
+        }
+        previous = 0;
+
+        uint8_t header[16] = {0xFF, (uint8_t)byte};
+        int len = 2;
+        header[len++] = read_bits(8);
+        header[len++] = read_bits(8);
+        int block_code = header[2] >> 4;
+        int rate_code = header[2] & 0x0F;
+        int assignment = header[3] >> 4;
+        int size_code = (header[3] >> 1) & 7;
+        if (block_code == 0 || rate_code == 15 || assignment > 10 || size_code == 3 || (header[3] & 1)) {
+            continue;
+        }
+
+        // Frame or sample number, UTF-8 style; only its length matters
+        uint8_t first = read_bits(8);
+        header[len++] = first;
+        int extra = 0;
+        while (extra < 7 && (first & (0x40 >> extra))) extra++;
+        if ((first & 0x80) && (extra == 0 || extra > 6)) continue;
+        if (!(first & 0x80)) extra = 0;
+        for (int i = 0; i < extra; i++) header[len++] = read_bits(8);
+
+        uint32_t size = 0;
+        if (block_code == 1) size = 192;
+        else if (block_code <= 5) size = 576 << (block_code - 2);
+        else if (block_code == 6) size = (header[len++] = read_bits(8)) + 1;
+        else if (block_code == 7) {
+            header[len++] = read_bits(8);
+            header[len++] = read_bits(8);
+            size = ((header[len - 2] << 8) | header[len - 1]) + 1;
+        } else size = 256 << (block_code - 8);
+
+        if (rate_code == 12) header[len++] = read_bits(8);
+        else if (rate_code >= 13) {
+            header[len++] = read_bits(8);
+            header[len++] = read_bits(8);
+        }
+
+        uint8_t crc = read_bits(8);
+        if (input_exhausted) return false;
+        if (crc != flac_crc8(header, len)) continue;
+        // From here every byte read goes into the frame's CRC-16
+        header[len++] = crc;
+        frame_crc = 0;
+        for (int i = 0; i < len; i++) frame_crc = flac_crc16_byte(frame_crc, header[i]);
+
+        int channels = assignment < 8 ? assignment + 1 : 2;
+        int bps = size_code == 0 ? stream_bps : sizes[size_code];
+        if (channels != format.channels || size > max_block_size || bps > 24) {
+            flac_stats.errors++;
+            continue;
+        }
+        if (rate_code >= 1 && rate_code < 12 && rates[rate_code] != (uint32_t)format.sample_rate) {
+            flac_stats.errors++;
+            continue;
+        }
+
+        block_size = size;
+        block_pos = 0;
+        frame_channels = channels;
+        channel_assignment = assignment;
+        frame_bps = bps;
+        return true;
+    }
+}
+
+// Decodes one frame into samples[]. Returns false only when the input is
+// used up; a damaged frame is counted and skipped.
+bool FlacCodec::decode_frame() {
+    uint32_t start_cycles = ESP.getCycleCount();
+    if (!read_frame_header()) {
+        block_size = 0;
+        block_pos = 0;
+        return false;
+    }
+
+    for (int ch = 0; ch < frame_channels; ch++) {
+        // The side channel carries one extra bit
+        int bps = frame_bps;
+        if ((channel_assignment == 8 && ch == 1) || (channel_assignment == 9 && ch == 0) ||
+            (channel_assignment == 10 && ch == 1)) {
+            bps++;
+        }
+        if (!decode_subframe(ch, bps) || input_exhausted) {
+            flac_stats.errors++;
+            block_size = 0;
+            block_pos = 0;
+            return !input_exhausted;
+        }
+    }
+
+    // Undo the stereo decorrelation
+    int32_t *a = samples[0];
+    int32_t *b = samples[1];
+    switch (channel_assignment) {
+        case 8: // left, side
+            for (uint32_t i = 0; i < block_size; i++) b[i] = a[i] - b[i];
+            break;
+        case 9: // side, right
+            for (uint32_t i = 0; i < block_size; i++) a[i] += b[i];
+            break;
+        case 10: // mid, side
+            for (uint32_t i = 0; i < block_size; i++) {
+                int32_t side = b[i];
+                int32_t mid = a[i] * 2 + (side & 1);
+                a[i] = (mid + side) >> 1;
+                b[i] = (mid - side) >> 1;
+            }
+            break;
+    }
+
+    // Footer: CRC-16 of the frame. Reads never leave whole bytes in the bit
+    // cache, so once aligned frame_crc covers exactly the frame so far.
+    // A damaged frame is played as silence of the same length, like a
+    // damaged MP3 frame.
+    align_to_byte();
+    uint16_t expected = frame_crc;
+    if (read_bits(16) != expected && !input_exhausted) {
+        flac_stats.errors++;
+        for (int ch = 0; ch < frame_channels; ch++) memset(samples[ch], 0, block_size * sizeof(int32_t));
+    }
+
+    uint32_t cycles = ESP.getCycleCount() - start_cycles;
+    flac_stats.blocks++;
+    if ((uint64_t)cycles * flac_stats.worst_block_size >= (uint64_t)flac_stats.worst_cycles * block_size) {
+        // Worst per sample, so short blocks do not hide behind long ones
+        flac_stats.worst_cycles = cycles;
+        flac_stats.worst_block_size = block_size;
+        flac_stats.worst_sample_rate = format.sample_rate;
+    }
+    return true;
+}
+
+bool FlacCodec::decode_subframe(int channel, int bps) {
+    int32_t *out = samples[channel];
+    if (read_bits(1) != 0) return false;
+    uint32_t type = read_bits(6);
+    int wasted = 0;
+    if (read_bits(1)) {
+        wasted = read_unary() + 1;
+        bps -= wasted;
+    }
+    if (bps <= 0) return false;
+
+    if (type == 0) {
+        // Constant
+        int32_t value = read_signed(bps);
+        for (uint32_t i = 0; i < block_size; i++) out[i] = value;
+    } else if (type == 1) {
+        // Verbatim
+        for (uint32_t i = 0; i < block_size; i++) out[i] = read_signed(bps);
+    } else if (type >= 8 && type <= 12) {
+        // Fixed polynomial predictor
+        int order = type - 8;
+        if ((uint32_t)order > block_size) return false;
+        for (int i = 0; i < order; i++) out[i] = read_signed(bps);
+        if (!decode_residual(out, order)) return false;
+        switch (order) {
+            case 1:
+                for (uint32_t i = 1; i < block_size; i++) out[i] += out[i - 1];
+                break;
+            case 2:
+                for (uint32_t i = 2; i < block_size; i++) out[i] += 2 * out[i - 1] - out[i - 2];
+                break;
+            case 3:
+                for (uint32_t i = 3; i < block_size; i++) out[i] += 3 * (out[i - 1] - out[i - 2]) + out[i - 3];
+                break;
+            case 4:
+                for (uint32_t i = 4; i < block_size; i++) {
+                    out[i] += 4 * (out[i - 1] + out[i - 3]) - 6 * out[i - 2] - out[i - 4];
+                }
+                break;
+        }
+    } else if (type >= 32) {
+        // Linear predictor
+        int order = type - 31;
+        if ((uint32_t)order > block_size) return false;
+        for (int i = 0; i < order; i++) out[i] = read_signed(bps);
+        int precision = read_bits(4) + 1;
+        int shift = read_signed(5);
+        if (precision == 16 || shift < 0) return false;
+        int32_t coefs[32];
+        for (int j = 0; j < order; j++) coefs[j] = read_signed(precision);
+        if (!decode_residual(out, order)) return false;
+
+        int order_bits = 32 - __builtin_clz(order);
+        if (bps + precision + order_bits <= 32) {
+            // 16-bit sources: the sum always fits 32 bits
+            for (uint32_t i = order; i < block_size; i++) {
+                int32_t sum = 0;
+                const int32_t *history = out + i;
+                for (int j = 0; j < order; j++) sum += coefs[j] * history[-j - 1];
+                out[i] += sum >> shift;
+            }
+        } else {
+            for (uint32_t i = order; i < block_size; i++) {
+                int64_t sum = 0;
+                const int32_t *history = out + i;
+                for (int j = 0; j < order; j++) sum += (int64_t)coefs[j] * history[-j - 1];
+                out[i] += (int32_t)(sum >> shift);
+            }
+        }
+    } else {
+        return false; // reserved
+    }
+
+    if (wasted) {
+        for (uint32_t i = 0; i < block_size; i++) out[i] *= 1 << wasted;
+    }
+    return true;
+}
+
+// Partitioned Rice residual, written after the warm-up samples
+bool FlacCodec::decode_residual(int32_t *out, int predictor_order) {
+    uint32_t method = read_bits(2);
+    if (method > 1) return false;
+    int param_bits = method == 0 ? 4 : 5;
+    uint32_t escape = method == 0 ? 15 : 31;
+
+    int partition_order = read_bits(4);
+    uint32_t partition_size = block_size >> partition_order;
+    if ((partition_size << partition_order) != block_size || partition_size < (uint32_t)predictor_order) {
+        return false;
+    }
+
+    int32_t *dst = out + predictor_order;
+    for (uint32_t p = 0; p < (1u << partition_order); p++) {
+        uint32_t count = p == 0 ? partition_size - predictor_order : partition_size;
+        uint32_t param = read_bits(param_bits);
+        if (param == escape) {
+            int raw_bits = read_bits(5);
+            for (uint32_t i = 0; i < count; i++) *dst++ = read_signed(raw_bits);
+        } else {
+            for (uint32_t i = 0; i < count; i++) {
+                uint32_t value = (read_unary() << param) | read_bits(param);
+                *dst++ = (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+            }
+        }
+        if (input_exhausted) return false;
+    }
+    return true;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "codec.h"
+
+// ---------- FLAC ----------
+// Small fixed-point FLAC decoder. The file is read through a 4 KB window and
+// decoded straight from there bit by bit, so no whole frame is ever held in
+// memory; the only other allocation is one block of 32-bit samples per
+// channel, sized for the largest block accepted so it can be kept from track
+// to track. Mono and stereo up to 24 bits are played, anything else is
+// refused at open().
+
+// Largest block accepted; the FLAC subset limit for rates up to 48 kHz
+#define FLAC_MAX_BLOCK_SIZE 4608
+#define FLAC_INPUT_SIZE 4096
+
+// Worst case seen since the last reset, for the real-time budget log
+struct FlacStats {
+    uint32_t worst_cycles;      // cycles for the slowest block
+    uint32_t worst_block_size;  // samples per channel in that block
+    uint32_t worst_sample_rate;
+    uint32_t blocks;
+    uint32_t errors;            // frames dropped for bad headers or residuals, or silenced for a bad CRC-16
+};
+
+FlacStats flac_get_stats();
+void flac_reset_stats();
+
+// STREAMINFO, and where the first frame starts
+struct FlacStreamInfo {
+    uint32_t min_block_size;
+    uint32_t max_block_size;
+    uint32_t sample_rate;
+    int channels;
+    int bits_per_sample;
+    uint64_t total_samples; // 0 when the encoder did not know
+    uint32_t first_frame;
+};
+
+// Reads the metadata blocks from data_start; only STREAMINFO matters, the
+// rest (pictures, seek tables, comments) is seeked over
+bool flac_read_info(File &file, uint32_t data_start, uint32_t data_end, FlacStreamInfo &info);
+
+// The first frame header at or after position, checked by its CRC-8 like the
+// decoder does, and the number of its first sample. Lets CUE tracks be found
+// by bisecting the file instead of decoding it.
+bool flac_find_frame(File &file, uint32_t position, uint32_t data_end, const FlacStreamInfo &info,
+                     uint32_t &offset, uint64_t &sample);
+
+class FlacCodec : public Codec {
+public:
+    const char *name() const override { return "FLAC"; }
+    bool open(File &file, uint32_t data_start, uint32_t data_end) override;
+    int32_t decode(int16_t *pcm, int32_t max_frames) override;
+    bool seek(uint32_t position) override;
+    void reset() override;
+    void close() override;
+    bool allocate() override;
+    void release() override;
+    bool finished() override;
+
+private:
+    // Input
+    bool refill();
+    inline uint8_t next_byte();
+    inline uint32_t read_bits(int bits);
+    inline int32_t read_signed(int bits);
+    inline uint32_t read_unary();
+    void align_to_byte() { bit_count -= bit_count & 7; }
+
+    // Frames
+    bool read_frame_header();
+    bool decode_frame();
+    bool decode_subframe(int channel, int bps);
+    bool decode_residual(int32_t *out, int predictor_order);
+
+    uint8_t *input = nullptr;
+    uint32_t input_len = 0;
+    uint32_t input_pos = 0;
+    uint64_t bit_cache = 0;
+    int bit_count = 0;
+    bool input_exhausted = false;
+
+    int32_t *samples[2] = {nullptr, nullptr};
+    uint32_t max_block_size = 0;
+    int stream_bps = 0;
+    uint32_t first_frame = 0;
+
+    // Current frame
+    uint32_t block_size = 0;
+    uint32_t block_pos = 0;
+    int frame_channels = 0;
+    int channel_assignment = 0;
+    int frame_bps = 0;
+    uint16_t frame_crc = 0; // CRC-16 of the frame's bytes read so far
+};
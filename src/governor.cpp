@@ -0,0 +1,91 @@
+#include "governor.h"
+#include "jitter.h"
+
+static const char *governor_level_names[GOV_LEVEL_COUNT] = {
+    "full", "slow ui", "no marquee", "no effects", "audio only"
+};
+
+// Ring low water (% of the jitter target) below which each level starts
+static const uint8_t governor_ring_percent[GOV_LEVEL_COUNT] = {100, 60, 45, 30, 15};
+// Decode load (% of a core) above which each level starts
+static const uint8_t governor_load_percent[GOV_LEVEL_COUNT] = {0, 50, 60, 70, 80};
+
+static volatile GovernorLevel level = GOV_FULL;
+static unsigned long last_update = 0;
+static unsigned long healthy_since = 0; // 0 while the target is at or above the level
+static uint32_t changes = 0;
+static uint32_t entered[GOV_LEVEL_COUNT];
+
+static GovernorLevel governor_target(uint32_t ring_percent, int decode_load) {
+    int target = GOV_FULL;
+    for (int i = GOV_LEVEL_COUNT - 1; i > GOV_FULL; i--) {
+        if (ring_percent < governor_ring_percent[i] || decode_load > governor_load_percent[i]) {
+            target = i;
+            break;
+        }
+    }
+    return (GovernorLevel)target;
+}
+
+static void governor_set(GovernorLevel next, uint32_t ring_low, int decode_load, uint32_t underruns) {
+    changes++;
+    entered[next]++;
+    Serial.printf("[Governor] %s -> %s: ring low %u/%u, decode %d%%, %u underruns so far (change %u, entered %u times)\n",
+                  governor_level_names[level], governor_level_names[next], ring_low, jitter_target_frames(),
+                  decode_load, underruns, changes, entered[next]);
+    level = next;
+}
+
+void governor_update(int decode_load, uint32_t underruns) {
+    unsigned long now = millis();
+    if (now - last_update < GOVERNOR_INTERVAL_MS) return;
+    last_update = now;
+
+    uint32_t ring_low = jitter_take_low_water();
+    GovernorLevel target = governor_target(min(ring_low, jitter_target_frames()) * 100 / jitter_target_frames(), decode_load);
+    if (target > level) {
+        governor_set(target, ring_low, decode_load, underruns);
+        healthy_since = 0;
+    } else if (target < level) {
+        if (healthy_since == 0) {
+            healthy_since = now;
+        } else if (now - healthy_since >= GOVERNOR_RECOVER_MS) {
+            governor_set((GovernorLevel)(level - 1), ring_low, decode_load, underruns);
+            healthy_since = now;
+        }
+    } else {
+        healthy_since = 0;
+    }
+}
+
+GovernorLevel governor_level() {
+    return level;
+}
+
+uint32_t governor_ui_interval_ms() {
+    return level >= GOV_SLOW_UI ? GOVERNOR_SLOW_UI_MS : GOVERNOR_UI_MS;
+}
+
+bool governor_marquee_enabled() {
+    return level < GOV_NO_MARQUEE;
+}
+
+bool governor_effects_enabled() {
+    return level < GOV_NO_EFFECTS;
+}
+
+bool governor_background_allowed() {
+    return level < GOV_AUDIO_ONLY;
+}
+
+void governor_wait(AppTask task) {
+    while (!governor_background_allowed()) {
+        task_busy_end(task);
+        vTaskDelay(pdMS_TO_TICKS(GOVERNOR_WAIT_MS));
+        task_busy_begin(task);
+    }
+}
+
+void governor_yield() {
+    if (!governor_background_allowed()) vTaskDelay(pdMS_TO_TICKS(GOVERNOR_YIELD_MS));
+}
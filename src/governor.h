@@ -0,0 +1,52 @@
+#pragma once
+
+#include <Arduino.h>
+#include "tasks.h"
+
+// ---------- Governor ----------
+// Sheds optional work while audio is in danger. Two signals: the lowest
+// depth the PCM ring reached while a track was decoding, and the decode
+// task's share of its core. The worse of the two picks a level; each level
+// drops one more kind of work, in this order:
+//   1 slow ui     the UI loop redraws every GOVERNOR_SLOW_UI_MS
+//   2 no marquee  long titles are truncated instead of scrolling
+//   3 no effects  the spectrum analyzer stops
+//   4 audio only  background work (session saves, prefetch, cover art,
+//                 library and tag index builds) waits; card reads the UI
+//                 is waiting on (playlist and CUE resolution) slow down
+// Levels go up at once and come down one at a time after
+// GOVERNOR_RECOVER_MS of headroom. Every change is logged with the
+// underruns so far, to check that shedding starts before audio breaks up.
+
+#define GOVERNOR_INTERVAL_MS 500
+#define GOVERNOR_RECOVER_MS 3000
+#define GOVERNOR_UI_MS 120
+#define GOVERNOR_SLOW_UI_MS 250
+#define GOVERNOR_WAIT_MS 250     // recheck while a background task is held back
+#define GOVERNOR_YIELD_MS 10     // pause per step of UI card reads while held back
+
+enum GovernorLevel {
+    GOV_FULL,
+    GOV_SLOW_UI,
+    GOV_NO_MARQUEE,
+    GOV_NO_EFFECTS,
+    GOV_AUDIO_ONLY,
+    GOV_LEVEL_COUNT
+};
+
+// decode_load: % of one core spent decoding and in the EQ
+void governor_update(int decode_load, uint32_t underruns);
+GovernorLevel governor_level();
+
+uint32_t governor_ui_interval_ms();
+bool governor_marquee_enabled();
+bool governor_effects_enabled();
+bool governor_background_allowed();
+
+// Between steps of a background scan or build on task: returns once
+// background work is allowed again
+void governor_wait(AppTask task);
+// Between steps of card reads the UI asked for: a short pause while
+// background work is held back, so the decode task gets the card without
+// the UI stalling for good
+void governor_yield();
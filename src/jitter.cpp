@@ -0,0 +1,129 @@
+#include "jitter.h"
+#include "pcmring.h"
+
+static volatile uint32_t target = JITTER_START_FRAMES;
+static volatile uint32_t underruns = 0;
+static volatile uint32_t gap_frames = 0;
+static volatile uint32_t low_water = PCM_RING_FRAMES;
+
+// Reader only
+static bool buffering = true;
+static bool fade_in = false;
+static uint32_t last_flushes = 0;
+static uint32_t period_frames = 0;
+static uint32_t period_low = PCM_RING_FRAMES;
+static uint32_t period_underruns = 0;
+static uint32_t quiet_periods = 0;
+
+static uint32_t logged_target = JITTER_START_FRAMES;
+
+static void ramp(Frame *frames, int32_t count, bool up) {
+    for (int32_t i = 0; i < count; i++) {
+        int32_t gain = up ? i + 1 : count - i;
+        frames[i].channel1 = frames[i].channel1 * gain / (count + 1);
+        frames[i].channel2 = frames[i].channel2 * gain / (count + 1);
+    }
+}
+
+static void grow(uint32_t frames) {
+    target = min((uint32_t)PCM_RING_FRAMES, target + frames);
+    quiet_periods = 0;
+}
+
+// Once per period: grow on a close call, shrink after enough quiet ones
+static void adapt() {
+    if (period_underruns == 0) {
+        if (period_low < target / 8) {
+            grow(JITTER_STEP_FRAMES);
+        } else if (period_low > target / 2 && ++quiet_periods >= JITTER_SHRINK_PERIODS) {
+            target = max((uint32_t)JITTER_MIN_FRAMES, target - JITTER_STEP_FRAMES);
+            quiet_periods = 0;
+        }
+    }
+    period_frames = 0;
+    period_low = PCM_RING_FRAMES;
+    period_underruns = 0;
+}
+
+int32_t jitter_read(Frame *frames, int32_t count, bool &underrun) {
+    underrun = false;
+    pcm_ring_read(frames, 0); // applies a pending flush
+    uint32_t flushes = pcm_ring_flushes();
+    if (flushes != last_flushes) {
+        last_flushes = flushes;
+        buffering = true;
+        fade_in = false;
+    }
+
+    uint32_t depth = pcm_ring_depth();
+    bool streaming = pcm_ring_streaming();
+    if (buffering) {
+        // Decoding fills up to the target a chunk at a time; the end of a
+        // track plays out whatever is left
+        if (depth + JITTER_STEP_FRAMES > target || (!streaming && depth > 0)) {
+            buffering = false;
+        } else {
+            if (fade_in) gap_frames += count; // still recovering from an underrun
+            memset(frames, 0, count * sizeof(Frame));
+            return 0;
+        }
+    }
+
+    // Running dry mid-track is called a read early, while there are still
+    // frames left to fade out; the ones not read play after the gap
+    bool dry = streaming && depth < (uint32_t)count + JITTER_FADE_FRAMES;
+    int32_t got = pcm_ring_read(frames, count);
+    if (fade_in && got > 0) {
+        ramp(frames, min(got, (int32_t)JITTER_FADE_FRAMES), true);
+        fade_in = false;
+    }
+    if (dry || got < count) {
+        if (dry) {
+            // Fade what we have, then wait for the target
+            int32_t fade = min(got, (int32_t)JITTER_FADE_FRAMES);
+            ramp(frames + got - fade, fade, false);
+            underrun = true;
+            underruns++;
+            period_underruns++;
+            gap_frames += count - got;
+            buffering = true;
+            fade_in = true;
+            grow(JITTER_GROW_FRAMES);
+        }
+        memset(frames + got, 0, (count - got) * sizeof(Frame));
+    } else if (streaming) {
+        depth = pcm_ring_depth();
+        if (depth < period_low) period_low = depth;
+        if (depth < low_water) low_water = depth;
+    }
+
+    period_frames += count;
+    if (period_frames >= JITTER_PERIOD_FRAMES) adapt();
+    return got;
+}
+
+uint32_t jitter_target_frames() {
+    return target;
+}
+
+uint32_t jitter_underruns() {
+    return underruns;
+}
+
+uint32_t jitter_gap_frames() {
+    return gap_frames;
+}
+
+uint32_t jitter_take_low_water() {
+    uint32_t low = low_water;
+    low_water = PCM_RING_FRAMES;
+    return low;
+}
+
+void jitter_log() {
+    uint32_t now = target;
+    if (now == logged_target) return;
+    Serial.printf("[Jitter] target %u -> %u frames (%u ms), %u underruns, %u frames concealed\n",
+                  logged_target, now, now * 1000 / 44100, underruns, gap_frames);
+    logged_target = now;
+}
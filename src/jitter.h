@@ -0,0 +1,39 @@
+#pragma once
+
+#include <Arduino.h>
+#include <BluetoothA2DPSource.h>
+
+// ---------- Jitter buffer ----------
+// The sink side of the PCM ring. Every read hands the sink the full count
+// it asked for, so what happens on a gap is up to us, not the BT library:
+// the last frames before it fade out, the gap is silence, and playback
+// only resumes, fading in, once the ring is back at its target depth. The
+// same wait happens after a flush, without the fade, so a new track starts
+// with a full reserve.
+//
+// The target is also how far ahead the decode task fills. It grows with
+// every underrun and with close calls (the ring nearly running dry on a
+// slow card), and shrinks again after a few quiet periods. "[Jitter]" log
+// lines show each change with the underrun count, to tune the limits per
+// card and speaker.
+
+#define JITTER_MIN_FRAMES 1024
+#define JITTER_START_FRAMES 2048
+#define JITTER_STEP_FRAMES 256       // no smaller than a decode chunk
+#define JITTER_GROW_FRAMES 512       // per underrun
+#define JITTER_FADE_FRAMES 64        // ~1.5 ms ramps either side of a gap
+#define JITTER_PERIOD_FRAMES 441000  // adapts once per ~10 s of output
+#define JITTER_SHRINK_PERIODS 3      // quiet periods before the target shrinks
+
+// Fills all count frames. Returns how many came from the ring; underrun is
+// set when the ring ran dry in the middle of a track.
+int32_t jitter_read(Frame *frames, int32_t count, bool &underrun);
+
+uint32_t jitter_target_frames();
+uint32_t jitter_underruns();
+uint32_t jitter_gap_frames();      // silence put in mid-track so far
+// Lowest depth while playing steadily since the last call
+uint32_t jitter_take_low_water();
+
+// Logs target changes; call from loop()
+void jitter_log();
@@ -0,0 +1,480 @@
+#include "jpeg.h"
+
+#define JPEG_MAX_COMPONENTS 3
+#define JPEG_MAX_TABLES 4
+
+static const uint8_t jpeg_zigzag[64] = {
+     0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+// cos((2x + 1) u pi / 16) with C(0) = 1/sqrt(2), in 1/2048, filled once
+static int16_t jpeg_idct_table[8][8];
+static bool jpeg_idct_ready = false;
+
+struct JpegHuffman {
+    bool present;
+    uint8_t values[256];
+    int32_t max_code[17]; // -1 when no code has this length
+    int32_t min_code[17];
+    int16_t value_index[17];
+};
+
+struct JpegComponent {
+    uint8_t id;
+    uint8_t h, v;
+    uint8_t quant;
+    uint8_t dc_table, ac_table;
+    int dc_pred;
+};
+
+struct JpegDecoder {
+    // Buffered reader over [pos, end)
+    File *file;
+    uint32_t pos, end;
+    uint8_t buf[JPEG_READ_CHUNK];
+    uint16_t buf_len, buf_pos;
+
+    // Entropy-coded bits
+    uint32_t bits;
+    int bit_count;
+    int marker;         // a marker met inside entropy data, 0 if none
+    int pending_marker; // read past by a skipped scan, for the marker loop
+
+    uint16_t quant[JPEG_MAX_TABLES][64]; // zigzag order, as in the file
+    JpegHuffman dc[JPEG_MAX_TABLES];
+    JpegHuffman ac[JPEG_MAX_TABLES];
+    JpegComponent comps[JPEG_MAX_COMPONENTS];
+    int comp_count;
+    int width, height;
+    int h_max, v_max;
+    int restart_interval;
+    bool frame_seen;
+
+    // Thumbnail accumulators
+    int out_w, out_h;
+    bool dc_only;
+    uint32_t *sum;
+    uint16_t *count;
+};
+
+// ---------- Reading ----------
+
+static int jpeg_byte(JpegDecoder &d) {
+    if (d.buf_pos == d.buf_len) {
+        if (d.pos >= d.end) return -1;
+        uint32_t n = min((uint32_t)JPEG_READ_CHUNK, d.end - d.pos);
+        d.file->seek(d.pos);
+        d.buf_len = d.file->read(d.buf, n);
+        d.buf_pos = 0;
+        d.pos += d.buf_len;
+        if (d.buf_len == 0) return -1;
+    }
+    return d.buf[d.buf_pos++];
+}
+
+static int jpeg_u16(JpegDecoder &d) {
+    int hi = jpeg_byte(d);
+    int lo = jpeg_byte(d);
+    return hi < 0 || lo < 0 ? -1 : (hi << 8) | lo;
+}
+
+static bool jpeg_skip(JpegDecoder &d, int n) {
+    while (n-- > 0) {
+        if (jpeg_byte(d) < 0) return false;
+    }
+    return true;
+}
+
+// Next marker code, past fill bytes and stuffed 0xFF 0x00 pairs; -1 at
+// the end of the data
+static int jpeg_next_marker(JpegDecoder &d) {
+    int c;
+    do {
+        do {
+            c = jpeg_byte(d);
+        } while (c >= 0 && c != 0xFF);
+        while (c == 0xFF) c = jpeg_byte(d);
+    } while (c == 0);
+    return c;
+}
+
+// Entropy data: a stuffed 0xFF 0x00 is a data byte, any other marker ends
+// the data and reads as zero bits until it is dealt with
+static void jpeg_fill_bits(JpegDecoder &d) {
+    while (d.bit_count <= 24) {
+        int c = 0;
+        if (!d.marker) {
+            c = jpeg_byte(d);
+            if (c < 0) {
+                d.marker = 0xD9;
+                c = 0;
+            } else if (c == 0xFF) {
+                int next = jpeg_byte(d);
+                while (next == 0xFF) next = jpeg_byte(d);
+                if (next != 0) {
+                    d.marker = next < 0 ? 0xD9 : next;
+                    c = 0;
+                }
+            }
+        }
+        d.bits |= (uint32_t)c << (24 - d.bit_count);
+        d.bit_count += 8;
+    }
+}
+
+static int jpeg_bits(JpegDecoder &d, int n) {
+    if (n == 0) return 0;
+    jpeg_fill_bits(d);
+    int value = d.bits >> (32 - n);
+    d.bits <<= n;
+    d.bit_count -= n;
+    return value;
+}
+
+// A magnitude category t and its t extra bits to a signed value
+static int jpeg_extend(int value, int t) {
+    return t && value < (1 << (t - 1)) ? value - (1 << t) + 1 : value;
+}
+
+static int jpeg_decode_huffman(JpegDecoder &d, const JpegHuffman &table) {
+    jpeg_fill_bits(d);
+    int32_t code = 0;
+    for (int length = 1; length <= 16; length++) {
+        code = (code << 1) | (d.bits >> 31);
+        d.bits <<= 1;
+        d.bit_count--;
+        if (code <= table.max_code[length]) {
+            return table.values[table.value_index[length] + code - table.min_code[length]];
+        }
+    }
+    return -1; // no such code: damaged data
+}
+
+// ---------- Marker segments ----------
+
+static bool jpeg_read_dqt(JpegDecoder &d, int length) {
+    while (length > 0) {
+        int pq_tq = jpeg_byte(d);
+        if (pq_tq < 0 || (pq_tq & 15) >= JPEG_MAX_TABLES) return false;
+        bool wide = pq_tq >> 4;
+        uint16_t *table = d.quant[pq_tq & 15];
+        for (int i = 0; i < 64; i++) {
+            int q = wide ? jpeg_u16(d) : jpeg_byte(d);
+            if (q < 0) return false;
+            table[i] = q;
+        }
+        length -= 1 + (wide ? 128 : 64);
+    }
+    return length == 0;
+}
+
+static bool jpeg_read_dht(JpegDecoder &d, int length) {
+    while (length > 0) {
+        int tc_th = jpeg_byte(d);
+        if (tc_th < 0 || (tc_th & 15) >= JPEG_MAX_TABLES || (tc_th >> 4) > 1) return false;
+        JpegHuffman &table = (tc_th >> 4) ? d.ac[tc_th & 15] : d.dc[tc_th & 15];
+        uint8_t counts[17];
+        int total = 0;
+        for (int i = 1; i <= 16; i++) {
+            int n = jpeg_byte(d);
+            if (n < 0) return false;
+            counts[i] = n;
+            total += n;
+        }
+        if (total > 256) return false;
+        for (int i = 0; i < total; i++) {
+            int value = jpeg_byte(d);
+            if (value < 0) return false;
+            table.values[i] = value;
+        }
+        // Canonical codes: consecutive within a length, doubling to the next
+        int32_t code = 0;
+        int index = 0;
+        for (int i = 1; i <= 16; i++) {
+            table.value_index[i] = index;
+            table.min_code[i] = code;
+            code += counts[i];
+            index += counts[i];
+            table.max_code[i] = counts[i] ? code - 1 : -1;
+            code <<= 1;
+        }
+        table.present = true;
+        length -= 17 + total;
+    }
+    return length == 0;
+}
+
+static bool jpeg_read_sof(JpegDecoder &d) {
+    int precision = jpeg_byte(d);
+    d.height = jpeg_u16(d);
+    d.width = jpeg_u16(d);
+    d.comp_count = jpeg_byte(d);
+    if (precision != 8 || d.width <= 0 || d.height <= 0 || d.width > JPEG_MAX_DIMENSION ||
+        d.height > JPEG_MAX_DIMENSION || (d.comp_count != 1 && d.comp_count != 3)) {
+        return false;
+    }
+    d.h_max = d.v_max = 1;
+    for (int i = 0; i < d.comp_count; i++) {
+        JpegComponent &c = d.comps[i];
+        c.id = jpeg_byte(d);
+        int hv = jpeg_byte(d);
+        int q = jpeg_byte(d);
+        c.h = hv >> 4;
+        c.v = hv & 15;
+        c.quant = q;
+        if (hv < 0 || c.h < 1 || c.h > 4 || c.v < 1 || c.v > 4 || q < 0 || q >= JPEG_MAX_TABLES) return false;
+        d.h_max = max(d.h_max, (int)c.h);
+        d.v_max = max(d.v_max, (int)c.v);
+    }
+    d.frame_seen = true;
+    return true;
+}
+
+// ---------- Blocks ----------
+
+static void jpeg_idct_init() {
+    for (int u = 0; u < 8; u++) {
+        for (int x = 0; x < 8; x++) {
+            float c = cosf((2 * x + 1) * u * (float)M_PI / 16.0f);
+            if (u == 0) c *= 0.70710678f;
+            jpeg_idct_table[u][x] = (int16_t)lrintf(c * 2048.0f);
+        }
+    }
+    jpeg_idct_ready = true;
+}
+
+// Coefficients (natural order, dequantized) to level-shifted pixels
+static void jpeg_idct(const int16_t *coef, uint8_t *pixels) {
+    int32_t rows[64];
+    for (int v = 0; v < 8; v++) {
+        const int16_t *in = coef + v * 8;
+        for (int x = 0; x < 8; x++) {
+            int32_t acc = 0;
+            for (int u = 0; u < 8; u++) acc += jpeg_idct_table[u][x] * in[u];
+            rows[v * 8 + x] = (acc + 1024) >> 11;
+        }
+    }
+    for (int x = 0; x < 8; x++) {
+        for (int y = 0; y < 8; y++) {
+            int32_t acc = 0;
+            for (int v = 0; v < 8; v++) acc += jpeg_idct_table[v][y] * rows[v * 8 + x];
+            int value = ((acc + 4096) >> 13) + 128;
+            pixels[y * 8 + x] = value < 0 ? 0 : value > 255 ? 255 : value;
+        }
+    }
+}
+
+static void jpeg_accumulate(JpegDecoder &d, int x, int y, int value) {
+    if (x >= d.width || y >= d.height) return;
+    int cell = (y * d.out_h / d.height) * d.out_w + x * d.out_w / d.width;
+    d.sum[cell] += value;
+    d.count[cell]++;
+}
+
+// One 8x8 block of component c at block column bx, row by. Only luma is
+// kept; its pixels land in the thumbnail cells they cover.
+static bool jpeg_decode_block(JpegDecoder &d, JpegComponent &c, bool luma, int bx, int by) {
+    const JpegHuffman &dc = d.dc[c.dc_table];
+    const JpegHuffman &ac = d.ac[c.ac_table];
+    int t = jpeg_decode_huffman(d, dc);
+    if (t < 0 || t > 11) return false;
+    c.dc_pred += jpeg_extend(jpeg_bits(d, t), t);
+
+    bool full = luma && !d.dc_only;
+    int16_t coef[64];
+    if (full) memset(coef, 0, sizeof(coef));
+    for (int k = 1; k < 64; k++) {
+        int rs = jpeg_decode_huffman(d, ac);
+        if (rs < 0) return false;
+        int run = rs >> 4;
+        int size = rs & 15;
+        if (size == 0) {
+            if (run != 15) break; // end of block
+            k += 15;
+            continue;
+        }
+        k += run;
+        if (k > 63) return false;
+        int value = jpeg_extend(jpeg_bits(d, size), size);
+        if (full) coef[jpeg_zigzag[k]] = constrain(value * d.quant[c.quant][k], -4096, 4096);
+    }
+    if (!luma) return true;
+
+    // Component samples to image pixels when luma is subsampled itself
+    int sx = d.h_max / c.h;
+    int sy = d.v_max / c.v;
+    int x0 = bx * 8 * sx;
+    int y0 = by * 8 * sy;
+    if (!full) {
+        int value = constrain(c.dc_pred * d.quant[c.quant][0] / 8 + 128, 0, 255);
+        jpeg_accumulate(d, x0 + 4 * sx, y0 + 4 * sy, value);
+        return true;
+    }
+    coef[0] = constrain(c.dc_pred * d.quant[c.quant][0], -4096, 4096);
+    uint8_t pixels[64];
+    jpeg_idct(coef, pixels);
+    for (int y = 0; y < 8; y++) {
+        for (int x = 0; x < 8; x++) {
+            jpeg_accumulate(d, x0 + x * sx, y0 + y * sy, pixels[y * 8 + x]);
+        }
+    }
+    return true;
+}
+
+// At a restart interval: the bits left are padding, then RSTn
+static bool jpeg_restart(JpegDecoder &d) {
+    d.bits = 0;
+    d.bit_count = 0;
+    if (!d.marker) d.marker = jpeg_next_marker(d);
+    bool ok = d.marker >= 0xD0 && d.marker <= 0xD7;
+    d.marker = 0;
+    for (int i = 0; i < d.comp_count; i++) d.comps[i].dc_pred = 0;
+    return ok;
+}
+
+// One scan. Luma is decoded into the thumbnail; a scan without luma is
+// skipped to its end. Returns 1 when the luma is complete, 0 to go on to
+// the next marker, -1 on error.
+static int jpeg_decode_scan(JpegDecoder &d, JpegContinue keep_going) {
+    int count = jpeg_byte(d);
+    if (count < 1 || count > d.comp_count) return -1;
+    JpegComponent *scan[JPEG_MAX_COMPONENTS];
+    bool has_luma = false;
+    for (int i = 0; i < count; i++) {
+        int id = jpeg_byte(d);
+        int tables = jpeg_byte(d);
+        scan[i] = nullptr;
+        for (int j = 0; j < d.comp_count; j++) {
+            if (d.comps[j].id == id) scan[i] = &d.comps[j];
+        }
+        if (!scan[i] || tables < 0) return -1;
+        scan[i]->dc_table = (tables >> 4) & 3;
+        scan[i]->ac_table = tables & 3;
+        scan[i]->dc_pred = 0;
+        if (!d.dc[scan[i]->dc_table].present || !d.ac[scan[i]->ac_table].present) return -1;
+        has_luma = has_luma || scan[i] == &d.comps[0];
+    }
+    if (!jpeg_skip(d, 3)) return -1; // spectral selection and approximation: fixed in baseline
+
+    if (!has_luma) {
+        // Chroma only (a non-interleaved file): on to the next marker
+        int marker;
+        do {
+            marker = jpeg_next_marker(d);
+        } while (marker >= 0xD0 && marker <= 0xD7);
+        if (marker < 0) return -1;
+        d.pending_marker = marker;
+        return 0;
+    }
+
+    int mcu_cols, mcu_rows;
+    if (count == 1) {
+        // Non-interleaved: one block per MCU over the component's own size
+        JpegComponent &c = *scan[0];
+        mcu_cols = ((d.width * c.h + d.h_max - 1) / d.h_max + 7) / 8;
+        mcu_rows = ((d.height * c.v + d.v_max - 1) / d.v_max + 7) / 8;
+    } else {
+        mcu_cols = (d.width + 8 * d.h_max - 1) / (8 * d.h_max);
+        mcu_rows = (d.height + 8 * d.v_max - 1) / (8 * d.v_max);
+    }
+
+    d.bits = 0;
+    d.bit_count = 0;
+    d.marker = 0;
+    int mcus = 0;
+    for (int my = 0; my < mcu_rows; my++) {
+        if (keep_going && !keep_going()) return -1;
+        for (int mx = 0; mx < mcu_cols; mx++) {
+            if (d.restart_interval && mcus && mcus % d.restart_interval == 0 && !jpeg_restart(d)) return -1;
+            mcus++;
+            for (int i = 0; i < count; i++) {
+                JpegComponent &c = *scan[i];
+                bool luma = &c == &d.comps[0];
+                if (count == 1) {
+                    if (!jpeg_decode_block(d, c, luma, mx, my)) return -1;
+                    continue;
+                }
+                for (int v = 0; v < c.v; v++) {
+                    for (int h = 0; h < c.h; h++) {
+                        if (!jpeg_decode_block(d, c, luma, mx * c.h + h, my * c.v + v)) return -1;
+                    }
+                }
+            }
+        }
+    }
+    return 1;
+}
+
+// ---------- Public ----------
+
+static bool jpeg_decode(JpegDecoder &d, JpegContinue keep_going) {
+    if (jpeg_byte(d) != 0xFF || jpeg_byte(d) != 0xD8) return false;
+    for (;;) {
+        int marker = d.pending_marker ? d.pending_marker : jpeg_next_marker(d);
+        d.pending_marker = 0;
+        if (marker < 0 || marker == 0xD9) return false; // no image data
+        if (marker == 0xD8 || marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) continue;
+        int length = jpeg_u16(d);
+        if (length < 2) return false;
+        length -= 2;
+
+        if (marker == 0xC0 || marker == 0xC1) {
+            if (!jpeg_read_sof(d)) return false;
+            // Block averages are enough once a thumbnail pixel spans 8 image pixels
+            d.dc_only = d.width >= d.out_w * 8 && d.height >= d.out_h * 8;
+        } else if ((marker >= 0xC2 && marker <= 0xCF) && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            Serial.printf("[JPEG] SOF%d (progressive, lossless or arithmetic) not supported\n", marker - 0xC0);
+            return false;
+        } else if (marker == 0xC4) {
+            if (!jpeg_read_dht(d, length)) return false;
+        } else if (marker == 0xDB) {
+            if (!jpeg_read_dqt(d, length)) return false;
+        } else if (marker == 0xDD) {
+            d.restart_interval = jpeg_u16(d);
+        } else if (marker == 0xDA) {
+            if (!d.frame_seen) return false;
+            int result = jpeg_decode_scan(d, keep_going);
+            if (result != 0) return result > 0;
+        } else if (!jpeg_skip(d, length)) {
+            return false;
+        }
+    }
+}
+
+bool jpeg_thumbnail(File &file, uint32_t start, uint32_t length, uint8_t *gray, int width, int height,
+                    JpegContinue keep_going) {
+    if (!jpeg_idct_ready) jpeg_idct_init();
+    JpegDecoder *d = new JpegDecoder();
+    uint32_t *sum = new uint32_t[width * height]();
+    uint16_t *count = new uint16_t[width * height]();
+    d->file = &file;
+    d->pos = start;
+    d->end = start + length;
+    d->out_w = width;
+    d->out_h = height;
+    d->sum = sum;
+    d->count = count;
+
+    bool ok = jpeg_decode(*d, keep_going);
+    if (ok) {
+        Serial.printf("[JPEG] %dx%d, %d components, %s\n", d->width, d->height, d->comp_count,
+                      d->dc_only ? "block averages" : "full IDCT");
+        // A cell no pixel landed in (images smaller than the thumbnail)
+        // repeats its left neighbour, or the row above when the whole row
+        // is empty. The first row and column always have pixels.
+        for (int i = 0; i < width * height; i++) {
+            if (count[i]) {
+                gray[i] = sum[i] / count[i];
+            } else {
+                gray[i] = count[i - i % width] ? gray[i - 1] : gray[i - width];
+            }
+        }
+    }
+    delete[] count;
+    delete[] sum;
+    delete d;
+    return ok;
+}
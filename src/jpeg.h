@@ -0,0 +1,26 @@
+#pragma once
+
+#include <Arduino.h>
+#include <FS.h>
+
+// ---------- JPEG thumbnails ----------
+// A baseline (sequential, Huffman) JPEG decoder that only ever produces a
+// small grayscale thumbnail. It streams the entropy data MCU by MCU and
+// box-filters the luma of each block straight into the thumbnail, so its
+// memory is a few KB whatever the image size; there is never a row of
+// pixels, let alone a frame. Chroma blocks are Huffman-decoded only to be
+// skipped. Once every thumbnail pixel covers at least 8x8 image pixels the
+// block averages (the DC coefficients) are all that is needed and the IDCT
+// is skipped too. Progressive and arithmetic-coded files are not supported.
+
+#define JPEG_MAX_DIMENSION 8192
+#define JPEG_READ_CHUNK 512
+
+// Called between MCU rows; returning false abandons the decode
+typedef bool (*JpegContinue)();
+
+// Decodes the JPEG at [start, start + length) of file into a width x height
+// 8-bit grayscale image (stretched to fit). False if it is not a baseline
+// JPEG, is damaged, or keep_going said stop.
+bool jpeg_thumbnail(File &file, uint32_t start, uint32_t length, uint8_t *gray, int width, int height,
+                    JpegContinue keep_going = nullptr);
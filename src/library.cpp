@@ -0,0 +1,278 @@
+#include "library.h"
+#include "governor.h"
+#include "tagindex.h"
+#include "tags.h"
+#include <SD.h>
+
+#define LIBRARY_MAGIC "WLIB"
+#define LIBRARY_VERSION 2
+#define LIBRARY_STAMP_SEED 2166136261u // FNV-1a offset basis
+
+struct LibraryHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t track_count;
+    uint32_t artist_count;
+    uint32_t stamp; // library_stamp() of the paths it was built from
+};
+
+static volatile bool library_loaded = false; // set last: the library task builds, the UI reads
+static uint32_t library_tracks = 0;
+static MemVector<LibraryRange, MEM_LIBRARY> library_artists;
+
+bool library_ready() {
+    return library_loaded;
+}
+
+uint32_t library_track_count() {
+    return library_tracks;
+}
+
+LibraryRange library_artist_range(int artist_index) {
+    if (artist_index < 0 || artist_index >= (int)library_artists.size()) {
+        return {0, 0};
+    }
+    return library_artists[artist_index];
+}
+
+// FNV-1a over every track path in scan order, so an added, removed or
+// renamed album or track changes it
+static uint32_t library_stamp_add(uint32_t stamp, const String &path) {
+    for (size_t i = 0; i < path.length(); i++) {
+        stamp = (stamp ^ (uint8_t)path[i]) * 16777619u;
+    }
+    return (stamp ^ '\n') * 16777619u;
+}
+
+static String library_base_name(const String &path) {
+    return path.substring(path.lastIndexOf('/') + 1);
+}
+
+// The same walk as library_build(), names only: directory entries are read
+// without opening the audio files, so this costs a fraction of a rebuild
+static uint32_t library_stamp(const NameList &artists) {
+    uint32_t stamp = LIBRARY_STAMP_SEED;
+    for (const auto &artist : artists) {
+        File artist_dir = SD.open("/" + artist);
+        if (!artist_dir) continue;
+        for (String album_path = artist_dir.getNextFileName(); album_path.length(); album_path = artist_dir.getNextFileName()) {
+            governor_wait(TASK_LIBRARY);
+            if (library_base_name(album_path)[0] == '.') continue;
+            File album_dir = SD.open(album_path);
+            if (!album_dir) continue;
+            if (album_dir.isDirectory()) {
+                for (String path = album_dir.getNextFileName(); path.length(); path = album_dir.getNextFileName()) {
+                    FileType type;
+                    if (song_type_from_path(path, type)) stamp = library_stamp_add(stamp, path);
+                }
+            }
+            album_dir.close();
+        }
+        artist_dir.close();
+    }
+    return stamp;
+}
+
+static bool library_load(const NameList &artists) {
+    library_loaded = false;
+    File idx = SD.open(LIBRARY_INDEX_FILE, FILE_READ);
+    if (!idx) return false;
+
+    LibraryHeader header;
+    bool ok = idx.read((uint8_t*)&header, sizeof(header)) == sizeof(header) &&
+              memcmp(header.magic, LIBRARY_MAGIC, 4) == 0 &&
+              header.version == LIBRARY_VERSION &&
+              header.artist_count == artists.size();
+    if (ok) {
+        unsigned long start = millis();
+        uint32_t stamp = library_stamp(artists);
+        Serial.printf("Library stamp checked in %lu ms.\n", millis() - start);
+        if (stamp != header.stamp) {
+            Serial.println("Library changed on the card.");
+            ok = false;
+        }
+    }
+    if (ok) {
+        library_artists.resize(header.artist_count);
+        idx.seek(sizeof(header) + header.track_count * sizeof(uint32_t));
+        size_t table_bytes = header.artist_count * sizeof(LibraryRange);
+        ok = idx.read((uint8_t*)library_artists.data(), table_bytes) == table_bytes;
+    }
+    idx.close();
+
+    if (ok && !tag_index_open(header.track_count)) {
+        Serial.println("Tag indexes invalid or missing.");
+        ok = false;
+    }
+    if (!ok) {
+        library_artists.clear();
+        return false;
+    }
+    library_tracks = header.track_count;
+    library_loaded = true;
+    return true;
+}
+
+bool library_open(const NameList &artists) {
+    if (library_load(artists)) {
+        Serial.printf("Library index is valid: %u tracks.\n", library_tracks);
+        return true;
+    }
+    Serial.println("Library index invalid or missing. Rebuilding.");
+    return library_build(artists);
+}
+
+// Second pass over the paths just written, so the scan above never holds
+// more files open than the card allows. Tags come from each folder's cache.
+static void library_build_tag_indexes() {
+    unsigned long start = millis();
+    tag_index_build_begin();
+    File dat = SD.open(LIBRARY_PATHS_FILE, FILE_READ);
+    uint32_t parsed = 0;
+    for (uint32_t track_id = 0; dat && track_id < library_tracks; track_id++) {
+        governor_wait(TASK_LIBRARY);
+        String path = dat.readStringUntil('\n');
+        path.trim();
+        FileType type;
+        if (!song_type_from_path(path, type) || type == WAV) continue; // WAV carries no tags we read
+        File file = SD.open(path, FILE_READ);
+        if (!file) continue;
+        TrackInfo info;
+        tags_read(file, path, info);
+        file.close();
+        tag_index_add(track_id, path, info);
+        parsed++;
+    }
+    if (dat) dat.close();
+    tag_index_build_end(library_tracks);
+    Serial.printf("Tag indexes built from %u tracks in %lu ms.\n", parsed, millis() - start);
+}
+
+bool library_build(const NameList &artists) {
+    MemoryScope scope(MEM_LIBRARY);
+    unsigned long start = millis();
+    library_loaded = false;
+
+    SD.remove(LIBRARY_PATHS_FILE);
+    SD.remove(LIBRARY_INDEX_FILE);
+    File dat = SD.open(LIBRARY_PATHS_FILE, FILE_WRITE);
+    File idx = SD.open(LIBRARY_INDEX_FILE, FILE_WRITE);
+    if (!dat || !idx) {
+        Serial.println("Failed to create library index files.");
+        if (dat) dat.close();
+        if (idx) idx.close();
+        return false;
+    }
+
+    LibraryHeader header;
+    memcpy(header.magic, LIBRARY_MAGIC, 4);
+    header.version = LIBRARY_VERSION;
+    header.track_count = 0;
+    header.artist_count = artists.size();
+    header.stamp = LIBRARY_STAMP_SEED;
+    idx.write((const uint8_t*)&header, sizeof(header)); // placeholder, rewritten below
+
+    MemVector<LibraryRange, MEM_LIBRARY> ranges;
+    ranges.reserve(artists.size());
+    uint32_t dat_offset = 0;
+
+    for (const auto &artist : artists) {
+        LibraryRange range = {header.track_count, 0};
+        String artist_path = "/" + artist;
+        File artist_dir = SD.open(artist_path);
+        File album = artist_dir ? artist_dir.openNextFile() : File();
+        while (album) {
+            governor_wait(TASK_LIBRARY);
+            if (album.isDirectory() && album.name()[0] != '.') {
+                String album_path = artist_path + "/" + album.name();
+                File album_dir = SD.open(album_path);
+                File file = album_dir ? album_dir.openNextFile() : File();
+                while (file) {
+                    FileType type;
+                    if (!file.isDirectory() && song_type_from_path(file.name(), type)) {
+                        String path = album_path + "/" + file.name();
+                        header.stamp = library_stamp_add(header.stamp, path);
+                        String line = path + "\n";
+                        idx.write((const uint8_t*)&dat_offset, sizeof(dat_offset));
+                        dat.print(line);
+                        dat_offset += line.length();
+                        header.track_count++;
+                        range.count++;
+                    }
+                    file = album_dir.openNextFile();
+                }
+                if (album_dir) album_dir.close();
+            }
+            album = artist_dir.openNextFile();
+        }
+        if (artist_dir) artist_dir.close();
+        ranges.push_back(range);
+    }
+
+    idx.write((const uint8_t*)ranges.data(), ranges.size() * sizeof(LibraryRange));
+    idx.seek(0);
+    idx.write((const uint8_t*)&header, sizeof(header));
+    idx.close();
+    dat.close();
+
+    library_artists = ranges;
+    library_tracks = header.track_count;
+    Serial.printf("Library index built: %u tracks, %u artists in %lu ms.\n",
+                  header.track_count, header.artist_count, millis() - start);
+    library_build_tag_indexes();
+    library_loaded = true;
+    return true;
+}
+
+bool library_get_song(uint32_t track_id, Song &song) {
+    if (!library_loaded || track_id >= library_tracks) return false;
+
+    File idx = SD.open(LIBRARY_INDEX_FILE, FILE_READ);
+    if (!idx) return false;
+    uint32_t offset = 0;
+    idx.seek(sizeof(LibraryHeader) + track_id * sizeof(uint32_t));
+    bool ok = idx.read((uint8_t*)&offset, sizeof(offset)) == sizeof(offset);
+    idx.close();
+    if (!ok) return false;
+
+    File dat = SD.open(LIBRARY_PATHS_FILE, FILE_READ);
+    if (!dat) return false;
+    dat.seek(offset);
+    String path = dat.readStringUntil('\n');
+    dat.close();
+
+    path.trim();
+    FileType type;
+    if (path.length() == 0 || !song_type_from_path(path, type)) return false;
+    song = {path, type};
+    return true;
+}
+
+bool library_get_songs(const uint32_t *track_ids, size_t count, SongList &songs) {
+    songs.clear();
+    if (!library_loaded) return false;
+    File idx = SD.open(LIBRARY_INDEX_FILE, FILE_READ);
+    File dat = SD.open(LIBRARY_PATHS_FILE, FILE_READ);
+    if (!idx || !dat) {
+        if (idx) idx.close();
+        if (dat) dat.close();
+        return false;
+    }
+    songs.resize(count);
+    for (size_t i = 0; i < count; i++) {
+        uint32_t offset = 0;
+        if (track_ids[i] >= library_tracks) continue;
+        idx.seek(sizeof(LibraryHeader) + track_ids[i] * sizeof(uint32_t));
+        if (idx.read((uint8_t*)&offset, sizeof(offset)) != sizeof(offset)) continue;
+        dat.seek(offset);
+        String path = dat.readStringUntil('\n');
+        path.trim();
+        FileType type;
+        if (path.length() > 0 && song_type_from_path(path, type)) {
+            songs[i] = {path, type};
+        }
+    }
+    idx.close();
+    dat.close();
+    return true;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <Arduino.h>
+#include <vector>
+#include "song.h"
+
+// ---------- Library index ----------
+// Every playable file on the card gets a track id, in Artist/Album/file scan
+// order. Paths live one per line in /data/_library.dat; /data/_library.idx
+// holds a fixed-size header, one uint32 offset per track and a first/count
+// pair per artist, so a track id resolves with two seeks and no RAM per track.
+// The tag indexes (tagindex.h) are built along with it. Scans and builds
+// run on the library task and pause while the governor holds background
+// work back.
+
+#define LIBRARY_PATHS_FILE "/data/_library.dat"
+#define LIBRARY_INDEX_FILE "/data/_library.idx"
+
+struct LibraryRange {
+    uint32_t first;
+    uint32_t count;
+};
+
+// Opens the index if it matches the artist list and the stamp of the paths
+// on the card, otherwise rebuilds it
+bool library_open(const NameList &artists);
+bool library_build(const NameList &artists);
+bool library_ready();
+
+uint32_t library_track_count();
+LibraryRange library_artist_range(int artist_index);
+bool library_get_song(uint32_t track_id, Song &song);
+
+// Resolves many ids with the index files opened once. songs[i] belongs to
+// track_ids[i] and has an empty path if that id doesn't resolve.
+bool library_get_songs(const uint32_t *track_ids, size_t count, SongList &songs);
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <Arduino.h>
+#include <FS.h>
+
+// ---------- Line reader ----------
+// Text files (playlists, CUE sheets, their caches) read a line at a time
+// straight off the card through a small buffer, never loaded whole. CR is
+// dropped, and a line longer than the caller's buffer is cut, the rest of
+// it skipped.
+
+#define LINE_READ_CHUNK 256
+
+struct LineReader {
+    File &file;
+    uint8_t buf[LINE_READ_CHUNK];
+    size_t len;
+    size_t pos;
+
+    LineReader(File &file) : file(file), len(0), pos(0) {}
+
+    // False at the end of the file
+    bool next(char *line, size_t size) {
+        size_t n = 0;
+        bool any = false;
+        for (;;) {
+            if (pos == len) {
+                len = file.read(buf, sizeof(buf));
+                pos = 0;
+                if (len == 0 || len > sizeof(buf)) {
+                    len = 0;
+                    break;
+                }
+            }
+            any = true;
+            char c = (char)buf[pos++];
+            if (c == '\n') break;
+            if (c == '\r') continue;
+            if (n + 1 < size) line[n++] = c;
+        }
+        line[n] = '\0';
+        return any;
+    }
+};
+
+// Strips spaces and tabs from both ends, in place
+inline char *line_trim(char *s) {
+    while (*s == ' ' || *s == '\t') s++;
+    size_t n = strlen(s);
+    while (n > 0 && (s[n - 1] == ' ' || s[n - 1] == '\t')) s[--n] = '\0';
+    return s;
+}
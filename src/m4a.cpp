@@ -0,0 +1,497 @@
+#include "m4a.h"
+
+// One ADTS header plus the access unit; shared by both decks since all decks
+// decode on the decode task
+static uint8_t m4a_frame_buffer[7 + M4A_MAX_SAMPLE];
+
+static const uint32_t m4a_sample_rates[13] = {96000, 88200, 64000, 48000, 44100, 32000, 24000,
+                                              22050, 16000, 12000, 11025, 8000, 7350};
+
+static inline uint32_t m4a_be32(const uint8_t *b) {
+    return ((uint32_t)b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
+}
+
+// Reads the box header at pos. size covers the whole box; header is 8 or 16.
+static bool m4a_read_box(File &file, uint32_t pos, uint32_t end, uint32_t &size, uint32_t &header, char type[5]) {
+    uint8_t b[16];
+    if (pos + 8 > end || !file.seek(pos) || file.read(b, 8) != 8) return false;
+    size = m4a_be32(b);
+    memcpy(type, b + 4, 4);
+    type[4] = 0;
+    header = 8;
+    if (size == 1) {
+        // 64-bit size; boxes past 4 GB cannot exist on FAT32 anyway
+        if (file.read(b + 8, 8) != 8 || m4a_be32(b + 8) != 0) return false;
+        size = m4a_be32(b + 12);
+        header = 16;
+    } else if (size == 0) {
+        size = end - pos; // runs to the end of its parent
+    }
+    return size >= header && pos + size <= end;
+}
+
+bool m4a_find_box(File &file, uint32_t start, uint32_t end, const char *wanted,
+                  uint32_t &payload, uint32_t &box_end) {
+    uint32_t pos = start;
+    uint32_t size, header;
+    char type[5];
+    while (m4a_read_box(file, pos, end, size, header, type)) {
+        if (memcmp(type, wanted, 4) == 0) {
+            payload = pos + header;
+            box_end = pos + size;
+            return true;
+        }
+        pos += size;
+    }
+    return false;
+}
+
+// ---------- Decoder glue ----------
+
+static M4aCodec *aac_writer = nullptr;
+
+static void aac_data_callback(AACFrameInfo &info, short *pcm, size_t len, void *ref) {
+    if (aac_writer) {
+        aac_writer->store_pcm(info, pcm, len);
+    }
+}
+
+void M4aCodec::store_pcm(AACFrameInfo &info, short *pcm, size_t len) {
+    format.sample_rate = info.sampRateOut; // twice the core rate with SBR
+    format.channels = info.nChans;
+    format.bits_per_sample = info.bitsPerSample;
+    if (info.bitRate) format.bitrate = info.bitRate;
+
+    if (buffer_len + len <= sizeof(buffer) / sizeof(int16_t)) {
+        memcpy(buffer + buffer_len, pcm, len * sizeof(int16_t));
+        buffer_len += len;
+    } else {
+        Serial.println("PCM buffer overflow!");
+    }
+}
+
+// ---------- Container ----------
+
+// Picks the AudioSpecificConfig out of stsd/mp4a/esds for the ADTS headers
+static bool m4a_read_audio_config(File &file, uint32_t stsd, uint32_t stsd_end, M4aTrack &track) {
+    uint32_t size, header;
+    char type[5];
+    if (!m4a_read_box(file, stsd + 8, stsd_end, size, header, type)) return false;
+    if (strcmp(type, "mp4a") != 0) {
+        Serial.printf("[M4A] unsupported audio format '%s'\n", type);
+        return false;
+    }
+    uint32_t entry = stsd + 8 + header;
+    uint32_t entry_end = stsd + 8 + size;
+
+    // AudioSampleEntry; QuickTime versions 1 and 2 append more fields
+    uint8_t b[128];
+    file.seek(entry);
+    if (file.read(b, 28) != 28) return false;
+    uint16_t version = (b[8] << 8) | b[9];
+    uint32_t children = entry + 28 + (version == 1 ? 16 : version == 2 ? 36 : 0);
+
+    uint32_t esds, esds_end, wave, wave_end;
+    if (!m4a_find_box(file, children, entry_end, "esds", esds, esds_end)) {
+        if (!m4a_find_box(file, children, entry_end, "wave", wave, wave_end) ||
+            !m4a_find_box(file, wave, wave_end, "esds", esds, esds_end)) {
+            Serial.println("[M4A] no esds box");
+            return false;
+        }
+    }
+
+    uint32_t len = min((uint32_t)sizeof(b), esds_end - esds);
+    file.seek(esds);
+    if (file.read(b, len) != len) return false;
+
+    // ES_Descriptor -> DecoderConfigDescriptor -> DecoderSpecificInfo
+    uint32_t p = 4; // version and flags
+    const uint8_t *asc = nullptr;
+    uint32_t asc_len = 0;
+    while (p + 2 <= len && !asc) {
+        uint8_t tag = b[p++];
+        uint32_t desc_len = 0;
+        for (int i = 0; i < 4 && p < len; i++) {
+            uint8_t c = b[p++];
+            desc_len = (desc_len << 7) | (c & 0x7F);
+            if (!(c & 0x80)) break;
+        }
+        if (tag == 0x03) {
+            if (p + 3 > len) break;
+            uint8_t flags = b[p + 2];
+            p += 3;
+            if (flags & 0x80) p += 2;
+            if ((flags & 0x40) && p < len) p += 1 + b[p];
+            if (flags & 0x20) p += 2;
+        } else if (tag == 0x04) {
+            if (p + 13 > len) break;
+            uint32_t avg_bitrate = m4a_be32(b + p + 9);
+            track.format.bitrate = avg_bitrate;
+            p += 13;
+        } else if (tag == 0x05) {
+            asc = b + p;
+            asc_len = min(desc_len, len - p);
+        } else {
+            p += desc_len;
+        }
+    }
+    if (!asc || asc_len < 2) {
+        Serial.println("[M4A] no AudioSpecificConfig");
+        return false;
+    }
+
+    // audioObjectType(5) samplingFrequencyIndex(4) channelConfiguration(4)
+    uint32_t bits = (asc[0] << 8) | asc[1];
+    uint8_t object_type = bits >> 11;
+    uint8_t rate_index = (bits >> 7) & 0x0F;
+    uint8_t channels = (bits >> 3) & 0x0F;
+    if ((object_type == 5 || object_type == 29) && asc_len >= 3) {
+        // Explicit SBR/PS: the core object type follows the extension rate;
+        // helix finds the SBR data in the stream by itself
+        uint32_t more = (asc[1] << 16) | (asc[2] << 8) | (asc_len > 3 ? asc[3] : 0);
+        object_type = (more >> 10) & 0x1F;
+    }
+    if (object_type < 1 || object_type > 4 || rate_index > 12 || channels < 1 || channels > 2) {
+        Serial.printf("[M4A] unsupported AAC: object type %u, rate index %u, %u channels\n",
+                      object_type, rate_index, channels);
+        return false;
+    }
+    track.adts_profile = object_type - 1;
+    track.adts_rate_index = rate_index;
+    track.adts_channels = channels;
+    track.format.sample_rate = m4a_sample_rates[rate_index];
+    track.format.channels = channels;
+    return true;
+}
+
+static bool m4a_find_track(File &file, uint32_t moov_start, uint32_t moov_end, M4aTrack &track) {
+    uint32_t pos = moov_start;
+    uint32_t size, header;
+    char type[5];
+    uint8_t b[24];
+    while (m4a_read_box(file, pos, moov_end, size, header, type)) {
+        uint32_t trak = pos + header;
+        uint32_t trak_end = pos + size;
+        pos += size;
+        if (strcmp(type, "trak") != 0) continue;
+
+        uint32_t mdia, mdia_end, box, box_end;
+        if (!m4a_find_box(file, trak, trak_end, "mdia", mdia, mdia_end)) continue;
+
+        // Audio tracks only
+        if (!m4a_find_box(file, mdia, mdia_end, "hdlr", box, box_end)) continue;
+        file.seek(box);
+        if (file.read(b, 12) != 12 || memcmp(b + 8, "soun", 4) != 0) continue;
+
+        if (m4a_find_box(file, mdia, mdia_end, "mdhd", box, box_end)) {
+            file.seek(box);
+            if (file.read(b, 24) == 24) {
+                if (b[0] == 1) {
+                    // version 1: 64-bit times
+                    file.seek(box + 20);
+                    uint8_t v1[12];
+                    file.read(v1, 12);
+                    track.timescale = m4a_be32(v1);
+                    track.duration = ((uint64_t)m4a_be32(v1 + 4) << 32) | m4a_be32(v1 + 8);
+                } else {
+                    track.timescale = m4a_be32(b + 12);
+                    track.duration = m4a_be32(b + 16);
+                }
+            }
+        }
+
+        uint32_t minf, minf_end, stbl, stbl_end;
+        if (!m4a_find_box(file, mdia, mdia_end, "minf", minf, minf_end) ||
+            !m4a_find_box(file, minf, minf_end, "stbl", stbl, stbl_end)) {
+            continue;
+        }
+        if (!m4a_find_box(file, stbl, stbl_end, "stsd", box, box_end) || !m4a_read_audio_config(file, box, box_end, track)) {
+            return false;
+        }
+
+        // Only the table positions and counts are kept; entries are read on demand
+        if (!m4a_find_box(file, stbl, stbl_end, "stsz", box, box_end)) return false;
+        file.seek(box);
+        if (file.read(b, 12) != 12) return false;
+        track.uniform_size = m4a_be32(b + 4);
+        track.sample_count = m4a_be32(b + 8);
+        track.sizes_offset = box + 12;
+
+        track.chunk_offsets_64 = false;
+        if (!m4a_find_box(file, stbl, stbl_end, "stco", box, box_end)) {
+            if (!m4a_find_box(file, stbl, stbl_end, "co64", box, box_end)) return false;
+            track.chunk_offsets_64 = true;
+        }
+        file.seek(box);
+        if (file.read(b, 8) != 8) return false;
+        track.chunks_offset = box + 8;
+        track.chunk_count = m4a_be32(b + 4);
+
+        if (!m4a_find_box(file, stbl, stbl_end, "stsc", box, box_end)) return false;
+        file.seek(box);
+        if (file.read(b, 8) != 8) return false;
+        track.runs_offset = box + 8;
+        track.run_count = m4a_be32(b + 4);
+
+        if (track.sample_count == 0 || track.chunk_count == 0 || track.run_count == 0) {
+            Serial.println("[M4A] empty sample table");
+            return false;
+        }
+        return true;
+    }
+    Serial.println("[M4A] no audio track");
+    return false;
+}
+
+bool m4a_read_track(File &file, uint32_t data_start, uint32_t data_end, M4aTrack &track) {
+    memset(&track, 0, sizeof(track));
+    track.format.bits_per_sample = 16;
+
+    // moov may sit before or after mdat
+    uint32_t moov, moov_end;
+    if (!m4a_find_box(file, data_start, data_end, "moov", moov, moov_end)) {
+        Serial.println("[M4A] no moov box");
+        return false;
+    }
+    if (!m4a_find_track(file, moov, moov_end, track)) {
+        return false;
+    }
+
+    uint32_t chunk_bytes = track.chunk_count * (track.chunk_offsets_64 ? 8 : 4);
+    uint32_t table_bytes = (track.uniform_size ? 0 : track.sample_count * 4) + chunk_bytes + track.run_count * 12;
+    Serial.printf("[M4A] %u samples in %u chunks, %lu s: sample table %u bytes on card, demuxer holds %u bytes\n",
+                  track.sample_count, track.chunk_count,
+                  track.timescale ? (unsigned long)(track.duration / track.timescale) : 0,
+                  table_bytes, (unsigned)(3 * sizeof(Mp4Table) + sizeof(m4a_frame_buffer)));
+    return true;
+}
+
+bool M4aCodec::open(File &file, uint32_t data_start, uint32_t data_end) {
+    M4aTrack track;
+    return m4a_read_track(file, data_start, data_end, track) && open_track(file, data_start, data_end, track);
+}
+
+bool M4aCodec::open_track(File &file, uint32_t data_start, uint32_t data_end, const M4aTrack &track) {
+    close();
+    this->file = file;
+    this->data_start = data_start;
+    this->data_end = data_end;
+    format = track.format;
+    errors = 0;
+    adts_profile = track.adts_profile;
+    adts_rate_index = track.adts_rate_index;
+    adts_channels = track.adts_channels;
+    timescale = track.timescale;
+    duration = track.duration;
+    uniform_size = track.uniform_size;
+    sample_count = track.sample_count;
+    chunk_offsets_64 = track.chunk_offsets_64;
+    sizes = {track.sizes_offset, uniform_size ? 0 : sample_count, 4, 0, 0};
+    chunks = {track.chunks_offset, track.chunk_count, (uint8_t)(chunk_offsets_64 ? 8 : 4), 0, 0};
+    runs = {track.runs_offset, track.run_count, 12, 0, 0};
+
+    if (decoder_running) {
+        decoder.drop_input(); // leftovers of the previous track
+    } else if (!allocate()) {
+        return false;
+    }
+    reset();
+    return true;
+}
+
+// ---------- Sample table ----------
+
+const uint8_t *M4aCodec::table_entry(Mp4Table &table, uint32_t index) {
+    if (index >= table.count) return nullptr;
+    if (index < table.window_first || index >= table.window_first + table.window_count) {
+        uint32_t per_window = M4A_TABLE_WINDOW / table.entry_size;
+        table.window_first = index;
+        table.window_count = min(per_window, table.count - index);
+        uint32_t bytes = table.window_count * table.entry_size;
+        file.seek(table.offset + index * table.entry_size);
+        if (file.read(table.data, bytes) != bytes) {
+            table.window_count = 0;
+            return nullptr;
+        }
+    }
+    return table.data + (index - table.window_first) * table.entry_size;
+}
+
+uint32_t M4aCodec::sample_size(uint32_t index) {
+    if (uniform_size) return uniform_size;
+    const uint8_t *entry = table_entry(sizes, index);
+    return entry ? m4a_be32(entry) : 0;
+}
+
+uint32_t M4aCodec::chunk_offset(uint32_t index) {
+    const uint8_t *entry = table_entry(chunks, index);
+    if (!entry) return UINT32_MAX;
+    if (chunk_offsets_64) {
+        return m4a_be32(entry) ? UINT32_MAX : m4a_be32(entry + 4);
+    }
+    return m4a_be32(entry);
+}
+
+void M4aCodec::start_chunk(uint32_t index, uint32_t first_sample) {
+    chunk = index;
+    sample = first_sample;
+    sample_offset = chunk_offset(index);
+    // stsc runs are numbered from chunk 1
+    const uint8_t *next;
+    while ((next = table_entry(runs, run + 1)) != nullptr && m4a_be32(next) - 1 <= index) {
+        run++;
+    }
+    const uint8_t *entry = table_entry(runs, run);
+    samples_per_chunk = entry ? m4a_be32(entry + 4) : 0;
+    chunk_samples_left = samples_per_chunk;
+}
+
+// Moves the cursor past the current sample
+bool M4aCodec::next_sample() {
+    sample_offset += sample_size(sample);
+    sample++;
+    if (chunk_samples_left > 0) chunk_samples_left--;
+    if (chunk_samples_left == 0 && sample < sample_count) {
+        start_chunk(chunk + 1, sample);
+    }
+    return sample < sample_count;
+}
+
+// Wraps the current sample in ADTS and hands it to helix. The cursor moves
+// (and may read table windows) before the sample is read, so the file is
+// left just after the audio that was decoded, which is what a pause saves.
+bool M4aCodec::feed_sample() {
+    uint32_t size = sample_size(sample);
+    uint32_t offset = sample_offset;
+    next_sample();
+    if (size == 0 || size > M4A_MAX_SAMPLE || offset == UINT32_MAX) {
+        errors++;
+        return false;
+    }
+
+    uint32_t frame_len = size + 7;
+    uint8_t *frame = m4a_frame_buffer;
+    frame[0] = 0xFF;
+    frame[1] = 0xF1; // MPEG-4, no CRC
+    frame[2] = (adts_profile << 6) | (adts_rate_index << 2) | (adts_channels >> 2);
+    frame[3] = ((adts_channels & 3) << 6) | (frame_len >> 11);
+    frame[4] = (frame_len >> 3) & 0xFF;
+    frame[5] = ((frame_len & 7) << 5) | 0x1F;
+    frame[6] = 0xFC;
+    if (!file.seek(offset) || file.read(frame + 7, size) != size) {
+        errors++;
+        return false;
+    }
+
+    aac_writer = this;
+    decoder.write(frame, frame_len);
+    aac_writer = nullptr;
+    return true;
+}
+
+// ---------- Codec ----------
+
+int32_t M4aCodec::decode(int16_t *pcm, int32_t max_frames) {
+    int attempts = 0;
+    while (buffer_len == 0) {
+        if (sample >= sample_count || attempts >= 8) return 0;
+        feed_sample();
+        attempts++;
+    }
+
+    int channels = format.channels == 1 ? 1 : 2;
+    int32_t frames = min(buffer_len / channels, max_frames);
+    memcpy(pcm, buffer, frames * channels * sizeof(int16_t));
+
+    int32_t consumed = frames * channels;
+    buffer_len -= consumed;
+    if (buffer_len > 0) {
+        memmove(buffer, buffer + consumed, buffer_len * sizeof(int16_t));
+    }
+    return frames;
+}
+
+// Maps a byte position (e.g. a saved pause point) to a sample through the
+// tables: binary search over chunk offsets, the stsc runs for the chunk's
+// first sample, then sample sizes within the chunk
+bool M4aCodec::seek(uint32_t position) {
+    buffer_len = 0;
+    uint32_t lo = 0;
+    uint32_t hi = chunks.count - 1;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi + 1) / 2;
+        if (chunk_offset(mid) <= position) lo = mid;
+        else hi = mid - 1;
+    }
+    uint32_t target = lo;
+
+    uint32_t first_sample = 0;
+    run = 0;
+    for (uint32_t r = 0; r < runs.count; r++) {
+        const uint8_t *entry = table_entry(runs, r);
+        if (!entry) return false;
+        uint32_t first_chunk = m4a_be32(entry) - 1;
+        uint32_t per_chunk = m4a_be32(entry + 4);
+        const uint8_t *next = table_entry(runs, r + 1);
+        uint32_t next_first = next ? m4a_be32(next) - 1 : chunks.count;
+        run = r;
+        if (target < next_first) {
+            first_sample += (target - first_chunk) * per_chunk;
+            break;
+        }
+        first_sample += (next_first - first_chunk) * per_chunk;
+    }
+
+    start_chunk(target, first_sample);
+    while (chunk == target && sample < sample_count && sample_offset + sample_size(sample) <= position) {
+        next_sample();
+    }
+    decoder.drop_input(); // AAC from the old position must not run into the new one
+    seek_position = position;
+    seek_sample = sample;
+    seek_pending = true;
+    return sample < sample_count;
+}
+
+void M4aCodec::reset() {
+    buffer_len = 0;
+    run = 0;
+    if (sample_count) start_chunk(0, 0);
+}
+
+void M4aCodec::close() {
+    buffer_len = 0;
+    sample = 0;
+    sample_count = 0;
+}
+
+bool M4aCodec::allocate() {
+    if (decoder_running) return true;
+    decoder.begin();
+    decoder.setDataCallback(aac_data_callback);
+    decoder_running = true;
+    return true;
+}
+
+void M4aCodec::release() {
+    if (decoder_running) {
+        decoder.end();
+        decoder_running = false;
+    }
+    close();
+}
+
+bool M4aCodec::finished() {
+    return buffer_len == 0 && sample >= sample_count;
+}
+
+void M4aCodec::log_events() {
+    if (!seek_pending) return;
+    seek_pending = false;
+    Serial.printf("[M4A] seek to %u: sample %u of %u\n", seek_position, seek_sample, sample_count);
+}
+
+uint32_t M4aCodec::remaining_ms() {
+    if (!sample_count || !timescale) return Codec::remaining_ms();
+    return (uint64_t)duration * (sample_count - sample) / sample_count * 1000 / timescale;
+}
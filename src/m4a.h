@@ -0,0 +1,111 @@
+#pragma once
+
+#include "codec.h"
+#include <AACDecoderHelix.h>
+
+// ---------- M4A ----------
+// MP4 demuxer feeding libhelix AAC. The sample table (stsz/stco/stsc) is never
+// loaded: each table is read through a small window as playback walks it, so
+// RAM use is the same for a three-minute song and a twenty-hour audiobook.
+// Helix only takes ADTS, so every MP4 sample gets a 7-byte ADTS header built
+// from the track's AudioSpecificConfig.
+
+#define M4A_TABLE_WINDOW 512   // bytes per table window
+#define M4A_MAX_SAMPLE 2048    // largest AAC access unit accepted
+
+// One sample table on the card, read through a window
+struct Mp4Table {
+    uint32_t offset;       // first entry in the file
+    uint32_t count;
+    uint8_t entry_size;
+    uint32_t window_first; // first entry held in data
+    uint32_t window_count;
+    uint8_t data[M4A_TABLE_WINDOW];
+};
+
+// Finds the first child box of a type between start and end; payload is
+// where its contents start. Also used by the tag reader.
+bool m4a_find_box(File &file, uint32_t start, uint32_t end, const char *type,
+                  uint32_t &payload, uint32_t &box_end);
+
+// Where a file's audio track and its sample tables are, read from moov.
+// m4a_read_track() needs no codec, so the UI reads it ahead of a deck
+// command and the decode task only has to set the cursor.
+struct M4aTrack {
+    CodecFormat format;
+    uint8_t adts_profile;
+    uint8_t adts_rate_index;
+    uint8_t adts_channels;
+    uint32_t timescale;
+    uint64_t duration;         // in timescale units
+    uint32_t sample_count;
+    uint32_t uniform_size;     // stsz sample size when every sample has it
+    bool chunk_offsets_64;
+    uint32_t sizes_offset;     // stsz entries
+    uint32_t chunks_offset;    // stco/co64 entries
+    uint32_t chunk_count;
+    uint32_t runs_offset;      // stsc entries
+    uint32_t run_count;
+};
+
+bool m4a_read_track(File &file, uint32_t data_start, uint32_t data_end, M4aTrack &track);
+
+class M4aCodec : public Codec {
+public:
+    const char *name() const override { return "M4A"; }
+    bool open(File &file, uint32_t data_start, uint32_t data_end) override;
+    // open() with the track already read
+    bool open_track(File &file, uint32_t data_start, uint32_t data_end, const M4aTrack &track);
+    int32_t decode(int16_t *pcm, int32_t max_frames) override;
+    bool seek(uint32_t position) override;
+    void reset() override;
+    void close() override;
+    bool allocate() override;
+    void release() override;
+    bool finished() override;
+    void log_events() override;
+    uint32_t remaining_ms() override;
+
+    // Called from the helix data callback while this codec is decoding
+    void store_pcm(AACFrameInfo &info, short *pcm, size_t len);
+
+private:
+    const uint8_t *table_entry(Mp4Table &table, uint32_t index);
+    uint32_t sample_size(uint32_t index);
+    uint32_t chunk_offset(uint32_t chunk);
+    void start_chunk(uint32_t chunk, uint32_t first_sample);
+    bool next_sample();
+    bool feed_sample();
+
+    ReusableHelix<libhelix::AACDecoderHelix> decoder;
+    bool decoder_running = false;
+    int16_t buffer[4096];
+    int32_t buffer_len = 0;
+
+    // Track
+    uint8_t adts_profile = 1;
+    uint8_t adts_rate_index = 4;
+    uint8_t adts_channels = 2;
+    uint32_t timescale = 0;
+    uint64_t duration = 0;    // in timescale units
+    uint32_t sample_count = 0;
+    uint32_t uniform_size = 0; // stsz sample size when every sample has it
+    bool chunk_offsets_64 = false;
+    Mp4Table sizes;
+    Mp4Table chunks;
+    Mp4Table runs;             // stsc
+
+    // Playback cursor
+    uint32_t sample = 0;           // next sample to decode
+    uint32_t sample_offset = 0;    // its position in the file
+    uint32_t chunk = 0;
+    uint32_t chunk_samples_left = 0;
+    uint32_t run = 0;              // current stsc entry
+    uint32_t samples_per_chunk = 0;
+    uint32_t errors = 0;
+
+    // Last seek, for log_events()
+    uint32_t seek_position = 0;
+    uint32_t seek_sample = 0;
+    volatile bool seek_pending = false;
+};
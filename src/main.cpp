@@ -1,8 +1,6 @@
 #include <Arduino.h>
 #include <SD.h>
-#include <SPIFFS.h>
 #include <BluetoothA2DPSource.h>
-#include <MP3DecoderHelix.h>
 #include <Wire.h>
 #include <Adafruit_GFX.h>
 #include <Adafruit_SSD1306.h>
@@ -11,6 +9,32 @@
 #include <vector>
 #include "esp_a2dp_api.h"
 #include "pins.h"
+#include "equalizer.h"
+#include "spectrum.h"
+#include "crossfade.h"
+#include "song.h"
+#include "library.h"
+#include "shuffle.h"
+#include "tags.h"
+#include "playlist.h"
+#include "cue.h"
+#include "tagindex.h"
+#include "cover.h"
+#include "codec.h"
+#include "flac.h"
+#include "m4a.h"
+#include "assets.h"
+#include "boot.h"
+#include "speakers.h"
+#include "settings.h"
+#include "session.h"
+#include "memory.h"
+#include "tasks.h"
+#include "pcmring.h"
+#include "governor.h"
+#include "capture.h"
+#include "sink.h"
+#include "jitter.h"
 
 #if !defined(CONFIG_BT_ENABLED) || !defined(CONFIG_BLUEDROID_ENABLED)
 #error Bluetooth is not enabled! Please run `make menuconfig` to and enable it
@@ -23,7 +47,7 @@ struct DiscoveredBTDevice {
     String name;
     esp_bd_addr_t address;
 };
-std::vector<DiscoveredBTDevice> bt_devices;
+MemVector<DiscoveredBTDevice, MEM_BT> bt_devices;
 int selected_bt_device = 0;
 int bt_discovery_scroll_offset = 0;
 volatile bool is_scanning = false;
@@ -31,33 +55,71 @@ volatile bool is_bt_connected = false;
 volatile bool is_connecting = false;
 unsigned long connection_start_time = 0;
 
+// ---------- BT Connect ----------
+#define BT_PAGE_TIMEOUT_MS 6000      // a known speaker paged directly
+#define BT_CONNECT_TIMEOUT_MS 15000  // a speaker picked from the scan list
+#define BT_RECONNECT_MIN_MS 1000     // backoff between reconnect rounds
+#define BT_RECONNECT_MAX_MS 30000
+esp_bd_addr_t connecting_address;
+String connecting_name;
+int page_candidate = -1;           // known speaker being paged, -1 for a picked one
+unsigned long connect_timer_start = 0; // first attempt of this connect, for the log
+unsigned long reconnect_start_time = 0; // 0 until BT_RECONNECTING starts its rounds
+
 // ---------- Artists ----------
-std::vector<String> artists;
+NameList artists;
 int selected_artist = 0;
 int artist_scroll_offset = 0;
 
-// ---------- Playlist ----------
-enum FileType { MP3, WAV };
+// ---------- Tag browsing ----------
+// Rows after the artists open a tag index; a key picked there lists its
+// tracks in the player like an album
+TagIndexField browse_field = TAG_INDEX_GENRE;
+int selected_tag_key = 0;
+int tag_key_scroll_offset = 0;
+bool player_from_tags = false; // the player list is a tag key's, not a folder's
+String player_title;           // the tag key, shown as the player header
 
-struct Song {
-  String path;
-  FileType type;
-};
+// ---------- Cover art ----------
+uint8_t player_cover[COVER_BYTES]; // the playing album's thumbnail, page layout
+bool player_cover_ready = false;
 
-std::vector<String> playlists;
+// ---------- Playlist ----------
+NameList playlists;
 int selected_playlist = 0;
 int playlist_scroll_offset = 0;
-std::vector<Song> current_playlist_files;
-int current_song_index = 0;
+SongList current_playlist_files;
+String current_album_path;
+int current_song_index = 0; // -1 when the playing song is not in this list
 int selected_song_in_player = 0;
 int player_scroll_offset = 0;
 bool is_playing = false;
 bool song_started = false;
 bool sample_started = false;
 bool ui_dirty = true;
-int paused_song_index = -1;
+bool has_paused_song = false;
+Song paused_song;
 unsigned long paused_song_position = 0;
 
+// ---------- Play order ----------
+Song now_playing;
+Song next_song;                 // picked ahead of time for a crossfade
+bool next_song_ready = false;
+bool next_song_from_album = false;
+bool pick_to_queue = false;     // long-press on a song queues it instead of playing
+bool cue_extended = false;      // the deck runs on into next_song, the CUE track after now_playing
+
+// Settings entries shown after the songs on the player screen
+enum PlayerMenuEntry {
+  PLAYER_MENU_EQ,
+  PLAYER_MENU_FADE,
+  PLAYER_MENU_SHUFFLE,
+  PLAYER_MENU_PICK,
+  PLAYER_MENU_BOOT,
+  PLAYER_MENU_BACK,
+  PLAYER_MENU_COUNT
+};
+
 // ---------- Marquee ----------
 const int MAX_MARQUEE_LINES = 6;
 bool is_marquee_active[MAX_MARQUEE_LINES] = {false};
@@ -67,6 +129,8 @@ String marquee_text[MAX_MARQUEE_LINES];
 // ---------- Configuration ----------
 #define SCREEN_WIDTH 128
 #define SCREEN_HEIGHT 64
+#define SPLASH_JINGLE_DELAY_MS 1000 // after the splash is up, lets the A2DP link settle
+#define SPLASH_TIMEOUT_MS 20000
 
 // ---------- Display ----------
 Adafruit_SSD1306 display(SCREEN_WIDTH, SCREEN_HEIGHT, &Wire, -1);
@@ -78,11 +142,102 @@ volatile int diag_channels = 0;
 int current_volume = 64; // Default volume 0-127
 
 BluetoothA2DPSource a2dp;
-libhelix::MP3DecoderHelix decoder;
-File audioFile;
-uint8_t read_buffer[1024];
-int16_t pcm_buffer[4096];
-int32_t pcm_buffer_len = 0;
+#if defined(AUDIO_SINK_I2S)
+I2sSink output_sink;
+#elif defined(AUDIO_SINK_NULL)
+NullSink output_sink;
+#else
+A2dpSink output_sink(a2dp);
+#endif
+AudioSink &sink = output_sink;
+
+// ---------- Decks ----------
+// A deck is one open track with its own codec. Normally only the current deck
+// plays; during a crossfade the next track is decoded on the other deck and
+// the two are mixed. Each deck keeps one instance of every codec; the resident
+// one holds its decoder memory from track to track (see codec.h).
+struct AudioDeck {
+    File file;
+    FileType type;
+    Mp3Codec mp3;
+    WavCodec wav;
+    FlacCodec flac;
+    M4aCodec m4a;
+    Codec *codec;
+    Codec *resident;    // codec holding decoder memory, kept after close
+    uint32_t resident_bytes;
+    uint32_t data_start;
+    uint32_t data_end;  // audio stops here; trailing tags are never decoded
+    TrackInfo tags;
+    unsigned long open_us;
+    bool first_pcm_pending; // time-to-first-audio not measured yet
+    volatile uint32_t first_pcm_ms; // measured, waiting for loop() to log it
+    const char *alloc_codec;        // the decoder that took it
+    volatile uint32_t alloc_bytes;  // decoder memory the last open took, waiting for loop() to log it
+    uint16_t preroll_pos;   // prefetch_pcm frames already played, of
+    uint16_t preroll_count; // the ones decoded ahead for this deck
+};
+AudioDeck decks[2];
+volatile int current_deck = 0;
+
+// What the UI may know of the current deck. Decks, their files and codecs
+// belong to the decode task, which publishes this after every chunk and
+// before every acknowledgement. A deck's tags are the exception: they are
+// only written by an open, while the UI waits for its acknowledgement.
+struct DeckStatus {
+    volatile bool open;
+    volatile bool finished;         // deck_finished()
+    volatile uint32_t position;     // byte position in its file
+    volatile uint32_t remaining_ms; // estimated
+    volatile int sample_rate;
+    const char *volatile codec;     // name, "" with nothing open
+};
+DeckStatus deck_status = {false, true, 0, 0, 0, ""};
+
+// ---------- Prefetch ----------
+// A song highlighted on the player screen for PREFETCH_DWELL_MS is opened on
+// the idle deck and its first PREFETCH_FRAMES decoded ahead, so picking it
+// starts from memory instead of from the card. The budget is this buffer
+// plus the idle deck's decoder, the one a crossfade uses anyway; below
+// PREFETCH_MIN_FREE_HEAP nothing is prefetched.
+// The decoders share their output buffers between instances, so only the
+// decode task ever runs one: the UI asks for the prefetch with a deck
+// command and the decode task fills the buffer a chunk at a time, whenever
+// the PCM ring is full.
+#define PREFETCH_DWELL_MS 600
+#define PREFETCH_FRAMES 4096 // a full PCM ring, ~93 ms at 44.1 kHz
+#define PREFETCH_MIN_FREE_HEAP 40000
+Frame prefetch_pcm[PREFETCH_FRAMES];
+volatile bool prefetch_filling = false; // decode task: still decoding into prefetch_pcm
+volatile bool prefetch_ready = false;   // the idle deck holds prefetch_song, its start decoded
+volatile uint32_t prefetch_frames = 0;  // decoded so far
+Song prefetch_song;           // last one tried, ready or not
+bool prefetch_logged = true;  // UI: the ready line is printed
+unsigned long prefetch_started = 0;
+int prefetch_highlight = -1;
+unsigned long prefetch_highlight_since = 0;
+
+// Button to first audio: set when a pick starts a song, checked by the sink
+unsigned long start_request_us = 0;
+volatile bool start_waiting = false;
+volatile uint32_t start_flushes = 0;  // pcm_ring_flushes() before the song's flush
+volatile uint32_t start_latency_us = 0;
+bool start_prefetched = false;
+
+// Crossfade handshake: the UI loop picks the next song and posts
+// DECK_XFADE_START, the decode task opens it on the other deck, mixes and
+// swaps decks; the UI loop then posts DECK_RETIRE to close the old one
+enum CrossfadeState { XFADE_IDLE, XFADE_RUNNING, XFADE_DONE, XFADE_ABORTED };
+volatile CrossfadeState crossfade_state = XFADE_IDLE;
+Song crossfade_song;
+bool crossfade_skipped = false; // no headroom for this track change, cut instead
+Frame crossfade_buffer[256];
+
+// Decode benchmark (cycles spent in Codec::decode(), file reads included)
+volatile uint32_t decode_bench_cycles = 0;
+volatile uint32_t decode_bench_frames = 0;
+volatile int audio_decode_load = 0; // % of one core, updated every 2 s
+volatile int audio_eq_load = 0;
 
 // Button states
 bool scroll_pressed = false;
@@ -102,7 +257,8 @@ enum AppState {
   SAMPLE_PLAYBACK,
   ARTIST_SELECTION,
   PLAYLIST_SELECTION,
-  PLAYER
+  PLAYER,
+  TAG_SELECTION
 };
 AppState currentState = STARTUP;
 AppState previousState = STARTUP;
@@ -110,52 +266,8 @@ AppState previousState = STARTUP;
 
 // forward declaration
 int32_t get_data_frames(Frame *frame, int32_t frame_count);
-void pcm_data_callback(MP3FrameInfo &info, short *pcm_buffer_cb, size_t len, void *ref);
 void bt_connection_state_cb(esp_a2d_connection_state_t state, void* ptr);
 
-struct WavHeader {
-    // RIFF Chunk
-    char riff_header[4]; // "RIFF"
-    uint32_t wav_size; // Size of the WAV file in bytes
-    char wave_header[4]; // "WAVE"
-    // Format Chunk
-    char fmt_header[4]; // "fmt "
-    uint32_t fmt_chunk_size; // Should be 16 for PCM
-    uint16_t audio_format; // Should be 1 for PCM
-    uint16_t num_channels;
-    uint32_t sample_rate;
-    uint32_t byte_rate; // sample_rate * num_channels * bits_per_sample / 8
-    uint16_t sample_alignment; // num_channels * bits_per_sample / 8
-    uint16_t bit_depth;
-    // Data Chunk
-    char data_header[4]; // "data"
-    uint32_t data_size; // Number of bytes in data.
-};
-
-bool parse_wav_header(String path, WavHeader &header) {
-    File file = SD.open(path);
-    if (!file) {
-        Serial.printf("Failed to open WAV file: %s\n", path.c_str());
-        return false;
-    }
-
-    if (file.readBytes((char*)&header, sizeof(WavHeader)) != sizeof(WavHeader)) {
-        Serial.println("Failed to read WAV header");
-        file.close();
-        return false;
-    }
-
-    file.close();
-
-    if (strncmp(header.riff_header, "RIFF", 4) != 0 || strncmp(header.wave_header, "WAVE", 4) != 0) {
-        Serial.println("Invalid WAV file format");
-        return false;
-    }
-
-    return true;
-}
-
-
 // ---------- Helper: Find MP3 ----------
 String findFirstMP3() {
   File root = SD.open("/");
@@ -177,70 +289,510 @@ String findFirstMP3() {
 
 
 
-// A2DP callback
-// WAV callback
-int32_t get_wav_data_frames(Frame *frame, int32_t frame_count) {
-    if (audioFile && audioFile.available()) {
-        int bytes_to_read = frame_count * diag_channels * (diag_bits_per_sample / 8);
-        int bytes_read = audioFile.read((uint8_t*)frame, bytes_to_read);
-        return bytes_read / (diag_channels * (diag_bits_per_sample / 8));
+// ---------- Deck helpers ----------
+void deck_close(AudioDeck &deck) {
+    if (deck.file) {
+        deck.file.close();
+    }
+    if (deck.codec) {
+        deck.codec->close();
+        deck.codec = nullptr;
     }
-    return 0;
+    deck.preroll_pos = 0;
+    deck.preroll_count = 0;
 }
 
-int32_t get_data_frames(Frame *frame, int32_t frame_count) {
-    // If we don't have enough PCM data, read from file and decode
-    if (pcm_buffer_len == 0) {
-        if (audioFile && audioFile.available()) {
-            int bytes_read = audioFile.read(read_buffer, sizeof(read_buffer));
-            if (bytes_read > 0) {
-                decoder.write(read_buffer, bytes_read);
+int deck_sample_rate(AudioDeck &deck) {
+    return deck.codec ? deck.codec->format.sample_rate : 0;
+}
+
+// True once the file is exhausted and all decoded PCM has been played
+bool deck_finished(AudioDeck &deck) {
+    return !deck.file || !deck.codec || (deck.codec->finished() && deck.preroll_pos == deck.preroll_count);
+}
+
+// Decode task side: refreshes deck_status from the current deck
+void deck_publish() {
+    AudioDeck &deck = decks[current_deck];
+    bool open = deck.file && deck.codec;
+    deck_status.position = open ? deck.file.position() : 0;
+    deck_status.remaining_ms = open ? deck.codec->remaining_ms() : 0;
+    deck_status.sample_rate = deck_sample_rate(deck);
+    deck_status.codec = open ? deck.codec->name() : "";
+    deck_status.finished = deck_finished(deck);
+    deck_status.open = open;
+}
+
+// Reads up to frame_count stereo frames from a deck, decoding as needed.
+// Returns fewer frames only at the end of the file or when the codec
+// cannot find audio in a few attempts.
+int32_t deck_read_frames(AudioDeck &deck, Frame *frame, int32_t frame_count) {
+    if (!deck.file || !deck.codec) return 0;
+    Codec &codec = *deck.codec;
+
+    int32_t produced = 0;
+    int32_t prerolled = 0;
+    if (deck.preroll_pos < deck.preroll_count) {
+        // Decoded ahead by the prefetch
+        produced = min(frame_count, (int32_t)(deck.preroll_count - deck.preroll_pos));
+        memcpy(frame, prefetch_pcm + deck.preroll_pos, produced * sizeof(Frame));
+        deck.preroll_pos += produced;
+        prerolled = produced;
+    }
+
+    uint32_t start_cycles = ESP.getCycleCount();
+    while (produced < frame_count) {
+        int16_t *out = (int16_t*)(frame + produced);
+        int32_t got = codec.decode(out, frame_count - produced);
+        if (got <= 0) break;
+        if (codec.format.channels == 1) {
+            // Expand mono in place, back to front
+            for (int32_t i = got - 1; i >= 0; i--) {
+                int16_t sample = out[i];
+                frame[produced + i].channel1 = sample;
+                frame[produced + i].channel2 = sample;
             }
-        } else {
-            // End of file or file not open
-            return 0;
         }
+        produced += got;
     }
+    decode_bench_cycles += ESP.getCycleCount() - start_cycles;
+    decode_bench_frames += produced - prerolled;
 
-    // Determine how many frames we can actually provide
-    int32_t frames_to_provide = (pcm_buffer_len / 2 < frame_count) ? pcm_buffer_len / 2 : frame_count;
+    if (produced > 0) {
+        if (deck.first_pcm_pending) {
+            // Logged from loop(): a line this long makes printf allocate
+            deck.first_pcm_pending = false;
+            deck.first_pcm_ms = max(1UL, (micros() - deck.open_us) / 1000);
+        }
+        if (&deck == &decks[current_deck]) {
+            // Safely store diagnostic info
+            diag_sample_rate = codec.format.sample_rate;
+            diag_bits_per_sample = codec.format.bits_per_sample;
+            diag_channels = codec.format.channels;
+        }
+    }
+    return produced;
+}
 
-    if (frames_to_provide > 0) {
-        // Copy PCM data into the frame structure, de-interleaving stereo
-        for (int i = 0; i < frames_to_provide; i++) {
-            frame[i].channel1 = pcm_buffer[i * 2];
-            frame[i].channel2 = pcm_buffer[i * 2 + 1];
+// Mixes the incoming deck into the frames already read from the current
+// deck; swaps decks once the overlap is complete
+void crossfade_step(Frame *frame, int32_t frames) {
+    AudioDeck &incoming = decks[1 - current_deck];
+    AudioDeck &outgoing = decks[current_deck];
+
+    for (int32_t done = 0; done < frames; ) {
+        int32_t chunk = min(frames - done, (int32_t)(sizeof(crossfade_buffer) / sizeof(Frame)));
+        int32_t got = deck_read_frames(incoming, crossfade_buffer, chunk);
+        int incoming_rate = deck_sample_rate(incoming);
+        int outgoing_rate = deck_sample_rate(outgoing);
+        if (incoming_rate && outgoing_rate && incoming_rate != outgoing_rate) {
+            // Different formats cannot be mixed; the UI loop falls back to a cut
+            crossfade_state = XFADE_ABORTED;
+            return;
+        }
+        for (int32_t i = got; i < chunk; i++) {
+            crossfade_buffer[i] = Frame(0);
         }
+        bool complete = crossfade_mix(frame + done, crossfade_buffer, chunk);
+        done += chunk;
 
-        // Shift the remaining data to the beginning of the buffer
-        int samples_consumed = frames_to_provide * 2;
-        pcm_buffer_len -= samples_consumed;
-        if (pcm_buffer_len > 0) {
-            memmove(pcm_buffer, pcm_buffer + samples_consumed, pcm_buffer_len * sizeof(int16_t));
+        if (complete) {
+            // The rest of this block comes from the incoming track alone
+            if (done < frames) {
+                deck_read_frames(incoming, frame + done, frames - done);
+            }
+            current_deck = 1 - current_deck;
+            crossfade_state = XFADE_DONE;
+            return;
         }
     }
-
-    return frames_to_provide;
 }
 
+// ---------- Decode task ----------
+// Runs the decks ahead of the sink and queues their PCM in the ring, so an
+// SD hiccup or a redraw never reaches the speaker. Anything that closes,
+// opens or moves a deck reaches it as a deck command.
+#define DECODE_CHUNK_FRAMES 256
+#define DECODE_IDLE_MS 10
+TaskHandle_t decode_task_handle = nullptr;
+
+// ---------- Deck commands ----------
+// Playback control from the UI: it posts a command and the decode task
+// carries it out between two chunks, where no codec call is in flight, then
+// acknowledges it. The queue has one producer (loop()) and one consumer
+// (the decode task); indices only ever grow, as in the PCM ring. The UI
+// sleeps until the decode task notifies it of the acknowledgement, so it is
+// never inside a deck while the decode task is, and a skip takes one chunk
+// plus the open, not however long a lock happens to be held. A command the
+// decode task has not taken up within DECK_COMMAND_TIMEOUT_MS is voided, so
+// it never runs late.
+enum DeckCommandType {
+    DECK_PLAY,  // close the current deck, flush, open file on it
+    DECK_STOP,  // close the current deck and flush; acked with its position
+    DECK_SEEK,  // move the current deck to a byte position and flush
+    DECK_SWAP,  // drop the current deck and play the prefetched idle one
+    DECK_END,   // move where the current deck stops, to run on into the next CUE track
+    DECK_PREFETCH, // open file on the idle deck and start filling prefetch_pcm
+    DECK_RETIRE,   // close the idle deck: a prefetch not picked, the old track of a fade
+    DECK_XFADE_START // open file on the idle deck (none: the prefetched song) and fade into it
+};
 
-// pcm data callback
-void pcm_data_callback(MP3FrameInfo &info, short *pcm_buffer_cb, size_t len, void *ref){
-    // Safely store diagnostic info
-    diag_sample_rate = info.samprate;
-    diag_bits_per_sample = info.bitsPerSample;
-    diag_channels = info.nChans;
+enum DeckSlotState : uint32_t {
+    DECK_SLOT_QUEUED,
+    DECK_SLOT_RUNNING,  // taken up by the decode task, will be acknowledged
+    DECK_SLOT_VOID      // timed out before it ran; skipped
+};
 
-    // Append new PCM data to the buffer
-    if (pcm_buffer_len + len < sizeof(pcm_buffer) / sizeof(int16_t)) {
-        memcpy(pcm_buffer + pcm_buffer_len, pcm_buffer_cb, len * sizeof(int16_t));
-        pcm_buffer_len += len;
+// What the UI reads of a file before a deck command hands it over: the tags
+// and, for M4A, where the sample tables are. Tag caches and moov boxes are
+// walked here, so the decode task only sets up the codec and seeks.
+struct DeckTrack {
+    TrackInfo tags;
+    M4aTrack m4a;
+    unsigned long read_us; // when reading started, for the time to first audio
+};
+
+struct DeckCommand {
+    DeckCommandType type;
+    uint32_t seq;
+    File file;          // DECK_PLAY, DECK_PREFETCH and DECK_XFADE_START, opened by the UI
+    String path;        // for the capture label
+    FileType file_type;
+    uint32_t position;  // DECK_PLAY, DECK_SEEK, DECK_PREFETCH and DECK_XFADE_START
+    uint32_t end;       // a CUE track's end, 0 for the whole file
+    uint32_t length;    // DECK_XFADE_START: the fade in frames
+    uint32_t state;     // DeckSlotState, changed atomically
+    DeckTrack track;    // with file, read by deck_read_track()
+};
+
+struct DeckAck {
+    bool ok;
+    uint32_t position;  // DECK_STOP: where the deck was, 0 if nothing was open
+};
+
+#define DECK_COMMAND_SLOTS 4
+#define DECK_COMMAND_TIMEOUT_MS 3000
+const char *deck_command_names[] = {"play", "stop", "seek", "swap", "end", "prefetch", "retire", "crossfade"};
+DeckCommand deck_commands[DECK_COMMAND_SLOTS];
+volatile uint32_t deck_command_write = 0;
+volatile uint32_t deck_command_read = 0;
+volatile uint32_t deck_ack_seq = 0;
+DeckAck deck_ack;
+uint32_t deck_command_seq = 0; // UI only
+TaskHandle_t deck_command_waiter = nullptr; // notified with each acknowledgement
+
+void crossfade_cancel();
+bool deck_read_track(File &file, const String &path, FileType type, bool from_sd, DeckTrack &track);
+bool deck_open_file(AudioDeck &deck, File file, FileType type, const DeckTrack &track, unsigned long seek_position);
+void deck_set_end(AudioDeck &deck, uint32_t end);
+void decode_task_run_commands();
+
+// UI side: queues a command and waits for the decode task to carry it out
+DeckAck deck_command(const DeckCommand &command) {
+    DeckAck failed = {false, 0};
+    uint32_t w = deck_command_write;
+    if (w - deck_command_read >= DECK_COMMAND_SLOTS) {
+        Serial.printf("[Deck] queue full, %s dropped\n", deck_command_names[command.type]);
+        return failed;
+    }
+    DeckCommand &slot = deck_commands[w % DECK_COMMAND_SLOTS];
+    slot = command;
+    uint32_t seq = ++deck_command_seq;
+    slot.seq = seq;
+    slot.state = DECK_SLOT_QUEUED;
+    deck_command_waiter = xTaskGetCurrentTaskHandle();
+    deck_command_write = w + 1;
+
+    if (!decode_task_handle) {
+        decode_task_run_commands(); // during setup(), before the task exists
     } else {
-        // Buffer overflow, handle error (e.g., log it)
-        Serial.println("PCM buffer overflow!");
+        xTaskNotifyGive(decode_task_handle);
+    }
+    bool running_late = false;
+    while (deck_ack_seq != seq) {
+        if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(DECK_COMMAND_TIMEOUT_MS)) || running_late) continue;
+        if (deck_ack_seq == seq) break;
+        uint32_t queued = DECK_SLOT_QUEUED;
+        if (__atomic_compare_exchange_n(&slot.state, &queued, (uint32_t)DECK_SLOT_VOID, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            Serial.printf("[Deck] %s not taken up after %u ms, cancelled\n", deck_command_names[command.type],
+                          DECK_COMMAND_TIMEOUT_MS);
+            return failed;
+        }
+        // Already running: waiting for it is the only way to know how it went
+        Serial.printf("[Deck] %s still running after %u ms\n", deck_command_names[command.type],
+                      DECK_COMMAND_TIMEOUT_MS);
+        running_late = true;
+    }
+    return deck_ack;
+}
+
+// Returns where the current deck was, for resuming later
+uint32_t deck_stop() {
+    DeckCommand command = {DECK_STOP};
+    return deck_command(command).position;
+}
+
+bool deck_play(File file, const String &path, FileType type, bool from_sd, uint32_t position, uint32_t end) {
+    DeckCommand command = {DECK_PLAY, 0, file, path, type, position, end};
+    if (!deck_read_track(file, path, type, from_sd, command.track)) {
+        deck_stop();
+        return false;
+    }
+    if (deck_command(command).ok) return true;
+    Serial.printf("[Deck] cannot play %s\n", path.c_str());
+    return false;
+}
+
+bool deck_seek(uint32_t position) {
+    DeckCommand command = {DECK_SEEK};
+    command.position = position;
+    return deck_command(command).ok;
+}
+
+void deck_swap(const String &path) {
+    DeckCommand command = {DECK_SWAP};
+    command.path = path;
+    deck_command(command);
+}
+
+bool deck_extend(uint32_t end) {
+    DeckCommand command = {DECK_END};
+    command.end = end;
+    return deck_command(command).ok;
+}
+
+bool deck_prefetch(File file, const Song &song) {
+    DeckCommand command = {DECK_PREFETCH, 0, file, song.path, song.type, song.start, song.end};
+    return deck_read_track(file, song.path, song.type, true, command.track) && deck_command(command).ok;
+}
+
+void deck_retire() {
+    DeckCommand command = {DECK_RETIRE};
+    deck_command(command);
+}
+
+// Without a file the prefetched song on the idle deck fades in
+bool deck_crossfade(File file, const Song &song, uint32_t length_frames) {
+    DeckCommand command = {DECK_XFADE_START, 0, file, song.path, song.type, song.start, song.end};
+    command.length = length_frames;
+    if (file && !deck_read_track(file, song.path, song.type, true, command.track)) return false;
+    return deck_command(command).ok;
+}
+
+// Decode task side, between chunks
+void decode_task_run_commands() {
+    while (deck_command_read != deck_command_write) {
+        DeckCommand &command = deck_commands[deck_command_read % DECK_COMMAND_SLOTS];
+        uint32_t queued = DECK_SLOT_QUEUED;
+        if (!__atomic_compare_exchange_n(&command.state, &queued, (uint32_t)DECK_SLOT_RUNNING, false,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            // Voided by the UI after a timeout
+            command.file = File();
+            deck_command_read = deck_command_read + 1;
+            continue;
+        }
+        DeckAck ack = {true, 0};
+        AudioDeck &deck = decks[current_deck];
+        AudioDeck &idle = decks[1 - current_deck];
+        switch (command.type) {
+            case DECK_PLAY:
+            case DECK_STOP:
+                crossfade_cancel();
+                if (deck.file && deck.codec) ack.position = deck.file.position();
+                deck_close(deck);
+#ifdef PCM_CAPTURE
+                if (command.type == DECK_PLAY) capture_set_label(command.path.c_str());
+#endif
+                pcm_ring_flush();
+                if (command.type == DECK_PLAY) {
+                    ack.ok = deck_open_file(deck, command.file, command.file_type, command.track, command.position);
+                    if (ack.ok && command.end) deck_set_end(deck, command.end);
+                }
+                break;
+            case DECK_SEEK:
+                ack.ok = deck.file && deck.codec && deck.codec->seek(command.position);
+                if (ack.ok) pcm_ring_flush();
+                break;
+            case DECK_SWAP:
+                crossfade_cancel();
+                deck_close(deck);
+                current_deck = 1 - current_deck;
+                prefetch_ready = false;
+#ifdef PCM_CAPTURE
+                capture_set_label(command.path.c_str());
+#endif
+                pcm_ring_flush();
+                break;
+            case DECK_END:
+                ack.ok = deck.file && deck.codec;
+                if (ack.ok) deck_set_end(deck, command.end);
+                break;
+            case DECK_RETIRE:
+                // Never while a crossfade is mixing the idle deck in; a
+                // finished or aborted one is over once its deck is closed
+                ack.ok = crossfade_state != XFADE_RUNNING;
+                if (!ack.ok) break;
+                prefetch_filling = false;
+                prefetch_ready = false;
+                deck_close(idle);
+                crossfade_state = XFADE_IDLE;
+                break;
+            case DECK_PREFETCH:
+                ack.ok = crossfade_state == XFADE_IDLE;
+                if (!ack.ok) break;
+                prefetch_filling = false;
+                prefetch_ready = false;
+                deck_close(idle);
+                ack.ok = deck_open_file(idle, command.file, command.file_type, command.track, command.position);
+                if (ack.ok && command.end) deck_set_end(idle, command.end);
+                prefetch_frames = 0;
+                prefetch_filling = ack.ok;
+                break;
+            case DECK_XFADE_START:
+                ack.ok = crossfade_state == XFADE_IDLE;
+                if (!ack.ok) break;
+                if (command.file) {
+                    prefetch_filling = false;
+                    prefetch_ready = false;
+                    deck_close(idle);
+                    ack.ok = deck_open_file(idle, command.file, command.file_type, command.track, command.position);
+                    if (ack.ok && command.end) deck_set_end(idle, command.end);
+                } else if (prefetch_filling) {
+                    // Whatever of its start is decoded so far plays first
+                    idle.preroll_pos = 0;
+                    idle.preroll_count = prefetch_frames;
+                    prefetch_filling = false;
+                } else {
+                    ack.ok = prefetch_ready;
+                }
+                if (!ack.ok) break;
+                prefetch_ready = false;
+                crossfade_begin(command.length);
+                crossfade_state = XFADE_RUNNING;
+                break;
+        }
+        command.file = File(); // the deck has its own handle
+        deck_publish();
+        deck_ack = ack;
+        deck_ack_seq = command.seq;
+        deck_command_read = deck_command_read + 1;
+        if (decode_task_handle && deck_command_waiter) xTaskNotifyGive(deck_command_waiter);
+    }
+}
+
+// Decodes the next chunk of a prefetch into prefetch_pcm; called while the
+// PCM ring is full, so the current track never waits for it
+void prefetch_fill() {
+    AudioDeck &deck = decks[1 - current_deck];
+    uint32_t filled = prefetch_frames;
+    int32_t got = deck_read_frames(deck, prefetch_pcm + filled,
+                                   min((uint32_t)DECODE_CHUNK_FRAMES, PREFETCH_FRAMES - filled));
+    if (got > 0) filled += got;
+    prefetch_frames = filled;
+    if (got <= 0 || filled == PREFETCH_FRAMES) {
+        deck.preroll_pos = 0;
+        deck.preroll_count = filled;
+        prefetch_filling = false;
+        prefetch_ready = true;
     }
 }
 
+// Current deck, mixed with the incoming one during a crossfade, then EQ
+int32_t decode_frames(Frame *frame, int32_t frame_count) {
+    AudioDeck &deck = decks[current_deck];
+    int32_t frames = deck_read_frames(deck, frame, frame_count);
+
+    if (crossfade_state == XFADE_RUNNING) {
+        if (frames < frame_count) {
+            // The outgoing track ran dry: keep the fade going on silence
+            for (int32_t i = frames; i < frame_count; i++) {
+                frame[i] = Frame(0);
+            }
+            frames = frame_count;
+        }
+        crossfade_step(frame, frames);
+    }
+    if (frames == 0) return 0;
+
+    // DSP stage: equalizer runs in place on the final stereo stream
+    eq_process((int16_t*)frame, frames * 2, 2, diag_sample_rate);
+    return frames;
+}
+
+void decode_task(void *param) {
+    static Frame chunk[DECODE_CHUNK_FRAMES];
+    for (;;) {
+        decode_task_run_commands();
+        if (pcm_ring_depth() + DECODE_CHUNK_FRAMES > jitter_target_frames()) {
+            if (prefetch_filling) {
+                task_busy_begin(TASK_DECODE);
+                {
+                    MemoryScope scope(MEM_AUDIO);
+                    prefetch_fill();
+                }
+                task_busy_end(TASK_DECODE);
+                continue;
+            }
+            // The sink wakes us once it has taken frames out
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(DECODE_IDLE_MS));
+            continue;
+        }
+        task_busy_begin(TASK_DECODE);
+        int32_t frames;
+        {
+            MemoryScope scope(MEM_AUDIO);
+            frames = decode_frames(chunk, DECODE_CHUNK_FRAMES);
+            // Before the write, so the sink never sees the last frames of a
+            // track as a gap or the first ones as the end
+            deck_publish();
+            pcm_ring_set_streaming(!deck_status.finished);
+            // Same task as the flushes, so old audio never follows one
+            pcm_ring_write(chunk, frames);
+        }
+        task_busy_end(TASK_DECODE);
+        if (frames == 0) {
+            // Nothing open, or the codec is hunting for sync
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(DECODE_IDLE_MS));
+        }
+    }
+}
+
+// Sink callback: only copies out what the decode task has queued, through
+// the jitter buffer, and always returns frame_count frames. Must not touch
+// the heap; the memory report flags it if it does
+int32_t get_data_frames(Frame *frame, int32_t frame_count) {
+    MemoryScope scope(MEM_AUDIO);
+    task_register(TASK_AUDIO_OUT);
+    task_busy_begin(TASK_AUDIO_OUT);
+    bool underrun;
+    int32_t frames = jitter_read(frame, frame_count, underrun);
+    if (underrun) {
+        // Decoding fell behind: the gap was faded and filled with silence
+        spectrum_note_underrun();
+    }
+    if (frames > 0) {
+        spectrum_tap((int16_t*)frame, frames * 2, 2, diag_sample_rate);
+        if (start_waiting && pcm_ring_flushes() != start_flushes) {
+            // First frames after the picked song's flush
+            start_latency_us = max(1UL, micros() - start_request_us);
+            start_waiting = false;
+        }
+    }
+#ifdef PCM_CAPTURE
+    capture_tap(frame, frame_count, pcm_ring_flushes());
+#endif
+    if (decode_task_handle) xTaskNotifyGive(decode_task_handle);
+    task_busy_end(TASK_AUDIO_OUT);
+    return frame_count;
+}
+
+// True once the current deck is done and the sink has played everything it
+// decoded
+bool deck_drained() {
+    return deck_status.finished && pcm_ring_depth() == 0;
+}
+
 void draw_dynamic_text(String text, int y, int x_offset, bool allow_scroll, int line_index) {
     if (line_index >= MAX_MARQUEE_LINES) return;
 
@@ -249,6 +801,7 @@ void draw_dynamic_text(String text, int y, int x_offset, bool allow_scroll, int
     display.getTextBounds(text, 0, 0, &x_b, &y_b, &w, &h);
 
     int max_width = SCREEN_WIDTH - x_offset;
+    if (!governor_marquee_enabled()) allow_scroll = false;
 
     if (w <= max_width) {
         display.setCursor(x_offset, y);
@@ -282,6 +835,17 @@ void draw_dynamic_text(String text, int y, int x_offset, bool allow_scroll, int
     }
 }
 
+// One entry of a scrolling list; only the selected entry marquees
+void draw_list_item(String text, int y_pos, int line_index, bool selected) {
+    if (selected) {
+        display.setCursor(0, y_pos);
+        display.print("> ");
+        draw_dynamic_text(text, y_pos, 12, true, line_index);
+    } else {
+        draw_dynamic_text(text, y_pos, 12, false, line_index);
+    }
+}
+
 void handle_button_press(bool is_short_press, bool is_scroll_button);
 void handle_startup();
 void handle_bt_discovery();
@@ -294,12 +858,33 @@ void handle_playlist_selection();
 void draw_playlist_ui();
 void handle_player();
 void draw_player_ui();
+void handle_tag_selection();
+void draw_tag_ui();
+bool open_tag_list(TagIndexField field, int key_index);
+void show_player_list();
+void cover_follow();
+void draw_cover();
 void draw_header(String title);
-void play_file(String filename, bool from_spiffs, unsigned long seek_position = 0);
-void play_wav(String filename, unsigned long seek_position = 0);
-void play_mp3(String filename, unsigned long seek_position = 0);
-void play_song(Song song, unsigned long seek_position = 0);
-void draw_bitmap_from_spiffs(const char *filename, int16_t x, int16_t y);
+bool play_file(String filename, FileType type, bool from_assets, unsigned long seek_position = 0, uint32_t end = 0);
+bool play_song(Song song, unsigned long seek_position = 0);
+bool play_next_song();
+int find_song_in_playlist(const Song &song, uint32_t position = 0);
+void cycle_shuffle_mode();
+void open_library();
+void library_follow();
+void scan_artists();
+void scan_playlists(String artist_name);
+bool open_album(const String &full_path);
+void restore_last_screen();
+bool restore_session_album(const String &path);
+bool bt_connect(const esp_bd_addr_t address, const String &name, int candidate);
+bool page_known_speakers(int first);
+void remember_screen();
+void draw_bitmap_asset(const char *name, int16_t x, int16_t y);
+bool deck_open(AudioDeck &deck, Song song, unsigned long seek_position);
+#ifdef HEAP_SOAK_TRACKS
+void heap_soak_test();
+#endif
 void calculate_scroll_offset(int &selected_item, int item_count, int &scroll_offset, int center_offset_ignored) {
     int display_lines = (currentState == PLAYER) ? 3 : 4;
     int center_offset = display_lines / 2;
@@ -336,76 +921,126 @@ void calculate_scroll_offset(int &selected_item, int item_count, int &scroll_off
 void esp_bt_gap_cb(esp_bt_gap_cb_event_t event, esp_bt_gap_cb_param_t *param);
 void get_bt_device_props(esp_bt_gap_cb_param_t *param);
 
+// Prints cycles per stereo frame for decode and EQ, plus the share of one
+// core that represents at the current sample rate, then resets the counters.
+void log_dsp_benchmark() {
+    EqStats eq_stats;
+    eq_get_stats(eq_stats);
+    uint32_t frames = decode_bench_frames;
+    if (frames == 0 && eq_stats.frames == 0) return;
+
+    uint32_t decode_cpf = frames ? decode_bench_cycles / frames : 0;
+    uint32_t core_hz_div = ESP.getCpuFreqMHz() * 10000;
+    audio_decode_load = decode_cpf * diag_sample_rate / core_hz_div;
+    audio_eq_load = eq_stats.cycles_per_frame * diag_sample_rate / core_hz_div;
+    spectrum_set_audio_load(audio_decode_load + audio_eq_load);
+    Serial.printf("DSP: decode %u cyc/frame (%u%% core) | EQ %s, %d bands, %u cyc/frame (%u%% core)\n",
+                  decode_cpf, audio_decode_load,
+                  eq_get_preset_name(), eq_stats.active_bands,
+                  eq_stats.cycles_per_frame, audio_eq_load);
+
+    FlacStats flac = flac_get_stats();
+    if (flac.blocks > 0 && flac.worst_sample_rate > 0) {
+        // A block must decode faster than it plays, with room left for the rest
+        uint32_t budget = (uint64_t)flac.worst_block_size * ESP.getCpuFreqMHz() * 1000000 / flac.worst_sample_rate;
+        Serial.printf("FLAC: worst block %u cyc for %u samples, %u%% of its real-time budget (%u blocks, %u errors)\n",
+                      flac.worst_cycles, flac.worst_block_size,
+                      budget ? (uint32_t)((uint64_t)flac.worst_cycles * 100 / budget) : 0,
+                      flac.blocks, flac.errors);
+        flac_reset_stats();
+    }
+
+    decode_bench_cycles = 0;
+    decode_bench_frames = 0;
+    eq_reset_stats();
+}
 
-void setup() {
-    // a 2-second delay at the very beginning, before any other code is executed
-    delay(2000); // Wait for power to stabilize
-    Serial.begin(115200);
-    while (!Serial) delay(10);
 
-    // Buttons
-    pinMode(BTN_SCROLL, INPUT_PULLUP);
+// Boot stage on the library task: brings up the card and scans the artists
+// while the main task starts Bluetooth
+volatile bool boot_sd_done = false;
+volatile bool boot_sd_ok = false;
 
-    // 1. SD init
+void boot_sd_task(void *param) {
+    task_busy_begin(TASK_LIBRARY);
+    boot_stage_begin(BOOT_SD);
     Serial.println("Initializing SD Card...");
-    bool sd_ok = false;
     for (int i = 0; i < 5; i++) {
         if (SD.begin(SD_CS)) {
-            sd_ok = true;
+            boot_sd_ok = true;
             break;
         }
         Serial.printf("SD Card init attempt %d failed\n", i + 1);
         delay(500);
     }
+    boot_stage_end(BOOT_SD);
 
-    if (!sd_ok) {
-        Serial.println("[SD] init failed after multiple attempts! Restarting...");
-        delay(1000); // delay to allow serial message to be sent
-        ESP.restart();
-    }
-    Serial.println("[SD] ready");
-
-    // 1. SPIFFS init
-    if(!SPIFFS.begin(true)){
-        Serial.println("An Error has occurred while mounting SPIFFS");
-        return;
-    }
-
-    // Create /data directory if it doesn't exist
-    if (!SD.exists("/data")) {
-        if (SD.mkdir("/data")) {
-            Serial.println("Created /data directory");
-        } else {
-            Serial.println("Failed to create /data directory");
+    if (boot_sd_ok) {
+        Serial.println("[SD] ready");
+        // Create /data directory if it doesn't exist
+        if (!SD.exists("/data")) {
+            if (SD.mkdir("/data")) {
+                Serial.println("Created /data directory");
+            } else {
+                Serial.println("Failed to create /data directory");
+            }
         }
+        boot_stage_begin(BOOT_CARD_SCAN);
+        scan_artists();
+        boot_stage_end(BOOT_CARD_SCAN);
     }
+    boot_sd_done = true;
+    task_busy_end(TASK_LIBRARY);
+    task_end(TASK_LIBRARY);
+}
 
-    // Delay before BT
-    delay(4000);
+// ---------- Library task ----------
+// The library index and the tag indexes are opened, and rebuilt when the
+// card changed, on the library task; the UI keeps running and loop() picks
+// up the result. Shuffle and the tag browser wait for library_ready().
+volatile bool library_job_running = false;
+volatile bool library_job_done = false;
+NameList library_job_artists; // the task's own copy of the artist list
+
+void library_task(void *param) {
+    task_busy_begin(TASK_LIBRARY);
+    library_open(library_job_artists);
+    task_busy_end(TASK_LIBRARY);
+    library_job_done = true;
+    task_end(TASK_LIBRARY);
+}
 
-    // 2. BT Init
-    Serial.println("Starting A2DP source...");
-    a2dp.set_on_connection_state_changed(bt_connection_state_cb);
-    a2dp.set_task_core(1);
-    a2dp.set_task_priority(2);
-    a2dp.start("winamp");
-    Serial.println("A2DP started, device name set to winamp");
+// Starts opening the library unless it is open or being opened; shuffle
+// and the tag browser call it when they need the library
+void open_library() {
+    if (library_ready() || library_job_running) return;
+    library_job_artists = artists;
+    library_job_running = true;
+    task_start(TASK_LIBRARY, library_task);
+}
 
-    esp_err_t err;
-    if ((err = esp_bt_gap_register_callback(esp_bt_gap_cb)) != ESP_OK) {
-        Serial.printf("esp_bt_gap_register_callback() FAILED: %s\n", esp_err_to_name(err));
-        return;
-    }
+// From loop(): the library task finished
+void library_follow() {
+    if (!library_job_done) return;
+    library_job_done = false;
+    library_job_running = false;
+    library_job_artists.clear();
+    if (!library_ready()) Serial.println("[Library] index could not be opened");
+    ui_dirty = true;
+}
 
-    // 3. Decoder init
-    decoder.begin();
-    decoder.setDataCallback(pcm_data_callback);
+void setup() {
+    Serial.begin(115200);
+    while (!Serial) delay(10);
 
-    // Delay before Display
-    delay(3000);
+    memory_begin();
+    task_register(TASK_UI); // setup() and loop() share the Arduino loop task
+
+    // Buttons
+    pinMode(BTN_SCROLL, INPUT_PULLUP);
 
-    // 4. Display init
-    Serial.println("Initializing Display...");
+    // 1. Display init, so there is something on screen while the rest starts
+    boot_stage_begin(BOOT_DISPLAY);
     Wire.begin(OLED_SDA, OLED_SCL);
     if(!display.begin(SSD1306_SWITCHCAPVCC, 0x3C)) {
         Serial.println(F("SSD1306 allocation failed"));
@@ -417,27 +1052,169 @@ void setup() {
     display.setCursor(25, 25);
     display.println("Winamp");
     display.display();
-    delay(2000); // Display splash
+    boot_stage_end(BOOT_DISPLAY);
+
+    // 2. Settings from NVS (known speakers, shuffle, boot settings, session)
+    // and the flash-mapped assets
+    boot_stage_begin(BOOT_SETTINGS);
+    settings_begin();
+    shuffle_begin();
+    speakers_begin();
+    boot_settings_load();
+    session_begin();
+    eq_set_preset(session_get().eq_preset < eq_preset_count ? session_get().eq_preset : 0);
+    boot_stage_end(BOOT_SETTINGS);
+    boot_stage_begin(BOOT_ASSETS);
+    assets_begin();
+    boot_stage_end(BOOT_ASSETS);
+
+    // 3. SD on the library task (core 0) in parallel with BT here
+    task_start(TASK_LIBRARY, boot_sd_task);
+
+    boot_stage_begin(BOOT_BT);
+#ifdef AUDIO_SINK_LOCAL
+    // Wired or null output: Bluetooth stays off, its memory stays free
+    is_bt_connected = sink.begin();
+    if (!is_bt_connected) Serial.printf("[Sink] %s output did not come up\n", sink.name());
+#else
+    Serial.println("Starting A2DP source...");
+    a2dp.set_on_connection_state_changed(bt_connection_state_cb);
+    a2dp.set_task_core(task_config(TASK_BT_EVENTS).core);
+    a2dp.set_task_priority(task_config(TASK_BT_EVENTS).priority);
+    a2dp.start("winamp");
+    Serial.println("A2DP started, device name set to winamp");
+
+    esp_err_t err;
+    if ((err = esp_bt_gap_register_callback(esp_bt_gap_cb)) != ESP_OK) {
+        Serial.printf("esp_bt_gap_register_callback() FAILED: %s\n", esp_err_to_name(err));
+    }
+    sink.begin();
+#endif
+    Serial.printf("[Sink] %s, %u Hz, ~%u ms output latency\n", sink.name(), sink.set_sample_rate(0), sink.latency_ms());
+    boot_stage_end(BOOT_BT);
+
+    while (!boot_sd_done) delay(10);
+    if (!boot_sd_ok) {
+        Serial.println("[SD] init failed after multiple attempts! Restarting...");
+        delay(1000); // delay to allow serial message to be sent
+        ESP.restart();
+    }
+#if defined(AUDIO_SINK_NULL) && defined(NULL_SINK_FILE)
+    output_sink.set_file(SD.open(NULL_SINK_FILE, FILE_WRITE));
+    Serial.printf("[Sink] null output goes to %s\n", NULL_SINK_FILE);
+#endif
+
+    // With Boot: resume the last track is reopened at its position once a
+    // speaker connects
+    if (boot_settings().mode == BOOT_MODE_RESUME && session_has_track() && SD.exists(session_get().path)) {
+        has_paused_song = true;
+        paused_song = {session_get().path, (FileType)session_get().type};
+        paused_song_position = session_get().position;
+    }
+
+    // 4. Library index, when shuffle was left on before the last reboot;
+    // opened on the library task while the boot carries on
+    if (shuffle_get_mode() != SHUFFLE_OFF) {
+        boot_stage_begin(BOOT_LIBRARY);
+        open_library();
+        boot_stage_end(BOOT_LIBRARY);
+    }
+
+    // 5. Decoder memory for the first deck, allocated once and kept; MP3 is
+    // the likeliest first track
+    boot_stage_begin(BOOT_AUDIO);
+    uint32_t heap_before = ESP.getFreeHeap();
+    decks[0].mp3.allocate();
+    decks[0].resident = &decks[0].mp3;
+    decks[0].resident_bytes = heap_before - ESP.getFreeHeap();
+    memory_note_alloc(MEM_AUDIO, decks[0].resident_bytes);
+    Serial.printf("[Audio] MP3 decoder allocated on deck 0: %u bytes (free %u, largest block %u)\n",
+                  decks[0].resident_bytes, ESP.getFreeHeap(), heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+    boot_stage_end(BOOT_AUDIO);
+
+#ifdef HEAP_SOAK_TRACKS
+    heap_soak_test();
+#endif
+    decode_task_handle = task_start(TASK_DECODE, decode_task);
+
+    // 6. Spectrum analyzer task (core 0)
+    boot_stage_begin(BOOT_SPECTRUM);
+    spectrum_begin();
+    boot_stage_end(BOOT_SPECTRUM);
+
+    // 7. Cover art task (core 0, idle priority)
+    cover_begin();
+#ifdef PCM_CAPTURE
+    capture_begin();
+#endif
+
+    boot_print_profile();
 }
 
 
 void loop() {
+    task_busy_begin(TASK_UI);
     // --- Volume control ---
     int pot_value = analogRead(POT_PIN);
     int new_volume = map(pot_value, 0, 4095, 0, 127);
     if (abs(new_volume - current_volume) > 1) { // Dead zone to prevent noise
         current_volume = new_volume;
-        a2dp.set_volume(current_volume);
+        sink.set_volume(current_volume);
         ui_dirty = true;
     }
 
      // --- Logs ---
+     memory_update();
      static unsigned long last_heap_log = 0;
      if (millis() - last_heap_log > 2000) {
-         Serial.printf("Free heap: %d bytes | Decoder: sample_rate=%d, bps=%d, channels=%d\n",
-                       ESP.getFreeHeap(), diag_sample_rate, diag_bits_per_sample, diag_channels);
+         Serial.printf("Free heap: %d bytes (largest block %u) | Decoder: sample_rate=%d, bps=%d, channels=%d\n",
+                       ESP.getFreeHeap(), heap_caps_get_largest_free_block(MALLOC_CAP_8BIT),
+                       diag_sample_rate, diag_bits_per_sample, diag_channels);
+         log_dsp_benchmark();
+#ifdef AUDIO_SINK_NULL
+         Serial.printf("[Sink] null: %u frames played\n", output_sink.frames_played());
+#endif
          last_heap_log = millis();
      }
+     eq_update();
+     task_stats_update();
+     governor_update(audio_decode_load + audio_eq_load, jitter_underruns());
+     jitter_log();
+     static unsigned long last_memory_report = 0;
+     if (millis() - last_memory_report > MEMORY_REPORT_INTERVAL_MS) {
+         memory_report();
+         last_memory_report = millis();
+     }
+     library_follow();
+     for (AudioDeck &deck : decks) {
+         if (deck.first_pcm_ms) {
+             Serial.printf("[Tags] first audio %u ms after open, %u tag bytes skipped\n",
+                           deck.first_pcm_ms, deck.data_start);
+             deck.first_pcm_ms = 0;
+         }
+         if (deck.alloc_bytes) {
+             Serial.printf("[Audio] %s decoder allocated on deck %d: %u bytes (free %u, largest block %u)\n",
+                           deck.alloc_codec, &deck == &decks[0] ? 0 : 1, deck.alloc_bytes,
+                           ESP.getFreeHeap(), heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+             deck.alloc_bytes = 0;
+         }
+         // Every codec of the deck: deck.codec may change under us
+         deck.mp3.log_events();
+         deck.flac.log_events();
+         deck.m4a.log_events();
+     }
+     if (start_latency_us) {
+         static uint32_t start_count[2], start_total_ms[2]; // cold, prefetched
+         uint32_t ms = start_latency_us / 1000;
+         start_count[start_prefetched]++;
+         start_total_ms[start_prefetched] += ms;
+         Serial.printf("[Player] button to first audio: %u ms (%s) + ~%u ms in the %s sink; average cold %u ms (%u), prefetched %u ms (%u)\n",
+                       ms, start_prefetched ? "prefetched" : "cold", sink.latency_ms(), sink.name(),
+                       start_count[0] ? start_total_ms[0] / start_count[0] : 0, start_count[0],
+                       start_count[1] ? start_total_ms[1] / start_count[1] : 0, start_count[1]);
+         start_latency_us = 0;
+         start_request_us = 0;
+     }
 
     // --- Button handling ---
     bool current_scroll = !digitalRead(BTN_SCROLL);
@@ -460,7 +1237,7 @@ void loop() {
 
     // --- State machine ---
     bool should_refresh_for_marquee = false;
-    for (int i = 0; i < MAX_MARQUEE_LINES; i++) {
+    for (int i = 0; governor_marquee_enabled() && i < MAX_MARQUEE_LINES; i++) {
         if (is_marquee_active[i]) {
             should_refresh_for_marquee = true;
             break;
@@ -471,6 +1248,10 @@ void loop() {
         ui_dirty = true;
     }
 
+    // Spectrum analyzer only runs while its bars are on screen, and is the
+    // first effect to go when the governor sheds load
+    spectrum_set_enabled(currentState == PLAYER && is_playing && governor_effects_enabled());
+
     switch (currentState) {
         case STARTUP:
             handle_startup();
@@ -496,8 +1277,13 @@ void loop() {
         case PLAYER:
             handle_player();
             break;
+        case TAG_SELECTION:
+            handle_tag_selection();
+            break;
     }
-    delay(120);
+    remember_screen();
+    task_busy_end(TASK_UI);
+    delay(governor_ui_interval_ms());
 }
 
 
@@ -521,39 +1307,41 @@ void handle_button_press(bool is_short_press, bool is_scroll_button) {
                 esp_bt_gap_cancel_discovery();
                 is_scanning = false;
 
-                // Connect to the device
-                is_connecting = true;
-                if (a2dp.connect_to(selected_device.address)) {
-                    connection_start_time = millis();
-                    // Save the address to SPIFFS
-                    File file = SPIFFS.open("/bt_address.txt", FILE_WRITE);
-                    if (file) {
-                        char addr_str[18];
-                        sprintf(addr_str, "%02x:%02x:%02x:%02x:%02x:%02x", selected_device.address[0], selected_device.address[1], selected_device.address[2], selected_device.address[3], selected_device.address[4], selected_device.address[5]);
-                        file.print(addr_str);
-                        file.close();
-                        Serial.println("Saved BT address to SPIFFS.");
-                    } else {
-                        Serial.println("Failed to save BT address.");
-                    }
-
-                    currentState = BT_CONNECTING;
-                } else {
+                // Connect to the device; it joins the known speakers once connected
+                connect_timer_start = millis();
+                if (!bt_connect(selected_device.address, selected_device.name, -1)) {
                     Serial.println("Failed to connect.");
-                    is_connecting = false;
                     // Go back to scanning
                     is_scanning = false;
                 }
             }
         }
+    } else if (currentState == BT_CONNECTING || currentState == BT_RECONNECTING) {
+        if (is_scroll_button && !is_short_press) { // Long press: stop trying, scan instead
+            Serial.println("Connect cancelled. Returning to discovery.");
+            a2dp.disconnect();
+            is_connecting = false;
+            page_candidate = -1;
+            reconnect_start_time = 0;
+            currentState = BT_DISCOVERY;
+            ui_dirty = true;
+        }
     } else if (currentState == ARTIST_SELECTION) {
         if (is_scroll_button && is_short_press) { // Scroll with short press
             selected_artist++;
-            calculate_scroll_offset(selected_artist, artists.size(), artist_scroll_offset, 2);
+            calculate_scroll_offset(selected_artist, artists.size() + TAG_INDEX_COUNT, artist_scroll_offset, 2);
             for (int i=0; i<MAX_MARQUEE_LINES; ++i) is_marquee_active[i] = false;
             ui_dirty = true;
         } else if (is_scroll_button && !is_short_press) { // Select with long press
-            if (!artists.empty()) {
+            if (selected_artist >= artists.size()) {
+                // A "By ..." row: the keys of that tag index
+                browse_field = (TagIndexField)(selected_artist - artists.size());
+                selected_tag_key = 0;
+                tag_key_scroll_offset = 0;
+                open_library();
+                currentState = TAG_SELECTION;
+                ui_dirty = true;
+            } else if (!artists.empty()) {
                 // Clear playlist data from any previous artist selection
                 playlists.clear();
                 selected_playlist = 0;
@@ -580,65 +1368,139 @@ void handle_button_press(bool is_short_press, bool is_scroll_button) {
                 String playlist_name = playlists[selected_playlist];
                 String full_path = "/" + artist_name + "/" + playlist_name;
                 Serial.printf("Selected playlist: %s\n", full_path.c_str());
-
-                // Scan for mp3 and wav files in the selected playlist folder
-                current_playlist_files.clear();
-                File playlist_folder = SD.open(full_path);
-                File file = playlist_folder.openNextFile();
-                while(file) {
-                    if (!file.isDirectory()) {
-                        String fileName = String(file.name());
-                        String lowerCaseFileName = fileName;
-                        lowerCaseFileName.toLowerCase();
-                        if (lowerCaseFileName.endsWith(".mp3")) {
-                            current_playlist_files.push_back({full_path + "/" + fileName, MP3});
-                        } else if (lowerCaseFileName.endsWith(".wav")) {
-                            current_playlist_files.push_back({full_path + "/" + fileName, WAV});
-                        }
-                    }
-                    file = playlist_folder.openNextFile();
-                }
-                playlist_folder.close();
-
-                if (!current_playlist_files.empty()) {
-                    current_song_index = 0;
-                    selected_song_in_player = 0;
-                    player_scroll_offset = 0;
-                    song_started = false;
-                    ui_dirty = true;
-                    currentState = PLAYER;
-                } else {
-                    Serial.println("No mp3 files found in this playlist!");
-                }
+                open_album(full_path);
+            }
+        }
+    } else if (currentState == TAG_SELECTION) {
+        int key_count = library_ready() ? tag_index_key_count(browse_field) : 0;
+        if (is_scroll_button && is_short_press) { // Scroll with short press
+            selected_tag_key++;
+            calculate_scroll_offset(selected_tag_key, key_count + 1, tag_key_scroll_offset, 2);
+            for (int i=0; i<MAX_MARQUEE_LINES; ++i) is_marquee_active[i] = false;
+            ui_dirty = true;
+        } else if (is_scroll_button && !is_short_press) { // Select with long press
+            if (selected_tag_key == key_count) {
+                // This is the "back" button
+                currentState = ARTIST_SELECTION;
+                ui_dirty = true;
+            } else {
+                open_tag_list(browse_field, selected_tag_key);
             }
         }
     } else if (currentState == PLAYER) {
         if (is_scroll_button && is_short_press) { // Scroll through songs
             selected_song_in_player++;
-            calculate_scroll_offset(selected_song_in_player, current_playlist_files.size() + 1, player_scroll_offset, 2);
+            calculate_scroll_offset(selected_song_in_player, current_playlist_files.size() + PLAYER_MENU_COUNT, player_scroll_offset, 2);
             for (int i=0; i<MAX_MARQUEE_LINES; ++i) is_marquee_active[i] = false;
             ui_dirty = true;
         } else if (is_scroll_button && !is_short_press) { // Select and play a song
-            if (selected_song_in_player == current_playlist_files.size()) {
+            int menu_entry = selected_song_in_player - (int)current_playlist_files.size();
+            if (menu_entry == PLAYER_MENU_EQ) {
+                // Cycle through the EQ presets
+                eq_set_preset((eq_get_preset() + 1) % eq_preset_count);
+                session_set_eq(eq_get_preset());
+                ui_dirty = true;
+            } else if (menu_entry == PLAYER_MENU_FADE) {
+                // Cycle through the crossfade overlap lengths
+                crossfade_cycle_length();
+                ui_dirty = true;
+            } else if (menu_entry == PLAYER_MENU_SHUFFLE) {
+                cycle_shuffle_mode();
+                ui_dirty = true;
+            } else if (menu_entry == PLAYER_MENU_PICK) {
+                pick_to_queue = !pick_to_queue;
+                ui_dirty = true;
+            } else if (menu_entry == PLAYER_MENU_BOOT) {
+                boot_settings().mode = (boot_settings().mode + 1) % BOOT_MODE_COUNT;
+                boot_settings_save();
+                ui_dirty = true;
+            } else if (menu_entry == PLAYER_MENU_BACK) {
                 // This is the "back" button
-                currentState = PLAYLIST_SELECTION;
+                currentState = player_from_tags ? TAG_SELECTION : PLAYLIST_SELECTION;
+                ui_dirty = true;
+            } else if (pick_to_queue && song_started) {
+                Song song = current_playlist_files[selected_song_in_player];
+                if (queue_push(song)) {
+                    Serial.printf("Queued %s (%d in queue)\n", song.path.c_str(), queue_count());
+                } else {
+                    Serial.println("Play queue is full.");
+                }
                 ui_dirty = true;
             } else if (current_song_index != selected_song_in_player || !song_started) {
                 current_song_index = selected_song_in_player;
-                play_song(current_playlist_files[current_song_index], 0);
+                start_request_us = micros();
+                if (!play_song(current_playlist_files[current_song_index], 0)) play_next_song();
             }
         }
     }
 }
 
 
+// Once the output is up: back to the interrupted song, the last screen, or
+// the jingle
+void enter_first_screen() {
+    sink.set_volume(current_volume);
+    if (has_paused_song && current_playlist_files.empty() && !restore_session_album(paused_song.path)) {
+        // Not in an album folder any more (or never was): nothing to show it in
+        Serial.printf("[Session] %s is not in an album on the card, not resuming\n", paused_song.path.c_str());
+        has_paused_song = false;
+        paused_song_position = 0;
+        session_clear();
+    }
+    if (has_paused_song) {
+        Serial.printf("[Session] resuming %s at byte %lu\n", paused_song.path.c_str(), paused_song_position);
+        currentState = PLAYER;
+    } else if (boot_settings().mode != BOOT_MODE_SPLASH) {
+        restore_last_screen();
+    } else {
+        currentState = SAMPLE_PLAYBACK;
+    }
+}
+
 void handle_startup() {
-    // Always start with BT discovery
+#ifdef AUDIO_SINK_LOCAL
+    // No speaker to find: the sink came up in setup()
+    ui_dirty = true;
+    enter_first_screen();
+    return;
+#endif
     bt_discovery_scroll_offset = 0;
     ui_dirty = true;
+    // Known speakers are paged directly; discovery only if none answers
+    connect_timer_start = millis();
+    if (page_known_speakers(0)) return;
     currentState = BT_DISCOVERY;
 }
 
+// Starts a connection and switches to BT_CONNECTING. candidate is the known
+// speaker index when paging them in turn.
+bool bt_connect(const esp_bd_addr_t address, const String &name, int candidate) {
+    esp_bd_addr_t peer;
+    memcpy(peer, address, ESP_BD_ADDR_LEN);
+    memcpy(connecting_address, address, ESP_BD_ADDR_LEN);
+    connecting_name = name;
+    page_candidate = candidate;
+    is_connecting = true;
+    if (!a2dp.connect_to(peer)) {
+        is_connecting = false;
+        return false;
+    }
+    connection_start_time = millis();
+    currentState = BT_CONNECTING;
+    ui_dirty = true;
+    return true;
+}
+
+// Pages the known speakers from index first on, most recently used first
+bool page_known_speakers(int first) {
+    for (int i = first; i < speakers_count(); i++) {
+        const KnownSpeaker &speaker = speakers_get(i);
+        Serial.printf("[BT] paging known speaker %s\n", speaker.name);
+        if (bt_connect(speaker.address, speaker.name, i)) return true;
+    }
+    return false;
+}
+
 void draw_bt_discovery_ui();
 
 void esp_bt_gap_cb(esp_bt_gap_cb_event_t event, esp_bt_gap_cb_param_t *param);
@@ -646,6 +1508,7 @@ void get_bt_device_props(esp_bt_gap_cb_param_t *param);
 void attempt_auto_connect();
 
 void esp_bt_gap_cb(esp_bt_gap_cb_event_t event, esp_bt_gap_cb_param_t *param) {
+    MemoryScope scope(MEM_BT);
     switch (event) {
         case ESP_BT_GAP_DISC_RES_EVT:
             get_bt_device_props(param);
@@ -719,45 +1582,32 @@ void get_bt_device_props(esp_bt_gap_cb_param_t *param) {
     ui_dirty = true;
 }
 
+// After a scan: connect to the most recently used known speaker it found
 void attempt_auto_connect() {
     if (is_connecting) {
         return; // Don't try to auto-connect if we're already connecting
     }
-    File file = SPIFFS.open("/bt_address.txt", FILE_READ);
-    if (!file) {
-        Serial.println("No saved BT address found.");
-        return;
-    }
-
-    String addr_str = file.readString();
-    file.close();
-    if (addr_str.length() != 17) {
-        Serial.printf("Invalid BT address length in SPIFFS: %d\n", addr_str.length());
+    if (speakers_count() == 0) {
+        Serial.println("No known speakers.");
         return;
     }
 
-    esp_bd_addr_t saved_addr;
-    sscanf(addr_str.c_str(), "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx", &saved_addr[0], &saved_addr[1], &saved_addr[2], &saved_addr[3], &saved_addr[4], &saved_addr[5]);
-
-    // Check if the saved device is in our discovered list
-    for (const auto& device : bt_devices) {
-        if (memcmp(device.address, saved_addr, ESP_BD_ADDR_LEN) == 0) {
-            Serial.printf("Saved device %s found in scan results. Attempting to connect...\n", addr_str.c_str());
+    for (int i = 0; i < speakers_count(); i++) {
+        const KnownSpeaker &speaker = speakers_get(i);
+        for (const auto& device : bt_devices) {
+            if (memcmp(device.address, speaker.address, ESP_BD_ADDR_LEN) != 0) continue;
+            Serial.printf("Known speaker %s found in scan results. Attempting to connect...\n", speaker.name);
             esp_bt_gap_cancel_discovery();
-            is_connecting = true;
-            if (a2dp.connect_to(saved_addr)) {
-                connection_start_time = millis();
-                currentState = BT_CONNECTING;
+            connect_timer_start = millis();
+            if (bt_connect(device.address, device.name, -1)) {
                 return;
-            } else {
-                Serial.println("Failed to connect to saved device.");
-                is_connecting = false;
-                is_scanning = false; // a new scan will start after the timeout
             }
+            Serial.println("Failed to connect to known speaker.");
+            is_scanning = false; // a new scan will start after the timeout
         }
     }
 
-    Serial.println("Saved device not found in scan results.");
+    Serial.println("No known speaker in scan results.");
 }
 
 void handle_bt_discovery() {
@@ -786,29 +1636,56 @@ void handle_bt_discovery() {
 void handle_bt_connecting() {
     display.clearDisplay();
     draw_header("Connecting...");
+    display.setCursor(0, 26);
+    display.print(connecting_name);
     display.display();
 
     if (is_bt_connected) {
-        Serial.println("Connection established.");
+        Serial.printf("[BT] connected to %s in %lu ms (%lu ms after power-on)\n",
+                      connecting_name.c_str(), millis() - connect_timer_start, millis());
         is_connecting = false;
-        a2dp.set_volume(current_volume);
-        if (paused_song_index != -1) {
-            currentState = PLAYER;
-        } else {
-            currentState = SAMPLE_PLAYBACK;
-        }
-    } else if (millis() - connection_start_time > 15000) { // 15 second timeout
-        Serial.println("Connection timeout. Returning to discovery.");
+        page_candidate = -1;
+        speakers_touch(connecting_address, connecting_name.c_str());
+        enter_first_screen();
+        return;
+    }
+
+    // A refused page reports DISCONNECTED well before the timeout
+    unsigned long elapsed = millis() - connection_start_time;
+    bool refused = !is_connecting && elapsed > 500;
+    if (refused || elapsed > (page_candidate >= 0 ? BT_PAGE_TIMEOUT_MS : BT_CONNECT_TIMEOUT_MS)) {
+        Serial.printf("[BT] %s did not answer after %lu ms\n", connecting_name.c_str(), elapsed);
+        a2dp.disconnect(); // kill the pending page before the next one
         is_bt_connected = false;
         is_connecting = false;
+        if (page_candidate >= 0 && page_known_speakers(page_candidate + 1)) {
+            return;
+        }
+        Serial.println("Connection timeout. Returning to discovery.");
+        page_candidate = -1;
         currentState = BT_DISCOVERY;
+        ui_dirty = true;
     }
 }
 
+// Pages the known speakers in rounds, most recently used first, with the
+// pause between rounds doubling up to BT_RECONNECT_MAX_MS. Never gives up on
+// its own; a long press goes back to discovery.
 void handle_bt_reconnecting() {
-    static unsigned long reconnect_start_time = 0;
+    static unsigned long next_round_time = 0;
+    static unsigned long backoff_ms = BT_RECONNECT_MIN_MS;
+    static unsigned long attempt_start = 0;
+    static bool attempt_pending = false;
+    static int candidate = 0;
+    static int attempts = 0;
     if (reconnect_start_time == 0) {
         reconnect_start_time = millis();
+        next_round_time = millis();
+        backoff_ms = BT_RECONNECT_MIN_MS;
+        attempt_pending = false;
+        candidate = 0;
+        attempts = 0;
+        is_connecting = false;
     }
 
     if (ui_dirty) {
@@ -817,22 +1694,63 @@ void handle_bt_reconnecting() {
         display.setTextColor(SSD1306_WHITE);
         display.setCursor(0, 0);
         display.println("Reconnecting...");
+        if (attempts > 0) {
+            display.printf("%d tries, %lus apart\n", attempts, backoff_ms / 1000);
+        }
+        display.println("Hold to scan instead");
         display.display();
         ui_dirty = false;
     }
 
     if (is_bt_connected) {
-        Serial.println("Reconnection successful.");
+        Serial.printf("[BT] reconnected to %s in %lu ms, %d attempts\n",
+                      connecting_name.c_str(), millis() - reconnect_start_time, attempts);
+        speakers_touch(connecting_address, connecting_name.c_str());
+        is_connecting = false;
         reconnect_start_time = 0; // Reset for next time
         currentState = PLAYER;
         ui_dirty = true;
-    } else if (millis() - reconnect_start_time > 15000) { // 15 second timeout
-        Serial.println("Reconnection timeout. Returning to discovery.");
+        return;
+    }
+    if (speakers_count() == 0) {
+        Serial.println("No known speakers. Returning to discovery.");
         reconnect_start_time = 0; // Reset for next time
-        is_connecting = false;
-        a2dp.disconnect(); // try to kill any pending connection
         currentState = BT_DISCOVERY;
         ui_dirty = true;
+        return;
+    }
+
+    if (attempt_pending) {
+        // A refused page reports DISCONNECTED well before the timeout
+        unsigned long elapsed = millis() - attempt_start;
+        bool refused = !is_connecting && elapsed > 500;
+        if (!refused && elapsed < BT_PAGE_TIMEOUT_MS) return;
+        a2dp.disconnect(); // kill any pending page
+        is_connecting = false;
+        attempt_pending = false;
+        if (++candidate >= speakers_count()) {
+            // Round over: wait, then try the whole list again
+            candidate = 0;
+            next_round_time = millis() + backoff_ms;
+            backoff_ms = min(backoff_ms * 2, (unsigned long)BT_RECONNECT_MAX_MS);
+            ui_dirty = true;
+        }
+        return;
+    }
+    if ((long)(millis() - next_round_time) < 0) return;
+
+    const KnownSpeaker &speaker = speakers_get(candidate);
+    memcpy(connecting_address, speaker.address, ESP_BD_ADDR_LEN);
+    connecting_name = speaker.name;
+    attempts++;
+    attempt_start = millis();
+    attempt_pending = true;
+    is_connecting = true;
+    Serial.printf("[BT] reconnect attempt %d: paging %s\n", attempts, speaker.name);
+    esp_bd_addr_t peer;
+    memcpy(peer, speaker.address, ESP_BD_ADDR_LEN);
+    if (!a2dp.connect_to(peer)) {
+        is_connecting = false; // counted as refused on the next pass
     }
 }
 
@@ -851,7 +1769,7 @@ void handle_sample_playback() {
     if (ui_dirty) {
         display.clearDisplay();
         draw_header("Winamp"); // Add a header for consistency
-        draw_bitmap_from_spiffs("/splash.bmp", 10, 12); // Adjust y-pos for header
+        draw_bitmap_asset("splash", 10, 12); // Adjust y-pos for header
         display.display();
         ui_dirty = false;
     }
@@ -859,7 +1777,7 @@ void handle_sample_playback() {
     // Check for BT disconnection
     if (!is_bt_connected) {
         Serial.println("BT disconnected during sample playback. Entering reconnecting state.");
-        if (audioFile) audioFile.close();
+        deck_stop();
         // Reset state for next time
         splash_start_time = 0;
         sound_started = false;
@@ -868,16 +1786,16 @@ void handle_sample_playback() {
         return;
     }
 
-    // After 5 seconds, start playing the sound (if not already started)
-    if (millis() - splash_start_time >= 5000 && !sound_started) {
-        play_file("/sample.mp3", true);
+    // Give the new A2DP link a moment, then start the jingle
+    if (millis() - splash_start_time >= SPLASH_JINGLE_DELAY_MS && !sound_started) {
+        play_file("sample.mp3", MP3, true);
         sound_started = true;
         is_playing = true;
         song_started = true; // Use song_started to be consistent with main player
     }
 
-    bool song_finished = sound_started && audioFile && !audioFile.available();
-    bool timeout_reached = millis() - splash_start_time >= 20000;
+    bool song_finished = sound_started && deck_drained();
+    bool timeout_reached = millis() - splash_start_time >= SPLASH_TIMEOUT_MS;
 
     // Transition when song finishes or timeout is reached
     if (song_finished || timeout_reached) {
@@ -885,13 +1803,10 @@ void handle_sample_playback() {
         if(timeout_reached) Serial.println("Sample playback timed out.");
 
         // Stop sample playback if it's still going
-        if (sound_started && audioFile) {
-             a2dp.set_data_callback_in_frames(nullptr);
-        }
-
-        if (audioFile) {
-            audioFile.close();
+        if (sound_started && deck_status.open) {
+             sink.stop();
         }
+        deck_stop();
 
         // Reset state for next time
         splash_start_time = 0;
@@ -907,10 +1822,11 @@ void handle_sample_playback() {
 }
 
 void scan_artists() {
+    MemoryScope scope(MEM_LIBRARY);
     artists.clear();
 
     // Step 1: Always scan the SD card to get the current state
-    std::vector<String> current_artists_on_sd;
+    NameList current_artists_on_sd;
     File root = SD.open("/");
     if (!root) {
         Serial.println("Failed to open SD root");
@@ -927,8 +1843,8 @@ void scan_artists() {
             if (artist_dir) {
                 File album_file = artist_dir.openNextFile();
                 while(album_file) {
-                    // We're looking for at least one non-hidden subdirectory (album)
-                    if (album_file.isDirectory() && album_file.name()[0] != '.') {
+                    // We're looking for at least one non-hidden subdirectory (album) or playlist file
+                    if (album_file.name()[0] != '.' && (album_file.isDirectory() || playlist_is_file(album_file.name()))) {
                         is_empty = false;
                         album_file.close(); // Found one, no need to check further
                         break;
@@ -1029,6 +1945,7 @@ void draw_header(String title) {
 void draw_bt_discovery_ui() {
     if (!ui_dirty) return;
     ui_dirty = false;
+    MemoryScope scope(MEM_UI);
     display.clearDisplay();
     draw_header("Select BT Speaker");
 
@@ -1066,11 +1983,12 @@ void draw_bt_discovery_ui() {
 }
 
 void scan_playlists(String artist_name) {
+    MemoryScope scope(MEM_LIBRARY);
     playlists.clear();
     String artist_path = "/" + artist_name;
 
     // Step 1: Always scan the artist folder to get the current state
-    std::vector<String> current_albums_on_sd;
+    NameList current_albums_on_sd;
     File artist_dir = SD.open(artist_path);
     if (!artist_dir) {
         Serial.printf("Failed to open artist directory: %s\n", artist_path.c_str());
@@ -1088,10 +2006,8 @@ void scan_playlists(String artist_name) {
                 File song_file = album_dir.openNextFile();
                 while(song_file) {
                     if (!song_file.isDirectory()) {
-                        String fileName = String(song_file.name());
-                        String lowerCaseFileName = fileName;
-                        lowerCaseFileName.toLowerCase();
-                        if (lowerCaseFileName.endsWith(".mp3") || lowerCaseFileName.endsWith(".wav")) {
+                        FileType type;
+                        if (song_type_from_path(song_file.name(), type)) {
                             is_empty = false;
                             song_file.close();
                             break;
@@ -1104,6 +2020,9 @@ void scan_playlists(String artist_name) {
             if (!is_empty) {
                 current_albums_on_sd.push_back(file.name());
             }
+        } else if (file.name()[0] != '.' && playlist_is_file(file.name())) {
+            // .m3u/.pls files list next to the albums and open like one
+            current_albums_on_sd.push_back(file.name());
         }
         file = artist_dir.openNextFile();
     }
@@ -1156,6 +2075,7 @@ void scan_playlists(String artist_name) {
 void draw_artist_ui() {
     if (!ui_dirty) return;
     ui_dirty = false;
+    MemoryScope scope(MEM_UI);
     display.clearDisplay();
     draw_header("Select Artist");
 
@@ -1164,10 +2084,14 @@ void draw_artist_ui() {
         display.print("No artists found!");
     } else {
         int list_size = artists.size();
-        for (int i = artist_scroll_offset; i < list_size && i < artist_scroll_offset + 4; i++) {
+        for (int i = artist_scroll_offset; i < list_size + TAG_INDEX_COUNT && i < artist_scroll_offset + 4; i++) {
             int y_pos = 12 + (i - artist_scroll_offset) * 10;
             String name;
-            name = artists[i];
+            if (i >= list_size) { // After the artists, the tag indexes
+                name = "By " + String(tag_index_label((TagIndexField)(i - list_size))) + "...";
+            } else {
+                name = artists[i];
+            }
             int line_index = i - artist_scroll_offset + 1;
             if (i == selected_artist) {
                 display.setCursor(0, y_pos);
@@ -1190,6 +2114,9 @@ void handle_artist_selection() {
     }
     if (artists.empty()) {
         scan_artists();
+        if (shuffle_get_mode() != SHUFFLE_OFF) {
+            open_library(); // shuffle was left on before the last reboot
+        }
     }
     draw_artist_ui();
 }
@@ -1198,6 +2125,7 @@ void handle_artist_selection() {
 void draw_playlist_ui() {
     if (!ui_dirty) return;
     ui_dirty = false;
+    MemoryScope scope(MEM_UI);
     display.clearDisplay();
     draw_header("Select Playlist");
 
@@ -1246,184 +2174,745 @@ void handle_playlist_selection() {
     draw_playlist_ui();
 }
 
+// Shown while a CUE sheet's seek table is built, like open_library()
+void draw_cue_progress(uint32_t percent) {
+    display.clearDisplay();
+    draw_header("CUE sheet");
+    display.setCursor(0, 26);
+    display.printf("Indexing... %u%%", percent);
+    display.display();
+    ui_dirty = true;
+}
+
+// A CUE sheet in an album folder: the file it splits is listed as its
+// tracks instead, where the file was
+void apply_cue_sheet(const String &sheet) {
+    SongList tracks;
+    if (!cue_load(sheet, tracks, draw_cue_progress)) return;
+    size_t from = 0;
+    while (from < tracks.size()) {
+        size_t to = from;
+        while (to < tracks.size() && tracks[to].path == tracks[from].path) to++;
+        auto whole = current_playlist_files.begin();
+        while (whole != current_playlist_files.end() && (whole->path != tracks[from].path || whole->end)) whole++;
+        if (whole != current_playlist_files.end()) {
+            whole = current_playlist_files.erase(whole);
+            current_playlist_files.insert(whole, tracks.begin() + from, tracks.begin() + to);
+        }
+        from = to;
+    }
+}
+
+// Lists the playable files of an album folder, or the tracks of a playlist
+// file, and switches to the player
+bool open_album(const String &full_path) {
+    MemoryScope scope(MEM_LIBRARY);
+    current_playlist_files.clear();
+    if (playlist_is_file(full_path)) {
+        // Titles come with the playlist; reading tags from folders all over
+        // the card would make a long one slow to open
+        playlist_load(full_path, current_playlist_files);
+    } else {
+        NameList cue_sheets;
+        File playlist_folder = SD.open(full_path);
+        File file = playlist_folder.openNextFile();
+        while(file) {
+            FileType type;
+            if (!file.isDirectory() && song_type_from_path(file.name(), type)) {
+                current_playlist_files.push_back({full_path + "/" + String(file.name()), type});
+            } else if (!file.isDirectory() && file.name()[0] != '.' && cue_is_file(file.name())) {
+                cue_sheets.push_back(full_path + "/" + String(file.name()));
+            }
+            file = playlist_folder.openNextFile();
+        }
+        playlist_folder.close();
+        tags_load_titles(current_playlist_files);
+        for (const auto &sheet : cue_sheets) {
+            apply_cue_sheet(sheet);
+        }
+    }
+
+    if (current_playlist_files.empty()) {
+        Serial.println("No mp3 files found in this playlist!");
+        return false;
+    }
+    current_album_path = full_path;
+    player_from_tags = false;
+    show_player_list();
+    return true;
+}
+
+// Switches to the player on a freshly filled current_playlist_files
+void show_player_list() {
+    selected_song_in_player = 0;
+    player_scroll_offset = 0;
+    if (pick_to_queue && is_playing) {
+        // Browsing to queue songs: keep the current song playing
+        current_song_index = find_song_in_playlist(now_playing);
+    } else {
+        current_song_index = 0;
+        song_started = false;
+        next_song_ready = false;
+    }
+    ui_dirty = true;
+    currentState = PLAYER;
+}
+
+// The tracks filed under one key of a tag index, in the player
+bool open_tag_list(TagIndexField field, int key_index) {
+    MemoryScope scope(MEM_LIBRARY);
+    TagIndexKey key;
+    if (!tag_index_key(field, key_index, key) || !tag_index_tracks(field, key_index, current_playlist_files) ||
+        current_playlist_files.empty()) {
+        Serial.println("No tracks found for this tag!");
+        return false;
+    }
+    Serial.printf("Selected %s: %s (%d tracks)\n", tag_index_label(field), key.name, (int)current_playlist_files.size());
+    player_title = key.name;
+    player_from_tags = true;
+    show_player_list();
+    return true;
+}
+
+void draw_tag_ui() {
+    if (!ui_dirty) return;
+    ui_dirty = false;
+    MemoryScope scope(MEM_UI);
+    display.clearDisplay();
+    draw_header("By " + String(tag_index_label(browse_field)));
+
+    // Only "back" while the library task is still building the indexes
+    int list_size = library_ready() ? tag_index_key_count(browse_field) : 0;
+    if (list_size == 0) {
+        display.setCursor(0, 14);
+        display.print(library_job_running ? "Indexing..." : "No tags indexed.");
+    }
+    for (int i = tag_key_scroll_offset; i < list_size + 1 && i < tag_key_scroll_offset + 4; i++) {
+        int y_pos = 26 + (i - tag_key_scroll_offset) * 10;
+        int line_index = i - tag_key_scroll_offset + 1;
+        bool selected = i == selected_tag_key;
+        TagIndexKey key;
+        if (i == list_size) { // After the last key, show "back"
+            draw_list_item("<- back", y_pos, line_index, selected);
+        } else if (tag_index_key(browse_field, i, key)) {
+            draw_list_item(String(key.name) + " (" + String(key.count) + ")", y_pos, line_index, selected);
+        }
+    }
+    display.display();
+}
+
+void handle_tag_selection() {
+    if (!is_bt_connected) {
+        Serial.println("BT disconnected during tag browsing. Entering reconnecting state.");
+        currentState = BT_RECONNECTING;
+        ui_dirty = true;
+        return;
+    }
+    draw_tag_ui();
+}
+
+// Straight back to a browse screen without walking the menus: the artist
+// list with artist highlighted, its album list, or the album open in the
+// player, as far as the card still matches. True if it got all the way.
+bool restore_screen(AppState screen, const String &artist_name, const String &album_path) {
+    currentState = ARTIST_SELECTION;
+    ui_dirty = true;
+    if (artists.empty()) scan_artists();
+
+    int artist = -1;
+    for (int i = 0; i < artists.size(); i++) {
+        if (artists[i] == artist_name) artist = i;
+    }
+    if (artist < 0) return false;
+    selected_artist = artist;
+    calculate_scroll_offset(selected_artist, artists.size(), artist_scroll_offset, 2);
+    if (screen == ARTIST_SELECTION) return true;
+
+    currentState = PLAYLIST_SELECTION;
+    scan_playlists(artists[artist]);
+    selected_playlist = 0;
+    bool album_found = false;
+    for (int i = 0; i < playlists.size(); i++) {
+        if ("/" + artists[artist] + "/" + playlists[i] == album_path) {
+            selected_playlist = i;
+            album_found = true;
+        }
+    }
+    calculate_scroll_offset(selected_playlist, playlists.size() + 1, playlist_scroll_offset, 2);
+    if (screen != PLAYER) return true;
+    return album_found && open_album(album_path);
+}
+
+// Fast boot: back to the browse screen that was open last
+void restore_last_screen() {
+    const BootSettings &boot = boot_settings();
+    restore_screen((AppState)boot.last_screen, boot.artist, boot.album);
+    Serial.printf("[Boot] fast boot back to %s\n", boot.last_screen == PLAYER ? boot.album : boot.artist);
+}
+
+// A track resumed from the session: open its album around it. Its path is
+// /Artist/Album/file; false for any other path, or an album that is gone.
+bool restore_session_album(const String &path) {
+    int album_end = path.lastIndexOf('/');
+    int artist_end = path.indexOf('/', 1);
+    if (album_end <= 0 || artist_end <= 0 || artist_end >= album_end) return false;
+    return restore_screen(PLAYER, path.substring(1, artist_end), path.substring(0, album_end));
+}
+
+// Keeps the browse screen in the boot settings. Only screen changes are
+// saved, not every scroll step, to spare the flash.
+void remember_screen() {
+    static AppState remembered = STARTUP;
+    static String remembered_album;
+    if (currentState < ARTIST_SELECTION) return;
+    if (remembered == STARTUP) boot_milestone("first screen");
+    if (currentState == TAG_SELECTION || (currentState == PLAYER && player_from_tags)) return; // folder screens only
+    if (currentState == remembered && (currentState != PLAYER || current_album_path == remembered_album)) return;
+    remembered = currentState;
+    remembered_album = current_album_path;
+
+    BootSettings &boot = boot_settings();
+    BootSettings updated = boot;
+    updated.last_screen = currentState;
+    memset(updated.artist, 0, sizeof(updated.artist));
+    memset(updated.album, 0, sizeof(updated.album));
+    if (selected_artist < artists.size()) {
+        strncpy(updated.artist, artists[selected_artist].c_str(), sizeof(updated.artist) - 1);
+    }
+    if (currentState == PLAYER) {
+        strncpy(updated.album, current_album_path.c_str(), sizeof(updated.album) - 1);
+    }
+    if (memcmp(&updated, &boot, sizeof(boot)) != 0) {
+        boot = updated;
+        boot_settings_save();
+    }
+}
+
+// The title tag when there is one, the file name otherwise
+String song_display_name(const Song &song) {
+    if (song.title.length() > 0) return song.title;
+    String name = song.path;
+    int last_slash = name.lastIndexOf('/');
+    if (last_slash != -1) {
+        name = name.substring(last_slash + 1);
+    }
+    int dot = name.lastIndexOf('.');
+    if (dot > 0) {
+        name = name.substring(0, dot);
+    }
+    return name;
+}
+
 void draw_player_ui() {
     if (!ui_dirty) return;
     ui_dirty = false;
+    MemoryScope scope(MEM_UI);
 
     display.clearDisplay();
     draw_header("Now Playing");
 
     // Header
-    String artist_name = artists[selected_artist];
-    String album_name = playlists[selected_playlist];
-    String header_text = artist_name + " - " + album_name;
+    String header_text = player_title;
+    if (!player_from_tags && selected_artist < (int)artists.size() && selected_playlist < (int)playlists.size()) {
+        header_text = artists[selected_artist] + " - " + playlists[selected_playlist];
+    }
     draw_dynamic_text(header_text, 12, 0, true, 0);
+    if (is_playing) {
+        spectrum_draw(display, 80, 12, 48, 9);
+    }
     display.drawLine(0, 22, 127, 22, SSD1306_WHITE);
 
     // Currently Playing Song
-    if (!current_playlist_files.empty()) {
-        String playing_song = current_playlist_files[current_song_index].path;
-        int last_slash = playing_song.lastIndexOf('/');
-        if (last_slash != -1) {
-            playing_song = playing_song.substring(last_slash + 1);
-        }
-        playing_song.replace(".mp3", "");
-        playing_song.replace(".wav", "");
-        draw_dynamic_text(">> " + playing_song, 24, 0, true, 1);
+    if (now_playing.path.length() > 0) {
+        draw_dynamic_text(">> " + song_display_name(now_playing), 24, 0, true, 1);
     }
     display.drawLine(0, 34, 127, 34, SSD1306_WHITE);
 
     // Playlist
     if (!current_playlist_files.empty()) {
         int list_size = current_playlist_files.size();
-        for (int i = player_scroll_offset; i < list_size + 1 && i < player_scroll_offset + 3; i++) {
+        for (int i = player_scroll_offset; i < list_size + PLAYER_MENU_COUNT && i < player_scroll_offset + 3; i++) {
             int y_pos = 38 + (i - player_scroll_offset) * 10;
             int line_index = i - player_scroll_offset + 2;
+            bool selected = i == selected_song_in_player;
 
-            if (i == list_size) { // After the last song, show "back"
-                if (i == selected_song_in_player) {
-                    display.setCursor(0, y_pos);
-                    display.print("> ");
-                    draw_dynamic_text("<- back", y_pos, 12, true, line_index);
-                } else {
-                    draw_dynamic_text("<- back", y_pos, 12, false, line_index);
+            if (i >= list_size) { // After the last song, show the settings and "back"
+                switch (i - list_size) {
+                    case PLAYER_MENU_EQ:
+                        draw_list_item("EQ: " + String(eq_get_preset_name()), y_pos, line_index, selected);
+                        break;
+                    case PLAYER_MENU_FADE:
+                        draw_list_item(crossfade_label(), y_pos, line_index, selected);
+                        break;
+                    case PLAYER_MENU_SHUFFLE:
+                        draw_list_item(shuffle_label(), y_pos, line_index, selected);
+                        break;
+                    case PLAYER_MENU_PICK:
+                        if (pick_to_queue) {
+                            draw_list_item("Pick: queue (" + String(queue_count()) + ")", y_pos, line_index, selected);
+                        } else {
+                            draw_list_item("Pick: play", y_pos, line_index, selected);
+                        }
+                        break;
+                    case PLAYER_MENU_BOOT:
+                        draw_list_item(boot_mode_label(), y_pos, line_index, selected);
+                        break;
+                    default:
+                        draw_list_item("<- back", y_pos, line_index, selected);
+                        break;
                 }
             } else {
-                String song_name = current_playlist_files[i].path;
-                int last_slash = song_name.lastIndexOf('/');
-                if (last_slash != -1) {
-                    song_name = song_name.substring(last_slash + 1);
-                }
-                song_name.replace(".mp3", "");
-                song_name.replace(".wav", "");
-
-                if (i == selected_song_in_player) {
-                    display.setCursor(0, y_pos);
-                    display.print("> ");
-                    draw_dynamic_text(song_name, y_pos, 12, true, line_index);
-                } else {
-                    draw_dynamic_text(song_name, y_pos, 12, false, line_index);
-                }
+                draw_list_item(song_display_name(current_playlist_files[i]), y_pos, line_index, selected);
             }
         }
     }
+    draw_cover();
 
     display.display();
 }
 
-void play_file(String filename, bool from_spiffs, unsigned long seek_position) {
-    if (audioFile) {
-        audioFile.close();
+// Asks for the playing album's thumbnail and picks it up once the cover
+// task has it; an album change drops the old one straight away
+void cover_follow() {
+    if (cover_request(now_playing)) {
+        player_cover_ready = false;
+        ui_dirty = true;
+    }
+    if (cover_take(player_cover)) {
+        player_cover_ready = true;
+        ui_dirty = true;
     }
+}
 
-    if (from_spiffs) {
-        audioFile = SPIFFS.open(filename);
-    } else {
-        audioFile = SD.open(filename);
+// The thumbnail in the bottom right corner, over the ends of the list rows.
+// It is already in page layout, so each page is a plain copy.
+void draw_cover() {
+    if (!player_cover_ready) return;
+    int x = SCREEN_WIDTH - COVER_SIZE;
+    int first_page = (SCREEN_HEIGHT - COVER_SIZE) / 8;
+    display.fillRect(x - 2, first_page * 8, 2, COVER_SIZE, SSD1306_BLACK);
+    uint8_t *buffer = display.getBuffer();
+    for (int p = 0; p < COVER_SIZE / 8; p++) {
+        memcpy(buffer + (first_page + p) * SCREEN_WIDTH + x, player_cover + p * COVER_SIZE, COVER_SIZE);
     }
+}
 
-    if (!audioFile) {
-        Serial.printf("Failed to open file: %s\n", filename.c_str());
-        return;
+// UI side, before a deck command: for compressed formats the tags are read
+// so the codec starts right at the audio and stops before any trailing
+// APE/ID3v1 tag; an M4A's sample tables are found in moov
+bool deck_read_track(File &file, const String &path, FileType type, bool from_sd, DeckTrack &track) {
+    memset(&track, 0, sizeof(track));
+    track.read_us = micros();
+    if (type == WAV) {
+        track.tags.audio_end = file.size();
+        return true;
+    }
+    tags_read(file, path, track.tags, from_sd);
+    if (type == M4A && !m4a_read_track(file, track.tags.audio_start, track.tags.audio_end, track.m4a)) {
+        Serial.printf("[M4A] cannot play %s\n", path.c_str());
+        return false;
     }
+    return true;
+}
 
-    if (seek_position > 0) {
-        if (audioFile.seek(seek_position)) {
-            Serial.printf("Resuming from position %lu\n", seek_position);
-            // a small buffer to scan for the sync word
-            char sync_buf[3];
-            // the MP3 sync word is 0xFFF*, so we check for the first 12 bits
-            while (audioFile.available()) {
-                int byte1 = audioFile.read();
-                if (byte1 == 0xFF) {
-                    int byte2 = audioFile.read();
-                    if ((byte2 & 0xE0) == 0xE0) {
-                        // MP3 sync word found, seek back two bytes and start playing
-                        audioFile.seek(audioFile.position() - 2);
-                        break;
-                    }
-                }
-            }
-        } else {
-            Serial.printf("Failed to seek to position %lu\n", seek_position);
+// Prepares an already opened file on a deck, with what deck_read_track()
+// found. Runs on the decode task, so it logs nothing itself; loop() reports
+// the decoder memory it took.
+bool deck_open_file(AudioDeck &deck, File file, FileType type, const DeckTrack &track, unsigned long seek_position) {
+    deck.open_us = track.read_us;
+    deck.file = file;
+    deck.type = type;
+    deck.tags = track.tags;
+    deck.data_start = track.tags.audio_start;
+    deck.data_end = track.tags.audio_end;
+    switch (type) {
+        case WAV: deck.codec = &deck.wav; break;
+        case FLAC: deck.codec = &deck.flac; break;
+        case M4A: deck.codec = &deck.m4a; break;
+        default: deck.codec = &deck.mp3; break;
+    }
+
+    // One compressed codec's memory per deck; the same format as the last
+    // track reuses it as is
+    if (deck.codec != &deck.wav && deck.resident != deck.codec) {
+        if (deck.resident) deck.resident->release();
+        memory_note_free(MEM_AUDIO, deck.resident_bytes);
+        deck.resident = deck.codec;
+        deck.resident_bytes = 0;
+    }
+
+    uint32_t heap_before = ESP.getFreeHeap();
+    bool opened = type == M4A ? deck.m4a.open_track(deck.file, deck.data_start, deck.data_end, track.m4a)
+                              : deck.codec->open(deck.file, deck.data_start, deck.data_end);
+    if (!opened) {
+        deck_close(deck);
+        return false;
+    }
+    uint32_t heap_after = ESP.getFreeHeap();
+    uint32_t cost = heap_before > heap_after ? heap_before - heap_after : 0;
+    if (cost > 0) {
+        memory_note_alloc(MEM_AUDIO, cost);
+        deck.resident_bytes += cost;
+        deck.alloc_codec = deck.codec->name();
+        deck.alloc_bytes = cost;
+        if (&deck != &decks[current_deck]) {
+            // This is the second decoder running alongside the current one
+            crossfade_note_decoder_cost(cost);
         }
     }
 
-    // Reset PCM buffer to prevent overflow from previous playback
-    memset(pcm_buffer, 0, sizeof(pcm_buffer));
-    pcm_buffer_len = 0;
+    if (seek_position > deck.data_start) {
+        deck.codec->seek(seek_position);
+    }
+    deck.first_pcm_ms = 0;
+    deck.first_pcm_pending = true;
+    return true;
+}
 
-    // A2DP stream reconfigure
-    esp_a2d_media_ctrl(ESP_A2D_MEDIA_CTRL_CHECK_SRC_RDY);
+bool deck_open(AudioDeck &deck, Song song, unsigned long seek_position) {
+    File file = SD.open(song.path);
+    if (!file) {
+        Serial.printf("Failed to open file: %s\n", song.path.c_str());
+        return false;
+    }
+    DeckTrack track;
+    if (!deck_read_track(file, song.path, song.type, true, track) ||
+        !deck_open_file(deck, file, song.type, track, max(seek_position, (unsigned long)song.start))) {
+        Serial.printf("Cannot play %s\n", song.path.c_str());
+        return false;
+    }
+    if (song.end) deck_set_end(deck, song.end);
+    return true;
+}
 
-    decoder.end();
-    decoder.begin();
-    decoder.setDataCallback(pcm_data_callback);
-    a2dp.set_data_callback_in_frames(get_data_frames);
-    Serial.printf("Playing %s from %s\n", filename.c_str(), from_spiffs ? "SPIFFS" : "SD");
+// A CUE track stops decoding at its end; moving the end on lets the same
+// deck carry on into the next track. Never past the audio of the file.
+void deck_set_end(AudioDeck &deck, uint32_t end) {
+    if (deck.codec) deck.codec->set_end(min(end, deck.data_end));
 }
 
-void play_wav(String filename, unsigned long seek_position) {
-    if (audioFile) {
-        audioFile.close();
+#ifdef HEAP_SOAK_TRACKS
+// Soak build only (env:esp32dev-soak): plays HEAP_SOAK_SECONDS of
+// HEAP_SOAK_TRACKS library tracks, alternating decks the way a crossfade
+// does, so each track opens while the one before is still open on the other
+// deck. Free heap and the largest free block are taken with both decks
+// open and kept per format of the new track, since what a decoder costs
+// depends on its format. Each format passes if its lowest values in the
+// second half of the run are no worse than in the first half.
+#define HEAP_SOAK_SECONDS 2
+#define HEAP_SOAK_TOLERANCE 1024
+struct SoakStats {
+    uint32_t tracks[2];     // first half, second half
+    uint32_t low_free[2];
+    uint32_t low_block[2];
+};
+void heap_soak_test() {
+    static const char *const format_names[] = {"MP3", "WAV", "FLAC", "M4A"};
+    static Frame frames[256];
+    open_library();
+    while (library_job_running && !library_job_done) delay(100);
+    library_follow();
+    uint32_t count = library_track_count();
+    if (count == 0) {
+        Serial.println("[Soak] library is empty, skipped");
+        return;
     }
 
-    WavHeader header;
-    if (!parse_wav_header(filename, header)) {
-        return;
+    SoakStats stats[4];
+    for (SoakStats &s : stats) s = {{0, 0}, {UINT32_MAX, UINT32_MAX}, {UINT32_MAX, UINT32_MAX}};
+    Serial.printf("[Soak] %d tracks from a library of %u, %d s each\n", HEAP_SOAK_TRACKS, count, HEAP_SOAK_SECONDS);
+    for (int i = 0; i < HEAP_SOAK_TRACKS; i++) {
+        AudioDeck &deck = decks[i & 1];
+        deck_close(deck); // the track before last
+        Song song;
+        if (!library_get_song(i % count, song) || !deck_open(deck, song, 0)) continue;
+        int32_t want = deck_sample_rate(deck) * HEAP_SOAK_SECONDS;
+        while (want > 0 && !deck_finished(deck)) {
+            int32_t n = deck_read_frames(deck, frames, min(want, (int32_t)256));
+            if (n <= 0) break;
+            want -= n;
+        }
+
+        uint32_t free_heap = ESP.getFreeHeap();
+        uint32_t block = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+        SoakStats &s = stats[song.type];
+        int half = i * 2 >= HEAP_SOAK_TRACKS;
+        s.tracks[half]++;
+        s.low_free[half] = min(s.low_free[half], free_heap);
+        s.low_block[half] = min(s.low_block[half], block);
+        if (i % 50 == 0) {
+            Serial.printf("[Soak] track %d (%s, deck %d): free %u, largest block %u\n",
+                          i, format_names[song.type], i & 1, free_heap, block);
+        }
     }
+    deck_close(decks[0]);
+    deck_close(decks[1]);
+
+    bool all_flat = true;
+    for (int f = 0; f < 4; f++) {
+        const SoakStats &s = stats[f];
+        if (!s.tracks[0] || !s.tracks[1]) continue; // not played in both halves
+        bool flat = s.low_free[1] + HEAP_SOAK_TOLERANCE >= s.low_free[0] &&
+                    s.low_block[1] + HEAP_SOAK_TOLERANCE >= s.low_block[0];
+        all_flat = all_flat && flat;
+        Serial.printf("[Soak] %s %s: %u + %u tracks, lowest free %u -> %u, smallest largest block %u -> %u\n",
+                      format_names[f], flat ? "flat" : "SHRANK", s.tracks[0], s.tracks[1],
+                      s.low_free[0], s.low_free[1], s.low_block[0], s.low_block[1]);
+    }
+    Serial.printf("[Soak] %s\n", all_flat ? "PASS" : "FAIL");
+}
+#endif
 
-    audioFile = SD.open(filename);
-    if (!audioFile) {
+// Drops any crossfade in progress, e.g. when the user picks another song.
+// Runs on the decode task, as part of a deck command.
+void crossfade_cancel() {
+    if (crossfade_state == XFADE_IDLE) return;
+    crossfade_state = XFADE_IDLE;
+    deck_close(decks[1 - current_deck]);
+}
+
+bool play_file(String filename, FileType type, bool from_assets, unsigned long seek_position, uint32_t end) {
+    File file;
+    if (from_assets) {
+        file = assets_open(filename.c_str());
+    } else {
+        file = SD.open(filename);
+    }
+
+    if (!file) {
         Serial.printf("Failed to open file: %s\n", filename.c_str());
-        return;
+        deck_stop();
+        return false;
     }
 
-    // Seek past the header
-    audioFile.seek(sizeof(WavHeader));
-    if (seek_position > 0) {
-        audioFile.seek(seek_position + sizeof(WavHeader));
+    // The old track stops and the new one opens in one step on the decode task
+    if (!deck_play(file, filename, type, !from_assets, seek_position, end)) {
+        return false;
     }
+    sink.set_sample_rate(deck_status.sample_rate);
+    sink.start(get_data_frames);
+    Serial.printf("Playing %s (%s) from %s\n", filename.c_str(), deck_status.codec, from_assets ? "flash" : "SD");
+    return true;
+}
 
-    diag_sample_rate = header.sample_rate;
-    diag_bits_per_sample = header.bit_depth;
-    diag_channels = header.num_channels;
+// Closes a prefetched song that was not picked, or stops one still filling
+void prefetch_drop() {
+    if (prefetch_ready || prefetch_filling) deck_retire();
+}
 
-    // A2DP stream reconfigure
-    esp_a2d_media_ctrl(ESP_A2D_MEDIA_CTRL_CHECK_SRC_RDY);
+// Opens the highlighted song on the idle deck once it has been highlighted
+// long enough; one attempt per song, so a file that fails is not retried
+void prefetch_update() {
+    if (!prefetch_logged && prefetch_ready) {
+        prefetch_logged = true;
+        Serial.printf("[Prefetch] %s: %u frames in %lu ms\n", prefetch_song.path.c_str(),
+                      prefetch_frames, millis() - prefetch_started);
+    }
+    if (selected_song_in_player != prefetch_highlight) {
+        prefetch_highlight = selected_song_in_player;
+        prefetch_highlight_since = millis();
+        return;
+    }
+    if (millis() - prefetch_highlight_since < PREFETCH_DWELL_MS) return;
+    if (prefetch_highlight >= (int)current_playlist_files.size()) return; // a menu entry
+    if (song_started && prefetch_highlight == current_song_index) return;
+    const Song &song = current_playlist_files[prefetch_highlight];
+    if (song_same(prefetch_song, song)) return;
+    if (crossfade_state != XFADE_IDLE || pick_to_queue || !governor_background_allowed()) return;
+    if (ESP.getFreeHeap() < PREFETCH_MIN_FREE_HEAP) return;
+
+    prefetch_drop();
+    prefetch_song = song;
+    prefetch_started = millis();
+    File file = SD.open(song.path);
+    if (!file) {
+        Serial.printf("Failed to open file: %s\n", song.path.c_str());
+        return;
+    }
+    // The decode task opens it on the idle deck and decodes its start
+    prefetch_logged = !deck_prefetch(file, song);
+}
 
-    a2dp.set_data_callback_in_frames(get_wav_data_frames);
-    esp_a2d_media_ctrl(ESP_A2D_MEDIA_CTRL_START);
-    Serial.printf("Playing WAV file: %s\n", filename.c_str());
-    is_playing = true;
-    song_started = true;
+// Starts the song from the idle deck when it is the prefetched one
+bool prefetch_take(const Song &song, unsigned long seek_position) {
+    if (!prefetch_ready || !song_same(prefetch_song, song) || seek_position != 0) return false;
+    deck_swap(song.path);
+    prefetch_song = Song();
+
+    sink.set_sample_rate(deck_status.sample_rate);
+    sink.start(get_data_frames);
+    Serial.printf("Playing %s (%s) from prefetch\n", song.path.c_str(), deck_status.codec);
+    return true;
+}
+
+// A song without a range (resumed from the session, or from the library)
+// finds the CUE track of its file that holds position
+int find_song_in_playlist(const Song &song, uint32_t position) {
+    for (int i = 0; i < current_playlist_files.size(); i++) {
+        const Song &entry = current_playlist_files[i];
+        if (entry.path != song.path) continue;
+        if (song.end ? entry.start == song.start : !entry.end || position < entry.end) {
+            return i;
+        }
+    }
+    return -1;
 }
 
-void play_mp3(String filename, unsigned long seek_position) {
-    play_file(filename, false, seek_position);
-    esp_a2d_media_ctrl(ESP_A2D_MEDIA_CTRL_START);
+bool play_song(Song song, unsigned long seek_position) {
+    crossfade_skipped = false;
+    current_song_index = find_song_in_playlist(song, seek_position);
+    if (!song.end && current_song_index >= 0 && current_playlist_files[current_song_index].end) {
+        song = current_playlist_files[current_song_index]; // keep to its CUE track
+    }
+    now_playing = song;
+    cue_extended = false;
+    if (next_song_ready && next_song_from_album) {
+        next_song_ready = false; // album order follows the new song instead
+    }
+    uint32_t flushes = pcm_ring_flushes();
+    bool prefetched = prefetch_take(song, seek_position);
+    if (!prefetched && !play_file(song.path, song.type, false, max(seek_position, (unsigned long)song.start), song.end)) {
+        start_request_us = 0;
+        return false;
+    }
+    if (start_request_us && !start_waiting) {
+        start_flushes = flushes;
+        start_prefetched = prefetched;
+        start_waiting = true;
+    }
     is_playing = true;
     song_started = true;
+    if (now_playing.title.length() == 0) now_playing.title = decks[current_deck].tags.title;
+    // A CUE track starts at its own offset, not at the start of the file
+    session_set_track(song, max(seek_position, (unsigned long)song.start));
+    return true;
 }
 
-void play_song(Song song, unsigned long seek_position) {
-    if (song.type == MP3) {
-        play_mp3(song.path, seek_position);
-    } else if (song.type == WAV) {
-        play_wav(song.path, seek_position);
+// Decides what plays after the current song: the play queue first, then the
+// shuffle permutation, then album order
+bool pick_next_song() {
+    if (next_song_ready) return true;
+    next_song_from_album = false;
+    if (queue_pop(next_song) || shuffle_next(next_song)) {
+        next_song_ready = true;
+        return true;
+    }
+    if (current_playlist_files.empty()) return false;
+    int next = current_song_index + 1;
+    if (next >= current_playlist_files.size()) {
+        next = 0;
+    }
+    next_song = current_playlist_files[next];
+    next_song_from_album = true;
+    next_song_ready = true;
+    return true;
+}
+
+// A song that won't open (gone from the card since its playlist was cached)
+// is skipped; after a full round of failures the player gives up
+bool play_next_song() {
+    int attempts = max((int)current_playlist_files.size(), 1);
+    while (attempts-- > 0) {
+        if (!pick_next_song()) break;
+        next_song_ready = false;
+        if (play_song(next_song, 0)) return true;
+    }
+    is_playing = false;
+    return false;
+}
+
+// CUE tracks of one file play on without a reopen. As soon as the next song
+// is known to be the following track, the deck's end moves on to its end;
+// once decoding crosses into it the player only relabels, a ring's depth
+// before the new track is heard.
+void cue_follow() {
+    if (!now_playing.end || crossfade_state != XFADE_IDLE || !deck_status.open) return;
+    if (!cue_extended) {
+        if (!pick_next_song()) return;
+        if (next_song.path != now_playing.path || next_song.start != now_playing.end || !next_song.end) return;
+        cue_extended = deck_extend(next_song.end);
+        return;
+    }
+    if (deck_status.position < now_playing.end) return;
+    if (!next_song_ready || next_song.path != now_playing.path || next_song.start != now_playing.end) {
+        // Another next song was picked since (shuffle switched on, say)
+        play_next_song();
+        return;
+    }
+    next_song_ready = false;
+    now_playing = next_song;
+    cue_extended = false;
+    current_song_index = find_song_in_playlist(now_playing);
+    session_set_track(now_playing, now_playing.start);
+    Serial.printf("[CUE] on into %s\n", song_display_name(now_playing).c_str());
+    ui_dirty = true;
+}
+
+// Off -> this artist -> whole library -> off. The library index is opened
+// (and built on first use) when shuffle is switched on.
+void cycle_shuffle_mode() {
+    ShuffleMode mode = shuffle_get_mode();
+    if (mode == SHUFFLE_OFF) {
+        mode = SHUFFLE_ARTIST;
+    } else if (mode == SHUFFLE_ARTIST) {
+        mode = SHUFFLE_LIBRARY;
+    } else {
+        mode = SHUFFLE_OFF;
+    }
+    if (mode != SHUFFLE_OFF) {
+        open_library();
+    }
+    shuffle_set_mode(mode, selected_artist);
+    if (next_song_ready && !next_song_from_album) {
+        // A pre-picked song comes from the old order; the queue is never dropped
+        if (crossfade_state == XFADE_IDLE) next_song_ready = false;
     }
+    Serial.println(shuffle_label());
+}
+
+// Opens the next song on the idle deck and arms the fade. One attempt per
+// track change; without headroom the track change stays a plain cut.
+void start_crossfade() {
+    crossfade_skipped = true;
+    if (!crossfade_has_headroom(audio_decode_load * 2 + audio_eq_load)) {
+        return;
+    }
+    if (!pick_next_song()) {
+        return;
+    }
+
+    int sample_rate = deck_status.sample_rate ? deck_status.sample_rate : 44100;
+    File file;
+    if (!(prefetch_ready || prefetch_filling) || !song_same(prefetch_song, next_song)) {
+        // Not already open on the idle deck: the decode task opens it there
+        file = SD.open(next_song.path);
+        if (!file) {
+            Serial.printf("Failed to open file: %s\n", next_song.path.c_str());
+            return;
+        }
+    }
+    if (!deck_crossfade(file, next_song, crossfade_get_ms() * sample_rate / 1000)) {
+        return;
+    }
+    prefetch_song = Song();
+    crossfade_song = next_song;
+    next_song_ready = false;
+    Serial.printf("[Crossfade] %u ms into %s\n", crossfade_get_ms(), crossfade_song.path.c_str());
 }
 
 void handle_player() {
     if (!is_bt_connected) {
         Serial.println("BT disconnected during playback. Entering reconnecting state.");
-        if (audioFile) {
-            paused_song_index = current_song_index;
-            paused_song_position = audioFile.position();
-            audioFile.close();
-            Serial.printf("Pausing song %d at position %lu\n", paused_song_index, paused_song_position);
+        uint32_t position = deck_stop();
+        if (position) {
+            has_paused_song = true;
+            paused_song = now_playing;
+            paused_song_position = position;
+            Serial.printf("Pausing %s at position %lu\n", paused_song.path.c_str(), paused_song_position);
+            session_set_position(paused_song_position);
+            session_save(true);
+            shuffle_save(true);
         }
-        decoder.end();
         song_started = false;
         is_playing = false;
         currentState = BT_RECONNECTING;
@@ -1432,134 +2921,120 @@ void handle_player() {
     }
 
     if (!song_started) {
-        if (paused_song_index != -1) {
-            current_song_index = paused_song_index;
-            play_song(current_playlist_files[current_song_index], paused_song_position);
-            paused_song_index = -1;
+        bool started;
+        if (has_paused_song) {
+            started = play_song(paused_song, paused_song_position);
+            has_paused_song = false;
             paused_song_position = 0;
         } else {
-            play_song(current_playlist_files[current_song_index], 0);
+            if (current_song_index < 0) current_song_index = 0;
+            started = play_song(current_playlist_files[current_song_index], 0);
+        }
+        if (!started && !play_next_song()) {
+            Serial.println("Nothing playable in this list.");
+            song_started = true; // not retried every loop
         }
     }
 
-    // The audio data is now handled by the a2dp_data_callback.
-    // We just need to check if the file has finished and play the next one.
-    if (is_playing && audioFile && !audioFile.available()) {
-        Serial.println("Song finished, playing next.");
-        current_song_index++;
-        if (current_song_index >= current_playlist_files.size()) {
-            current_song_index = 0;
-        }
-        play_song(current_playlist_files[current_song_index], 0);
+    // The decode task swaps decks at the end of a fade; the old one is retired
+    // there too, which makes the crossfade idle again
+    if (crossfade_state == XFADE_DONE) {
+        deck_retire();
+        now_playing = crossfade_song;
+        cue_extended = false;
+        if (now_playing.title.length() == 0) now_playing.title = decks[current_deck].tags.title;
+        current_song_index = find_song_in_playlist(now_playing);
+        session_set_track(now_playing, deck_status.position);
+        crossfade_skipped = false;
+        Serial.println("Crossfade finished.");
         ui_dirty = true;
+    } else if (crossfade_state == XFADE_ABORTED) {
+        deck_retire();
+        next_song = crossfade_song; // still the next song, just without the fade
+        next_song_ready = true;
+        Serial.println("[Crossfade] track formats differ, cutting instead");
     }
 
-    draw_player_ui();
-}
-
-// Helper function to read a 16-bit value from a file
-uint16_t read16(File &f) {
-  uint16_t result;
-  ((uint8_t *)&result)[0] = f.read(); // LSB
-  ((uint8_t *)&result)[1] = f.read(); // MSB
-  return result;
-}
+    if (is_playing && crossfade_state == XFADE_IDLE && !crossfade_skipped && crossfade_get_ms() > 0 &&
+        deck_status.remaining_ms <= crossfade_get_ms()) {
+        start_crossfade();
+    }
 
-// Helper function to read a 32-bit value from a file
-uint32_t read32(File &f) {
-  uint32_t result;
-  ((uint8_t *)&result)[0] = f.read(); // LSB
-  ((uint8_t *)&result)[1] = f.read();
-  ((uint8_t *)&result)[2] = f.read();
-  ((uint8_t *)&result)[3] = f.read(); // MSB
-  return result;
-}
+    if (is_playing) cue_follow();
+    cover_follow();
 
-void draw_bitmap_from_spiffs(const char *filename, int16_t x, int16_t y) {
-  File bmpFile;
-  int bmpWidth, bmpHeight;
-  uint8_t bmpDepth;
-  uint32_t bmpImageoffset;
-  uint8_t sdbuffer[3 * SCREEN_WIDTH]; // 3 * 128 = 384
+    // The decode task does the audio; here we only check whether the file
+    // has finished and been played out, and play the next one.
+    if (is_playing && crossfade_state == XFADE_IDLE && deck_drained()) {
+        Serial.println("Song finished, playing next.");
+        play_next_song();
+        ui_dirty = true;
+    }
 
-  if ((x >= display.width()) || (y >= display.height()))
-    return;
+    // Position for the session; written at most once per interval
+    if (is_playing && deck_status.open) {
+        session_set_position(deck_status.position);
+        // Flash writes wait while the governor is shedding load
+        if (governor_background_allowed()) {
+            session_save(false);
+            shuffle_save(false);
+        }
+    }
 
-  bmpFile = SPIFFS.open(filename, "r");
-  if (!bmpFile) {
-    Serial.print("File not found: ");
-    Serial.println(filename);
-    return;
-  }
+    prefetch_update();
 
-  // Parse BMP header
-  if (read16(bmpFile) != 0x4D42) {
-    Serial.println("Invalid BMP signature");
-    return;
-  }
+    if (spectrum_frame_ready()) {
+        ui_dirty = true;
+    }
 
-  read32(bmpFile); // File size
-  read32(bmpFile); // Creator
-  bmpImageoffset = read32(bmpFile);
-  read32(bmpFile); // Header size
-  bmpWidth = read32(bmpFile);
-  bmpHeight = read32(bmpFile);
+    draw_player_ui();
+}
 
-  if (read16(bmpFile) != 1) {
-    Serial.println("Unsupported BMP format (planes)");
+// ORs a packed 1-bpp asset into the display buffer. Source rows are already
+// in SSD1306 page order, so a y that is not a multiple of 8 just splits each
+// byte across two pages.
+void draw_bitmap_asset(const char *name, int16_t x, int16_t y) {
+  const AssetEntry *asset = assets_find(name);
+  if (!asset || asset->type != ASSET_BITMAP) {
+    Serial.printf("Bitmap asset not found: %s\n", name);
     return;
   }
-
-  bmpDepth = read16(bmpFile);
-  if ((bmpDepth != 24) || (read32(bmpFile) != 0)) { // 24-bit, no compression
-    Serial.println("Unsupported BMP format (depth or compression)");
+  if (x < 0 || y < 0 || x >= display.width() || y >= display.height())
     return;
-  }
 
-  // BMP rows are padded (if needed) to 4-byte boundary
-  uint32_t rowSize = (bmpWidth * 3 + 3) & ~3;
-
-  // If bmpHeight is negative, image is in top-down order.
-  // This is not common but has been observed in the wild.
-  bool flip = true;
-  if (bmpHeight < 0) {
-    bmpHeight = -bmpHeight;
-    flip = false;
-  }
-
-  // Crop area to be loaded
-  int w = bmpWidth;
-  int h = bmpHeight;
-  if ((x + w - 1) >= display.width())
-    w = display.width() - x;
-  if ((y + h - 1) >= display.height())
-    h = display.height() - y;
-
-  for (int j = 0; j < h; j++) {
-    int row = flip ? bmpHeight - 1 - j : j;
-    bmpFile.seek(bmpImageoffset + row * rowSize);
-    if (bmpFile.read(sdbuffer, sizeof(sdbuffer)) != sizeof(sdbuffer)) {
-      // Serial.println("file.read failed");
-    }
+  const uint8_t *src = assets_data(asset);
+  uint8_t *buffer = display.getBuffer();
+  int w = min((int)asset->width, display.width() - x);
+  int pages = (asset->height + 7) / 8;
+  int screen_pages = display.height() / 8;
+  int shift = y & 7;
+
+  for (int p = 0; p < pages; p++) {
+    int page = y / 8 + p;
+    if (page >= screen_pages) break;
+    const uint8_t *row = src + p * asset->width;
+    uint8_t *dst = buffer + page * display.width() + x;
     for (int i = 0; i < w; i++) {
-      // Convert 24-bit color to 1-bit for OLED
-      uint8_t r = sdbuffer[i * 3 + 2];
-      uint8_t g = sdbuffer[i * 3 + 1];
-      uint8_t b = sdbuffer[i * 3];
-      if ((r + g + b) > 128 * 3) {
-        display.drawPixel(x + i, y + j, SSD1306_WHITE);
+      dst[i] |= row[i] << shift;
+    }
+    if (shift && page + 1 < screen_pages) {
+      dst += display.width();
+      for (int i = 0; i < w; i++) {
+        dst[i] |= row[i] >> (8 - shift);
       }
     }
   }
-  bmpFile.close();
 }
 
 void bt_connection_state_cb(esp_a2d_connection_state_t state, void* ptr){
+    task_register(TASK_BT_EVENTS);
     Serial.printf("A2DP connection state changed: %d\n", state);
     if (state == ESP_A2D_CONNECTION_STATE_CONNECTED) {
         is_bt_connected = true;
     } else {
         is_bt_connected = false;
-        is_connecting = false; // Ensure we can scan again if disconnected
+        if (state == ESP_A2D_CONNECTION_STATE_DISCONNECTED) {
+            is_connecting = false; // Ensure we can scan again if disconnected
+        }
     }
 }
@@ -0,0 +1,148 @@
+#include "memory.h"
+#include <esp_heap_caps.h>
+#include <assert.h>
+
+static const char *memory_subsystem_names[MEM_SUBSYSTEM_COUNT] = {
+    "audio", "ui", "library", "bt"
+};
+
+static MemStats stats[MEM_SUBSYSTEM_COUNT];
+// Tasks inside a scope; more than one task can be in the same subsystem
+// (the decode task and the A2DP callback both run audio code)
+struct MemScopeSlot {
+    TaskHandle_t task;
+    MemSubsystem subsystem;
+};
+static MemScopeSlot scope_slots[MEMORY_SCOPE_SLOTS];
+static volatile uint32_t audio_path_allocs = 0;
+static uint32_t min_largest_block = UINT32_MAX;
+
+void memory_begin() {
+    memset(stats, 0, sizeof(stats));
+    memory_update();
+#ifdef MEMORY_TRACE
+    Serial.println("[Memory] tracing every allocation");
+#endif
+}
+
+// Subsystem whose scope the calling task is in, MEM_SUBSYSTEM_COUNT if none.
+// Before the scheduler starts there is no current task; free slots hold a
+// null task too, so they must never match it.
+static MemSubsystem memory_current_scope() {
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    if (task == nullptr) return MEM_SUBSYSTEM_COUNT;
+    for (int i = 0; i < MEMORY_SCOPE_SLOTS; i++) {
+        TaskHandle_t owner = __atomic_load_n(&scope_slots[i].task, __ATOMIC_ACQUIRE);
+        if (owner != nullptr && owner == task) return scope_slots[i].subsystem;
+    }
+    return MEM_SUBSYSTEM_COUNT;
+}
+
+void memory_note_alloc(MemSubsystem subsystem, size_t size) {
+    MemStats &s = stats[subsystem];
+    s.allocs++;
+    s.bytes += size;
+    s.peak_bytes = max(s.peak_bytes, s.bytes);
+#ifndef MEMORY_TRACE
+    // The trace build counts this in the malloc wrap instead
+    if (memory_current_scope() == MEM_AUDIO) audio_path_allocs++;
+#endif
+}
+
+void memory_note_free(MemSubsystem subsystem, size_t size) {
+    MemStats &s = stats[subsystem];
+    s.frees++;
+    s.bytes -= min((uint32_t)size, s.bytes);
+}
+
+const MemStats &memory_stats(MemSubsystem subsystem) {
+    return stats[subsystem];
+}
+
+uint32_t memory_audio_path_allocs() {
+    return audio_path_allocs;
+}
+
+void memory_scope_enter(MemSubsystem subsystem) {
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    // No task yet (before the scheduler): a null owner would look like a free slot
+    if (task == nullptr) return;
+    for (int i = 0; i < MEMORY_SCOPE_SLOTS; i++) {
+        TaskHandle_t expected = nullptr;
+        if (__atomic_compare_exchange_n(&scope_slots[i].task, &expected, task, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            scope_slots[i].subsystem = subsystem;
+            return;
+        }
+    }
+    // All slots taken: this scope goes uncounted
+}
+
+void memory_scope_leave(MemSubsystem subsystem) {
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    if (task == nullptr) return;
+    for (int i = 0; i < MEMORY_SCOPE_SLOTS; i++) {
+        if (scope_slots[i].task == task && scope_slots[i].subsystem == subsystem) {
+            __atomic_store_n(&scope_slots[i].task, (TaskHandle_t)nullptr, __ATOMIC_RELEASE);
+            return;
+        }
+    }
+}
+
+void memory_update() {
+    min_largest_block = min(min_largest_block, (uint32_t)heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+}
+
+void memory_report() {
+    uint32_t free_heap = ESP.getFreeHeap();
+    uint32_t largest = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    // Share of the free heap that a single allocation cannot use
+    uint32_t fragmentation = free_heap ? 100 - (uint64_t)largest * 100 / free_heap : 0;
+    Serial.printf("[Memory] free %u, lowest ever %u, largest block %u (lowest %u), fragmentation %u%%\n",
+                  free_heap, ESP.getMinFreeHeap(), largest, min_largest_block, fragmentation);
+    Serial.println("[Memory] subsystem  allocs   frees    live    peak  traced");
+    for (int i = 0; i < MEM_SUBSYSTEM_COUNT; i++) {
+        const MemStats &s = stats[i];
+        Serial.printf("[Memory] %-9s %7u %7u %7u %7u %7u\n", memory_subsystem_names[i],
+                      s.allocs, s.frees, s.bytes, s.peak_bytes, s.traced);
+    }
+    if (audio_path_allocs > 0) {
+        Serial.printf("[Memory] WARNING: %u heap allocations on the audio path\n", audio_path_allocs);
+    }
+}
+
+#ifdef MEMORY_TRACE
+// Linked with -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc: every call
+// lands here first, from our code, the Arduino core and the libraries alike
+extern "C" void *__real_malloc(size_t size);
+extern "C" void *__real_calloc(size_t count, size_t size);
+extern "C" void *__real_realloc(void *ptr, size_t size);
+
+static void memory_trace() {
+    MemSubsystem subsystem = memory_current_scope();
+    if (subsystem == MEM_SUBSYSTEM_COUNT) return;
+    stats[subsystem].traced++;
+    if (subsystem == MEM_AUDIO) {
+        audio_path_allocs++;
+#ifdef MEMORY_ASSERT_AUDIO
+        // The backtrace shows who allocated
+        assert(!"heap allocation on the audio path");
+#endif
+    }
+}
+
+extern "C" void *__wrap_malloc(size_t size) {
+    memory_trace();
+    return __real_malloc(size);
+}
+
+extern "C" void *__wrap_calloc(size_t count, size_t size) {
+    memory_trace();
+    return __real_calloc(count, size);
+}
+
+extern "C" void *__wrap_realloc(void *ptr, size_t size) {
+    memory_trace();
+    return __real_realloc(ptr, size);
+}
+#endif
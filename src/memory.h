@@ -0,0 +1,83 @@
+#pragma once
+
+#include <Arduino.h>
+#include <vector>
+
+// ---------- Memory ----------
+// Heap report for long runs. Free heap alone hides fragmentation, so the
+// report also has the largest free block, the minimum free heap ever and
+// allocation counts per subsystem. Containers that grow at run time take a
+// tagged allocator (MemVector) and are counted in every build. A MemoryScope
+// marks code as belonging to a subsystem; the audio scope covers decoding
+// and the A2DP callback, where any tagged allocation is flagged.
+//
+// The MEMORY_TRACE build (env:esp32dev-memtrace) wraps malloc/calloc/realloc
+// at link time, so every allocation inside a scope is counted, String
+// temporaries included. With MEMORY_ASSERT_AUDIO it aborts with a backtrace
+// on the first heap allocation on the audio path. heap_caps_malloc()
+// calls bypass the wrap.
+
+#define MEMORY_REPORT_INTERVAL_MS 60000
+#define MEMORY_SCOPE_SLOTS 6 // tasks that can be inside a scope at once
+
+enum MemSubsystem {
+    MEM_AUDIO,
+    MEM_UI,
+    MEM_LIBRARY,
+    MEM_BT,
+    MEM_SUBSYSTEM_COUNT
+};
+
+struct MemStats {
+    uint32_t allocs;
+    uint32_t frees;
+    uint32_t bytes;      // live
+    uint32_t peak_bytes;
+    uint32_t traced;     // every allocation in scope, MEMORY_TRACE builds only
+};
+
+void memory_begin();
+void memory_note_alloc(MemSubsystem subsystem, size_t size);
+void memory_note_free(MemSubsystem subsystem, size_t size);
+const MemStats &memory_stats(MemSubsystem subsystem);
+uint32_t memory_audio_path_allocs();
+
+// Samples the heap; cheap enough for every loop() pass
+void memory_update();
+void memory_report();
+
+void memory_scope_enter(MemSubsystem subsystem);
+void memory_scope_leave(MemSubsystem subsystem);
+
+struct MemoryScope {
+    MemSubsystem subsystem;
+    MemoryScope(MemSubsystem s) : subsystem(s) { memory_scope_enter(s); }
+    ~MemoryScope() { memory_scope_leave(subsystem); }
+};
+
+// std allocator that counts against one subsystem
+template <class T, MemSubsystem S>
+struct MemAllocator {
+    typedef T value_type;
+    template <class U> struct rebind { typedef MemAllocator<U, S> other; };
+
+    MemAllocator() {}
+    template <class U> MemAllocator(const MemAllocator<U, S> &) {}
+
+    T *allocate(size_t n) {
+        memory_note_alloc(S, n * sizeof(T));
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+    void deallocate(T *p, size_t n) {
+        memory_note_free(S, n * sizeof(T));
+        ::operator delete(p);
+    }
+};
+
+template <class T, class U, MemSubsystem S>
+bool operator==(const MemAllocator<T, S> &, const MemAllocator<U, S> &) { return true; }
+template <class T, class U, MemSubsystem S>
+bool operator!=(const MemAllocator<T, S> &, const MemAllocator<U, S> &) { return false; }
+
+template <class T, MemSubsystem S>
+using MemVector = std::vector<T, MemAllocator<T, S>>;
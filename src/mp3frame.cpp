@@ -0,0 +1,33 @@
+#include "mp3frame.h"
+
+// Layer III bitrates in kbps by bitrate index; 0 is free format, 15 invalid
+static const uint16_t mp3_bitrates_v1[15] = {0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320};
+static const uint16_t mp3_bitrates_v2[15] = {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160};
+static const uint32_t mp3_sample_rates_v1[3] = {44100, 48000, 32000};
+
+bool mp3_parse_header(const uint8_t *data, Mp3FrameHeader &header) {
+    if (data[0] != 0xFF || (data[1] & 0xE0) != 0xE0) return false;
+
+    uint8_t version_bits = (data[1] >> 3) & 0x03; // 0: 2.5, 1: reserved, 2: 2, 3: 1
+    uint8_t layer_bits = (data[1] >> 1) & 0x03;   // 1: Layer III
+    uint8_t bitrate_index = data[2] >> 4;
+    uint8_t rate_index = (data[2] >> 2) & 0x03;
+    uint8_t padding = (data[2] >> 1) & 0x01;
+    uint8_t mode = data[3] >> 6;                  // 3: mono
+    uint8_t emphasis = data[3] & 0x03;
+    if (version_bits == 1 || layer_bits != 1) return false;
+    if (bitrate_index == 0 || bitrate_index == 15 || rate_index == 3 || emphasis == 2) return false;
+
+    bool mpeg1 = version_bits == 3;
+    header.version = mpeg1 ? 1 : (version_bits == 2 ? 2 : 25);
+    header.channels = mode == 3 ? 1 : 2;
+    header.sample_rate = mp3_sample_rates_v1[rate_index] >> (mpeg1 ? 0 : (version_bits == 2 ? 1 : 2));
+    header.bitrate = (mpeg1 ? mp3_bitrates_v1 : mp3_bitrates_v2)[bitrate_index] * 1000;
+    header.samples = mpeg1 ? 1152 : 576;
+    header.frame_bytes = (mpeg1 ? 144 : 72) * header.bitrate / header.sample_rate + padding;
+    return true;
+}
+
+bool mp3_same_stream(const Mp3FrameHeader &a, const Mp3FrameHeader &b) {
+    return a.version == b.version && a.sample_rate == b.sample_rate && a.channels == b.channels;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <Arduino.h>
+
+// ---------- MP3 frames ----------
+// Layer III frame headers of MPEG 1, 2 and 2.5. Enough to find frame
+// boundaries and to tell a real header from two stray bytes that happen to
+// look like a sync word.
+
+#define MP3_HEADER_BYTES 4
+#define MP3_MAX_FRAME_BYTES 1441 // 320 kbps at 32 kHz with padding
+
+struct Mp3FrameHeader {
+    uint8_t version;      // 1, 2, or 25 for MPEG 2.5
+    uint8_t channels;
+    uint32_t sample_rate;
+    uint32_t bitrate;     // bits per second
+    uint16_t frame_bytes; // header included
+    uint16_t samples;     // per channel: 1152 for MPEG 1, 576 otherwise
+};
+
+// False for anything that is not a Layer III header with a valid bitrate
+// and sample rate; free-format streams are not supported
+bool mp3_parse_header(const uint8_t *data, Mp3FrameHeader &header);
+
+// Frames of one stream agree on version, sample rate and channel count;
+// only the bitrate may change (VBR)
+bool mp3_same_stream(const Mp3FrameHeader &a, const Mp3FrameHeader &b);
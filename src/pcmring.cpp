@@ -0,0 +1,60 @@
+#include "pcmring.h"
+
+static Frame pcm_ring[PCM_RING_FRAMES];
+static volatile uint32_t pcm_ring_write_pos = 0;
+static volatile uint32_t pcm_ring_read_pos = 0;
+static volatile uint32_t pcm_ring_flush_to = 0;
+static volatile bool pcm_ring_flush_pending = false;
+static volatile uint32_t pcm_ring_flush_count = 0;
+static volatile bool pcm_ring_is_streaming = false;
+
+uint32_t pcm_ring_depth() {
+    return pcm_ring_write_pos - pcm_ring_read_pos;
+}
+
+uint32_t pcm_ring_space() {
+    return PCM_RING_FRAMES - pcm_ring_depth();
+}
+
+uint32_t pcm_ring_write(const Frame *frames, uint32_t count) {
+    uint32_t w = pcm_ring_write_pos;
+    count = min(count, PCM_RING_FRAMES - (w - pcm_ring_read_pos));
+    for (uint32_t i = 0; i < count; i++) {
+        pcm_ring[(w + i) & (PCM_RING_FRAMES - 1)] = frames[i];
+    }
+    pcm_ring_write_pos = w + count;
+    return count;
+}
+
+uint32_t pcm_ring_read(Frame *frames, uint32_t count) {
+    if (pcm_ring_flush_pending) {
+        pcm_ring_flush_pending = false;
+        pcm_ring_flush_count++;
+        if ((int32_t)(pcm_ring_flush_to - pcm_ring_read_pos) > 0) pcm_ring_read_pos = pcm_ring_flush_to;
+    }
+    uint32_t r = pcm_ring_read_pos;
+    count = min(count, pcm_ring_write_pos - r);
+    for (uint32_t i = 0; i < count; i++) {
+        frames[i] = pcm_ring[(r + i) & (PCM_RING_FRAMES - 1)];
+    }
+    pcm_ring_read_pos = r + count;
+    return count;
+}
+
+void pcm_ring_set_streaming(bool streaming) {
+    pcm_ring_is_streaming = streaming;
+}
+
+bool pcm_ring_streaming() {
+    return pcm_ring_is_streaming;
+}
+
+void pcm_ring_flush() {
+    pcm_ring_flush_to = pcm_ring_write_pos;
+    pcm_ring_flush_pending = true;
+    pcm_ring_is_streaming = false; // until the decode task has the next track going
+}
+
+uint32_t pcm_ring_flushes() {
+    return pcm_ring_flush_count;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <Arduino.h>
+#include <BluetoothA2DPSource.h>
+
+// ---------- PCM ring ----------
+// Decoded stereo frames between the decode task (the only writer) and the
+// sink callback (the only reader, through jitter.h). Indices only ever
+// grow, so neither side needs a lock. How full it is kept is the jitter
+// buffer's target, up to the whole ring.
+
+#define PCM_RING_FRAMES 4096 // power of two; ~93 ms at 44.1 kHz
+
+uint32_t pcm_ring_depth();
+uint32_t pcm_ring_space();
+
+// Decode side
+uint32_t pcm_ring_write(const Frame *frames, uint32_t count);
+
+// Sink side; returns fewer frames when the ring runs dry
+uint32_t pcm_ring_read(Frame *frames, uint32_t count);
+
+// Set by the decode side, before it writes, while the current track still
+// has audio to come; a short read is only an underrun then
+void pcm_ring_set_streaming(bool streaming);
+bool pcm_ring_streaming();
+
+// Drops everything queued so far, e.g. the rest of the old track after a
+// skip; frames written afterwards stay. The reader does it on its next
+// read. Call from the decode task (a deck command), between writes.
+void pcm_ring_flush();
+// Flushes the reader has carried out so far; read on the sink side it
+// changes with the first read of the new audio
+uint32_t pcm_ring_flushes();
@@ -15,5 +15,10 @@
 // Onboard "select" button
 #define BTN_SCROLL 0
 
+// I2S DAC (MAX98357A), AUDIO_SINK_I2S builds
+#define I2S_BCLK 26
+#define I2S_LRC 25
+#define I2S_DOUT 22
+
 // B103 potentiometer for sound level control
 #define POT_PIN 35
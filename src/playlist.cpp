@@ -0,0 +1,248 @@
+#include "playlist.h"
+#include <SD.h>
+#include "governor.h"
+#include "lines.h"
+
+#define PLAYLIST_CACHE_MAGIC "WPLS"
+
+// FNV-1a over the playlist's path names its cache file
+static String cache_path(const String &path) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < path.length(); i++) {
+        h = (h ^ (uint8_t)path[i]) * 16777619u;
+    }
+    char name[40];
+    snprintf(name, sizeof(name), PLAYLIST_CACHE_DIR "/%08x.dat", h);
+    return String(name);
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Collapses "." and ".." and doubled slashes; path starts with '/'
+static String normalize(const String &path) {
+    String out;
+    int start = 1;
+    while (start <= (int)path.length()) {
+        int end = path.indexOf('/', start);
+        if (end < 0) end = path.length();
+        String part = path.substring(start, end);
+        if (part == "..") {
+            int slash = out.lastIndexOf('/');
+            out = slash > 0 ? out.substring(0, slash) : String();
+        } else if (part.length() > 0 && part != ".") {
+            out += "/" + part;
+        }
+        start = end + 1;
+    }
+    return out;
+}
+
+// Card path for one entry, or empty when it can't be on the card
+static String resolve(const String &dir, const char *entry) {
+    String path;
+    if (strncasecmp(entry, "file://", 7) == 0) {
+        // file:///Music/a%20b.mp3
+        for (const char *p = entry + 7; *p; p++) {
+            int hi, lo;
+            if (*p == '%' && (hi = hex_value(p[1])) >= 0 && (lo = hex_value(p[2])) >= 0) {
+                path += (char)(hi * 16 + lo);
+                p += 2;
+            } else {
+                path += *p;
+            }
+        }
+    } else if (strstr(entry, "://")) {
+        return String(); // a stream URL
+    } else {
+        path = entry;
+    }
+    path.replace('\\', '/');
+    if (path.length() >= 2 && isalpha((unsigned char)path[0]) && path[1] == ':') {
+        path = path.substring(2); // C:\Music\... is taken from the card root
+    }
+    if (!path.startsWith("/")) {
+        path = dir + "/" + path;
+    }
+    return normalize(path);
+}
+
+// ---------- Parsing ----------
+struct ParseState {
+    String dir;
+    SongList &songs;
+    NameList absent;   // playable entries not on the card, checked again on open
+    uint32_t absent_total; // including those past PLAYLIST_MAX_ABSENT
+    uint32_t missing;
+    uint32_t dropped;
+    ParseState(const String &dir, SongList &songs) : dir(dir), songs(songs), absent_total(0), missing(0), dropped(0) {}
+};
+
+static bool add_entry(ParseState &state, const char *entry, const char *title) {
+    if (state.songs.size() >= PLAYLIST_MAX_TRACKS) {
+        state.dropped++;
+        return false;
+    }
+    String path = resolve(state.dir, entry);
+    FileType type;
+    if (path.length() == 0 || !song_type_from_path(path, type)) {
+        state.missing++;
+        return false;
+    }
+    governor_yield(); // one card lookup per entry
+    if (!SD.exists(path)) {
+        state.missing++;
+        if (state.absent.size() < PLAYLIST_MAX_ABSENT) state.absent.push_back(path);
+        state.absent_total++;
+        return false;
+    }
+    state.songs.push_back({path, type, String(title)});
+    return true;
+}
+
+static void parse(File &file, bool pls, ParseState &state) {
+    LineReader in(file);
+    char line[PLAYLIST_LINE_MAX];
+    char title[PLAYLIST_LINE_MAX] = "";
+    bool first = true;
+    int last_number = -1; // PLS: the FileN just added, for its TitleN
+
+    while (in.next(line, sizeof(line))) {
+        char *s = line;
+        if (first && (uint8_t)s[0] == 0xEF && (uint8_t)s[1] == 0xBB && (uint8_t)s[2] == 0xBF) {
+            s += 3; // UTF-8 BOM, common in .m3u8
+        }
+        first = false;
+        s = line_trim(s);
+        if (*s == '\0') continue;
+
+        if (pls) {
+            char *eq = strchr(s, '=');
+            if (!eq) continue;
+            char *value = line_trim(eq + 1);
+            if (strncasecmp(s, "File", 4) == 0) {
+                int number = atoi(s + 4);
+                last_number = add_entry(state, value, "") ? number : -1;
+            } else if (strncasecmp(s, "Title", 5) == 0 && atoi(s + 5) == last_number) {
+                state.songs.back().title = value;
+            }
+        } else if (*s == '#') {
+            // #EXTINF:<seconds>,<title> names the entry that follows
+            if (strncasecmp(s, "#EXTINF:", 8) == 0) {
+                char *comma = strchr(s, ',');
+                snprintf(title, sizeof(title), "%s", comma ? line_trim(comma + 1) : "");
+            }
+        } else {
+            add_entry(state, s, title);
+            title[0] = '\0';
+        }
+    }
+}
+
+// ---------- Cache ----------
+// A stamp line, then one "<type>|<path>|<title>" line per track. FAT names
+// can't hold '|', so only the title may. Entries that were not on the card
+// follow as "-|<path>" lines; once any of them is there the cache is stale.
+static bool cache_read(const String &path, uint32_t size, uint32_t modified, SongList &songs) {
+    File cache = SD.open(cache_path(path), FILE_READ);
+    if (!cache) return false;
+    LineReader in(cache);
+    char line[PLAYLIST_LINE_MAX * 2];
+    char magic[5] = "";
+    unsigned version = 0, cached_size = 0, cached_modified = 0, count = 0, absent = 0;
+    bool ok = in.next(line, sizeof(line)) &&
+              sscanf(line, "%4s %u %u %u %u %u", magic, &version, &cached_size, &cached_modified,
+                     &count, &absent) == 6 &&
+              strcmp(magic, PLAYLIST_CACHE_MAGIC) == 0 && version == PLAYLIST_CACHE_VERSION &&
+              cached_size == size && cached_modified == modified;
+    if (ok) {
+        songs.reserve(count);
+        unsigned absent_seen = 0;
+        while (ok && in.next(line, sizeof(line))) {
+            if (line[0] == '-' && line[1] == '|') {
+                absent_seen++;
+                if (SD.exists(line + 2)) {
+                    Serial.printf("[Playlist] %s is on the card now\n", line + 2);
+                    ok = false;
+                }
+                continue;
+            }
+            char *bar = strchr(line, '|');
+            char *title_bar = bar ? strchr(bar + 1, '|') : nullptr;
+            if (!title_bar) continue;
+            *title_bar = '\0';
+            songs.push_back({String(bar + 1), (FileType)atoi(line), String(title_bar + 1)});
+        }
+        ok = ok && songs.size() == count && absent_seen == absent;
+        if (!ok) songs.clear();
+    }
+    cache.close();
+    return ok;
+}
+
+static void cache_write(const String &path, uint32_t size, uint32_t modified, const SongList &songs,
+                        const NameList &absent) {
+    if (!SD.exists(PLAYLIST_CACHE_DIR)) SD.mkdir(PLAYLIST_CACHE_DIR);
+    String name = cache_path(path);
+    SD.remove(name);
+    File cache = SD.open(name, FILE_WRITE);
+    if (!cache) {
+        Serial.printf("[Playlist] cannot write cache %s\n", name.c_str());
+        return;
+    }
+    cache.printf("%s %u %u %u %u %u\n", PLAYLIST_CACHE_MAGIC, PLAYLIST_CACHE_VERSION,
+                 size, modified, (unsigned)songs.size(), (unsigned)absent.size());
+    for (const auto &song : songs) {
+        cache.printf("%d|%s|%s\n", (int)song.type, song.path.c_str(), song.title.c_str());
+    }
+    for (const auto &name : absent) {
+        cache.printf("-|%s\n", name.c_str());
+    }
+    cache.close();
+}
+
+bool playlist_is_file(const String &name) {
+    String lower = name;
+    lower.toLowerCase();
+    return lower.endsWith(".m3u") || lower.endsWith(".m3u8") || lower.endsWith(".pls");
+}
+
+bool playlist_load(const String &path, SongList &songs) {
+    unsigned long start = millis();
+    songs.clear();
+    File file = SD.open(path, FILE_READ);
+    if (!file || file.isDirectory()) {
+        Serial.printf("[Playlist] cannot open %s\n", path.c_str());
+        return false;
+    }
+    uint32_t size = file.size();
+    uint32_t modified = (uint32_t)file.getLastWrite();
+
+    if (cache_read(path, size, modified, songs)) {
+        file.close();
+        Serial.printf("[Playlist] %s: %u tracks from cache in %lu ms\n", path.c_str(),
+                      (unsigned)songs.size(), millis() - start);
+        return true;
+    }
+
+    String lower = path;
+    lower.toLowerCase();
+    ParseState state(path.substring(0, path.lastIndexOf('/')), songs);
+    parse(file, lower.endsWith(".pls"), state);
+    file.close();
+    cache_write(path, size, modified, songs, state.absent);
+    Serial.printf("[Playlist] %s: %u tracks, %u missing skipped, resolved in %lu ms\n", path.c_str(),
+                  (unsigned)songs.size(), state.missing, millis() - start);
+    if (state.absent_total > state.absent.size()) {
+        Serial.printf("[Playlist] only %u of %u missing entries are looked up again on open\n",
+                      (unsigned)state.absent.size(), state.absent_total);
+    }
+    if (state.dropped) {
+        Serial.printf("[Playlist] %u entries past the %d track limit ignored\n", state.dropped, PLAYLIST_MAX_TRACKS);
+    }
+    return true;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <Arduino.h>
+#include "song.h"
+
+// ---------- Playlist files ----------
+// .m3u, .m3u8 and .pls files in an artist folder show up next to its albums.
+// A playlist is read a line at a time, never whole. Its entries are resolved
+// against the card once: relative paths from the playlist's own folder,
+// absolute ones from the card root (a Windows drive letter is dropped and
+// backslashes are fine). Entries that are not on the card or not playable
+// are left out, and URLs are ignored. The resolved list is cached in
+// PLAYLIST_CACHE_DIR, stamped with the playlist's size and modification
+// time, so the next open is a single read with card lookups only for the
+// entries that were missing; once one of those is copied to the card the
+// playlist is resolved again. Only the first PLAYLIST_MAX_ABSENT missing
+// entries are remembered for that; any others show up once the playlist
+// file itself changes.
+// Titles come from #EXTINF / TitleN lines; tracks without one show their
+// file name until they play.
+
+#define PLAYLIST_CACHE_DIR "/data/_playlists"
+#define PLAYLIST_CACHE_VERSION 2
+#define PLAYLIST_MAX_TRACKS 500 // entries past this are ignored; each costs heap
+#define PLAYLIST_MAX_ABSENT 32  // missing entries looked up again on each open
+#define PLAYLIST_LINE_MAX 256
+
+// True for a playlist file name (by extension)
+bool playlist_is_file(const String &name);
+
+// Fills songs with the playable entries of the playlist at path, from the
+// cache while it still matches the file. False if the playlist can't be read.
+bool playlist_load(const String &path, SongList &songs);
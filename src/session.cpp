@@ -0,0 +1,64 @@
+#include "session.h"
+#include "settings.h"
+
+static SessionState session;
+static bool session_dirty = false;
+static unsigned long session_saved_at = 0;
+
+void session_begin() {
+    if (!settings_get(SESSION_KEY, session)) {
+        memset(&session, 0, sizeof(session));
+    }
+    session.path[SESSION_PATH_LEN - 1] = '\0';
+    if (session_has_track()) {
+        Serial.printf("[Session] last track %s at byte %u\n", session.path, session.position);
+    }
+}
+
+const SessionState &session_get() {
+    return session;
+}
+
+bool session_has_track() {
+    return session.path[0] != '\0';
+}
+
+void session_set_track(const Song &song, uint32_t position) {
+    memset(session.path, 0, sizeof(session.path));
+    if (song.path.length() < SESSION_PATH_LEN) {
+        strncpy(session.path, song.path.c_str(), SESSION_PATH_LEN - 1);
+    }
+    session.type = song.type;
+    session.position = position;
+    session_dirty = true;
+    session_save(true);
+}
+
+void session_set_position(uint32_t position) {
+    if (position == session.position) return;
+    session.position = position;
+    session_dirty = true;
+}
+
+void session_set_eq(uint8_t preset) {
+    if (preset == session.eq_preset) return;
+    session.eq_preset = preset;
+    session_dirty = true;
+    session_save(true);
+}
+
+void session_clear() {
+    if (!session_has_track()) return;
+    memset(session.path, 0, sizeof(session.path));
+    session.position = 0;
+    session_dirty = true;
+    session_save(true);
+}
+
+void session_save(bool force) {
+    if (!session_dirty) return;
+    if (!force && millis() - session_saved_at < SESSION_SAVE_INTERVAL_MS) return;
+    settings_put(SESSION_KEY, session);
+    session_dirty = false;
+    session_saved_at = millis();
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <Arduino.h>
+#include "song.h"
+
+// ---------- Session ----------
+// What was playing and where, so a reboot reopens the same track at the same
+// spot. The playback position is tracked in RAM and written at most once per
+// SESSION_SAVE_INTERVAL_MS; track changes, pauses and setting changes are
+// written straight away. Artist and album come from the track's path.
+
+#define SESSION_KEY "session" // in the settings
+#define SESSION_SAVE_INTERVAL_MS 60000
+#define SESSION_PATH_LEN 160
+
+struct SessionState {
+    char path[SESSION_PATH_LEN]; // empty when there is nothing to resume
+    uint32_t position;           // byte position in the file, as a pause keeps it
+    uint8_t type;                // FileType
+    uint8_t eq_preset;
+    uint8_t reserved[2];
+};
+
+void session_begin();
+const SessionState &session_get();
+bool session_has_track();
+
+void session_set_track(const Song &song, uint32_t position);
+void session_set_position(uint32_t position);
+void session_set_eq(uint8_t preset);
+// Forgets the track, e.g. one that can no longer be resumed; keeps the EQ
+void session_clear();
+// Writes pending changes; with force the rate limit is ignored
+void session_save(bool force);
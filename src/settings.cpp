@@ -0,0 +1,83 @@
+#include "settings.h"
+#include "speakers.h"
+#include <Preferences.h>
+#include <SPIFFS.h>
+
+static Preferences prefs;
+static uint32_t write_count = 0;
+
+// Older firmware kept the address of the last speaker in a SPIFFS text
+// file, "aa:bb:cc:dd:ee:ff". It is read once, stored as the first known
+// speaker and deleted; after that SPIFFS is never mounted again. The spiffs
+// partition keeps its old offset and size for this (partitions.csv), since
+// SPIFFS does not mount with a different geometry.
+static void settings_migrate() {
+    if (!SPIFFS.begin(false)) {
+        prefs.putBool("migrated", true); // never formatted: nothing to move
+        return;
+    }
+
+    File file = SPIFFS.open("/bt_address.txt", FILE_READ);
+    if (file) {
+        String addr_str = file.readString();
+        file.close();
+        SpeakerList speakers;
+        memset(&speakers, 0, sizeof(speakers));
+        KnownSpeaker &speaker = speakers.list[0];
+        addr_str.trim();
+        if (addr_str.length() == 17 &&
+            sscanf(addr_str.c_str(), "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx", &speaker.address[0], &speaker.address[1],
+                   &speaker.address[2], &speaker.address[3], &speaker.address[4], &speaker.address[5]) == 6) {
+            strncpy(speaker.name, addr_str.c_str(), sizeof(speaker.name) - 1);
+            speaker.last_seen = 1;
+            speakers.count = 1;
+            settings_put(SPEAKERS_KEY, speakers);
+            Serial.printf("[Settings] imported speaker %s\n", speaker.name);
+        }
+        SPIFFS.remove("/bt_address.txt");
+    }
+    SPIFFS.end();
+    prefs.putBool("migrated", true);
+}
+
+bool settings_begin() {
+    if (!prefs.begin(SETTINGS_NAMESPACE, false)) {
+        Serial.println("[Settings] NVS could not be opened, settings will not be kept");
+        return false;
+    }
+    if (!prefs.getBool("migrated", false)) {
+        settings_migrate();
+    }
+    if (prefs.isKey("boots")) prefs.remove("boots"); // boot counter of an earlier build
+    Serial.printf("[Settings] %u NVS entries free\n", (unsigned)prefs.freeEntries());
+    return true;
+}
+
+uint32_t settings_write_count() {
+    return write_count;
+}
+
+bool settings_get_blob(const char *key, void *value, size_t size) {
+    if (prefs.getBytesLength(key) != size) return false;
+    return prefs.getBytes(key, value, size) == size;
+}
+
+bool settings_put_blob(const char *key, const void *value, size_t size) {
+    // Identical bytes are not written again
+    if (size <= SETTINGS_MAX_VALUE && prefs.getBytesLength(key) == size) {
+        uint8_t stored[SETTINGS_MAX_VALUE];
+        if (prefs.getBytes(key, stored, size) == size && memcmp(stored, value, size) == 0) {
+            return true;
+        }
+    }
+    write_count++;
+    if (prefs.putBytes(key, value, size) != size) {
+        Serial.printf("[Settings] failed to write %s\n", key);
+        return false;
+    }
+    return true;
+}
+
+void settings_remove(const char *key) {
+    prefs.remove(key);
+}
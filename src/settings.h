@@ -0,0 +1,33 @@
+#pragma once
+
+#include <Arduino.h>
+
+// ---------- Settings ----------
+// Typed key-value store on NVS (Preferences, namespace "winamp"). Each value
+// is a plain struct stored as one blob under a short key; a blob whose size
+// no longer matches its struct reads as missing, so a changed layout falls
+// back to defaults instead of being misread. Writes that would store the same
+// bytes again are skipped, which together with the session's rate limit keeps
+// NVS wear down.
+
+#define SETTINGS_NAMESPACE "winamp"
+#define SETTINGS_MAX_VALUE 256 // largest blob that is compared before writing
+
+// Opens NVS; moves the speaker address older firmware kept on SPIFFS into
+// NVS the first time. Nothing is written on an ordinary boot.
+bool settings_begin();
+uint32_t settings_write_count();
+
+bool settings_get_blob(const char *key, void *value, size_t size);
+bool settings_put_blob(const char *key, const void *value, size_t size);
+void settings_remove(const char *key);
+
+template <typename T>
+bool settings_get(const char *key, T &value) {
+    return settings_get_blob(key, &value, sizeof(T));
+}
+
+template <typename T>
+bool settings_put(const char *key, const T &value) {
+    return settings_put_blob(key, &value, sizeof(T));
+}
@@ -0,0 +1,149 @@
+#include "shuffle.h"
+#include "library.h"
+#include "settings.h"
+
+#define SHUFFLE_ROUNDS 4
+
+static ShuffleState shuffle = {0, 0, 0, 0, SHUFFLE_OFF, 0};
+
+static Song play_queue[PLAY_QUEUE_SIZE];
+static int play_queue_head = 0;
+static int play_queue_count = 0;
+
+// murmur3 finalizer, used as the Feistel round function
+static uint32_t shuffle_mix(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x85ebca6b;
+    x ^= x >> 13;
+    x *= 0xc2b2ae35;
+    x ^= x >> 16;
+    return x;
+}
+
+uint32_t shuffle_permute(uint32_t index, uint32_t n, uint32_t seed) {
+    if (n <= 1) return 0;
+
+    // Smallest even bit width whose domain covers n; at most 4n values, so the
+    // cycle walk below takes fewer than four rounds on average
+    int bits = 32 - __builtin_clz(n - 1);
+    int half = (bits + 1) / 2;
+    uint32_t mask = (1u << half) - 1;
+
+    uint32_t x = index;
+    do {
+        uint32_t left = x >> half;
+        uint32_t right = x & mask;
+        for (int round = 0; round < SHUFFLE_ROUNDS; round++) {
+            uint32_t next = left ^ (shuffle_mix(right ^ seed ^ (round * 0x9e3779b9)) & mask);
+            left = right;
+            right = next;
+        }
+        x = (left << half) | right;
+    } while (x >= n); // cycle walking keeps the result inside [0, n)
+    return x;
+}
+
+static bool shuffle_dirty = false;
+static unsigned long shuffle_saved_at = 0;
+
+void shuffle_save(bool force) {
+    if (!shuffle_dirty) return;
+    if (!force && millis() - shuffle_saved_at < SHUFFLE_SAVE_INTERVAL_MS) return;
+    settings_put(SHUFFLE_KEY, shuffle);
+    shuffle_dirty = false;
+    shuffle_saved_at = millis();
+}
+
+void shuffle_begin() {
+    ShuffleState saved;
+    if (settings_get(SHUFFLE_KEY, saved) && saved.mode <= SHUFFLE_LIBRARY) {
+        shuffle = saved;
+        Serial.printf("Shuffle state restored: mode %d, position %u of %u\n",
+                      shuffle.mode, shuffle.position, shuffle.track_count);
+    }
+}
+
+ShuffleMode shuffle_get_mode() {
+    return (ShuffleMode)shuffle.mode;
+}
+
+const ShuffleState &shuffle_state() {
+    return shuffle;
+}
+
+static void shuffle_new_cycle(uint32_t track_count) {
+    shuffle.seed = esp_random();
+    shuffle.position = 0;
+    shuffle.track_count = track_count;
+}
+
+void shuffle_set_mode(ShuffleMode mode, int artist_index) {
+    shuffle.mode = mode;
+    shuffle.artist = artist_index;
+    shuffle.track_count = 0; // picked up by the next shuffle_next()
+    shuffle_dirty = true;
+    shuffle_save(true);
+}
+
+String shuffle_label() {
+    switch (shuffle.mode) {
+        case SHUFFLE_ARTIST: return "Shuffle: artist";
+        case SHUFFLE_LIBRARY: return "Shuffle: all";
+        default: return "Shuffle: off";
+    }
+}
+
+bool shuffle_next(Song &song) {
+    if (shuffle.mode == SHUFFLE_OFF || !library_ready()) return false;
+
+    LibraryRange range = {0, library_track_count()};
+    if (shuffle.mode == SHUFFLE_ARTIST) {
+        range = library_artist_range(shuffle.artist);
+    }
+    if (range.count == 0) return false;
+
+    // Library changed size or the cycle is complete: start a new permutation
+    if (shuffle.track_count != range.count || shuffle.position >= range.count) {
+        shuffle_new_cycle(range.count);
+    }
+
+    // Skip entries that can no longer be resolved, but never loop forever
+    for (uint32_t attempts = 0; attempts < range.count; attempts++) {
+        uint32_t track = range.first + shuffle_permute(shuffle.position, range.count, shuffle.seed);
+        shuffle.position++;
+        if (shuffle.position >= range.count) {
+            shuffle_new_cycle(range.count);
+        }
+        if (library_get_song(track, song)) {
+            shuffle_dirty = true;
+            shuffle_save(false);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool queue_push(const Song &song) {
+    if (play_queue_count >= PLAY_QUEUE_SIZE) return false;
+    play_queue[(play_queue_head + play_queue_count) % PLAY_QUEUE_SIZE] = song;
+    play_queue_count++;
+    return true;
+}
+
+bool queue_pop(Song &song) {
+    if (play_queue_count == 0) return false;
+    song = play_queue[play_queue_head];
+    play_queue[play_queue_head].path = String(); // release the path right away
+    play_queue_head = (play_queue_head + 1) % PLAY_QUEUE_SIZE;
+    play_queue_count--;
+    return true;
+}
+
+int queue_count() {
+    return play_queue_count;
+}
+
+void queue_clear() {
+    Song song;
+    while (queue_pop(song)) {}
+}
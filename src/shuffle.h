@@ -0,0 +1,50 @@
+#pragma once
+
+#include <Arduino.h>
+#include "song.h"
+
+// ---------- Shuffle ----------
+// Library- and artist-wide shuffle walk a keyed Feistel permutation over the
+// track ids of the library index: every track once per cycle, no per-track
+// RAM, and the whole position is {seed, position}, persisted in a few bytes.
+
+enum ShuffleMode : uint8_t { SHUFFLE_OFF, SHUFFLE_ARTIST, SHUFFLE_LIBRARY };
+
+#define SHUFFLE_KEY "shuffle" // in the settings
+#define SHUFFLE_SAVE_INTERVAL_MS 60000 // position writes; a mode change is saved at once
+
+struct ShuffleState {
+    uint32_t seed;
+    uint32_t position;    // next index into the permutation
+    uint32_t track_count; // size of the scope the permutation was built for
+    uint16_t artist;      // scope for SHUFFLE_ARTIST
+    uint8_t mode;
+    uint8_t reserved;
+};
+
+void shuffle_begin();
+ShuffleMode shuffle_get_mode();
+void shuffle_set_mode(ShuffleMode mode, int artist_index);
+String shuffle_label();
+const ShuffleState &shuffle_state();
+
+// Next song of the current shuffle cycle; starts a new cycle with a fresh
+// seed once every track has played
+bool shuffle_next(Song &song);
+
+// Writes a moved position at most once per SHUFFLE_SAVE_INTERVAL_MS; with
+// force the rate limit is ignored
+void shuffle_save(bool force);
+
+// Bijection on [0, n) keyed by seed; exposed for the diagnostics log
+uint32_t shuffle_permute(uint32_t index, uint32_t n, uint32_t seed);
+
+// ---------- Play queue ----------
+// Bounded FIFO of songs picked from any album; it plays before shuffle or
+// album order
+#define PLAY_QUEUE_SIZE 16
+
+bool queue_push(const Song &song);
+bool queue_pop(Song &song);
+int queue_count();
+void queue_clear();
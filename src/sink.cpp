@@ -0,0 +1,140 @@
+#include "sink.h"
+#include <driver/i2s.h>
+#include "esp_a2dp_api.h"
+#include "pins.h"
+#include "tasks.h"
+#include <esp_timer.h>
+
+// ---------- A2DP ----------
+void A2dpSink::start(SinkCallback callback) {
+    // A2DP stream reconfigure
+    esp_a2d_media_ctrl(ESP_A2D_MEDIA_CTRL_CHECK_SRC_RDY);
+    a2dp.set_data_callback_in_frames(callback);
+    esp_a2d_media_ctrl(ESP_A2D_MEDIA_CTRL_START);
+}
+
+void A2dpSink::stop() {
+    a2dp.set_data_callback_in_frames(nullptr);
+}
+
+void A2dpSink::set_volume(int volume) {
+    a2dp.set_volume(volume);
+}
+
+bool A2dpSink::ready() {
+    return a2dp.is_connected();
+}
+
+// ---------- Task sinks ----------
+void TaskSink::task(void *param) {
+    TaskSink &sink = *(TaskSink*)param;
+    static Frame block[SINK_BLOCK_FRAMES];
+    for (;;) {
+        SinkCallback pull = sink.callback;
+        if (!pull) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+        int32_t frames = pull(block, SINK_BLOCK_FRAMES);
+        task_busy_begin(TASK_AUDIO_OUT);
+        // Short reads become silence so the output keeps its clock
+        for (int32_t i = max(frames, (int32_t)0); i < SINK_BLOCK_FRAMES; i++) {
+            block[i] = Frame(0);
+        }
+        int32_t gain = sink.gain;
+        if (gain < 32767) {
+            for (int32_t i = 0; i < frames; i++) {
+                block[i].channel1 = (block[i].channel1 * gain) >> 15;
+                block[i].channel2 = (block[i].channel2 * gain) >> 15;
+            }
+        }
+        task_busy_end(TASK_AUDIO_OUT);
+        sink.output(block, SINK_BLOCK_FRAMES);
+    }
+}
+
+void TaskSink::start(SinkCallback callback) {
+    this->callback = callback;
+    if (!handle) {
+        handle = task_start(TASK_AUDIO_OUT, task, this);
+    } else {
+        xTaskNotifyGive(handle);
+    }
+}
+
+void TaskSink::stop() {
+    callback = nullptr;
+    silence();
+}
+
+void TaskSink::set_volume(int volume) {
+    gain = constrain(volume, 0, 127) * 32767 / 127;
+}
+
+// ---------- I2S ----------
+bool I2sSink::begin() {
+    i2s_config_t config = {};
+    config.mode = (i2s_mode_t)(I2S_MODE_MASTER | I2S_MODE_TX);
+    config.sample_rate = rate;
+    config.bits_per_sample = I2S_BITS_PER_SAMPLE_16BIT;
+    config.channel_format = I2S_CHANNEL_FMT_RIGHT_LEFT;
+    config.communication_format = I2S_COMM_FORMAT_STAND_I2S;
+    config.dma_buf_count = I2S_SINK_DMA_BUFFERS;
+    config.dma_buf_len = I2S_SINK_DMA_FRAMES;
+    config.tx_desc_auto_clear = true; // silence, not a stuck buffer, if we fall behind
+
+    i2s_pin_config_t pins = {};
+    pins.mck_io_num = I2S_PIN_NO_CHANGE;
+    pins.bck_io_num = I2S_BCLK;
+    pins.ws_io_num = I2S_LRC;
+    pins.data_out_num = I2S_DOUT;
+    pins.data_in_num = I2S_PIN_NO_CHANGE;
+
+    esp_err_t err = i2s_driver_install(I2S_SINK_PORT, &config, 0, nullptr);
+    if (err == ESP_OK) err = i2s_set_pin(I2S_SINK_PORT, &pins);
+    if (err != ESP_OK) {
+        Serial.printf("[I2S] driver failed: %s\n", esp_err_to_name(err));
+        return false;
+    }
+    installed = true;
+    return true;
+}
+
+uint32_t I2sSink::set_sample_rate(uint32_t rate) {
+    if (!installed || rate == 0 || rate == this->rate) return this->rate;
+    // The DAC follows the track, so nothing needs resampling
+    if (i2s_set_sample_rates(I2S_SINK_PORT, rate) == ESP_OK) {
+        this->rate = rate;
+    }
+    return this->rate;
+}
+
+uint32_t I2sSink::latency_ms() {
+    // Every DMA buffer queued, plus the block being filled
+    return (I2S_SINK_DMA_BUFFERS * I2S_SINK_DMA_FRAMES + SINK_BLOCK_FRAMES) * 1000 / rate;
+}
+
+void I2sSink::output(const Frame *frames, int32_t count) {
+    size_t written = 0;
+    i2s_write(I2S_SINK_PORT, frames, count * sizeof(Frame), &written, portMAX_DELAY);
+}
+
+void I2sSink::silence() {
+    if (installed) i2s_zero_dma_buffer(I2S_SINK_PORT);
+}
+
+// ---------- Null ----------
+uint32_t NullSink::set_sample_rate(uint32_t rate) {
+    if (rate) this->rate = rate;
+    return this->rate;
+}
+
+void NullSink::output(const Frame *frames, int32_t count) {
+    if (file) file.write((const uint8_t*)frames, count * sizeof(Frame));
+    played += count;
+    // Paced like a DAC: one block per block time, catching up after a stall
+    int64_t now = esp_timer_get_time();
+    if (due_us < now - 100000) due_us = now;
+    due_us += (int64_t)count * 1000000 / rate;
+    if (due_us - now >= 1000) vTaskDelay(pdMS_TO_TICKS((due_us - now) / 1000));
+}
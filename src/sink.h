@@ -0,0 +1,126 @@
+#pragma once
+
+#include <Arduino.h>
+#include <FS.h>
+#include <BluetoothA2DPSource.h>
+
+// ---------- Output sinks ----------
+// Where the PCM goes. Every sink pulls: once started it calls the callback
+// whenever it wants more frames, and whatever the callback returns is all it
+// gets (a short read is padded with silence by sinks that have to keep a
+// clock going). The player picks one at build time:
+//   A2dpSink  Bluetooth speaker, the default
+//   I2sSink   I2S DAC such as a MAX98357A on the pins in pins.h
+//             (-DAUDIO_SINK_I2S, env:esp32dev-i2s)
+//   NullSink  paced to real time, writes to a file or nowhere; for
+//             benchmarks and boards without audio hardware (-DAUDIO_SINK_NULL,
+//             env:esp32dev-null; -DNULL_SINK_FILE="/x.pcm" names the file)
+// The wired and null sinks leave Bluetooth off altogether (AUDIO_SINK_LOCAL).
+
+#if defined(AUDIO_SINK_I2S) || defined(AUDIO_SINK_NULL)
+#define AUDIO_SINK_LOCAL
+#endif
+
+#define A2DP_SINK_RATE 44100     // the SBC stream ESP32-A2DP sets up
+#define A2DP_SINK_LATENCY_MS 150 // SBC, radio and speaker buffer; speakers vary
+#define I2S_SINK_PORT I2S_NUM_0
+#define I2S_SINK_DMA_BUFFERS 4
+#define I2S_SINK_DMA_FRAMES 256
+#define SINK_BLOCK_FRAMES 256    // pulled at a time by sinks with their own task
+
+typedef int32_t (*SinkCallback)(Frame *frames, int32_t frame_count);
+
+class AudioSink {
+public:
+    virtual ~AudioSink() {}
+    virtual const char *name() const = 0;
+
+    // Brings the output up once at boot; false when it is not there
+    virtual bool begin() = 0;
+    // Starts pulling from callback; again with another callback to switch
+    virtual void start(SinkCallback callback) = 0;
+    // Stops pulling; the output plays silence or pauses
+    virtual void stop() = 0;
+    // Asks to run at the source's rate; returns the rate the output uses
+    virtual uint32_t set_sample_rate(uint32_t rate) = 0;
+    // From a frame leaving the callback to it being heard, roughly
+    virtual uint32_t latency_ms() = 0;
+    // 0..127, like the pot
+    virtual void set_volume(int volume) = 0;
+    // True while audio can go out (a speaker is connected)
+    virtual bool ready() = 0;
+};
+
+class A2dpSink : public AudioSink {
+public:
+    A2dpSink(BluetoothA2DPSource &a2dp) : a2dp(a2dp) {}
+    const char *name() const override { return "A2DP"; }
+    bool begin() override { return true; } // a2dp.start() is part of the BT boot stage
+    void start(SinkCallback callback) override;
+    void stop() override;
+    uint32_t set_sample_rate(uint32_t rate) override { return A2DP_SINK_RATE; }
+    uint32_t latency_ms() override { return A2DP_SINK_LATENCY_MS; }
+    void set_volume(int volume) override;
+    bool ready() override;
+
+private:
+    BluetoothA2DPSource &a2dp;
+};
+
+// Sinks that pull from a task of their own (TASK_AUDIO_OUT) and apply the
+// volume themselves
+class TaskSink : public AudioSink {
+public:
+    void start(SinkCallback callback) override;
+    void stop() override;
+    void set_volume(int volume) override;
+
+protected:
+    // Plays a full block, blocking until the output has taken it
+    virtual void output(const Frame *frames, int32_t count) = 0;
+    virtual void silence() {}
+
+    volatile uint32_t rate = A2DP_SINK_RATE;
+
+private:
+    static void task(void *param);
+    TaskHandle_t handle = nullptr;
+    volatile SinkCallback callback = nullptr;
+    volatile int32_t gain = 32767; // Q15
+};
+
+class I2sSink : public TaskSink {
+public:
+    const char *name() const override { return "I2S"; }
+    bool begin() override;
+    uint32_t set_sample_rate(uint32_t rate) override;
+    uint32_t latency_ms() override;
+    bool ready() override { return installed; }
+
+protected:
+    void output(const Frame *frames, int32_t count) override;
+    void silence() override;
+
+private:
+    bool installed = false;
+};
+
+class NullSink : public TaskSink {
+public:
+    const char *name() const override { return "null"; }
+    bool begin() override { return true; }
+    uint32_t set_sample_rate(uint32_t rate) override;
+    uint32_t latency_ms() override { return 0; }
+    bool ready() override { return true; }
+    // Raw 16-bit stereo PCM goes here from now on; an unopened File drops it
+    void set_file(File file) { this->file = file; }
+    uint32_t frames_played() const { return played; }
+
+protected:
+    void output(const Frame *frames, int32_t count) override;
+
+private:
+    File file;
+    volatile uint32_t played = 0;
+    int64_t due_us = 0;
+};
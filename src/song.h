@@ -0,0 +1,47 @@
+#pragma once
+
+#include <Arduino.h>
+#include "memory.h"
+
+// ---------- Songs ----------
+enum FileType { MP3, WAV, FLAC, M4A };
+
+struct Song {
+  String path;
+  FileType type;
+  String title; // from the tags, empty until known
+  uint32_t start; // CUE track: byte range of the file it plays;
+  uint32_t end;   // both 0 for a whole file
+};
+
+// CUE tracks of one file share its path and differ by where they start
+inline bool song_same(const Song &a, const Song &b) {
+    return a.path == b.path && a.start == b.start;
+}
+
+// Library lists count against MEM_LIBRARY in the memory report
+typedef MemVector<Song, MEM_LIBRARY> SongList;
+typedef MemVector<String, MEM_LIBRARY> NameList;
+
+// Maps a file name to a playable type by extension; false for anything else
+inline bool song_type_from_path(const String &path, FileType &type) {
+    String lower = path;
+    lower.toLowerCase();
+    if (lower.endsWith(".mp3")) {
+        type = MP3;
+        return true;
+    }
+    if (lower.endsWith(".wav")) {
+        type = WAV;
+        return true;
+    }
+    if (lower.endsWith(".flac")) {
+        type = FLAC;
+        return true;
+    }
+    if (lower.endsWith(".m4a") || lower.endsWith(".m4b")) {
+        type = M4A;
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,56 @@
+#include "speakers.h"
+#include "settings.h"
+
+static SpeakerList speakers;
+
+void speakers_begin() {
+    if (!settings_get(SPEAKERS_KEY, speakers) || speakers.count > SPEAKERS_MAX) {
+        memset(&speakers, 0, sizeof(speakers));
+    }
+    for (int i = 0; i < speakers.count; i++) {
+        KnownSpeaker &speaker = speakers.list[i];
+        speaker.name[sizeof(speaker.name) - 1] = '\0';
+        Serial.printf("Known speaker %d: %s, last connected %u connections ago\n", i + 1, speaker.name,
+                      speakers_connections_ago(i));
+    }
+}
+
+// The ESP32 has no clock that survives a reboot, so "when" is a connection
+// number: the newest speaker's last_seen is the count of connections so far.
+// It is only written with the list, once per connection.
+uint32_t speakers_connections_ago(int index) {
+    return speakers.count ? speakers.list[0].last_seen - speakers.list[index].last_seen : 0;
+}
+
+int speakers_count() {
+    return speakers.count;
+}
+
+const KnownSpeaker &speakers_get(int index) {
+    return speakers.list[index];
+}
+
+int speakers_find(const esp_bd_addr_t address) {
+    for (int i = 0; i < speakers.count; i++) {
+        if (memcmp(speakers.list[i].address, address, ESP_BD_ADDR_LEN) == 0) return i;
+    }
+    return -1;
+}
+
+void speakers_touch(const esp_bd_addr_t address, const char *name) {
+    uint32_t connection = speakers.count ? speakers.list[0].last_seen + 1 : 1;
+    int index = speakers_find(address);
+    if (index < 0) {
+        // New speaker; the least recently used one drops off a full list
+        index = speakers.count < SPEAKERS_MAX ? speakers.count++ : SPEAKERS_MAX - 1;
+    }
+    for (int i = index; i > 0; i--) {
+        speakers.list[i] = speakers.list[i - 1];
+    }
+    KnownSpeaker &speaker = speakers.list[0];
+    memset(&speaker, 0, sizeof(speaker));
+    memcpy(speaker.address, address, ESP_BD_ADDR_LEN);
+    strncpy(speaker.name, name, sizeof(speaker.name) - 1);
+    speaker.last_seen = connection;
+    settings_put(SPEAKERS_KEY, speakers);
+}
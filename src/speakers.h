@@ -0,0 +1,33 @@
+#pragma once
+
+#include <Arduino.h>
+#include <esp_bt_defs.h>
+
+// ---------- Known speakers ----------
+// Speakers that connected before, most recently used first. At boot and on a
+// lost link they are paged directly by address, which takes a second or two
+// per speaker, instead of waiting for a ~13 s inquiry to find them again.
+
+#define SPEAKERS_KEY "speakers"
+#define SPEAKERS_MAX 4
+
+struct KnownSpeaker {
+    esp_bd_addr_t address;
+    char name[32];
+    uint32_t last_seen;      // connection number of its last connection, counting all speakers
+};
+
+// As stored in the settings
+struct SpeakerList {
+    uint8_t count;
+    KnownSpeaker list[SPEAKERS_MAX];
+};
+
+void speakers_begin();
+int speakers_count();
+const KnownSpeaker &speakers_get(int index);
+int speakers_find(const esp_bd_addr_t address);
+// Connections since this one last connected; 0 for the latest
+uint32_t speakers_connections_ago(int index);
+// Moves a speaker to the front after a successful connection
+void speakers_touch(const esp_bd_addr_t address, const char *name);
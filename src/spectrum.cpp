@@ -0,0 +1,237 @@
+#include "spectrum.h"
+#include "tasks.h"
+#include <Adafruit_SSD1306.h>
+#include <math.h>
+
+#define SPECTRUM_FFT_BITS 8
+#define SPECTRUM_FFT_SIZE (1 << SPECTRUM_FFT_BITS)
+#define SPECTRUM_RING_SIZE 1024 // power of two, 4x the FFT window
+#define SPECTRUM_TARGET_RATE 22050
+
+// Frame intervals: full rate matches the loop() redraw period, the others
+// are used as the decode path runs out of CPU
+#define SPECTRUM_INTERVAL_FULL_MS 120
+#define SPECTRUM_INTERVAL_REDUCED_MS 250
+#define SPECTRUM_INTERVAL_MIN_MS 500
+#define SPECTRUM_UNDERRUN_BACKOFF_MS 5000
+#define SPECTRUM_LOAD_REDUCED 50
+#define SPECTRUM_LOAD_MIN 70
+
+// ---------- PCM tap (written by the A2DP callback only) ----------
+static int16_t spectrum_ring[SPECTRUM_RING_SIZE];
+static volatile uint32_t spectrum_ring_write = 0;
+static uint32_t spectrum_decim_phase = 0;
+
+// ---------- Analyzer state ----------
+static int16_t fft_re[SPECTRUM_FFT_SIZE];
+static int16_t fft_im[SPECTRUM_FFT_SIZE];
+static int16_t fft_window[SPECTRUM_FFT_SIZE];
+static int16_t fft_sin[SPECTRUM_FFT_SIZE * 3 / 4];
+static uint8_t spectrum_band_edges[SPECTRUM_BARS + 1];
+
+// Published to the UI; torn reads only cost one odd-looking bar
+static volatile uint8_t spectrum_bars[SPECTRUM_BARS];
+static volatile uint8_t spectrum_peaks[SPECTRUM_BARS];
+static uint8_t spectrum_peak_hold[SPECTRUM_BARS];
+static volatile uint32_t spectrum_frame_seq = 0;
+static uint32_t spectrum_drawn_seq = 0;
+
+static volatile bool spectrum_enabled = false;
+static volatile int spectrum_audio_load = 0;
+static volatile unsigned long spectrum_last_underrun = 0;
+static volatile uint32_t spectrum_interval_ms = SPECTRUM_INTERVAL_FULL_MS;
+static TaskHandle_t spectrum_task_handle = nullptr;
+
+void spectrum_tap(const int16_t *pcm, size_t samples, int channels, int sample_rate) {
+    if (!spectrum_enabled || channels < 1 || channels > 2 || sample_rate <= 0) return;
+
+    uint32_t decim = sample_rate / SPECTRUM_TARGET_RATE;
+    if (decim < 1) decim = 1;
+
+    uint32_t w = spectrum_ring_write;
+    for (size_t n = 0; n + channels <= samples; n += channels) {
+        if (++spectrum_decim_phase < decim) continue;
+        spectrum_decim_phase = 0;
+        int32_t mono = channels == 2 ? (pcm[n] + pcm[n + 1]) >> 1 : pcm[n];
+        spectrum_ring[w & (SPECTRUM_RING_SIZE - 1)] = (int16_t)mono;
+        w++;
+    }
+    spectrum_ring_write = w;
+}
+
+void spectrum_set_audio_load(int core_percent) {
+    spectrum_audio_load = core_percent;
+}
+
+void spectrum_note_underrun() {
+    spectrum_last_underrun = millis();
+}
+
+void spectrum_set_enabled(bool enabled) {
+    spectrum_enabled = enabled;
+}
+
+bool spectrum_frame_ready() {
+    return spectrum_frame_seq != spectrum_drawn_seq;
+}
+
+uint32_t spectrum_frame_interval_ms() {
+    return spectrum_interval_ms;
+}
+
+// sin(2*pi*i/N) in Q15; cos is read from the same table a quarter further on
+static inline int16_t fft_sin_at(int i) { return fft_sin[i]; }
+static inline int16_t fft_cos_at(int i) { return fft_sin[i + SPECTRUM_FFT_SIZE / 4]; }
+
+// In-place radix-2 DIT FFT, Q15, scaled by 1/2 per stage so it cannot overflow
+static void spectrum_fft() {
+    // Bit reversal
+    for (int i = 1, j = 0; i < SPECTRUM_FFT_SIZE; i++) {
+        int bit = SPECTRUM_FFT_SIZE >> 1;
+        for (; j & bit; bit >>= 1) j ^= bit;
+        j ^= bit;
+        if (i < j) {
+            int16_t t = fft_re[i]; fft_re[i] = fft_re[j]; fft_re[j] = t;
+            t = fft_im[i]; fft_im[i] = fft_im[j]; fft_im[j] = t;
+        }
+    }
+
+    for (int len = 2; len <= SPECTRUM_FFT_SIZE; len <<= 1) {
+        int half = len >> 1;
+        int step = SPECTRUM_FFT_SIZE / len;
+        for (int i = 0; i < SPECTRUM_FFT_SIZE; i += len) {
+            for (int k = 0; k < half; k++) {
+                int32_t wr = fft_cos_at(k * step);
+                int32_t wi = -fft_sin_at(k * step);
+                int a = i + k, b = a + half;
+                int32_t tr = (fft_re[b] * wr - fft_im[b] * wi) >> 15;
+                int32_t ti = (fft_re[b] * wi + fft_im[b] * wr) >> 15;
+                int32_t ar = fft_re[a], ai = fft_im[a];
+                fft_re[a] = (int16_t)((ar + tr) >> 1);
+                fft_im[a] = (int16_t)((ai + ti) >> 1);
+                fft_re[b] = (int16_t)((ar - tr) >> 1);
+                fft_im[b] = (int16_t)((ai - ti) >> 1);
+            }
+        }
+    }
+}
+
+// log2 with two fractional bits, cheap enough for 128 bins
+static int spectrum_log2_q2(uint32_t v) {
+    if (v == 0) return 0;
+    int msb = 31 - __builtin_clz(v);
+    int frac = msb >= 2 ? (v >> (msb - 2)) & 3 : (v << (2 - msb)) & 3;
+    return msb * 4 + frac;
+}
+
+static void spectrum_analyze() {
+    // Copy the newest window out of the ring; the producer would need to write
+    // three more windows during this loop to catch up with us
+    uint32_t end = spectrum_ring_write;
+    uint32_t start = end - SPECTRUM_FFT_SIZE;
+    for (int i = 0; i < SPECTRUM_FFT_SIZE; i++) {
+        fft_re[i] = (int16_t)((spectrum_ring[(start + i) & (SPECTRUM_RING_SIZE - 1)] * fft_window[i]) >> 15);
+        fft_im[i] = 0;
+    }
+
+    spectrum_fft();
+
+    for (int b = 0; b < SPECTRUM_BARS; b++) {
+        uint32_t level = 0;
+        for (int k = spectrum_band_edges[b]; k < spectrum_band_edges[b + 1]; k++) {
+            uint32_t re = abs(fft_re[k]), im = abs(fft_im[k]);
+            // alpha max plus beta min magnitude estimate
+            uint32_t mag = re > im ? re + (im * 3 >> 3) : im + (re * 3 >> 3);
+            if (mag > level) level = mag;
+        }
+
+        // 1.5 dB per step: a full-scale sine lands on 40, -60 dB on 0
+        int height = spectrum_log2_q2(level) - 12;
+        height = constrain(height, 0, 40);
+
+        uint8_t bar = spectrum_bars[b];
+        bar = height >= bar ? height : (bar > 3 ? bar - 3 : 0);
+        spectrum_bars[b] = bar;
+
+        if (bar >= spectrum_peaks[b]) {
+            spectrum_peaks[b] = bar;
+            spectrum_peak_hold[b] = 4;
+        } else if (spectrum_peak_hold[b] > 0) {
+            spectrum_peak_hold[b]--;
+        } else if (spectrum_peaks[b] > 0) {
+            spectrum_peaks[b]--;
+        }
+    }
+    spectrum_frame_seq++;
+}
+
+static uint32_t spectrum_pick_interval() {
+    if (millis() - spectrum_last_underrun < SPECTRUM_UNDERRUN_BACKOFF_MS) {
+        return SPECTRUM_INTERVAL_MIN_MS;
+    }
+    if (spectrum_audio_load >= SPECTRUM_LOAD_MIN) return SPECTRUM_INTERVAL_MIN_MS;
+    if (spectrum_audio_load >= SPECTRUM_LOAD_REDUCED) return SPECTRUM_INTERVAL_REDUCED_MS;
+    return SPECTRUM_INTERVAL_FULL_MS;
+}
+
+static void spectrum_task(void *param) {
+    TickType_t last_wake = xTaskGetTickCount();
+    for (;;) {
+        uint32_t interval = spectrum_pick_interval();
+        if (interval != spectrum_interval_ms) {
+            Serial.printf("[Spectrum] frame interval %u ms (audio load %d%%)\n", interval, spectrum_audio_load);
+            spectrum_interval_ms = interval;
+        }
+
+        if (spectrum_enabled) {
+            spectrum_analyze();
+        } else {
+            bool changed = false;
+            for (int b = 0; b < SPECTRUM_BARS; b++) {
+                if (spectrum_bars[b] || spectrum_peaks[b]) changed = true;
+                spectrum_bars[b] = 0;
+                spectrum_peaks[b] = 0;
+            }
+            if (changed) spectrum_frame_seq++;
+        }
+        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(interval));
+    }
+}
+
+void spectrum_begin() {
+    // Tables are built once with float maths; the analyzer itself is integer only
+    for (int i = 0; i < SPECTRUM_FFT_SIZE * 3 / 4; i++) {
+        fft_sin[i] = (int16_t)lrintf(32767.0f * sinf(2.0f * (float)M_PI * i / SPECTRUM_FFT_SIZE));
+    }
+    for (int i = 0; i < SPECTRUM_FFT_SIZE; i++) {
+        fft_window[i] = (int16_t)lrintf(32767.0f * 0.5f * (1.0f - cosf(2.0f * (float)M_PI * i / (SPECTRUM_FFT_SIZE - 1))));
+    }
+    // Log-spaced bands over bins 1..127 (~86 Hz to ~11 kHz), at least one bin each
+    spectrum_band_edges[0] = 1;
+    for (int b = 1; b <= SPECTRUM_BARS; b++) {
+        int edge = (int)lrintf(powf(SPECTRUM_FFT_SIZE / 2, (float)b / SPECTRUM_BARS));
+        if (edge <= spectrum_band_edges[b - 1]) edge = spectrum_band_edges[b - 1] + 1;
+        spectrum_band_edges[b] = min(edge, SPECTRUM_FFT_SIZE / 2);
+    }
+
+    spectrum_task_handle = task_start(TASK_SPECTRUM, spectrum_task);
+}
+
+void spectrum_draw(Adafruit_GFX &gfx, int16_t x, int16_t y, int16_t w, int16_t h) {
+    spectrum_drawn_seq = spectrum_frame_seq;
+    gfx.fillRect(x, y, w, h, SSD1306_BLACK);
+
+    int16_t bar_pitch = w / SPECTRUM_BARS;
+    int16_t bar_width = bar_pitch > 1 ? bar_pitch - 1 : 1;
+    for (int b = 0; b < SPECTRUM_BARS; b++) {
+        int16_t bar_h = spectrum_bars[b] * h / 40;
+        int16_t peak_y = spectrum_peaks[b] * h / 40;
+        int16_t bx = x + b * bar_pitch;
+        if (bar_h > 0) {
+            gfx.fillRect(bx, y + h - bar_h, bar_width, bar_h, SSD1306_WHITE);
+        }
+        if (peak_y > bar_h && peak_y <= h) {
+            gfx.drawFastHLine(bx, y + h - peak_y, bar_width, SSD1306_WHITE);
+        }
+    }
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <Arduino.h>
+#include <Adafruit_GFX.h>
+
+// ---------- Spectrum analyzer ----------
+// The audio path pushes decimated mono samples into a lock-free ring with
+// spectrum_tap(); an analyzer task (see tasks.h) runs a 256-point fixed-point
+// FFT at display frame rate and publishes bar heights for the renderer.
+
+#define SPECTRUM_BARS 16
+
+void spectrum_begin();
+
+// Audio path (never blocks, never allocates)
+void spectrum_tap(const int16_t *pcm, size_t samples, int channels, int sample_rate);
+
+// Hints from the audio side used to lower the analyzer frame rate
+void spectrum_set_audio_load(int core_percent);
+void spectrum_note_underrun();
+
+void spectrum_set_enabled(bool enabled);
+bool spectrum_frame_ready();
+uint32_t spectrum_frame_interval_ms();
+
+// Draws bars with peak markers into the given box (bottom aligned)
+void spectrum_draw(Adafruit_GFX &gfx, int16_t x, int16_t y, int16_t w, int16_t h);
@@ -0,0 +1,321 @@
+#include "tagindex.h"
+#include "library.h"
+#include <SD.h>
+#include <algorithm>
+
+#define TAG_INDEX_MAGIC "WTIX"
+#define TAG_INDEX_FLUSH_RECORDS 128   // postings held per index before they go to its run file
+#define TAG_INDEX_SORT_RECORDS 2048   // postings placed per pass when the index is written
+
+struct TagIndexHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t track_count;
+    uint32_t key_count;
+};
+
+struct TagPosting {
+    uint32_t track_id;
+    uint16_t key;     // key slot while building, sorted key index in the file
+    uint16_t number;  // track number, 0 if untagged
+};
+
+static const char *const index_files[TAG_INDEX_COUNT] = {
+    "/data/_genre.idx", "/data/_year.idx", "/data/_albumartist.idx",
+};
+static const char *const run_files[TAG_INDEX_COUNT] = {
+    "/data/_genre.tmp", "/data/_year.tmp", "/data/_albumartist.tmp",
+};
+static const char *const labels[TAG_INDEX_COUNT] = {"Genre", "Year", "Album artist"};
+
+static uint32_t key_counts[TAG_INDEX_COUNT];
+
+// The page of keys the browse screen is on
+static int page_field = -1;
+static uint32_t page_first = 0;
+static uint32_t page_count = 0;
+static TagIndexKey page_keys[TAG_INDEX_PAGE_KEYS];
+
+const char *tag_index_label(TagIndexField field) {
+    return labels[field];
+}
+
+// ---------- Build ----------
+// Each index collects its distinct keys in RAM (counts only) and appends
+// (track, key slot) postings to a run file on the card. At the end the keys
+// are sorted and the postings are placed behind them in key order, a buffer
+// of them per pass over the run file, so RAM stays bounded by the number of
+// keys however large the library is. Only two files are open at a time; the
+// card allows five.
+struct TagIndexBuild {
+    MemVector<TagIndexKey, MEM_LIBRARY> keys;
+    MemVector<TagPosting, MEM_LIBRARY> pending;
+    int last_slot;   // tracks of one album usually share their keys
+    uint32_t dropped;
+};
+static TagIndexBuild builds[TAG_INDEX_COUNT];
+
+static void flush_pending(int field) {
+    TagIndexBuild &build = builds[field];
+    if (build.pending.empty()) return;
+    File run = SD.open(run_files[field], FILE_APPEND);
+    if (run) {
+        run.write((const uint8_t*)build.pending.data(), build.pending.size() * sizeof(TagPosting));
+        run.close();
+    }
+    build.pending.clear();
+}
+
+static int find_slot(TagIndexBuild &build, const char *name) {
+    if (build.last_slot >= 0 && strcasecmp(build.keys[build.last_slot].name, name) == 0) {
+        return build.last_slot;
+    }
+    for (size_t i = 0; i < build.keys.size(); i++) {
+        if (strcasecmp(build.keys[i].name, name) == 0) return build.last_slot = i;
+    }
+    if (build.keys.size() >= TAG_INDEX_MAX_KEYS) return -1;
+    TagIndexKey key = {};
+    strncpy(key.name, name, sizeof(key.name) - 1);
+    build.keys.push_back(key);
+    return build.last_slot = build.keys.size() - 1;
+}
+
+static void add_posting(int field, uint32_t track_id, const char *name, uint16_t number) {
+    TagIndexBuild &build = builds[field];
+    while (*name == ' ') name++;
+    if (*name == '\0') return;
+    int slot = find_slot(build, name);
+    if (slot < 0) {
+        build.dropped++;
+        return;
+    }
+    build.keys[slot].count++;
+    build.pending.push_back({track_id, (uint16_t)slot, number});
+    if (build.pending.size() >= TAG_INDEX_FLUSH_RECORDS) flush_pending(field);
+}
+
+void tag_index_build_begin() {
+    for (int field = 0; field < TAG_INDEX_COUNT; field++) {
+        SD.remove(run_files[field]);
+        builds[field].keys.clear();
+        builds[field].pending.clear();
+        builds[field].last_slot = -1;
+        builds[field].dropped = 0;
+        key_counts[field] = 0;
+    }
+    page_field = -1;
+}
+
+void tag_index_add(uint32_t track_id, const String &path, const TrackInfo &info) {
+    add_posting(TAG_INDEX_GENRE, track_id, info.genre, info.track);
+    if (info.year) {
+        char year[8];
+        snprintf(year, sizeof(year), "%04u", info.year);
+        add_posting(TAG_INDEX_YEAR, track_id, year, info.track);
+    }
+    if (info.album_artist[0]) {
+        add_posting(TAG_INDEX_ALBUM_ARTIST, track_id, info.album_artist, info.track);
+    } else if (info.artist[0]) {
+        add_posting(TAG_INDEX_ALBUM_ARTIST, track_id, info.artist, info.track);
+    } else {
+        // /Artist/Album/file
+        String folder = path.substring(1, path.indexOf('/', 1));
+        add_posting(TAG_INDEX_ALBUM_ARTIST, track_id, folder.c_str(), info.track);
+    }
+}
+
+static bool write_index(int field, uint32_t track_count) {
+    TagIndexBuild &build = builds[field];
+    flush_pending(field);
+    uint32_t key_count = build.keys.size();
+
+    // rank[slot] is the key's place in sorted order
+    MemVector<uint16_t, MEM_LIBRARY> order(key_count);
+    for (uint32_t i = 0; i < key_count; i++) order[i] = i;
+    std::sort(order.begin(), order.end(), [&build](uint16_t a, uint16_t b) {
+        return strcasecmp(build.keys[a].name, build.keys[b].name) < 0;
+    });
+    MemVector<uint16_t, MEM_LIBRARY> rank(key_count);
+    MemVector<TagIndexKey, MEM_LIBRARY> sorted(key_count);
+    uint32_t total = 0;
+    for (uint32_t i = 0; i < key_count; i++) {
+        rank[order[i]] = i;
+        sorted[i] = build.keys[order[i]];
+        sorted[i].first = total;
+        total += sorted[i].count;
+    }
+    build.keys.clear();
+
+    SD.remove(index_files[field]);
+    File out = SD.open(index_files[field], FILE_WRITE);
+    if (!out) {
+        Serial.printf("[Index] cannot write %s\n", index_files[field]);
+        SD.remove(run_files[field]);
+        return false;
+    }
+    TagIndexHeader header;
+    memcpy(header.magic, TAG_INDEX_MAGIC, 4);
+    header.version = TAG_INDEX_VERSION;
+    header.track_count = 0; // placeholder until the postings are all written
+    header.key_count = key_count;
+    out.write((const uint8_t*)&header, sizeof(header));
+    out.write((const uint8_t*)sorted.data(), key_count * sizeof(TagIndexKey));
+
+    // The run file is in track order, so each key's postings land in track
+    // order as well; one pass places postings [from, from + buffer size)
+    MemVector<TagPosting, MEM_LIBRARY> placed(min(total, (uint32_t)TAG_INDEX_SORT_RECORDS));
+    MemVector<uint32_t, MEM_LIBRARY> filled(key_count);
+    TagPosting chunk[32];
+    bool ok = true;
+    for (uint32_t from = 0; from < total && ok; from += placed.size()) {
+        uint32_t to = min(total, from + (uint32_t)placed.size());
+        std::fill(filled.begin(), filled.end(), 0);
+        File run = SD.open(run_files[field], FILE_READ);
+        if (!run) {
+            ok = false;
+            break;
+        }
+        size_t got;
+        while ((got = run.read((uint8_t*)chunk, sizeof(chunk)) / sizeof(TagPosting)) > 0) {
+            for (size_t i = 0; i < got; i++) {
+                uint16_t key = rank[chunk[i].key];
+                uint32_t at = sorted[key].first + filled[key]++;
+                if (at >= from && at < to) placed[at - from] = {chunk[i].track_id, key, chunk[i].number};
+            }
+        }
+        run.close();
+        size_t bytes = (to - from) * sizeof(TagPosting);
+        ok = out.write((const uint8_t*)placed.data(), bytes) == bytes;
+    }
+    if (ok) {
+        header.track_count = track_count;
+        out.seek(0);
+        out.write((const uint8_t*)&header, sizeof(header));
+    }
+    out.close();
+    SD.remove(run_files[field]);
+
+    if (ok) key_counts[field] = key_count;
+    Serial.printf("[Index] %s: %u keys, %u tracks", labels[field], key_count, total);
+    if (build.dropped) Serial.printf(", %u past the %d key limit left out", build.dropped, TAG_INDEX_MAX_KEYS);
+    Serial.println(ok ? "" : ", write failed");
+    return ok;
+}
+
+bool tag_index_build_end(uint32_t track_count) {
+    bool ok = true;
+    for (int field = 0; field < TAG_INDEX_COUNT; field++) {
+        ok = write_index(field, track_count) && ok;
+    }
+    return ok;
+}
+
+// ---------- Lookup ----------
+
+static bool read_header(int field, TagIndexHeader &header) {
+    File idx = SD.open(index_files[field], FILE_READ);
+    if (!idx) return false;
+    bool ok = idx.read((uint8_t*)&header, sizeof(header)) == sizeof(header) &&
+              memcmp(header.magic, TAG_INDEX_MAGIC, 4) == 0 && header.version == TAG_INDEX_VERSION;
+    idx.close();
+    return ok;
+}
+
+bool tag_index_open(uint32_t track_count) {
+    page_field = -1;
+    for (int field = 0; field < TAG_INDEX_COUNT; field++) {
+        TagIndexHeader header;
+        if (!read_header(field, header) || header.track_count != track_count) {
+            memset(key_counts, 0, sizeof(key_counts));
+            return false;
+        }
+        key_counts[field] = header.key_count;
+    }
+    return true;
+}
+
+uint32_t tag_index_key_count(TagIndexField field) {
+    return key_counts[field];
+}
+
+bool tag_index_key(TagIndexField field, uint32_t index, TagIndexKey &key) {
+    if (index >= key_counts[field]) return false;
+    if (page_field != field || index < page_first || index >= page_first + page_count) {
+        page_field = -1;
+        File idx = SD.open(index_files[field], FILE_READ);
+        if (!idx) return false;
+        page_first = index - index % TAG_INDEX_PAGE_KEYS;
+        page_count = min((uint32_t)TAG_INDEX_PAGE_KEYS, key_counts[field] - page_first);
+        idx.seek(sizeof(TagIndexHeader) + page_first * sizeof(TagIndexKey));
+        size_t bytes = page_count * sizeof(TagIndexKey);
+        bool ok = idx.read((uint8_t*)page_keys, bytes) == bytes;
+        idx.close();
+        if (!ok) return false;
+        page_field = field;
+    }
+    key = page_keys[index - page_first];
+    return true;
+}
+
+bool tag_index_tracks(TagIndexField field, uint32_t index, SongList &songs) {
+    songs.clear();
+    TagIndexKey key;
+    if (!tag_index_key(field, index, key)) return false;
+    uint32_t count = min(key.count, (uint32_t)TAG_INDEX_MAX_TRACKS);
+
+    MemVector<TagPosting, MEM_LIBRARY> postings(count);
+    File idx = SD.open(index_files[field], FILE_READ);
+    if (!idx) return false;
+    idx.seek(sizeof(TagIndexHeader) + key_counts[field] * sizeof(TagIndexKey) + key.first * sizeof(TagPosting));
+    size_t bytes = count * sizeof(TagPosting);
+    bool ok = idx.read((uint8_t*)postings.data(), bytes) == bytes;
+    idx.close();
+    if (!ok) return false;
+
+    MemVector<uint32_t, MEM_LIBRARY> ids(count);
+    for (uint32_t i = 0; i < count; i++) ids[i] = postings[i].track_id;
+    SongList resolved;
+    if (!library_get_songs(ids.data(), count, resolved)) return false;
+    if (key.count > count) {
+        Serial.printf("[Index] %s: first %u of %u tracks listed\n", key.name, count, key.count);
+    }
+    // Ids the library can no longer resolve are left out
+    MemVector<uint16_t, MEM_LIBRARY> numbers;
+    songs.reserve(count);
+    numbers.reserve(count);
+    for (uint32_t i = 0; i < count; i++) {
+        if (resolved[i].path.length() == 0) continue;
+        songs.push_back(resolved[i]);
+        numbers.push_back(postings[i].number);
+    }
+
+    // Library order keeps an album's files together but in card order;
+    // an album whose tracks are all numbered plays in number order
+    size_t from = 0;
+    while (from < songs.size()) {
+        String folder = songs[from].path.substring(0, songs[from].path.lastIndexOf('/') + 1);
+        size_t to = from;
+        bool numbered = true;
+        while (to < songs.size() && songs[to].path.startsWith(folder) &&
+               songs[to].path.indexOf('/', folder.length()) < 0) {
+            numbered = numbered && numbers[to];
+            to++;
+        }
+        SongList album;
+        album.reserve(to - from);
+        if (numbered) {
+            MemVector<uint16_t, MEM_LIBRARY> order(to - from);
+            for (size_t i = 0; i < order.size(); i++) order[i] = from + i;
+            std::stable_sort(order.begin(), order.end(), [&numbers](uint16_t a, uint16_t b) {
+                return numbers[a] < numbers[b];
+            });
+            for (uint16_t i : order) album.push_back(songs[i]);
+        } else {
+            album.insert(album.end(), songs.begin() + from, songs.begin() + to);
+        }
+        tags_load_titles(album);
+        for (size_t i = from; i < to; i++) songs[i] = album[i - from];
+        from = to;
+    }
+    return true;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <Arduino.h>
+#include "song.h"
+#include "tags.h"
+
+// ---------- Tag indexes ----------
+// Secondary indexes over the library track ids, for browsing by genre, year
+// and album artist whatever the folders are called. Each is one file: a
+// header, the distinct keys sorted case-insensitively (fixed-size entries,
+// each with the first and count of its postings), then the posting lists,
+// track ids in library order with their track numbers. A browse screen reads
+// the page of keys it shows and the one posting list picked; nothing is kept
+// in RAM per track. The indexes are built with the library, from the tags
+// cached per album folder. Tracks without an album artist tag are listed
+// under their artist tag, or else their artist folder.
+
+#define TAG_INDEX_VERSION 1
+#define TAG_INDEX_KEY_LEN 32
+#define TAG_INDEX_MAX_KEYS 1024   // distinct keys per index; tracks of later ones are left out
+#define TAG_INDEX_PAGE_KEYS 16    // keys read per page while browsing
+#define TAG_INDEX_MAX_TRACKS 500  // longest list a key opens; each song costs heap
+
+enum TagIndexField {
+    TAG_INDEX_GENRE,
+    TAG_INDEX_YEAR,
+    TAG_INDEX_ALBUM_ARTIST,
+    TAG_INDEX_COUNT
+};
+
+struct TagIndexKey {
+    char name[TAG_INDEX_KEY_LEN];
+    uint32_t first;  // posting number of its first track
+    uint32_t count;
+};
+
+// "Genre", "Year", "Album artist"
+const char *tag_index_label(TagIndexField field);
+
+// Build, called by library_build() with every track id in order
+void tag_index_build_begin();
+void tag_index_add(uint32_t track_id, const String &path, const TrackInfo &info);
+bool tag_index_build_end(uint32_t track_count);
+
+// True if all indexes on the card were built for this library
+bool tag_index_open(uint32_t track_count);
+
+uint32_t tag_index_key_count(TagIndexField field);
+bool tag_index_key(TagIndexField field, uint32_t index, TagIndexKey &key);
+
+// The tracks filed under one key, album by album in track number order and
+// with their titles
+bool tag_index_tracks(TagIndexField field, uint32_t index, SongList &songs);
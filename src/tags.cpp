@@ -0,0 +1,679 @@
+#include "tags.h"
+#include "m4a.h"
+#include <SD.h>
+
+#define TAGS_CACHE_VERSION 4
+#define TAGS_MAX_FRAME_READ 256
+
+struct TagCacheRecord {
+    uint32_t name_hash;
+    uint32_t file_size;
+    TrackInfo info;
+};
+
+struct TagCacheHeader {
+    char magic[4];
+    uint32_t version;
+};
+
+// ---------- Text helpers ----------
+
+// FNV-1a over the file name, enough to key a folder's cache
+static uint32_t tags_hash(const String &name) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < name.length(); i++) {
+        h = (h ^ (uint8_t)name[i]) * 16777619u;
+    }
+    return h;
+}
+
+// Converts ID3 text (any of the four encodings) to the plain ASCII the OLED
+// font can show; anything else becomes '?'. NUL separators are kept so
+// TXXX description/value pairs survive. Returns the number of chars written.
+static size_t tags_decode_text(const uint8_t *data, size_t len, char *out, size_t out_size) {
+    if (len == 0 || out_size == 0) return 0;
+    uint8_t encoding = data[0];
+    data++;
+    len--;
+
+    size_t o = 0;
+    if (encoding == 1 || encoding == 2) {
+        bool little_endian = false;
+        size_t i = 0;
+        if (encoding == 1 && len >= 2) {
+            little_endian = data[0] == 0xFF && data[1] == 0xFE;
+            i = 2;
+        }
+        for (; i + 1 < len && o + 1 < out_size; i += 2) {
+            uint16_t unit = little_endian ? data[i] | (data[i + 1] << 8) : (data[i] << 8) | data[i + 1];
+            if (unit == 0xFEFF) continue; // a BOM in front of the next string
+            if (unit == 0xDC00 || (unit >= 0xD800 && unit < 0xDC00)) {
+                out[o++] = '?';
+                i += 2; // skip the low surrogate as well
+                continue;
+            }
+            if (unit >= 0xDC00 && unit < 0xE000) continue;
+            out[o++] = unit < 0x80 ? (char)unit : '?';
+        }
+    } else {
+        for (size_t i = 0; i < len && o + 1 < out_size; i++) {
+            uint8_t c = data[i];
+            if (c < 0x80) {
+                out[o++] = (char)c;
+            } else if (encoding == 3 && (c & 0xC0) == 0x80) {
+                continue; // UTF-8 continuation byte
+            } else {
+                out[o++] = '?';
+            }
+        }
+    }
+    out[o] = 0;
+    return o;
+}
+
+static void tags_set_field(char *field, size_t size, const char *value) {
+    if (field[0] != 0 || value[0] == 0) return; // first tag found wins
+    strncpy(field, value, size - 1);
+    field[size - 1] = 0;
+}
+
+static int16_t tags_parse_gain(const char *value) {
+    float db = atof(value);
+    if (db < -60.0f || db > 60.0f) return TAGS_NO_REPLAYGAIN;
+    return (int16_t)lrintf(db * 100.0f);
+}
+
+static uint32_t tags_syncsafe(const uint8_t *b) {
+    return ((b[0] & 0x7F) << 21) | ((b[1] & 0x7F) << 14) | ((b[2] & 0x7F) << 7) | (b[3] & 0x7F);
+}
+
+static uint32_t tags_be32(const uint8_t *b) {
+    return ((uint32_t)b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
+}
+
+static uint32_t tags_le32(const uint8_t *b) {
+    return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+// ID3v1 genre numbers, also used by ID3v2 "(17)" and MP4 'gnre'
+static const char *const tags_genres[] = {
+    "Blues", "Classic Rock", "Country", "Dance", "Disco", "Funk", "Grunge", "Hip-Hop",
+    "Jazz", "Metal", "New Age", "Oldies", "Other", "Pop", "R&B", "Rap",
+    "Reggae", "Rock", "Techno", "Industrial", "Alternative", "Ska", "Death Metal", "Pranks",
+    "Soundtrack", "Euro-Techno", "Ambient", "Trip-Hop", "Vocal", "Jazz+Funk", "Fusion", "Trance",
+    "Classical", "Instrumental", "Acid", "House", "Game", "Sound Clip", "Gospel", "Noise",
+    "AlternRock", "Bass", "Soul", "Punk", "Space", "Meditative", "Instrumental Pop", "Instrumental Rock",
+    "Ethnic", "Gothic", "Darkwave", "Techno-Industrial", "Electronic", "Pop-Folk", "Eurodance", "Dream",
+    "Southern Rock", "Comedy", "Cult", "Gangsta", "Top 40", "Christian Rap", "Pop/Funk", "Jungle",
+    "Native American", "Cabaret", "New Wave", "Psychedelic", "Rave", "Showtunes", "Trailer", "Lo-Fi",
+    "Tribal", "Acid Punk", "Acid Jazz", "Polka", "Retro", "Musical", "Rock & Roll", "Hard Rock",
+};
+
+static void tags_set_genre_number(TrackInfo &info, int number) {
+    if (number >= 0 && number < (int)(sizeof(tags_genres) / sizeof(tags_genres[0]))) {
+        tags_set_field(info.genre, sizeof(info.genre), tags_genres[number]);
+    }
+}
+
+// "Rock", "17", "(17)" or "(17)Rock"; text after the number wins
+static void tags_set_genre(TrackInfo &info, const char *value) {
+    char *rest;
+    bool parens = value[0] == '(';
+    long number = strtol(value + parens, &rest, 10);
+    if (rest == value + parens || (parens && *rest != ')') || (!parens && *rest)) {
+        tags_set_field(info.genre, sizeof(info.genre), value); // plain text, "80s" included
+        return;
+    }
+    rest += parens;
+    if (*rest) {
+        tags_set_field(info.genre, sizeof(info.genre), rest);
+    } else {
+        tags_set_genre_number(info, (int)number);
+    }
+}
+
+// "1999", "1999-05-01" or "1999-05-01T12:00"
+static void tags_set_year(TrackInfo &info, const char *value) {
+    int year = atoi(value);
+    if (info.year == 0 && year > 0 && year < 10000) info.year = year;
+}
+
+// ---------- ID3v2 ----------
+
+static void tags_apply_frame(const char *id, const uint8_t *data, size_t len, TrackInfo &info) {
+    char text[TAGS_MAX_FRAME_READ];
+    size_t n = tags_decode_text(data, len, text, sizeof(text));
+
+    if (!strcmp(id, "TIT2") || !strcmp(id, "TT2")) {
+        tags_set_field(info.title, sizeof(info.title), text);
+    } else if (!strcmp(id, "TPE1") || !strcmp(id, "TP1")) {
+        tags_set_field(info.artist, sizeof(info.artist), text);
+    } else if (!strcmp(id, "TALB") || !strcmp(id, "TAL")) {
+        tags_set_field(info.album, sizeof(info.album), text);
+    } else if (!strcmp(id, "TPE2") || !strcmp(id, "TP2")) {
+        tags_set_field(info.album_artist, sizeof(info.album_artist), text);
+    } else if (!strcmp(id, "TCON") || !strcmp(id, "TCO")) {
+        tags_set_genre(info, text);
+    } else if (!strcmp(id, "TYER") || !strcmp(id, "TYE") || !strcmp(id, "TDRC")) {
+        tags_set_year(info, text);
+    } else if (!strcmp(id, "TRCK") || !strcmp(id, "TRK")) {
+        if (info.track == 0) info.track = atoi(text); // "5/12" reads as 5
+    } else if (!strcmp(id, "TXXX") || !strcmp(id, "TXX")) {
+        // description NUL value
+        size_t desc_len = strlen(text);
+        if (desc_len < n && !strcasecmp(text, "REPLAYGAIN_TRACK_GAIN")) {
+            info.replaygain_db100 = tags_parse_gain(text + desc_len + 1);
+        }
+    }
+}
+
+// Reads a tag body. With tag-wide unsynchronisation (the header flag, used
+// by v2.2/v2.3 writers) every FF 00 in the file stands for FF, so the
+// frame sizes count bytes after undoing it and the walk has to read
+// through rather than seek.
+struct Id3Reader {
+    File &file;
+    uint32_t pos;  // file position
+    uint32_t end;  // file position where the tag ends
+    bool unsync;
+    bool after_ff;
+};
+
+static size_t tags_id3_read(Id3Reader &r, uint8_t *out, size_t n) {
+    r.file.seek(r.pos);
+    if (!r.unsync) {
+        n = r.file.read(out, min((uint32_t)n, r.end - r.pos));
+        r.pos += n;
+        return n;
+    }
+    size_t got = 0;
+    while (got < n && r.pos < r.end) {
+        int c = r.file.read();
+        if (c < 0) break;
+        r.pos++;
+        if (r.after_ff && c == 0) {
+            r.after_ff = false;
+            continue;
+        }
+        r.after_ff = c == 0xFF;
+        out[got++] = c;
+    }
+    return got;
+}
+
+static bool tags_id3_skip(Id3Reader &r, uint32_t n) {
+    if (!r.unsync) {
+        r.pos += n;
+        return r.pos <= r.end;
+    }
+    uint8_t scratch[64];
+    while (n > 0) {
+        size_t step = min(n, (uint32_t)sizeof(scratch));
+        if (tags_id3_read(r, scratch, step) != step) return false;
+        n -= step;
+    }
+    return true;
+}
+
+// v2.4 unsynchronises frame by frame; undoes it in place
+static size_t tags_id3_resync(uint8_t *data, size_t n) {
+    size_t o = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (i > 0 && data[i - 1] == 0xFF && data[i] == 0) continue;
+        data[o++] = data[i];
+    }
+    return o;
+}
+
+// Walks one ID3v2 tag starting at the current position. Returns the tag's
+// total size, or 0 when there is no tag here.
+static uint32_t tags_read_id3v2(File &file, uint32_t tag_start, TrackInfo &info) {
+    uint8_t header[10];
+    file.seek(tag_start);
+    if (file.read(header, 10) != 10 || memcmp(header, "ID3", 3) != 0) return 0;
+
+    uint8_t version = header[3];
+    uint8_t flags = header[5];
+    uint32_t tag_size = tags_syncsafe(header + 6);
+    uint32_t total = 10 + tag_size + ((flags & 0x10) ? 10 : 0);
+    if (version < 2 || version > 4) return total; // unknown layout: skip it whole
+
+    Id3Reader r = {file, tag_start + 10, tag_start + 10 + tag_size, (flags & 0x80) && version < 4, false};
+    bool all_frames_unsync = (flags & 0x80) && version == 4;
+
+    if ((flags & 0x40) && version >= 3) {
+        // Extended header: v2.4 size includes itself and is syncsafe
+        uint8_t ext[4];
+        if (tags_id3_read(r, ext, 4) != 4) return total;
+        uint32_t ext_size = version == 4 ? tags_syncsafe(ext) : tags_be32(ext) + 4;
+        if (ext_size < 4 || !tags_id3_skip(r, ext_size - 4)) return total;
+    }
+
+    int header_len = version == 2 ? 6 : 10;
+    uint8_t data[TAGS_MAX_FRAME_READ];
+    while (r.pos + header_len <= r.end) {
+        uint8_t fh[10];
+        if (tags_id3_read(r, fh, header_len) != header_len || fh[0] == 0) break; // padding
+
+        char id[5] = {0};
+        uint32_t frame_size;
+        uint8_t format = 0;
+        if (version == 2) {
+            memcpy(id, fh, 3);
+            frame_size = (fh[3] << 16) | (fh[4] << 8) | fh[5];
+        } else {
+            memcpy(id, fh, 4);
+            frame_size = version == 4 ? tags_syncsafe(fh + 4) : tags_be32(fh + 4);
+            format = fh[9];
+        }
+        if (frame_size == 0 || r.pos + frame_size > r.end) break;
+        uint32_t frame_start = r.pos;
+
+        // Compressed or encrypted frames are skipped whole
+        bool packed = version == 3 ? (format & 0xC0) : version == 4 ? (format & 0x0C) : false;
+        bool frame_unsync = r.unsync || (version == 4 && (all_frames_unsync || (format & 0x02)));
+        // v2.4 data length indicator: 4 syncsafe bytes ahead of the data
+        uint32_t skip = version == 4 && (format & 0x01) ? 4 : 0;
+
+        // Only text frames are read; pictures are noted and seeked over. An
+        // unsynchronised picture is not the plain image the thumbnailer
+        // needs, so it is left out.
+        uint32_t consumed = 0;
+        bool picture = !strcmp(id, "APIC") || !strcmp(id, "PIC");
+        if (packed || frame_size <= skip) {
+            // nothing we can read
+        } else if (picture && info.picture_length == 0 && !frame_unsync) {
+            info.picture_start = frame_start + skip;
+            info.picture_length = frame_size - skip;
+        } else if (id[0] == 'T') {
+            size_t n = min((uint32_t)sizeof(data), frame_size);
+            consumed = tags_id3_read(r, data, n);
+            if (consumed == n) {
+                n -= skip;
+                memmove(data, data + skip, n);
+                if (frame_unsync && !r.unsync) n = tags_id3_resync(data, n);
+                tags_apply_frame(id, data, n, info);
+            }
+        }
+        if (r.unsync) {
+            // frame_size counts the bytes after resynchronising: read through
+            if (!tags_id3_skip(r, frame_size - consumed)) break;
+        } else {
+            r.pos = frame_start + frame_size;
+        }
+    }
+    return total;
+}
+
+// ---------- Trailing tags ----------
+
+static void tags_read_id3v1(const uint8_t *tag, TrackInfo &info) {
+    char text[31];
+    const struct { int offset; char *field; size_t size; } fields[] = {
+        {3, info.title, sizeof(info.title)},
+        {33, info.artist, sizeof(info.artist)},
+        {63, info.album, sizeof(info.album)},
+    };
+    for (const auto &f : fields) {
+        memcpy(text, tag + f.offset, 30);
+        text[30] = 0;
+        for (int i = 29; i >= 0 && (text[i] == ' ' || text[i] == 0); i--) text[i] = 0;
+        for (int i = 0; text[i]; i++) if ((uint8_t)text[i] >= 0x80) text[i] = '?';
+        tags_set_field(f.field, f.size, text);
+    }
+    if (info.track == 0 && tag[125] == 0 && tag[126] != 0) {
+        info.track = tag[126]; // ID3v1.1
+    }
+    memcpy(text, tag + 93, 4);
+    text[4] = 0;
+    tags_set_year(info, text);
+    if (tag[127] != 0xFF) tags_set_genre_number(info, tag[127]);
+}
+
+// APEv2 items (UTF-8 key/value pairs); mostly here for ReplayGain
+static void tags_read_ape_items(File &file, uint32_t items_start, uint32_t items_len, uint32_t count, TrackInfo &info) {
+    uint32_t pos = items_start;
+    uint32_t end = items_start + items_len;
+    for (uint32_t i = 0; i < count && pos + 8 < end; i++) {
+        uint8_t head[8];
+        char key[32];
+        file.seek(pos);
+        if (file.read(head, 8) != 8) return;
+        uint32_t value_size = tags_le32(head);
+        size_t key_len = 0;
+        int c;
+        while ((c = file.read()) > 0 && key_len + 1 < sizeof(key)) key[key_len++] = (char)c;
+        key[key_len] = 0;
+        if (c != 0) return; // key too long or truncated
+        pos += 8 + key_len + 1;
+        if (pos + value_size > end) return;
+
+        uint8_t raw[TAGS_MAX_FRAME_READ];
+        char value[TAGS_MAX_FRAME_READ];
+        size_t n = min((uint32_t)sizeof(raw) - 1, value_size);
+        raw[0] = 3; // decode as UTF-8
+        if (file.read(raw + 1, n) == n) {
+            tags_decode_text(raw, n + 1, value, sizeof(value));
+            if (!strcasecmp(key, "Title")) tags_set_field(info.title, sizeof(info.title), value);
+            else if (!strcasecmp(key, "Artist")) tags_set_field(info.artist, sizeof(info.artist), value);
+            else if (!strcasecmp(key, "Album")) tags_set_field(info.album, sizeof(info.album), value);
+            else if (!strcasecmp(key, "Album Artist")) tags_set_field(info.album_artist, sizeof(info.album_artist), value);
+            else if (!strcasecmp(key, "Genre")) tags_set_genre(info, value);
+            else if (!strcasecmp(key, "Year")) tags_set_year(info, value);
+            else if (!strcasecmp(key, "Track") && info.track == 0) info.track = atoi(value);
+            else if (!strcasecmp(key, "REPLAYGAIN_TRACK_GAIN") && info.replaygain_db100 == TAGS_NO_REPLAYGAIN) {
+                info.replaygain_db100 = tags_parse_gain(value);
+            }
+        }
+        pos += value_size;
+    }
+}
+
+// ---------- FLAC ----------
+
+// Vorbis comments ("KEY=value", UTF-8) from a FLAC metadata block
+static void tags_read_vorbis_comments(File &file, uint32_t start, uint32_t length, TrackInfo &info) {
+    uint32_t end = start + length;
+    uint8_t word[4];
+    file.seek(start);
+    if (file.read(word, 4) != 4) return;
+    uint32_t pos = start + 4 + tags_le32(word); // past the vendor string
+    file.seek(pos);
+    if (pos + 4 > end || file.read(word, 4) != 4) return;
+    uint32_t count = tags_le32(word);
+    pos += 4;
+
+    uint8_t raw[TAGS_MAX_FRAME_READ];
+    char text[TAGS_MAX_FRAME_READ];
+    for (uint32_t i = 0; i < count && pos + 4 <= end; i++) {
+        file.seek(pos);
+        if (file.read(word, 4) != 4) return;
+        uint32_t comment_len = tags_le32(word);
+        pos += 4;
+        if (pos + comment_len > end) return;
+
+        size_t n = min((uint32_t)sizeof(raw) - 1, comment_len);
+        raw[0] = 3; // decode as UTF-8
+        if (file.read(raw + 1, n) != n) return;
+        tags_decode_text(raw, n + 1, text, sizeof(text));
+        char *value = strchr(text, '=');
+        if (value) {
+            *value++ = 0;
+            if (!strcasecmp(text, "TITLE")) tags_set_field(info.title, sizeof(info.title), value);
+            else if (!strcasecmp(text, "ARTIST")) tags_set_field(info.artist, sizeof(info.artist), value);
+            else if (!strcasecmp(text, "ALBUM")) tags_set_field(info.album, sizeof(info.album), value);
+            else if (!strcasecmp(text, "ALBUMARTIST") || !strcasecmp(text, "ALBUM ARTIST")) {
+                tags_set_field(info.album_artist, sizeof(info.album_artist), value);
+            }
+            else if (!strcasecmp(text, "GENRE")) tags_set_field(info.genre, sizeof(info.genre), value);
+            else if (!strcasecmp(text, "DATE") || !strcasecmp(text, "YEAR")) tags_set_year(info, value);
+            else if (!strcasecmp(text, "TRACKNUMBER") && info.track == 0) info.track = atoi(value);
+            else if (!strcasecmp(text, "REPLAYGAIN_TRACK_GAIN") && info.replaygain_db100 == TAGS_NO_REPLAYGAIN) {
+                info.replaygain_db100 = tags_parse_gain(value);
+            }
+        }
+        pos += comment_len;
+    }
+}
+
+// Walks the metadata blocks after "fLaC"; audio_start stays on the marker
+// because the FLAC codec needs STREAMINFO itself
+static void tags_read_flac(File &file, uint32_t start, uint32_t file_size, TrackInfo &info) {
+    uint8_t header[4];
+    file.seek(start);
+    if (file.read(header, 4) != 4 || memcmp(header, "fLaC", 4) != 0) return;
+    uint32_t pos = start + 4;
+    bool last = false;
+    while (!last && pos + 4 <= file_size) {
+        file.seek(pos);
+        if (file.read(header, 4) != 4) return;
+        last = header[0] & 0x80;
+        uint32_t length = (header[1] << 16) | (header[2] << 8) | header[3];
+        pos += 4;
+        if ((header[0] & 0x7F) == 4) {
+            tags_read_vorbis_comments(file, pos, length, info);
+        } else if ((header[0] & 0x7F) == 6 && info.picture_length == 0) {
+            info.picture_start = pos;
+            info.picture_length = length;
+        }
+        pos += length;
+    }
+}
+
+// ---------- MP4 ----------
+
+// iTunes-style metadata in moov/udta/meta/ilst. Each item holds a 'data' box
+// with 8 bytes of type and locale in front of the value.
+static void tags_read_mp4(File &file, uint32_t file_size, TrackInfo &info) {
+    uint8_t head[8];
+    file.seek(0);
+    if (file.read(head, 8) != 8 || memcmp(head + 4, "ftyp", 4) != 0) return;
+
+    uint32_t moov, moov_end, udta, udta_end, meta, meta_end, ilst, ilst_end;
+    if (!m4a_find_box(file, 0, file_size, "moov", moov, moov_end) ||
+        !m4a_find_box(file, moov, moov_end, "udta", udta, udta_end) ||
+        !m4a_find_box(file, udta, udta_end, "meta", meta, meta_end)) {
+        return;
+    }
+    // meta is a full box in MP4 but a plain one in QuickTime files
+    file.seek(meta);
+    if (file.read(head, 8) == 8 && memcmp(head + 4, "hdlr", 4) != 0) meta += 4;
+    if (!m4a_find_box(file, meta, meta_end, "ilst", ilst, ilst_end)) return;
+
+    uint32_t pos = ilst;
+    uint8_t raw[TAGS_MAX_FRAME_READ];
+    char text[TAGS_MAX_FRAME_READ];
+    while (pos + 8 <= ilst_end) {
+        file.seek(pos);
+        if (file.read(head, 8) != 8) return;
+        uint32_t item_size = (head[0] << 24) | (head[1] << 16) | (head[2] << 8) | head[3];
+        if (item_size < 8 || pos + item_size > ilst_end) return;
+        char type[5] = {(char)head[4], (char)head[5], (char)head[6], (char)head[7], 0};
+
+        uint32_t data, data_end;
+        if (!strcmp(type, "covr")) {
+            if (m4a_find_box(file, pos + 8, pos + item_size, "data", data, data_end) && data_end > data + 8) {
+                info.picture_start = data + 8;
+                info.picture_length = data_end - data - 8;
+            }
+        } else if (m4a_find_box(file, pos + 8, pos + item_size, "data", data, data_end) && data_end > data + 8) {
+            uint32_t n = min((uint32_t)sizeof(raw) - 1, data_end - data - 8);
+            file.seek(data + 8);
+            raw[0] = 3; // decode as UTF-8
+            if (file.read(raw + 1, n) == n) {
+                tags_decode_text(raw, n + 1, text, sizeof(text));
+                if (!strcmp(type, "\251nam")) tags_set_field(info.title, sizeof(info.title), text);
+                else if (!strcmp(type, "\251ART")) tags_set_field(info.artist, sizeof(info.artist), text);
+                else if (!strcmp(type, "\251alb")) tags_set_field(info.album, sizeof(info.album), text);
+                else if (!strcmp(type, "aART")) tags_set_field(info.album_artist, sizeof(info.album_artist), text);
+                else if (!strcmp(type, "\251gen")) tags_set_field(info.genre, sizeof(info.genre), text);
+                else if (!strcmp(type, "\251day")) tags_set_year(info, text);
+                else if (!strcmp(type, "gnre") && n >= 2) tags_set_genre_number(info, ((raw[1] << 8) | raw[2]) - 1);
+                else if (!strcmp(type, "trkn") && n >= 4 && info.track == 0) info.track = (raw[3] << 8) | raw[4];
+            }
+        }
+        pos += item_size;
+    }
+}
+
+// ---------- Public ----------
+
+bool tags_parse(File &file, TrackInfo &info) {
+    memset(&info, 0, sizeof(info));
+    info.replaygain_db100 = TAGS_NO_REPLAYGAIN;
+    uint32_t file_size = file.size();
+
+    // Leading ID3v2 tags (some encoders write more than one)
+    uint32_t start = 0;
+    for (int i = 0; i < 4 && start + 10 < file_size; i++) {
+        uint32_t size = tags_read_id3v2(file, start, info);
+        if (size == 0) break;
+        start += size;
+    }
+    info.audio_start = min(start, file_size);
+    tags_read_flac(file, info.audio_start, file_size, info);
+    tags_read_mp4(file, file_size, info);
+
+    // Trailing ID3v1, then an APEv2 tag in front of it
+    uint32_t end = file_size;
+    if (end >= info.audio_start + 128) {
+        uint8_t tag[128];
+        file.seek(end - 128);
+        if (file.read(tag, 128) == 128 && memcmp(tag, "TAG", 3) == 0) {
+            end -= 128;
+            tags_read_id3v1(tag, info);
+        }
+    }
+    if (end >= info.audio_start + 32) {
+        uint8_t footer[32];
+        file.seek(end - 32);
+        if (file.read(footer, 32) == 32 && memcmp(footer, "APETAGEX", 8) == 0) {
+            uint32_t size = tags_le32(footer + 12);  // items + footer
+            uint32_t count = tags_le32(footer + 16);
+            uint32_t flags = tags_le32(footer + 20);
+            uint32_t total = size + ((flags & 0x80000000u) ? 32 : 0);
+            if (size >= 32 && total <= end - info.audio_start) {
+                tags_read_ape_items(file, end - size, size - 32, count, info);
+                end -= total;
+            }
+        }
+    }
+    info.audio_end = end;
+    return true;
+}
+
+static String tags_cache_path(const String &path, String &name) {
+    int slash = path.lastIndexOf('/');
+    name = path.substring(slash + 1);
+    return path.substring(0, slash) + "/" + TAGS_CACHE_NAME;
+}
+
+static bool tags_cache_valid(File &cache) {
+    TagCacheHeader header;
+    return cache.read((uint8_t*)&header, sizeof(header)) == sizeof(header) &&
+           memcmp(header.magic, "WTAG", 4) == 0 && header.version == TAGS_CACHE_VERSION;
+}
+
+static void tags_cache_write(const String &cache_path, const TagCacheRecord *records, size_t count) {
+    File cache = SD.open(cache_path, FILE_READ);
+    bool valid = cache && tags_cache_valid(cache);
+    if (cache) cache.close();
+
+    if (!valid) {
+        // Missing or from another firmware version: start it over
+        SD.remove(cache_path);
+        cache = SD.open(cache_path, FILE_WRITE);
+        if (!cache) return;
+        TagCacheHeader header = {{'W', 'T', 'A', 'G'}, TAGS_CACHE_VERSION};
+        cache.write((const uint8_t*)&header, sizeof(header));
+    } else {
+        cache = SD.open(cache_path, FILE_APPEND);
+        if (!cache) return;
+    }
+    cache.write((const uint8_t*)records, count * sizeof(TagCacheRecord));
+    cache.close();
+}
+
+// The library task builds the tag indexes while the UI loads an album's
+// titles, and both may append to the same folder's cache
+static SemaphoreHandle_t tags_cache_lock() {
+    static SemaphoreHandle_t lock = xSemaphoreCreateMutex();
+    return lock;
+}
+
+static void tags_cache_append(const String &cache_path, const TagCacheRecord *records, size_t count) {
+    xSemaphoreTake(tags_cache_lock(), portMAX_DELAY);
+    tags_cache_write(cache_path, records, count);
+    xSemaphoreGive(tags_cache_lock());
+}
+
+bool tags_read(File &file, const String &path, TrackInfo &info, bool use_cache) {
+    if (!use_cache) {
+        return tags_parse(file, info);
+    }
+
+    String name;
+    String cache_path = tags_cache_path(path, name);
+    uint32_t hash = tags_hash(name);
+    uint32_t file_size = file.size();
+
+    File cache = SD.open(cache_path, FILE_READ);
+    if (cache) {
+        if (tags_cache_valid(cache)) {
+            TagCacheRecord record;
+            while (cache.read((uint8_t*)&record, sizeof(record)) == sizeof(record)) {
+                if (record.name_hash == hash && record.file_size == file_size) {
+                    info = record.info;
+                    cache.close();
+                    return true;
+                }
+            }
+        }
+        cache.close();
+    }
+
+    tags_parse(file, info);
+    TagCacheRecord record;
+    record.name_hash = hash;
+    record.file_size = file_size;
+    record.info = info;
+    tags_cache_append(cache_path, &record, 1);
+    return true;
+}
+
+// The list only needs titles, so the cache is matched by name alone and a
+// file is opened only when the cache has no record for it. A changed file
+// gets a fresh record once it is played, and the newest record for a name
+// wins. The new records go to the cache in one append at the end.
+void tags_load_titles(SongList &songs) {
+    if (songs.empty()) return;
+    unsigned long start = millis();
+
+    String name;
+    String cache_path = tags_cache_path(songs[0].path, name);
+    MemVector<TagCacheRecord, MEM_LIBRARY> records;
+    File cache = SD.open(cache_path, FILE_READ);
+    if (cache) {
+        if (tags_cache_valid(cache)) {
+            records.reserve((cache.size() - sizeof(TagCacheHeader)) / sizeof(TagCacheRecord));
+            TagCacheRecord record;
+            while (cache.read((uint8_t*)&record, sizeof(record)) == sizeof(record)) {
+                records.push_back(record);
+            }
+        }
+        cache.close();
+    }
+    size_t cached = records.size();
+
+    for (auto &song : songs) {
+        if (song.type == WAV) continue;
+        String file_name = song.path.substring(song.path.lastIndexOf('/') + 1);
+        uint32_t hash = tags_hash(file_name);
+
+        const TrackInfo *found = nullptr;
+        for (size_t i = cached; i-- > 0;) {
+            if (records[i].name_hash == hash) {
+                found = &records[i].info;
+                break;
+            }
+        }
+        if (found) {
+            song.title = found->title;
+            continue;
+        }
+
+        File file = SD.open(song.path);
+        if (!file) continue;
+        TagCacheRecord record;
+        record.name_hash = hash;
+        record.file_size = file.size();
+        tags_parse(file, record.info);
+        file.close();
+        song.title = record.info.title;
+        records.push_back(record);
+    }
+
+    int parsed = records.size() - cached;
+    if (parsed > 0) tags_cache_append(cache_path, records.data() + cached, parsed);
+    Serial.printf("Loaded tags for %d songs (%d parsed) in %lu ms.\n", (int)songs.size(), parsed, millis() - start);
+}
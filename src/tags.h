@@ -0,0 +1,42 @@
+#pragma once
+
+#include <Arduino.h>
+#include <FS.h>
+#include <vector>
+#include "song.h"
+
+// ---------- Tags ----------
+// Streaming ID3v2 / ID3v1 / APEv2 / FLAC Vorbis comment / MP4 ilst reader. It walks frame headers only, seeks
+// over everything it does not need (cover art included, though where it is
+// is noted for the cover thumbnails), and reports where
+// the audio actually starts and ends so the decoder never sees tag bytes.
+// Parsed records are cached per album folder in _tags.dat.
+
+#define TAGS_CACHE_NAME "_tags.dat"
+#define TAGS_NO_REPLAYGAIN INT16_MIN
+
+struct TrackInfo {
+    char title[48];
+    char artist[32];
+    char album[32];
+    char album_artist[32];
+    char genre[24];
+    uint16_t track;
+    uint16_t year;             // 0 if absent
+    int16_t replaygain_db100;  // track gain in 1/100 dB, TAGS_NO_REPLAYGAIN if absent
+    uint32_t audio_start;      // first byte after any ID3v2 tags
+    uint32_t audio_end;        // first byte of a trailing APE/ID3v1 tag, or the file size
+    uint32_t picture_start;    // embedded cover art: the APIC frame, FLAC PICTURE block or
+    uint32_t picture_length;   // MP4 covr data holding the image, 0 if none
+};
+
+// Fills info from the cache, or parses the open file and caches the result.
+// The file position is undefined afterwards.
+bool tags_read(File &file, const String &path, TrackInfo &info, bool use_cache = true);
+
+// Parses without touching the cache (e.g. the flash-mapped assets)
+bool tags_parse(File &file, TrackInfo &info);
+
+// Sets song.title for every song of one album folder, reading that folder's
+// cache once and parsing only the files it does not know yet
+void tags_load_titles(SongList &songs);
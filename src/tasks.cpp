@@ -0,0 +1,133 @@
+#include "tasks.h"
+#include <esp_timer.h>
+
+#ifdef ARDUINO_RUNNING_CORE
+#define TASK_UI_CORE ARDUINO_RUNNING_CORE
+#else
+#define TASK_UI_CORE 1
+#endif
+
+#if configUSE_TRACE_FACILITY && configGENERATE_RUN_TIME_STATS
+#define TASK_RUNTIME_STATS 1
+#endif
+
+static const TaskConfig task_configs[APP_TASK_COUNT] = {
+    {"audio out", TASK_AUDIO_OUT_CORE, TASK_AUDIO_OUT_PRIORITY, 3072},
+    {"bt events", TASK_BT_EVENTS_CORE, TASK_BT_EVENTS_PRIORITY, 0},
+    {"decode", TASK_DECODE_CORE, TASK_DECODE_PRIORITY, 10240}, // opens files and reads tags too
+    {"ui", TASK_UI_CORE, 1, 0},
+    {"library", TASK_LIBRARY_CORE, TASK_LIBRARY_PRIORITY, 6144},
+    {"spectrum", TASK_SPECTRUM_CORE, TASK_SPECTRUM_PRIORITY, 3072},
+    {"capture", TASK_CAPTURE_CORE, TASK_CAPTURE_PRIORITY, 4096},
+    {"cover", TASK_COVER_CORE, TASK_COVER_PRIORITY, 6144}, // tags, JPEG decode and the card
+};
+
+static volatile TaskHandle_t task_handles[APP_TASK_COUNT];
+static int8_t task_cores[APP_TASK_COUNT];
+static int64_t busy_since[APP_TASK_COUNT];
+static volatile uint32_t busy_us[APP_TASK_COUNT]; // since the last report
+static int64_t last_report_us = 0;
+
+const TaskConfig &task_config(AppTask task) {
+    return task_configs[task];
+}
+
+TaskHandle_t task_start(AppTask task, TaskFunction_t function, void *param) {
+    const TaskConfig &config = task_configs[task];
+    TaskHandle_t handle = nullptr;
+    xTaskCreatePinnedToCore(function, config.name, config.stack, param, config.priority, &handle, config.core);
+    task_handles[task] = handle;
+    task_cores[task] = config.core;
+    return handle;
+}
+
+void task_register(AppTask task) {
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    if (task_handles[task] == self) return;
+    task_handles[task] = self;
+    task_cores[task] = xPortGetCoreID();
+}
+
+void task_end(AppTask task) {
+    task_handles[task] = nullptr;
+    vTaskDelete(nullptr);
+}
+
+void task_busy_begin(AppTask task) {
+    busy_since[task] = esp_timer_get_time();
+}
+
+void task_busy_end(AppTask task) {
+    busy_us[task] += (uint32_t)(esp_timer_get_time() - busy_since[task]);
+}
+
+static const char *task_role(TaskHandle_t handle) {
+    for (int i = 0; i < APP_TASK_COUNT; i++) {
+        if (handle && task_handles[i] == handle) return task_configs[i].name;
+    }
+    return "";
+}
+
+#ifdef TASK_RUNTIME_STATS
+struct TaskRuntime {
+    TaskHandle_t handle;
+    uint32_t runtime;
+};
+static TaskStatus_t task_status[TASK_STATS_MAX];
+static TaskRuntime last_runtime[TASK_STATS_MAX];
+static int last_runtime_count = 0;
+static uint32_t last_total_runtime = 0;
+
+// Every task in the system, from the FreeRTOS run time counters
+static void task_report_runtime() {
+    uint32_t total = 0;
+    UBaseType_t count = uxTaskGetSystemState(task_status, TASK_STATS_MAX, &total);
+    uint32_t elapsed = total - last_total_runtime;
+    Serial.println("[Tasks] task             role       core prio  cpu%  stack free");
+    for (UBaseType_t i = 0; i < count; i++) {
+        const TaskStatus_t &s = task_status[i];
+        uint32_t before = s.ulRunTimeCounter;
+        for (int j = 0; j < last_runtime_count; j++) {
+            if (last_runtime[j].handle == s.xHandle) before = last_runtime[j].runtime;
+        }
+        uint32_t share = elapsed && last_total_runtime ? (uint64_t)(s.ulRunTimeCounter - before) * 100 / elapsed : 0;
+        int core = s.xCoreID == tskNO_AFFINITY ? -1 : s.xCoreID;
+        Serial.printf("[Tasks] %-16s %-10s %4d %4u %4u%% %6u\n", s.pcTaskName, task_role(s.xHandle), core,
+                      (unsigned)s.uxCurrentPriority, share, (unsigned)s.usStackHighWaterMark);
+    }
+    last_runtime_count = count;
+    for (UBaseType_t i = 0; i < count; i++) {
+        last_runtime[i] = {task_status[i].xHandle, task_status[i].ulRunTimeCounter};
+    }
+    last_total_runtime = total;
+}
+#endif
+
+// Our own tasks only, from the busy time they measure themselves
+static void task_report_busy(uint32_t elapsed_us) {
+    Serial.println("[Tasks] role       core prio  cpu%  stack free");
+    for (int i = 0; i < APP_TASK_COUNT; i++) {
+        TaskHandle_t handle = task_handles[i];
+        if (!handle) continue;
+        uint32_t busy = busy_us[i];
+        Serial.printf("[Tasks] %-10s %4d %4u %4u%% %6u\n", task_configs[i].name, task_cores[i],
+                      (unsigned)uxTaskPriorityGet(handle), (uint32_t)((uint64_t)busy * 100 / elapsed_us),
+                      (unsigned)uxTaskGetStackHighWaterMark(handle));
+    }
+}
+
+void task_stats_update() {
+    int64_t now = esp_timer_get_time();
+    if (last_report_us == 0) {
+        last_report_us = now;
+        return;
+    }
+    if (now - last_report_us < (int64_t)TASK_STATS_INTERVAL_MS * 1000) return;
+#ifdef TASK_RUNTIME_STATS
+    task_report_runtime();
+#else
+    task_report_busy(now - last_report_us);
+#endif
+    for (int i = 0; i < APP_TASK_COUNT; i++) busy_us[i] = 0;
+    last_report_us = now;
+}
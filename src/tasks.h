@@ -0,0 +1,106 @@
+#pragma once
+
+#include <Arduino.h>
+
+// ---------- Tasks ----------
+// Where everything runs. The BT controller and the Bluedroid host sit on
+// core 0 at high priority; our own tasks are laid out around them:
+//   audio out  the task calling get_data_frames(): copies PCM out of the
+//              ring, never decodes. With A2DP it is the BT stack's (not
+//              ours to pin; found at the first callback), with the I2S and
+//              null sinks our own (sink.h)
+//   bt events  ESP32-A2DP's event task: connection and GAP callbacks
+//   decode     decks, crossfade and EQ into the PCM ring, ahead of the sink
+//   ui         the Arduino loop(): buttons, state machine, display
+//   library    the card scan at boot, library and tag index builds. An
+//              album's folder, playlist and CUE sheets are read by the ui
+//              when it is opened
+//   spectrum   FFT for the analyzer bars
+//   capture    WAV writer of the PCM capture build (capture.h)
+//   cover      cover art thumbnails (cover.h), below everything else
+// Each core and priority can be overridden with a -D build flag.
+//
+// Every TASK_STATS_INTERVAL_MS the CPU share of each task is reported. With
+// FreeRTOS run time stats in the build that covers every task in the
+// system; otherwise our tasks time their own busy sections.
+
+#define TASK_STATS_INTERVAL_MS 10000
+#define TASK_STATS_MAX 24 // system tasks tracked between samples
+
+#ifndef TASK_AUDIO_OUT_CORE
+#define TASK_AUDIO_OUT_CORE 0 // free of the BT stack in builds that have our own
+#endif
+#ifndef TASK_AUDIO_OUT_PRIORITY
+#define TASK_AUDIO_OUT_PRIORITY 5
+#endif
+#ifndef TASK_BT_EVENTS_CORE
+#define TASK_BT_EVENTS_CORE 0
+#endif
+#ifndef TASK_BT_EVENTS_PRIORITY
+#define TASK_BT_EVENTS_PRIORITY 2
+#endif
+#ifndef TASK_DECODE_CORE
+#define TASK_DECODE_CORE 1
+#endif
+#ifndef TASK_DECODE_PRIORITY
+#define TASK_DECODE_PRIORITY 3 // above the UI so a redraw cannot starve it
+#endif
+#ifndef TASK_LIBRARY_CORE
+#define TASK_LIBRARY_CORE 0
+#endif
+#ifndef TASK_LIBRARY_PRIORITY
+#define TASK_LIBRARY_PRIORITY 1
+#endif
+#ifndef TASK_SPECTRUM_CORE
+#define TASK_SPECTRUM_CORE 0
+#endif
+#ifndef TASK_SPECTRUM_PRIORITY
+#define TASK_SPECTRUM_PRIORITY 1
+#endif
+#ifndef TASK_CAPTURE_CORE
+#define TASK_CAPTURE_CORE 0
+#endif
+#ifndef TASK_CAPTURE_PRIORITY
+#define TASK_CAPTURE_PRIORITY 1
+#endif
+#ifndef TASK_COVER_CORE
+#define TASK_COVER_CORE 0
+#endif
+#ifndef TASK_COVER_PRIORITY
+#define TASK_COVER_PRIORITY 0 // shares the idle priority: runs only on spare time
+#endif
+
+enum AppTask {
+    TASK_AUDIO_OUT,
+    TASK_BT_EVENTS,
+    TASK_DECODE,
+    TASK_UI,
+    TASK_LIBRARY,
+    TASK_SPECTRUM,
+    TASK_CAPTURE,
+    TASK_COVER,
+    APP_TASK_COUNT
+};
+
+struct TaskConfig {
+    const char *name;
+    int8_t core;      // -1: decided elsewhere
+    uint8_t priority;
+    uint32_t stack;
+};
+
+const TaskConfig &task_config(AppTask task);
+
+// Creates a task with its configured core, priority and stack
+TaskHandle_t task_start(AppTask task, TaskFunction_t function, void *param = nullptr);
+// For tasks created by someone else (loop(), the BT stack), from inside them
+void task_register(AppTask task);
+// Deletes the calling task, which task_start() created
+void task_end(AppTask task);
+
+// Busy time of our own tasks, for builds without run time stats
+void task_busy_begin(AppTask task);
+void task_busy_end(AppTask task);
+
+// Reports CPU share per task once per interval; call from loop()
+void task_stats_update();
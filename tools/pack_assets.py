@@ -0,0 +1,112 @@
+#!/usr/bin/env python3
+"""Packs data/ into the read-only asset bundle flashed to the `assets` partition.
+
+BMP files become 1-bpp bitmaps in SSD1306 page order, thresholded the same way
+the firmware used to do it at runtime, and are named without their extension
+(splash.bmp -> "splash"). Everything else is stored byte for byte.
+
+Layout (little endian, see src/assets.h):
+    header  "WAST", u16 version, u16 count, u32 total_size
+    entries count x {char name[24], u32 offset, u32 size,
+                     u16 width, u16 height, u8 type, u8 reserved[3]}
+    data    each asset 4-byte aligned
+"""
+import argparse
+import os
+import struct
+import sys
+
+MAGIC = b"WAST"
+VERSION = 1
+NAME_LEN = 24
+ASSET_RAW = 0
+ASSET_BITMAP = 1
+HEADER = struct.Struct("<4sHHI")
+ENTRY = struct.Struct("<%dsIIHHB3x" % NAME_LEN)
+PARTITION_LABEL = "assets"
+
+
+def bmp_to_pages(path):
+    data = open(path, "rb").read()
+    if data[:2] != b"BM":
+        sys.exit("%s: not a BMP file" % path)
+    pixel_offset, = struct.unpack_from("<I", data, 10)
+    width, height, planes, depth, compression = struct.unpack_from("<iiHHI", data, 18)
+    if planes != 1 or depth != 24 or compression != 0:
+        sys.exit("%s: only uncompressed 24-bit BMPs are supported" % path)
+
+    bottom_up = height > 0
+    height = abs(height)
+    row_size = (width * 3 + 3) & ~3
+
+    def lit(x, y):
+        row = height - 1 - y if bottom_up else y
+        i = pixel_offset + row * row_size + x * 3
+        b, g, r = data[i], data[i + 1], data[i + 2]
+        return r + g + b > 128 * 3
+
+    pages = bytearray()
+    for page in range((height + 7) // 8):
+        for x in range(width):
+            byte = 0
+            for bit in range(8):
+                y = page * 8 + bit
+                if y < height and lit(x, y):
+                    byte |= 1 << bit
+            pages.append(byte)
+    return bytes(pages), width, height
+
+
+def partition_size(partitions_csv):
+    for line in open(partitions_csv):
+        fields = [f.strip() for f in line.split("#")[0].split(",")]
+        if fields[0] == PARTITION_LABEL:
+            return int(fields[4], 0)
+    sys.exit("%s: no '%s' partition" % (partitions_csv, PARTITION_LABEL))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("data_dir")
+    parser.add_argument("output")
+    parser.add_argument("--partitions", help="partitions.csv to check the bundle fits")
+    args = parser.parse_args()
+
+    assets = []
+    for filename in sorted(os.listdir(args.data_dir)):
+        path = os.path.join(args.data_dir, filename)
+        if not os.path.isfile(path):
+            continue
+        if filename.lower().endswith(".bmp"):
+            payload, width, height = bmp_to_pages(path)
+            assets.append((os.path.splitext(filename)[0], ASSET_BITMAP, payload, width, height))
+        else:
+            assets.append((filename, ASSET_RAW, open(path, "rb").read(), 0, 0))
+
+    offset = HEADER.size + ENTRY.size * len(assets)
+    entries = b""
+    blobs = b""
+    for name, kind, payload, width, height in assets:
+        encoded = name.encode()
+        if len(encoded) >= NAME_LEN:
+            sys.exit("%s: name longer than %d bytes" % (name, NAME_LEN - 1))
+        offset = (offset + 3) & ~3
+        blobs = blobs.ljust(offset - HEADER.size - ENTRY.size * len(assets), b"\0")
+        entries += ENTRY.pack(encoded, offset, len(payload), width, height, kind)
+        blobs += payload
+        offset += len(payload)
+        print("  %-23s %8d bytes%s" % (name, len(payload),
+              " (%dx%d, 1 bpp)" % (width, height) if kind == ASSET_BITMAP else ""))
+
+    bundle = HEADER.pack(MAGIC, VERSION, len(assets), offset) + entries + blobs
+    if args.partitions:
+        limit = partition_size(args.partitions)
+        if len(bundle) > limit:
+            sys.exit("bundle is %d bytes, the %s partition holds %d" % (len(bundle), PARTITION_LABEL, limit))
+    with open(args.output, "wb") as f:
+        f.write(bundle)
+    print("Packed %d assets into %s (%d bytes)" % (len(assets), args.output, len(bundle)))
+
+
+if __name__ == "__main__":
+    main()